@@ -7,13 +7,23 @@
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 
-typedef struct {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_AudioDeviceID deviceID;
-    SDL_AudioSpec want, have;
-} sdl_t;
+#include "chip8_core.h"
+#include "chip8_batch.h"
+#include "chip8_lockstep.h"
+#include "chip8_rewind.h"
+#include "chip8_movie.h"
+#include "chip8_profile.h"
+#include "chip8_audio.h"
+#include "chip8_library.h"
+#include "chip8_debug.h"
+#include "chip8_aot.h"
+#include "chip8_trace.h"
+#include "chip8_shm.h"
+#include "chip8_fuzz.h"
+#include "chip8_capture.h"
 
 typedef struct {
     uint32_t scale_factor;          // Amount to scale the 64x32 display of CHIP8 
@@ -21,33 +31,314 @@ typedef struct {
     uint32_t window_height;         // height of the SDL window
     uint32_t foreground_color;      // foreground color of sprites
     uint32_t background_color;      // background color of window
+    uint32_t plane2_color;          // XO-CHIP pixels set in the second plane only
+    uint32_t blend_color;           // XO-CHIP pixels set in both planes
     uint32_t instr_rate;            // number of instructions per second to be run 
     uint32_t square_wave_freq;       // Frequency of square wave sound 
     uint16_t volume;                // volume of audio
     uint32_t audio_sample_rate;
+    uint32_t refresh_rate;          // frames presented per second
+    bool headless;                  // run without window/audio, uncapped
+    uint64_t cycle_limit;           // headless: stop after this many instructions (0 = run forever); --fuzz: per execution
+    chip8_engine_t engine;          // interpreter used to execute instructions
+    chip8_variant_t variant;        // instruction set: CHIP-8, SUPER-CHIP or XO-CHIP
+    chip8_quirks_t quirks;          // quirk profile, follows the variant by default
+    bool profile;                   // count instructions per opcode and PC, print the hot spots at exit
+    uint32_t lanes;                 // headless: run this many instances in lockstep (0 = a single instance)
+    uint32_t rewind_seconds;        // length of the rewind buffer (0 = no rewind)
+    uint64_t seed;                  // CXNN random seed
+    bool seed_set;                  // false: seed from the clock
+    char* record_path;              // record keypad input to this movie file
+    char* replay_path;              // replay this movie headless and verify it
+    char* state_path;               // state file loaded at startup and used by F6/F7 (default is <rom>.state)
+    char* batch_path;               // run the ROMs in this directory / list file headless in parallel
+    unsigned threads;               // batch worker / fuzzer threads (0 = one per core)
+    char* output_path;              // batch results, JSON if it ends in .json, CSV otherwise; --aot C file (default stdout);
+                                    // --fuzz directory for the fault movies (default .)
+    char* library_path;             // ROM library index, lets -p take a SHA-1
+    char* scan_path;                // index the ROMs under this directory into library_path and exit
+    char* settings_path;            // per-ROM settings, looked up by the SHA-1 of the loaded ROM
+    char keymap[17];                // host key of each CHIP-8 key 0-F
+    bool debug;                     // stop before the first instruction, debugger commands come from the terminal
+    bool disasm;                    // print the disassembled ROM and exit
+    bool aot;                       // compile the ROM to C for -engine aot and exit
+    char* trace_path;               // write a trace of every instruction run to this file
+    char* shm_name;                 // publish frames to and take keys from this shared memory segment
+    double fuzz_seconds;            // fuzz the keypad input for this long and exit (0 = no fuzzing)
+    char* capture_path;             // capture the frames to this video, GIF if it ends in .gif, Y4M otherwise
+    uint32_t capture_scale;         // output pixels per lores pixel of the capture
 } config_t;
 
-typedef enum {
-    QUIT,
-    PAUSED,
-    RUNNING,
-} emulator_state_t;
+typedef struct {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;           // 64x32 streaming texture the framebuffer is uploaded to
+    SDL_AudioDeviceID deviceID;
+    SDL_AudioSpec want, have;
+    chip8_audio_t* audio;           // filled by the emulation thread, drained by the audio callback
+    uint64_t texture_changes;       // frame_t.changes of the frame in the texture
+} sdl_t;
+
+// Fixed-timestep scheduler of the emulation thread. Elapsed host time, measured with the performance
+// counter, is turned into a number of due instructions with the remainder carried over, so the
+// CPU runs at exactly instr_rate; the 60Hz timers follow the CPU through chip8_run_schedule.
+// Frames are published on their own deadlines, independent of how long emulation took.
+// After a stall longer than MAX_CATCH_UP the excess time is dropped instead of being replayed,
+// and missed frame deadlines are skipped, both counted. In turbo mode the CPU runs flat out
+// between frame deadlines instead, TURBO_SLICE instructions between looks at the clock.
+#define MAX_CATCH_UP_DIVISOR 4      // catch up at most 1/4 s of emulated time at once
+#define TURBO_SLICE 4096
+#define MIN_SPEED 60                // instructions/s range of the speed keys
+#define MAX_SPEED 100000000
+
+typedef struct {
+    uint64_t freq;                  // performance counter ticks per second
+    uint64_t last;                  // counter value emulation was last advanced to
+    uint64_t owed;                  // fraction of an instruction carried over, in 1/freq instruction units
+    uint64_t frame_period;          // counter ticks between presented frames
+    uint64_t next_frame;            // counter value the next frame is due at
+    uint64_t frames;                // frame deadlines passed, dropped ones included
+    uint64_t dropped_frames;
+    uint64_t dropped_cycles;        // instructions skipped after stalls
+    uint64_t cycles_before;         // instructions and timer ticks run at earlier speeds
+    uint64_t ticks_before;
+    chip8_schedule_t schedule;
+} scheduler_t;
+
+void scheduler_init(scheduler_t* sched, const config_t config){
+    *sched = (scheduler_t){
+        .freq = SDL_GetPerformanceFrequency(),
+        .last = SDL_GetPerformanceCounter(),
+        .schedule = { .instr_rate = config.instr_rate },
+    };
+    sched->frame_period = sched->freq / config.refresh_rate;
+    sched->next_frame = sched->last;
+}
+
+// forget the time spent paused so it is not caught up
+void scheduler_resync(scheduler_t* sched){
+    sched->last = SDL_GetPerformanceCounter();
+    sched->next_frame = sched->last;
+}
+
+// change the speed, keeping how far emulation is into the current timer period
+void scheduler_set_rate(scheduler_t* sched, uint32_t instr_rate){
+    const chip8_schedule_t old = sched->schedule;
+    const uint64_t period_start = old.timer_ticks * old.instr_rate / 60;
+    const uint64_t period = instr_rate / 60;
+    uint64_t cycles = (old.cycles - period_start) * instr_rate / old.instr_rate;
+    if(cycles >= period) cycles = period > 0 ? period - 1 : 0;
+    sched->cycles_before += old.cycles - cycles;
+    sched->ticks_before += old.timer_ticks;
+    sched->schedule = (chip8_schedule_t){ .instr_rate = instr_rate, .cycles = cycles, .sound = old.sound };
+}
+
+// instructions that became due by `now`
+uint64_t scheduler_due(scheduler_t* sched, uint64_t now){
+    uint64_t elapsed = now - sched->last;
+    sched->last = now;
+    const uint64_t max_elapsed = sched->freq / MAX_CATCH_UP_DIVISOR;
+    if(elapsed > max_elapsed){
+        sched->dropped_cycles += (elapsed - max_elapsed) * sched->schedule.instr_rate / sched->freq;
+        elapsed = max_elapsed;
+    }
+    sched->owed += elapsed * sched->schedule.instr_rate;
+    const uint64_t due = sched->owed / sched->freq;
+    sched->owed %= sched->freq;
+    return due;
+}
+
+// run every instruction (and timer tick) that became due by `now`, one timer period at a time so
+// the beeper is rendered with the sound state of each period
+void scheduler_run_due(scheduler_t* sched, chip8_t* chip8, chip8_audio_t* audio, uint64_t now){
+    uint64_t due = scheduler_due(sched, now);
+    while(due > 0 && chip8->state != QUIT){
+        const uint64_t until_tick = chip8_schedule_until_tick(&sched->schedule);
+        const uint64_t run = until_tick < due ? until_tick : due;
+        const bool sound = chip8->sound_timer > 0;
+        const uint64_t before = sched->schedule.cycles;
+        chip8_run_schedule(chip8, &sched->schedule, run);
+        const uint64_t ran = sched->schedule.cycles - before;
+        chip8_audio_render(audio, chip8, ran, sched->schedule.instr_rate, sound);
+        if(ran < run) break;
+        due -= ran;
+    }
+}
+
+// advance the frame deadline after publishing a frame
+void scheduler_frame_done(scheduler_t* sched){
+    const uint64_t now = SDL_GetPerformanceCounter();
+    sched->next_frame += sched->frame_period;
+    sched->frames++;
+    if(sched->next_frame <= now){
+        const uint64_t missed = (now - sched->next_frame) / sched->frame_period + 1;
+        sched->dropped_frames += missed;
+        sched->next_frame += missed * sched->frame_period;
+        sched->frames += missed;
+    }
+}
+
+void scheduler_report(const scheduler_t* sched){
+    printf("%" PRIu64 " instructions, %" PRIu64 " timer ticks, %" PRIu64 " dropped frames, %" PRIu64 " dropped instructions\n",
+           sched->cycles_before + sched->schedule.cycles, sched->ticks_before + sched->schedule.timer_ticks,
+           sched->dropped_frames, sched->dropped_cycles);
+}
+
+void audio_report(const chip8_audio_t* audio, uint32_t sample_rate){
+    const chip8_audio_stats_t stats = chip8_audio_stats(audio);
+    const double ms = 1000.0 / sample_rate;
+    printf("audio: %" PRIu64 " samples, %" PRIu64 " underruns (%.1f ms of silence), %" PRIu64 " dropped, max queue %.1f ms\n",
+           stats.produced, stats.underruns, stats.underrun_samples * ms, stats.dropped_samples, stats.max_depth * ms);
+}
+
+// save state slots of the SDL frontend
+typedef struct {
+    chip8_snapshot_t boot;          // machine right after loading, `=` restores it without touching the ROM file
+    chip8_snapshot_t quick;         // F5 saves, F9 restores
+    bool has_quick;
+    char* path;                     // F6 writes, F7 reads
+    chip8_rewind_t* rewind;         // one frame per published frame, NULL if disabled
+    chip8_movie_t* movie;           // recording, the keys that replace the machine state are disabled
+} states_t;
+
+#define REWIND_BUDGET (4u << 20)    // bytes of encoded frames, about 10 minutes of a typical game
+#define REWIND_KEYFRAME_INTERVAL 60
+#define PROFILE_HOT_SPOTS 20        // PCs listed by -profile
+
+void rewind_report(const states_t* states, const config_t config){
+    if(states->rewind == NULL) return;
+    const chip8_rewind_stats_t stats = chip8_rewind_stats(states->rewind);
+    printf("rewind: %zu frames (%.1f s) in %.1f KB, %.0f ns per frame\n", stats.frames,
+           (double)stats.frames / config.refresh_rate, stats.bytes / 1024.0,
+           stats.pushes ? (double)stats.push_ns / stats.pushes : 0.0);
+}
+
+// The emulation thread owns the machine, the scheduler, the save states, the rewind buffer and the
+// audio producer; the SDL thread owns the window and only talks to it through link_t, so a slow
+// SDL_RenderPresent never holds up emulation and emulation never holds up the event loop.
+// Frames travel through a triple buffer: the emulation thread fills its back slot and swaps it
+// with the middle one, the SDL thread swaps its front slot with the middle one whenever that holds
+// a newer frame. Neither side waits, the SDL thread just skips frames it was too slow to show.
+#define FRAME_FRESH 4               // middle slot flag: published and not taken yet
+
+typedef struct {
+    uint32_t pixels[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+    uint32_t width, height;         // display mode, pixels outside it are stale
+    uint64_t changes;               // frames with new pixels published up to this one
+} frame_t;
+
+typedef struct {
+    frame_t slots[3];
+    _Atomic uint8_t middle;         // slot index | FRAME_FRESH
+    uint8_t back;                   // written by the emulation thread
+    uint8_t front;                  // shown by the SDL thread
+    uint64_t changes;               // emulation thread's count for frame_t.changes
+    uint64_t published;
+    uint64_t presented;
+} frames_t;
+
+enum {
+    COMMAND_RESET = 1 << 0,         // `=`
+    COMMAND_QUICK_SAVE = 1 << 1,    // F5
+    COMMAND_QUICK_LOAD = 1 << 2,    // F9
+    COMMAND_SAVE = 1 << 3,          // F6
+    COMMAND_LOAD = 1 << 4,          // F7
+    COMMAND_BREAK = 1 << 5,         // F10: stop in the debugger
+};
+
+typedef struct {
+    _Atomic uint16_t keys;          // keypad, one bit per key
+    _Atomic uint32_t commands;      // COMMAND_* bits not carried out yet
+    _Atomic bool paused;
+    _Atomic bool rewinding;         // backspace held: step back a frame per frame instead of emulating
+    _Atomic bool quit;              // set by either thread, ends both loops
+    _Atomic int volume;
+    _Atomic uint32_t instr_rate;    // speed asked for with -ips and the speed keys
+    _Atomic bool turbo;             // run unthrottled, presenting frames at the display rate
+    _Atomic uint64_t cycles;        // instructions run by the scheduler, for the title readout
+    SDL_sem* wake;                  // posted on input while the emulation thread sleeps in FX0A
+    bool recording;                 // a movie is being recorded, the keys that replace the machine state are disabled
+    frames_t frames;
+} link_t;
+
+void frames_init(frames_t* frames){
+    frames->front = 0;
+    atomic_init(&frames->middle, 1);
+    frames->back = 2;
+}
+
+// emulation thread: hand the back slot over, continue in the previous middle slot
+void frames_publish(frames_t* frames){
+    frames->back = atomic_exchange_explicit(&frames->middle, frames->back | FRAME_FRESH, memory_order_acq_rel) & 3;
+    frames->published++;
+}
 
+// SDL thread: the newest published frame, NULL if nothing was published since the last one
+const frame_t* frames_take(frames_t* frames){
+    if(!(atomic_load_explicit(&frames->middle, memory_order_relaxed) & FRAME_FRESH)) return NULL;
+    frames->front = atomic_exchange_explicit(&frames->middle, frames->front, memory_order_acq_rel) & 3;
+    frames->presented++;
+    return &frames->slots[frames->front];
+}
+
+// input-to-pixel latency, measured on the SDL thread from a keypad key press to the first
+// presented frame with new pixels
 typedef struct {
-    emulator_state_t state;
-    uint8_t RAM[4096];
-    bool display[64*32]; // original chip8 resolution
-    uint16_t stack[12];
-    uint8_t SP;
-    uint8_t V[16];
-    uint16_t I;
-    uint16_t PC;
-    uint8_t delay_timer;
-    uint8_t sound_timer;
-    bool keypad[16];
-    char *rom_path;
-
-} chip8_t;
+    uint64_t key_time;              // counter value of the oldest key press not yet answered by a frame, 0 if none
+    uint64_t changes;               // frame_t.changes of the frame on screen
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} latency_t;
+
+void latency_key_pressed(latency_t* latency){
+    if(latency->key_time == 0) latency->key_time = SDL_GetPerformanceCounter();
+}
+
+void latency_frame_presented(latency_t* latency, const frame_t* frame){
+    const bool changed = frame->changes != latency->changes;
+    latency->changes = frame->changes;
+    if(changed && latency->key_time != 0){
+        const uint64_t elapsed = SDL_GetPerformanceCounter() - latency->key_time;
+        latency->count++;
+        latency->sum += elapsed;
+        if(elapsed > latency->max) latency->max = elapsed;
+        latency->key_time = 0;
+    }
+}
+
+// SDL thread: once a second, put the achieved speed and frame time in the window title
+typedef struct {
+    uint64_t time;                  // counter value of the last update
+    uint64_t cycles;                // link_t.cycles then
+    uint64_t presented;             // frames_t.presented then
+} readout_t;
+
+void readout_update(readout_t* readout, sdl_t* sdl, link_t* link){
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    if(now - readout->time < freq) return;
+    const double seconds = (double)(now - readout->time) / freq;
+    const uint64_t cycles = atomic_load_explicit(&link->cycles, memory_order_relaxed);
+    const uint64_t frames = link->frames.presented - readout->presented;
+    char title[128];
+    snprintf(title, sizeof title, "CHIP8-Emulator - %.0f instr/s (target %" PRIu32 "%s), %.1f ms/frame",
+             (cycles - readout->cycles) / seconds, atomic_load(&link->instr_rate),
+             atomic_load(&link->turbo) ? ", turbo" : "", frames ? seconds * 1000 / frames : 0.0);
+    SDL_SetWindowTitle(sdl->window, title);
+    *readout = (readout_t){ now, cycles, link->frames.presented };
+}
+
+void latency_report(const latency_t* latency, const frames_t* frames){
+    const double ms = 1000.0 / SDL_GetPerformanceFrequency();
+    printf("%" PRIu64 " frames published, %" PRIu64 " presented\n", frames->published, frames->presented);
+    if(latency->count){
+        printf("input-to-pixel latency: %" PRIu64 " samples, avg %.2f ms, max %.2f ms\n", latency->count,
+               latency->sum * ms / latency->count, latency->max * ms);
+    }
+}
+
+bool parse_flags(config_t* config, chip8_t* chip8, const int argc, char **argv);
 
 bool set_config(config_t* config, chip8_t* chip8, const int argc, char **argv){
     *config = (config_t){
@@ -56,11 +347,23 @@ bool set_config(config_t* config, chip8_t* chip8, const int argc, char **argv){
         .window_height = 32,                // height of SDL window
         .foreground_color = 0xFFFFFFFF,     // white
         .background_color = 0x00000000,     // black 
+        .plane2_color = 0xAAAAAAFF,         // light gray
+        .blend_color = 0x555555FF,          // dark gray
         .instr_rate = 700,                 // Number of instructions to run in 1 second
         .square_wave_freq = 440,             // 440Hz
         .audio_sample_rate = 44100,
+        .refresh_rate = 60,
+        .capture_scale = 4,
+        .rewind_seconds = 600,              // 10 minutes
         .volume = 3000,                     // INT16_MAX would be max volume 
+        .engine = ENGINE_SWITCH,
+        .keymap = "0123456789abcdef",
     };
+    return parse_flags(config, chip8, argc, argv);
+}
+
+// command line flags over whatever config holds, so they also override per-ROM settings
+bool parse_flags(config_t* config, chip8_t* chip8, const int argc, char **argv){
     if(argc > 1) {
         for (int i=0; i < argc; i++){
             if(strcmp(argv[i], "-w")==0){
@@ -104,6 +407,225 @@ bool set_config(config_t* config, chip8_t* chip8, const int argc, char **argv){
                     return false;
                 }
             }
+            else if (strcmp(argv[i], "--headless") == 0) {
+                config->headless = true;
+            }
+            else if (strcmp(argv[i], "-variant") == 0) {
+                if( ++i < argc){
+                    if(!chip8_variant_from_name(argv[i], &config->variant)){
+                        fprintf(stderr, "Unknown variant %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified variant");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-quirks") == 0) {
+                if( ++i < argc){
+                    if(!chip8_quirks_from_name(argv[i], &config->quirks)){
+                        fprintf(stderr, "Unknown quirk profile %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified quirk profile");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-profile") == 0) {
+                config->profile = true;
+            }
+            else if (strcmp(argv[i], "-debug") == 0) {
+                config->debug = true;
+            }
+            else if (strcmp(argv[i], "-disasm") == 0) {
+                config->disasm = true;
+            }
+            else if (strcmp(argv[i], "--aot") == 0) {
+                if( ++i < argc){
+                    chip8->rom_path = argv[i];
+                    config->aot = true;
+                } else {
+                    perror("Unspecified ROM to compile");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-c") == 0) {
+                if( ++i < argc){
+                    config->cycle_limit = strtoull(argv[i], NULL, 10);
+                } else {
+                    perror("Unspecified cycle count");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-ips") == 0) {
+                if( ++i < argc){
+                    config->instr_rate = (uint32_t)strtoul(argv[i], NULL, 10);
+                    if(config->instr_rate == 0){
+                        fprintf(stderr, "Invalid instructions per second %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified instructions per second");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-engine") == 0) {
+                if( ++i < argc){
+                    if(!chip8_engine_from_name(argv[i], &config->engine)){
+                        fprintf(stderr, "Unknown engine %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified engine");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-lanes") == 0) {
+                if( ++i < argc){
+                    config->lanes = (uint32_t)strtoul(argv[i], NULL, 10);
+                } else {
+                    perror("Unspecified lane count");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-seed") == 0) {
+                if( ++i < argc){
+                    config->seed = strtoull(argv[i], NULL, 10);
+                    config->seed_set = true;
+                } else {
+                    perror("Unspecified seed");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-record") == 0) {
+                if( ++i < argc){
+                    config->record_path = argv[i];
+                } else {
+                    perror("Unspecified movie file");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-trace") == 0) {
+                if( ++i < argc){
+                    config->trace_path = argv[i];
+                } else {
+                    perror("Unspecified trace file");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-shm") == 0) {
+                if( ++i < argc){
+                    config->shm_name = argv[i];
+                } else {
+                    perror("Unspecified shared memory segment");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-capture") == 0) {
+                if( ++i < argc){
+                    config->capture_path = argv[i];
+                } else {
+                    perror("Unspecified capture file");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-capture-scale") == 0) {
+                if( ++i < argc){
+                    config->capture_scale = (uint32_t)strtoul(argv[i], NULL, 10);
+                    if(config->capture_scale == 0){
+                        fprintf(stderr, "Invalid capture scale %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified capture scale");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-replay") == 0) {
+                if( ++i < argc){
+                    config->replay_path = argv[i];
+                } else {
+                    perror("Unspecified movie file");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-rewind") == 0) {
+                if( ++i < argc){
+                    config->rewind_seconds = (uint32_t)strtoul(argv[i], NULL, 10);
+                } else {
+                    perror("Unspecified rewind length");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-state") == 0) {
+                if( ++i < argc){
+                    config->state_path = argv[i];
+                } else {
+                    perror("Unspecified state file");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "--batch") == 0) {
+                if( ++i < argc){
+                    config->batch_path = argv[i];
+                } else {
+                    perror("Unspecified batch directory or ROM list");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "--fuzz") == 0) {
+                if( ++i < argc){
+                    config->fuzz_seconds = atof(argv[i]);
+                    if(config->fuzz_seconds <= 0){
+                        fprintf(stderr, "Invalid fuzzing time %s\n", argv[i]);
+                        return false;
+                    }
+                } else {
+                    perror("Unspecified fuzzing time");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-j") == 0) {
+                if( ++i < argc){
+                    config->threads = (unsigned)strtoul(argv[i], NULL, 10);
+                } else {
+                    perror("Unspecified thread count");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-o") == 0) {
+                if( ++i < argc){
+                    config->output_path = argv[i];
+                } else {
+                    perror("Unspecified output path");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-library") == 0) {
+                if( ++i < argc){
+                    config->library_path = argv[i];
+                } else {
+                    perror("Unspecified library index");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "--scan") == 0) {
+                if( ++i < argc){
+                    config->scan_path = argv[i];
+                } else {
+                    perror("Unspecified ROM directory");
+                    return false;
+                }
+            }
+            else if (strcmp(argv[i], "-settings") == 0) {
+                if( ++i < argc){
+                    config->settings_path = argv[i];
+                } else {
+                    perror("Unspecified settings file");
+                    return false;
+                }
+            }
             else if (strcmp(argv[i], "-sf") == 0) {
                 if( ++i < argc){
                     
@@ -115,69 +637,17 @@ bool set_config(config_t* config, chip8_t* chip8, const int argc, char **argv){
         }
         
     }
-    return true;
-}
-
-bool init_chip8(chip8_t *chip8, char rom_path[]){
-    const uint8_t font[] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
-        0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
-        0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
-        0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
-        0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
-    };
-    memset(chip8, 0, sizeof(chip8_t));
-    memcpy(&(chip8->RAM[0]), font, sizeof(font));
-
-    FILE *rom = fopen(rom_path, "rb");
-    if(rom==NULL){
-        perror("Failed to read the specified ROM file");
+    // the lockstep lanes run as a batch, there is no single machine to publish or take keys
+    if(config->shm_name != NULL && config->headless && config->lanes > 0){
+        fprintf(stderr, "-shm cannot be combined with -lanes\n");
         return false;
     }
-    fseek(rom, 0, SEEK_END);
-    const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->RAM - 0x200; 
-    rewind(rom);
-    if(rom_size > max_size) {
-        SDL_Log("ROM file %s is too big; ROM size: %zu; Max size allowed %zu\n", chip8->rom_path, rom_size, max_size);
-        return false;
-    }
-
-    if (fread(&(chip8->RAM[0x200]), rom_size, 1, rom) !=1) {
-        SDL_Log("Could not read ROM file into chip8 memory");
-        return false;
-    }
-    fclose(rom);
-    chip8->rom_path = rom_path;
-    chip8->state = RUNNING;
-    chip8->PC = 0x200;
-    chip8->SP = 0;
     return true;
 }
 
+// runs on SDL's audio thread: only drains the ring, never touches the emulator or the config
 void audio_callback(void *userdata, uint8_t *stream, int len){
-    config_t *config = (config_t*) userdata;
-    int16_t *audio_data = (int16_t*)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->audio_sample_rate / config->square_wave_freq;
-    const int32_t half_square_wave_period = square_wave_period /2;
-
-    for(int i=0; i<len/2; i++){
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ? config->volume: -config->volume;
-
-    }
-
+    chip8_audio_read(userdata, (int16_t*)stream, (size_t)len / sizeof(int16_t));
 }
 
 bool init_sdl(sdl_t* sdl, config_t* config){
@@ -194,16 +664,28 @@ bool init_sdl(sdl_t* sdl, config_t* config){
         SDL_Log("Could not create renderer: %s\n", SDL_GetError());
         return false;
     }
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+    if(sdl->texture == NULL){
+        SDL_Log("Could not create texture: %s\n", SDL_GetError());
+        return false;
+    }
 
     sdl->want = (SDL_AudioSpec) {
-        .freq = 44100,              // 44100 HZ frquency
+        .freq = config->audio_sample_rate,
         .format = AUDIO_S16LSB,     // Signed 16 bit little endian
         .channels = 1,              // 1 channel for reading/ loading audio
         .samples = 512,            
         .callback = audio_callback, // callback function for audio
-        .userdata = config,        // userdata passed to audio callback
     };
 
+    // the main loop renders a frame's worth of samples at a time: hold that plus one device buffer
+    // before playing, and room for the longest catch up
+    const int freq = config->audio_sample_rate;
+    sdl->audio = chip8_audio_create(freq, freq / MAX_CATCH_UP_DIVISOR + freq / 8, freq / config->refresh_rate + sdl->want.samples,
+                                    config->square_wave_freq, config->volume);
+    if(sdl->audio == NULL) return false;
+    sdl->want.userdata = sdl->audio;
+
     sdl->deviceID = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
     if (sdl->deviceID == 0) {
         SDL_Log("Could not get an audio device\n");
@@ -218,9 +700,11 @@ bool init_sdl(sdl_t* sdl, config_t* config){
 }
 
 void finish_sdl(sdl_t* sdl){
+    SDL_DestroyTexture(sdl->texture);
     SDL_DestroyRenderer(sdl->renderer);
     SDL_DestroyWindow(sdl->window);
     SDL_CloseAudioDevice(sdl->deviceID);
+    chip8_audio_destroy(sdl->audio);
     atexit(SDL_Quit);
 }
 
@@ -235,405 +719,723 @@ void clear_screen(const config_t config, sdl_t* sdl){
 
 }
 
-void update_screen(sdl_t* sdl, const config_t config, const chip8_t* chip8){
-    SDL_Rect rect = {.x=0, .y=0, .w=config.scale_factor, .h = config.scale_factor};
-
-    // foreground color
-    uint8_t fg_r = (config.foreground_color >> 24) & 0xFF;
-    uint8_t fg_g = (config.foreground_color >> 16) & 0xFF;
-    uint8_t fg_b = (config.foreground_color >> 8) & 0xFF;
-    uint8_t fg_a = (config.foreground_color >> 0) & 0xFF;
-
-    //background color
-    uint8_t bg_r = (config.background_color >> 24) & 0xFF;
-    uint8_t bg_g = (config.background_color >> 16) & 0xFF;
-    uint8_t bg_b = (config.background_color >> 8) & 0xFF;
-    uint8_t bg_a = (config.background_color >> 0) & 0xFF;
-    for(uint32_t i=0; i< sizeof chip8->display; i++){
-        rect.x = config.scale_factor* (i % config.window_width);
-        rect.y = config.scale_factor*(i / config.window_width);
+// emulation thread: convert the framebuffer into the back slot and publish it, if it changed
+// since the last frame; a screen that stays the same costs neither side anything
+void publish_frame(link_t* link, const config_t* config, chip8_t* chip8){
+    if(!chip8->display_dirty) return;
+    frame_t* frame = &link->frames.slots[link->frames.back];
+    const uint32_t palette[4] = { config->background_color, config->foreground_color, config->plane2_color, config->blend_color };
+    chip8_framebuffer_to_rgba(chip8, palette, frame->pixels, sizeof frame->pixels[0]);
+    frame->width = chip8_display_width(chip8);
+    frame->height = chip8_display_height(chip8);
+    chip8->display_dirty = false;
+    frame->changes = ++link->frames.changes;
+    frames_publish(&link->frames);
+}
 
-        if (chip8->display[i]) {
-            SDL_SetRenderDrawColor(sdl->renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(sdl->renderer, &rect);
-        } else {
-            SDL_SetRenderDrawColor(sdl->renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(sdl->renderer, &rect);
+// upload a published frame into the streaming texture unless it is already there, then let the
+// renderer scale the current mode to the window in one copy
+void update_screen(sdl_t* sdl, const frame_t* frame){
+    // the texture fits the hires mode, lores frames only fill its top left quarter
+    const SDL_Rect mode = { 0, 0, (int)frame->width, (int)frame->height };
+    if(frame->changes != sdl->texture_changes){
+        if(SDL_UpdateTexture(sdl->texture, &mode, frame->pixels, sizeof frame->pixels[0]) != 0){
+            SDL_Log("Could not update texture: %s\n", SDL_GetError());
         }
+        sdl->texture_changes = frame->changes;
     }
+    SDL_RenderCopy(sdl->renderer, sdl->texture, &mode, NULL);
     SDL_RenderPresent(sdl->renderer);
 }
 
-void handle_input(chip8_t* chip8, config_t* config){
+void set_key(link_t* link, uint8_t key, bool pressed){
+    if(pressed) {
+        atomic_fetch_or_explicit(&link->keys, 1u << key, memory_order_relaxed);
+    } else {
+        atomic_fetch_and_explicit(&link->keys, ~(1u << key), memory_order_relaxed);
+    }
+}
+
+void send_command(link_t* link, uint32_t command){
+    atomic_fetch_or_explicit(&link->commands, command, memory_order_release);
+}
+
+// CHIP-8 key bound to a host key, -1 if none
+int keypad_key(const config_t* config, SDL_Keycode sym){
+    for(int key = 0; key < 16; key++){
+        if((SDL_Keycode)(unsigned char)config->keymap[key] == sym) return key;
+    }
+    return -1;
+}
+
+// SDL thread: turn events into keypad bits and commands for the emulation thread, waking it if it
+// sleeps waiting for a key
+void handle_input(link_t* link, config_t* config, latency_t* latency){
     SDL_Event event;
+    bool any = false;
+    int key;
     while(SDL_PollEvent(&event)){
+        any = true;
         switch(event.type){
-            case SDL_QUIT: chip8->state = QUIT; break;
+            case SDL_QUIT: atomic_store(&link->quit, true); break;
             case SDL_KEYDOWN: 
+                // keypad keys start an input-to-pixel latency sample, and take precedence over hotkeys
+                if((key = keypad_key(config, event.key.keysym.sym)) >= 0){
+                    latency_key_pressed(latency);
+                    set_key(link, (uint8_t)key, true);
+                    break;
+                }
                 switch(event.key.keysym.sym){
-                    case SDLK_ESCAPE: chip8->state = QUIT; break;
+                    case SDLK_ESCAPE: atomic_store(&link->quit, true); break;
                     case SDLK_SPACE: 
-                        if(chip8->state == PAUSED) {
-                            chip8->state = RUNNING;
-                        } else if(chip8->state == RUNNING) {
-                            chip8->state = PAUSED;
-                            puts("==Paused==");
-                        } else {
-                            perror("Somehow state QUIT was reached\n");
-                            exit(EXIT_FAILURE);
+                        if(!atomic_load(&link->paused)) puts("==Paused==");
+                        atomic_store(&link->paused, !atomic_load(&link->paused));
+                        break;
+                    case SDLK_o: if(config->volume >0) config->volume-=500; atomic_store(&link->volume, config->volume); break;
+                    case SDLK_p: if(config->volume < INT16_MAX) config->volume+=500; atomic_store(&link->volume, config->volume); break;
+                    case SDLK_EQUALS:
+                    case SDLK_F7:
+                    case SDLK_F9:
+                    case SDLK_BACKSPACE:
+                        // a movie has to follow the machine from the start, it cannot jump around
+                        if(link->recording) {
+                            puts("==Not available while recording==");
+                            break;
+                        }
+                        switch(event.key.keysym.sym){
+                            case SDLK_EQUALS: send_command(link, COMMAND_RESET); break;
+                            case SDLK_F9: send_command(link, COMMAND_QUICK_LOAD); break;
+                            case SDLK_F7: send_command(link, COMMAND_LOAD); break;
+                            default: atomic_store(&link->rewinding, true); break;
                         } break;
-                    case SDLK_0: chip8->keypad[0x00] = true; break;
-                    case SDLK_1: chip8->keypad[0x01] = true; break;
-                    case SDLK_2: chip8->keypad[0x02] = true; break;
-                    case SDLK_3: chip8->keypad[0x03] = true; break;
-                    case SDLK_4: chip8->keypad[0x04] = true; break;
-                    case SDLK_5: chip8->keypad[0x05] = true; break;
-                    case SDLK_6: chip8->keypad[0x06] = true; break;
-                    case SDLK_7: chip8->keypad[0x07] = true; break;
-                    case SDLK_8: chip8->keypad[0x08] = true; break;
-                    case SDLK_9: chip8->keypad[0x09] = true; break;
-                    case SDLK_a: chip8->keypad[0x0A] = true; break;
-                    case SDLK_b: chip8->keypad[0x0B] = true; break;
-                    case SDLK_c: chip8->keypad[0x0C] = true; break;
-                    case SDLK_d: chip8->keypad[0x0D] = true; break;
-                    case SDLK_e: chip8->keypad[0x0E] = true; break;
-                    case SDLK_f: chip8->keypad[0x0F] = true; break;
-                    case SDLK_o: if(config->volume >0) config->volume-=500; break;
-                    case SDLK_p: if(config->volume < INT16_MAX) config->volume+=500; break;
-                    case SDLK_EQUALS: init_chip8(chip8, chip8->rom_path); break;
+                    case SDLK_LEFTBRACKET:
+                    case SDLK_RIGHTBRACKET: {
+                        // a movie replays at the speed it was recorded at
+                        if(link->recording) {
+                            puts("==Not available while recording==");
+                            break;
+                        }
+                        uint32_t rate = atomic_load(&link->instr_rate);
+                        if(event.key.keysym.sym == SDLK_RIGHTBRACKET) {
+                            rate = rate < MAX_SPEED / 2 ? rate * 2 : MAX_SPEED;
+                        } else {
+                            rate = rate > MIN_SPEED * 2 ? rate / 2 : MIN_SPEED;
+                        }
+                        atomic_store(&link->instr_rate, rate);
+                        printf("==%" PRIu32 " instructions/s==\n", rate);
+                    } break;
+                    case SDLK_TAB: atomic_store(&link->turbo, !atomic_load(&link->turbo)); break;
+                    case SDLK_F5: send_command(link, COMMAND_QUICK_SAVE); break;
+                    case SDLK_F6: send_command(link, COMMAND_SAVE); break;
+                    case SDLK_F10: send_command(link, COMMAND_BREAK); break;
                     default: break;
                 } break;
             case SDL_KEYUP:
+                if((key = keypad_key(config, event.key.keysym.sym)) >= 0){
+                    set_key(link, (uint8_t)key, false);
+                    break;
+                }
                 switch(event.key.keysym.sym){
-                    case SDLK_0: chip8->keypad[0x00] = false; break;
-                    case SDLK_1: chip8->keypad[0x01] = false; break;
-                    case SDLK_2: chip8->keypad[0x02] = false; break;
-                    case SDLK_3: chip8->keypad[0x03] = false; break;
-                    case SDLK_4: chip8->keypad[0x04] = false; break;
-                    case SDLK_5: chip8->keypad[0x05] = false; break;
-                    case SDLK_6: chip8->keypad[0x06] = false; break;
-                    case SDLK_7: chip8->keypad[0x07] = false; break;
-                    case SDLK_8: chip8->keypad[0x08] = false; break;
-                    case SDLK_9: chip8->keypad[0x09] = false; break;
-                    case SDLK_a: chip8->keypad[0x0A] = false; break;
-                    case SDLK_b: chip8->keypad[0x0B] = false; break;
-                    case SDLK_c: chip8->keypad[0x0C] = false; break;
-                    case SDLK_d: chip8->keypad[0x0D] = false; break;
-                    case SDLK_e: chip8->keypad[0x0E] = false; break;
-                    case SDLK_f: chip8->keypad[0x0F] = false; break;
+                    case SDLK_BACKSPACE: atomic_store(&link->rewinding, false); break;
                     default: break;
                 } break;
             default: break;
                 
         }
     }
+    if(any && SDL_SemValue(link->wake) == 0) SDL_SemPost(link->wake);
 }
 
-void emulate_instruction(chip8_t* chip8, config_t config){
-    // get the instruction to be executed
-    // I have a little endian machine, so the program would first get the larger 8 bits
-    // then they need to be shifted and bitwise ORed with the lower 8 bits stored at the next memory address
-    uint16_t instr = (chip8->RAM[chip8->PC] << 8) | chip8->RAM[(chip8->PC) + 1];
-    
-    // increment program counter for the next 16 bit instruction
-    chip8->PC += 2;
-
-    uint16_t first4bits = (instr & 0xF000) >> 12;
-    uint16_t NNN = (instr & 0x0FFF);
-    uint16_t NN = (instr & 0x00FF);
-    uint16_t X = (instr & 0x0F00) >> 8;
-    uint16_t Y = (instr & 0x00F0) >> 4;
-    uint16_t N = (instr & 0x000F);
-    switch(first4bits) {
-        case 0x00: 
-            if (NN == 0xE0) {
-                memset(&chip8->display[0], false, sizeof chip8->display);
-            } else if(NN == 0xEE) {
-                chip8->SP--;
-                chip8->PC = chip8->stack[chip8->SP];
-                
-            }
-            break;
-        case 0x01: 
-            // Opcode is 1NNN: Jumps to address NNN
-            chip8->PC = NNN;
-            break;
-        case 0x02: 
-            // Opcode is 2NNN: Calls subroutin at NNN
-            
-            // only allow a maximum recurive detpth of 12
-            if(chip8->SP < 12){
-                chip8->stack[chip8->SP] = chip8->PC;
-                chip8->SP ++;
-                chip8->PC = NNN;
-                return;
-            } else {
-                perror("Stack overflow");
-                exit(EXIT_FAILURE);
-            }
-            
-        case 0x03: 
-            // Opcode is 3XNN: skips next instruction if VX == NN
-            if(chip8->V[X] == NN) {
-                chip8->PC += 2;
-            }
-            return;
-        case 0x04: 
-            // Opcode is 4XNN: skips next instruction if VX != NN
-            if(chip8->V[X] != NN) {
-                chip8->PC += 2;
-            }
-            return;
-        case 0x05:
-            // Opcode is 5XY0: skips next instruction if VX == VY
-            if(chip8->V[X] == chip8->V[Y]){
-                chip8->PC += 2;
-            }
-            return;
-        case 0x06: 
-            // Opcode is 6XNN: sets value of register VX to NN
-            chip8->V[X] = NN;
-            return;
-        case 0x07: 
-            // Opcode is 7XNN: increments value of register VX to NN
-            chip8->V[X] += NN;
-            return;
-        case 0x08: 
-            switch(N) {
-                //Opcode is 8XY0: set register VX to the value of VY
-                case 0x00: chip8->V[X] = chip8->V[Y]; break;
-                // Opcode is 8XY1: set register VX to VX OR VY
-                case 0x01: chip8->V[X] |= chip8->V[Y]; break;
-                // Opcode is 8XY2: set register VX to VX AND VY
-                case 0x02: chip8->V[X] &= chip8->V[Y]; break;
-                // Opcode is 8XY3: set register VX to VX XOR VY
-                case 0x03: chip8->V[X] ^= chip8->V[Y]; break;
-                // Opcode is 8XY4: set register VX to VX + VY, if overflow, set VF to 1, otherwise to 0
-                case 0x04: 
-                    if(chip8->V[X] + chip8->V[Y] > 0xFF) {
-                        chip8->V[0x0F] = 0x01;
-                    } else {
-                        chip8->V[0x0F] = 0x00;
-                    } 
-                    chip8->V[X] += chip8->V[Y];
-                    break;
-                // Opcode is 8XY5: set register VX to VX - VY, if underflow, set VF to 0, otherwise to 1
-                case 0x05: 
-                    if(chip8->V[X] >= chip8->V[Y]) {
-                        chip8->V[0x0F] = 0x01;
-                        
-                    } else {
-                        chip8->V[0x0F] = 0x00;
-                    }    
-                    chip8->V[X] -= chip8->V[Y];
-                    break;
-                // Opcode is 8XY6: set register VX to VX >>1 (shift to right by 1); set VF to the last bit of VX
-                case 0x06: chip8->V[0x0F] = chip8->V[X] & 0x01; chip8->V[X] >>= 1; break;
-                // Opcode is 8XY7: set register VX to VY - VX, if underflow, set VF to 0, otherwise to 1
-                case 0x07: 
-                    if(chip8->V[Y] >= chip8->V[X]) {
-                        chip8->V[0x0F] = 0x01;
-                    } else {
-                        
-                        chip8->V[0x0F] = 0x00;
-                    } 
-                    chip8->V[X] = chip8->V[Y] - chip8->V[X];
-                    break;
+typedef struct {
+    chip8_t* chip8;
+    const config_t* config;
+    scheduler_t* sched;
+    states_t* states;
+    chip8_audio_t* audio;
+    link_t* link;
+    chip8_shm_t* shm;               // -shm export, NULL if none
+    chip8_capture_t* capture;       // -capture, NULL if none
+} emulation_t;
 
-                case 0x0E: chip8->V[0x0F] = (chip8->V[X] & 0x80)>>7; chip8->V[X] <<= 1; break;
-                default: printf("Invalid opcode 0x8%d%d%d\n", X, Y, N);
-            }    
-            return;
-        case 0x09: 
-            // Opcode is 9XY0: skips next instruction if VX != VY
-            if(chip8->V[X] != chip8->V[Y]){
-                chip8->PC += 2;
-            }
-            return;
-        case 0xA: 
-            // Opcode is ANNN: sets the register I to value NNN
-            chip8->I = NNN;
-            return;
-        case 0xB: 
-            // Opcode is BNNN: sets the value of the program counter to V0 plus NNN
-            chip8->PC = chip8->V[0] + NNN;
-            return;
-        case 0xC: 
-            // Opcode is CXNN: sets value of register VX to the bitwise and of NN and a random number between 0 and 255
-            chip8->V[X] = NN & (rand() % 256 + 1);
-            return;
-        case 0xD: 
-            // Opcode is DXYN: reads N bytes from memory, starting at position I and XORs them with the display bits starting at coordinate
-            // X, Y. If any pixel is erase/ set off, VF is set to 1, otherwise, it is set to 0. If part of the sprite is outside the display, it 
-            // wraps around the display.
-            uint8_t X_coord = chip8->V[X] % config.window_width;
-            uint8_t Y_coord = chip8->V[Y] % config.window_height;
-            uint8_t X_original = X_coord;
-            chip8->V[0x0F] = 0;
-            for (uint8_t i =0; i< N; i++) {
-                const uint8_t sprite = chip8->RAM[chip8->I + i];
-                X_coord = X_original;
-                for (int8_t j=7; j>=0; j--) {
-                    // get the bit of the sprite and the corresponding one on the display 
-                    bool *pixel = &chip8->display[Y_coord * config.window_width + X_coord];
-                    bool sprite_bit = sprite & (1 << j);
-                    if (sprite_bit && *pixel) {
-                        chip8->V[0x0F] = 1;
-                    }
-                    *pixel ^= sprite_bit;
+// emulation thread: take debugger commands from the terminal until the machine resumes. The
+// window keeps showing the last frame and the audio plays out; a quit waits for the prompt
+void run_debugger(emulation_t* emu){
+    if(!chip8_debug_enable(emu->chip8)) return;
+    chip8_audio_idle(emu->audio);
+    chip8_debug_prompt(emu->chip8, stdin, stdout);
+    // whatever the commands changed is shown before running on
+    publish_frame(emu->link, emu->config, emu->chip8);
+    if(emu->shm != NULL) chip8_shm_publish(emu->shm, emu->chip8);
+    scheduler_resync(emu->sched);
+}
 
-                    if(++X_coord >= config.window_width) break;
-                }
-                if(++Y_coord >= config.window_height) break;
-            }
-            break;
-        case 0xE:
-            // Opcode is EX9E: skip next instruction if key stored in VX is pressed
-            if(NN == 0x9E) {
-                if(chip8->keypad[chip8->V[X]]){
-                    chip8->PC += 2;
-                }
-            // Opcode is EXA1: skip next instruction if key stored in VX is not pressed
-            } else if (NN == 0xA1){
-                if(!chip8->keypad[chip8->V[X]]){
-                    chip8->PC += 2;
-                }
+// emulation thread: carry out the commands the SDL thread sent since the last iteration
+void run_commands(emulation_t* emu){
+    chip8_t* chip8 = emu->chip8;
+    states_t* states = emu->states;
+    const uint32_t commands = atomic_exchange_explicit(&emu->link->commands, 0, memory_order_acquire);
+    if(commands & COMMAND_RESET) chip8_restore(chip8, &states->boot);
+    if((commands & COMMAND_QUICK_LOAD) && states->has_quick) {
+        chip8_restore(chip8, &states->quick);
+        puts("==State restored==");
+    }
+    if((commands & COMMAND_LOAD) && chip8_load_state(chip8, states->path)) printf("==State loaded from %s==\n", states->path);
+    if(commands & COMMAND_QUICK_SAVE) {
+        chip8_snapshot(chip8, &states->quick);
+        states->has_quick = true;
+        puts("==State saved==");
+    }
+    if((commands & COMMAND_SAVE) && chip8_save_state(chip8, states->path)) printf("==State written to %s==\n", states->path);
+    if(commands & COMMAND_BREAK) run_debugger(emu);
+}
+
+int emulation_thread(void* data){
+    emulation_t* emu = data;
+    chip8_t* chip8 = emu->chip8;
+    scheduler_t* sched = emu->sched;
+    states_t* states = emu->states;
+    link_t* link = emu->link;
+    if(chip8->debug != NULL) run_debugger(emu);
+    while(!atomic_load(&link->quit) && chip8->state != QUIT){
+        run_commands(emu);
+        uint16_t keys = atomic_load_explicit(&link->keys, memory_order_relaxed);
+        if(emu->shm != NULL) keys |= chip8_shm_keys(emu->shm);
+        for(int key = 0; key < 16; key++) chip8->keypad[key] = (keys >> key) & 1;
+        if(states->movie != NULL) chip8_movie_record_keypad(states->movie, chip8);
+        chip8_audio_set_volume(emu->audio, atomic_load_explicit(&link->volume, memory_order_relaxed));
+        // if paused, then simply halt all execution
+        if(atomic_load(&link->paused)) {
+            chip8->state = PAUSED;
+            SDL_Delay(16);
+            scheduler_resync(sched);
+            continue;
+        }
+        chip8->state = RUNNING;
+        const uint32_t instr_rate = atomic_load_explicit(&link->instr_rate, memory_order_relaxed);
+        if(instr_rate != sched->schedule.instr_rate) scheduler_set_rate(sched, instr_rate);
+        // run the instructions and timer ticks that became due, at exactly instr_rate per second;
+        // no emulated time passes while rewinding, and turbo runs as much as fits before the next
+        // frame. The audio keeps playing silence in both, at the real time rate
+        const bool rewinding = states->rewind != NULL && atomic_load(&link->rewinding);
+        const bool turbo = !rewinding && atomic_load_explicit(&link->turbo, memory_order_relaxed);
+        const uint64_t now = SDL_GetPerformanceCounter();
+        if(rewinding || turbo) {
+            chip8_audio_render(emu->audio, chip8, scheduler_due(sched, now), sched->schedule.instr_rate, false);
+            while(turbo && chip8->state != QUIT && !chip8_debug_stopped(chip8, NULL) && SDL_GetPerformanceCounter() < sched->next_frame){
+                chip8_run_schedule(chip8, &sched->schedule, TURBO_SLICE);
             }
-            break;
-        case 0xF: 
-             
-            switch(NN) {
-                // Opcode is FX07: sets value of ragister VX to the value of the delay timer
-                case 0x07:
-                    chip8->V[X] = chip8->delay_timer;
-                    break;
-                // Opcode is FX0A: awaits a keypress and blocks, then stores key value in VX
-                case 0x0A:
-                    // static variables to handle the keypress
-                    static bool is_key_pressed = false;
-                    static uint8_t key = 0xFF;
-                    // check if any key on the keypad was pressed
-                    for(uint8_t i =0; i < 16 && key == 0xFF; i++) {
-                        if(chip8->keypad[i]){
-                            key = i;
-                            is_key_pressed = true;
-                            break;
-                        }
-                    }
-                    // if no key was pressed, repeat this instruction 
-                    if (!is_key_pressed){
-                        chip8->PC -= 2;
-                    } else {
-                        
-                        // if key is still pressed, repeat instruction
-                        if(chip8->keypad[key]){
-                            chip8->PC -= 2;
-                        } else {
-                            chip8->V[X] = key;
-                            key = 0xFF;
-                            is_key_pressed = false;
-                        }
-                    }
-                    break;
-                
-                // Opcode is FX15: set the delay timer to VX
-                case 0x15:
-                    chip8->delay_timer = chip8->V[X];
-                    break;
-                // Opcode is FX18: set the sound timer to VX
-                case 0x18:
-                    chip8->sound_timer = chip8->V[X];
-                    break;
-                // Opcode is FX1E: set I = I + VX
-                case 0x1E:
-                    chip8->I += chip8->V[X];
-                    break;
-                // Opcode is FX29: set I to the location in memory of the sprite for the character in VX
-                case 0x29:
-                    chip8->I = 5 * chip8->V[X];
-                    break;
-                // Opcode is FX33: stores the binary coded decimal representation of VX with hundreds digit at I, tens at I+1, ones digit at I+2
-                case 0x33:
-                    chip8->RAM[chip8->I] = chip8->V[X] / 100;
-                    chip8->RAM[chip8->I +1] = (chip8->V[X] / 10) % 10;
-                    chip8->RAM[chip8->I +2] = chip8->V[X] % 10;
-                    break;
-                // Opcode is FX55: stores V0 - VX in memory starting at address I
-                case 0x55:
-                    for(uint8_t i =0; i<= X; i++) {
-                        chip8->RAM[chip8->I + i] = chip8->V[i];
-                    }
-                    break;
-                // Opcode is FX65: fills V0-VX with values from memory starting at I
-                case 0x65:
-                    for(uint8_t i =0; i<= X; i++) {
-                        chip8->V[i] = chip8->RAM[chip8->I + i];
-                    }
-                    break;
-            }   
-            break;
+        } else {
+            scheduler_run_due(sched, chip8, emu->audio, now);
+        }
+        if(chip8_debug_stopped(chip8, NULL)) {
+            run_debugger(emu);
+            continue;
+        }
+        // the scheduler's count only grows, chip8->cycles jumps back with every restored state
+        atomic_store_explicit(&link->cycles, sched->cycles_before + sched->schedule.cycles, memory_order_relaxed);
+        // when a frame is due, record it for rewind or step one back, and publish it if it changed
+        if(now >= sched->next_frame){
+            if(rewinding) {
+                chip8_rewind_pop(states->rewind, chip8);
+            } else if(states->rewind != NULL) {
+                chip8_rewind_push(states->rewind, chip8);
+            }
+            // an encoder that fell behind costs the capture this frame, never the emulation its time
+            if(emu->capture != NULL && chip8->display_dirty) chip8_capture_frame(emu->capture, chip8, sched->frames);
+            publish_frame(link, emu->config, chip8);
+            if(emu->shm != NULL) chip8_shm_publish(emu->shm, chip8);
+            scheduler_frame_done(sched);
+        }
+        // FX0A with the timers run out and the last frame shown: nothing can happen before a key
+        // event, so sleep until the SDL thread has one instead of waking every frame; the time
+        // spent asleep is not emulated, like a pause. Keys from the -shm segment cannot wake it, so
+        // with one the thread keeps looking once per frame
+        if(chip8_waiting_for_key(chip8) && chip8->delay_timer == 0 && chip8->sound_timer == 0 &&
+           !chip8->display_dirty && !rewinding && atomic_load(&link->commands) == 0 && emu->shm == NULL) {
+            chip8_audio_idle(emu->audio);
+            SDL_SemWait(link->wake);
+            scheduler_resync(sched);
+            continue;
+        }
+        // sleep until the next frame deadline
+        const uint64_t after = SDL_GetPerformanceCounter();
+        if(!turbo && after < sched->next_frame){
+            SDL_Delay((sched->next_frame - after) * 1000 / sched->freq);
+        }
+    }
+    atomic_store(&link->quit, true);
+    return 0;
+}
+
+// say what stopped the machine if it was a fault rather than the ROM exiting, true if it was
+bool report_fault(const chip8_t* chip8){
+    if(chip8->fault == FAULT_NONE) return false;
+    fprintf(stderr, "Stopped by a %s at 0x%03X\n", chip8_fault_name(chip8->fault), chip8->PC);
+    return true;
+}
+
+// start config.capture_path at `fps` frames per second; `lossless` waits for the encoder rather
+// than dropping frames
+chip8_capture_t* capture_start(const config_t* config, uint32_t fps, bool lossless){
+    const uint32_t palette[4] = { config->background_color, config->foreground_color, config->plane2_color, config->blend_color };
+    return chip8_capture_start(config->capture_path, CHIP8_DISPLAY_WIDTH * config->capture_scale, CHIP8_DISPLAY_HEIGHT * config->capture_scale,
+                               fps, palette, lossless);
+}
+
+// finish the capture, its last frame lasting until frame number `end`; false if writing it failed
+bool capture_finish(chip8_capture_t* capture, const config_t* config, uint64_t end){
+    chip8_capture_stats_t stats;
+    const bool ok = chip8_capture_stop(capture, end, &stats);
+    printf("captured %" PRIu64 " frames to %s (%" PRIu64 " in the file), %" PRIu64 " dropped\n",
+           stats.frames, config->capture_path, stats.written, stats.dropped);
+    return ok;
+}
+
+// run without any window or audio device, as fast as the host allows;
+// the 60Hz timers follow emulated time (instructions run) so runs stay deterministic.
+// A capture gets a frame per timer tick the display changed in, waiting for the encoder if need be;
+// a -shm segment gets every timer tick's frame and sets the keypad; false if writing the capture failed
+bool run_headless(chip8_t* chip8, const config_t config, chip8_capture_t* capture, chip8_shm_t* shm){
+    chip8_schedule_t schedule = { .instr_rate = config.instr_rate };
+    const uint64_t start = SDL_GetPerformanceCounter();
+    if(chip8->debug != NULL) chip8_debug_prompt(chip8, stdin, stdout);
+    while(chip8->state != QUIT){
+        if(chip8_debug_stopped(chip8, NULL)) {
+            chip8_debug_prompt(chip8, stdin, stdout);
+            continue;
+        }
+        uint64_t cycles = config.instr_rate;
+        if(capture != NULL){
+            if(chip8->display_dirty) chip8_capture_frame(capture, chip8, schedule.timer_ticks);
+            chip8->display_dirty = false;
+            cycles = chip8_schedule_until_tick(&schedule);
+        }
+        if(shm != NULL){
+            chip8_shm_publish(shm, chip8);
+            const uint16_t keys = chip8_shm_keys(shm);
+            for(int key = 0; key < 16; key++) chip8->keypad[key] = (keys >> key) & 1;
+            cycles = chip8_schedule_until_tick(&schedule);
+        }
+        if(config.cycle_limit){
+            if(chip8->cycles >= config.cycle_limit) break;
+            if(config.cycle_limit - chip8->cycles < cycles) cycles = config.cycle_limit - chip8->cycles;
+        }
+        chip8_run_schedule(chip8, &schedule, cycles);
+    }
+    if(capture != NULL && chip8->display_dirty) chip8_capture_frame(capture, chip8, schedule.timer_ticks);
+    if(shm != NULL) chip8_shm_publish(shm, chip8);
+    const double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("%" PRIu64 " instructions in %.3f s (%.0f instructions/s), framebuffer hash %016" PRIx64 "\n",
+           chip8->cycles, elapsed, elapsed > 0 ? chip8->cycles / elapsed : 0.0, chip8_framebuffer_hash(chip8));
+    return capture == NULL || capture_finish(capture, &config, schedule.timer_ticks + 1);
+}
 
+// print the ROM as the variant and quirks decode it, from 0x200 to its end
+void print_disassembly(const chip8_t* chip8, size_t rom_size){
+    for(uint32_t addr = 0x200; addr < 0x200 + rom_size;){
+        char text[32];
+        const int len = chip8_disassemble(chip8, (uint16_t)addr, text, sizeof text);
+        printf("0x%03X  %02X%02X  %s\n", (unsigned)addr, chip8->RAM[addr], chip8->RAM[addr + 1], text);
+        addr += len;
     }
 }
 
-void update_timers(chip8_t* chip8, sdl_t* sdl){
-    if(chip8->delay_timer > 0){
-        chip8->delay_timer--;
+// compile the loaded ROM to C for config.output_path (stdout by default)
+bool compile_rom(const chip8_t* chip8, const config_t config, size_t rom_size){
+    FILE* out = stdout;
+    if(config.output_path != NULL && (out = fopen(config.output_path, "w")) == NULL){
+        perror("Could not open the output file");
+        return false;
     }
-    if(chip8->sound_timer > 0) {
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl->deviceID, 0);
-    } else {
-        SDL_PauseAudioDevice(sdl->deviceID, 1);
+    const char* name = strrchr(chip8->rom_path, '/') ? strrchr(chip8->rom_path, '/') + 1 : chip8->rom_path;
+    bool ok = chip8_aot_compile(chip8, rom_size, name, out);
+    if(out != stdout && fclose(out) != 0){
+        perror("Could not write the output file");
+        ok = false;
+    }
+    return ok;
+}
+
+// run every ROM of config.batch_path on its own instance across all cores and write the results
+bool run_batch(const config_t config){
+    // batch jobs must end, default to a minute of emulated time per ROM
+    const uint64_t default_budget = config.cycle_limit ? config.cycle_limit : (uint64_t)config.instr_rate * 60;
+    chip8_job_t *jobs;
+    size_t job_count;
+    if(!chip8_batch_load(config.batch_path, default_budget, &jobs, &job_count)){
+        return false;
+    }
+    const uint64_t start = SDL_GetPerformanceCounter();
+    bool ok = chip8_batch_run(jobs, job_count, config.engine, config.variant, config.quirks, config.instr_rate, config.threads);
+    const double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    FILE *out = stdout;
+    if(ok && config.output_path != NULL && (out = fopen(config.output_path, "w")) == NULL){
+        perror("Could not open the batch output file");
+        ok = false;
+    }
+    if(ok){
+        const size_t len = config.output_path ? strlen(config.output_path) : 0;
+        if(len >= 5 && strcmp(config.output_path + len - 5, ".json") == 0){
+            chip8_batch_write_json(out, jobs, job_count);
+        } else {
+            chip8_batch_write_csv(out, jobs, job_count);
+        }
+        if(out != stdout) fclose(out);
+        fprintf(stderr, "%zu ROMs in %.3f s\n", job_count, elapsed);
+    }
+    chip8_batch_free(jobs, job_count);
+    return ok;
+}
+
+// run config.lanes copies of the loaded ROM in lockstep and report the aggregate rate,
+// to compare against a plain --headless run of a single instance
+bool run_lockstep(chip8_t* chip8, const config_t config){
+    chip8_lockstep_t *ls = chip8_lockstep_create(chip8, config.lanes);
+    if(ls == NULL){
+        return false;
+    }
+    chip8_schedule_t schedule = { .instr_rate = config.instr_rate };
+    // without a limit, run a minute of emulated time
+    const uint64_t limit = config.cycle_limit ? config.cycle_limit : (uint64_t)config.instr_rate * 60;
+    const uint64_t start = SDL_GetPerformanceCounter();
+    chip8_lockstep_run_schedule(ls, &schedule, limit);
+    const double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    const chip8_lockstep_stats_t stats = chip8_lockstep_stats(ls);
+    const uint64_t total = stats.vector_lane_steps + stats.scalar_lane_steps;
+    chip8_lockstep_get(ls, 0, chip8);
+    printf("%u lanes x %" PRIu64 " instructions in %.3f s (%.0f instructions/s aggregate, %.1f%% in SIMD kernels), "
+           "lane 0 framebuffer hash %016" PRIx64 "\n", config.lanes, limit, elapsed, elapsed > 0 ? total / elapsed : 0.0,
+           total ? 100.0 * stats.vector_lane_steps / total : 0.0, chip8_framebuffer_hash(chip8));
+    chip8_lockstep_destroy(ls);
+    return true;
+}
+
+// replay a recorded movie headless and uncapped, and check it ends on the recorded machine state
+bool run_replay(chip8_t* chip8, const config_t config){
+    chip8_movie_t movie;
+    if(!chip8_movie_load(&movie, config.replay_path)){
+        return false;
+    }
+    const uint64_t start = SDL_GetPerformanceCounter();
+    const bool ok = chip8_movie_replay(&movie, chip8);
+    const double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("replayed %zu key events, %" PRIu64 " instructions (%.1f s of emulated time) in %.3f s: %s\n",
+           movie.event_count, chip8->cycles, (double)chip8->cycles / movie.instr_rate, elapsed,
+           ok ? "framebuffer and RAM match" : "MISMATCH");
+    report_fault(chip8);
+    chip8_movie_free(&movie);
+    return ok;
+}
+
+// fuzz the keypad input of the loaded ROM for config.fuzz_seconds, report the coverage and the
+// faults found; false if there were any
+bool run_fuzz(chip8_t* chip8, const config_t config){
+    const chip8_fuzz_config_t fuzz = {
+        .instr_rate = config.instr_rate,
+        // without a limit, every execution gets ten seconds of emulated time
+        .cycles = config.cycle_limit ? config.cycle_limit : (uint64_t)config.instr_rate * 10,
+        .seconds = config.fuzz_seconds,
+        .threads = config.threads,
+        .seed = config.seed_set ? config.seed : (uint64_t)time(NULL),
+        .fault_dir = config.output_path ? config.output_path : ".",
+    };
+    static chip8_fuzz_stats_t stats;
+    if(!chip8_fuzz_run(chip8, &fuzz, &stats)){
+        return false;
+    }
+    const double per_core = stats.seconds > 0 ? stats.executions / stats.seconds / stats.threads : 0.0;
+    printf("%" PRIu64 " executions of %" PRIu64 " instructions in %.1f s on %u threads (%.0f executions/s per core, "
+           "%.0f instructions/s), %zu edges, %zu inputs kept, %zu faults\n", stats.executions, fuzz.cycles, stats.seconds,
+           stats.threads, per_core, stats.seconds > 0 ? stats.instructions / stats.seconds : 0.0, stats.edges, stats.corpus,
+           stats.fault_count);
+    for(size_t i = 0; i < stats.fault_count; i++){
+        const chip8_fuzz_fault_t* fault = &stats.faults[i];
+        // the fault may be in code the ROM wrote itself, disassemble the opcode that was seen
+        const uint8_t saved[2] = { chip8->RAM[fault->pc], chip8->RAM[(fault->pc + 1) & 0xFFFF] };
+        chip8->RAM[fault->pc] = fault->instr >> 8;
+        chip8->RAM[(fault->pc + 1) & 0xFFFF] = fault->instr & 0xFF;
+        char text[64];
+        chip8_disassemble(chip8, fault->pc, text, sizeof text);
+        chip8->RAM[fault->pc] = saved[0];
+        chip8->RAM[(fault->pc + 1) & 0xFFFF] = saved[1];
+        printf("%s at 0x%03X (%04X %s) after %" PRIu64 " instructions", chip8_fault_name(fault->kind), fault->pc,
+               fault->instr, text, fault->cycle);
+        if(fault->movie_path[0] != '\0') printf(", replay with -replay %s", fault->movie_path);
+        printf("\n");
+    }
+    return stats.fault_count == 0;
+}
+
+// index the ROMs under config.scan_path into config.library_path, hashing only new and changed files
+bool scan_library(const config_t config){
+    if(config.library_path == NULL){
+        fprintf(stderr, "--scan needs -library to name the index file\n");
+        return false;
+    }
+    chip8_library_scan_stats_t stats;
+    const uint64_t start = SDL_GetPerformanceCounter();
+    if(!chip8_library_scan(config.scan_path, config.library_path, &stats)){
+        return false;
+    }
+    const double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("%zu ROMs indexed into %s in %.3f s: %zu hashed, %zu unchanged, %zu files skipped\n",
+           stats.files, config.library_path, elapsed, stats.hashed, stats.reused, stats.skipped);
+    return true;
+}
+
+// resolve a -p given as a SHA-1 through the library, then apply the settings stored for the ROM's
+// contents; the command line flags are parsed again on top, so they still win
+bool find_rom(config_t* config, chip8_t* chip8, const int argc, char **argv){
+    static char rom_path[4096];
+    if(chip8->rom_path == NULL) return true;
+    uint8_t sha1[20];
+    if(config->library_path != NULL && access(chip8->rom_path, F_OK) != 0 && chip8_sha1_from_hex(chip8->rom_path, sha1)){
+        chip8_library_t* library = chip8_library_open(config->library_path);
+        if(library == NULL){
+            return false;
+        }
+        chip8_library_entry_t entry;
+        const bool found = chip8_library_find(library, sha1, &entry);
+        if(found) snprintf(rom_path, sizeof rom_path, "%s", entry.path);
+        chip8_library_close(library);
+        if(!found){
+            fprintf(stderr, "No ROM with SHA-1 %s in %s\n", chip8->rom_path, config->library_path);
+            return false;
+        }
+        chip8->rom_path = rom_path;
+    }
+    if(config->settings_path == NULL) return true;
+
+    chip8_rom_t rom;
+    if(!chip8_rom_map(chip8->rom_path, &rom)){
+        return false;
+    }
+    chip8_sha1(rom.data, rom.size, sha1);
+    chip8_rom_unmap(&rom);
+    chip8_rom_settings_t settings;
+    if(!chip8_settings_find(config->settings_path, sha1, &settings)){
+        return false;
+    }
+    if(!settings.found) return true;
+    char hex[41];
+    chip8_sha1_to_hex(sha1, hex);
+    printf("Using the settings for %s from %s\n", hex, config->settings_path);
+    if(settings.variant_set) config->variant = settings.variant;
+    if(settings.quirks_set) config->quirks = settings.quirks;
+    if(settings.instr_rate) config->instr_rate = settings.instr_rate;
+    uint32_t* const colors[4] = {
+        [ROM_COLOR_BACKGROUND] = &config->background_color,
+        [ROM_COLOR_FOREGROUND] = &config->foreground_color,
+        [ROM_COLOR_PLANE2] = &config->plane2_color,
+        [ROM_COLOR_BLEND] = &config->blend_color,
+    };
+    for(int c = 0; c < 4; c++){
+        if(settings.color_set[c]) *colors[c] = settings.colors[c];
     }
+    if(settings.keys[0] != '\0') memcpy(config->keymap, settings.keys, sizeof config->keymap);
+    char* path = chip8->rom_path;
+    const bool ok = parse_flags(config, chip8, argc, argv);
+    chip8->rom_path = path;
+    return ok;
 }
 
 int main(int argc, char **argv){
     sdl_t sdl= {0};
     config_t config = {0};
-    chip8_t chip8 = {0};
-    srand(time(NULL));
+    chip8_t *chip8 = chip8_create();
+    if(chip8 == NULL){
+        perror("Could not allocate the emulator");
+        exit(EXIT_FAILURE);
+    }
+
+    if(!set_config(&config, chip8, argc, argv)){
+        exit(EXIT_FAILURE);
+    }
+    if(config.scan_path != NULL){
+        const bool ok = scan_library(config);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
+    // batch jobs run with the command line settings only
+    if(config.batch_path == NULL && !find_rom(&config, chip8, argc, argv)){
+        exit(EXIT_FAILURE);
+    }
+
+    chip8_set_variant(chip8, config.variant);
+    chip8_set_quirks(chip8, config.quirks);
+    if(!chip8_set_engine(chip8, config.engine)){
+        exit(EXIT_FAILURE);
+    }
+    chip8_seed(chip8, config.seed_set ? config.seed : (uint64_t)time(NULL));
+    if(config.profile && !chip8_profile_enable(chip8)){
+        exit(EXIT_FAILURE);
+    }
+
+    if(config.batch_path != NULL){
+        const bool ok = run_batch(config);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
+
+    char* rom_path = chip8->rom_path;
+    if(!init_chip8(chip8, rom_path)){
+        exit(EXIT_FAILURE);
+    }
+    if(config.disasm || config.aot){
+        chip8_rom_t rom;
+        if(!chip8_rom_map(rom_path, &rom)){
+            exit(EXIT_FAILURE);
+        }
+        bool ok = true;
+        if(config.disasm) print_disassembly(chip8, rom.size);
+        else ok = compile_rom(chip8, config, rom.size);
+        chip8_rom_unmap(&rom);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
+    if(config.engine == ENGINE_AOT){
+        const chip8_aot_program_t* program = chip8_aot_program(chip8);
+        if(program != NULL) printf("Running the code compiled from %s\n", program->name);
+        else fprintf(stderr, "No code compiled for this ROM with these settings, interpreting it\n");
+    }
+    if(config.fuzz_seconds > 0){
+        const bool ok = run_fuzz(chip8, config);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
+    if(config.trace_path != NULL && !chip8_trace_start(chip8, config.trace_path)){
+        exit(EXIT_FAILURE);
+    }
+    if(config.replay_path != NULL){
+        const bool ok = run_replay(chip8, config);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
+
+    states_t states = { .path = config.state_path };
+    chip8_snapshot(chip8, &states.boot);
+    char default_state_path[4096];
+    if(states.path == NULL){
+        snprintf(default_state_path, sizeof default_state_path, "%s.state", rom_path);
+        states.path = default_state_path;
+    } else if(config.record_path != NULL) {
+        fprintf(stderr, "A movie has to be recorded from the start of the ROM, not from a state file\n");
+        exit(EXIT_FAILURE);
+    } else if(!chip8_load_state(chip8, states.path)){
+        exit(EXIT_FAILURE);
+    }
+
+    if(config.debug && !chip8_debug_enable(chip8)){
+        exit(EXIT_FAILURE);
+    }
+
+    if(config.headless && config.lanes > 0){
+        const bool ok = run_lockstep(chip8, config);
+        chip8_destroy(chip8);
+        return ok ? 0 : EXIT_FAILURE;
+    }
 
-    if(!set_config(&config, &chip8 ,argc, argv)){
+    // headless frames are numbered by timer tick, windowed ones by frame published
+    chip8_capture_t* capture = NULL;
+    if(config.capture_path != NULL &&
+       (capture = capture_start(&config, config.headless ? 60 : config.refresh_rate, config.headless)) == NULL){
         exit(EXIT_FAILURE);
     }
 
-    char* rom_path = chip8.rom_path;
-    if(!init_chip8(&chip8, rom_path)){
+    chip8_shm_t* shm = NULL;
+    if(config.shm_name != NULL && (shm = chip8_shm_create(config.shm_name)) == NULL){
         exit(EXIT_FAILURE);
     }
+
+    if(config.headless){
+        const bool captured = run_headless(chip8, config, capture, shm);
+        chip8_shm_destroy(shm);
+        chip8_profile_report(chip8, stdout, PROFILE_HOT_SPOTS);
+        const bool faulted = report_fault(chip8);
+        chip8_destroy(chip8);
+        return faulted || !captured ? EXIT_FAILURE : 0;
+    }
     
     // Initialize SDL subsystem 
     if(!init_sdl(&sdl, &config)){
+        chip8_shm_destroy(shm);
         exit(EXIT_FAILURE);
     }
     
     clear_screen(config, &sdl);
-    while(chip8.state != QUIT){
-        // handle any input the user might have done first
-        handle_input(&chip8, &config);
-        // if paused, then simply halt all execution
-        if(chip8.state == PAUSED) continue;
-        // get the time before running the instructions
-        uint64_t before_frame = SDL_GetPerformanceCounter();
-        // execute config.instr_rate instructions per second
-        for(uint32_t i=0; i < config.instr_rate / 60; i++){
-            emulate_instruction(&chip8, config);
+    chip8_movie_t movie;
+    if(config.record_path != NULL){
+        chip8_movie_start(&movie, chip8, config.instr_rate);
+        states.movie = &movie;
+    }
+    if(config.rewind_seconds > 0){
+        states.rewind = chip8_rewind_create((size_t)config.rewind_seconds * config.refresh_rate, REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL);
+    }
+    scheduler_t sched;
+    scheduler_init(&sched, config);
+    static link_t link;             // three hires frames, too big for the stack
+    frames_init(&link.frames);
+    atomic_init(&link.volume, config.volume);
+    atomic_init(&link.instr_rate, config.instr_rate);
+    link.wake = SDL_CreateSemaphore(0);
+    if(link.wake == NULL){
+        SDL_Log("Could not create a semaphore: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    link.recording = states.movie != NULL;
+    emulation_t emu = { chip8, &config, &sched, &states, sdl.audio, &link, shm, capture };
+    SDL_Thread* thread = SDL_CreateThread(emulation_thread, "emulation", &emu);
+    if(thread == NULL){
+        SDL_Log("Could not start the emulation thread: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    // the device plays continuously, silence included, and only stops while the emulator is paused
+    SDL_PauseAudioDevice(sdl.deviceID, 0);
+    bool paused = false;
+    latency_t latency = {0};
+    readout_t readout = { .time = SDL_GetPerformanceCounter() };
+    while(!atomic_load(&link.quit)){
+        handle_input(&link, &config, &latency);
+        readout_update(&readout, &sdl, &link);
+        if(atomic_load(&link.paused) != paused){
+            paused = !paused;
+            // resume with fresh samples rather than the ones queued before the pause
+            if(!paused) chip8_audio_flush(sdl.audio);
+            SDL_PauseAudioDevice(sdl.deviceID, paused);
+        }
+        // show the newest frame; presenting may block on vsync, emulation carries on regardless
+        const frame_t* frame = frames_take(&link.frames);
+        if(frame != NULL) {
+            update_screen(&sdl, frame);
+            latency_frame_presented(&latency, frame);
+        } else {
+            SDL_Delay(1);
         }
-        // get the time after running the instructions
-        uint64_t after_frame = SDL_GetPerformanceCounter();
-        // delay for 60Hz or actual elapsed time
-        const double time_elapsed = (double)((after_frame - before_frame) * 1000) / SDL_GetPerformanceFrequency();
-        // delay the display
-        SDL_Delay(16.67f > time_elapsed ? 16.67f - time_elapsed: 0);
-        // update the display
-        update_screen(&sdl, config, &chip8);
-        // update the delay and sound timers
-        update_timers(&chip8, &sdl);
     }
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroySemaphore(link.wake);
+    scheduler_report(&sched);
+    latency_report(&latency, &link.frames);
+    audio_report(sdl.audio, config.audio_sample_rate);
+    rewind_report(&states, config);
+    chip8_profile_report(chip8, stdout, PROFILE_HOT_SPOTS);
+    if(states.movie != NULL){
+        chip8_movie_finish(states.movie, chip8);
+        if(chip8_movie_save(states.movie, config.record_path)){
+            printf("recorded %zu key events over %" PRIu64 " instructions to %s\n", states.movie->event_count, chip8->cycles, config.record_path);
+        }
+        chip8_movie_free(states.movie);
+    }
+    chip8_rewind_destroy(states.rewind);
+    chip8_shm_destroy(emu.shm);
+    const bool captured = capture == NULL || capture_finish(capture, &config, sched.frames);
     // properly close all SDL initalizers and end the program
     finish_sdl(&sdl);
+    const bool faulted = report_fault(chip8);
+    chip8_destroy(chip8);
 
-    return 0;
+    return faulted || !captured ? EXIT_FAILURE : 0;
 }
 
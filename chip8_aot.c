@@ -0,0 +1,638 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_core.h"
+#include "chip8_debug.h"
+#include "chip8_internal.h"
+
+// Compiler: every address control can reach from 0x200 without running the ROM starts a block:
+// jump and call targets, return addresses, both sides of a skip, the instruction after one left
+// to the interpreter, and BNNN targets when the register is set to a constant earlier in the same
+// block or the base is a table of jumps. A block runs straight-line code until a jump, call,
+// return, skip, BNNN or a store to RAM (which may have hit code), or until just before an
+// instruction it leaves to emulate_instruction (FX0A, DXYN under the display wait quirk, the
+// SUPER-CHIP/XO-CHIP instructions with state outside the registers, anything past the ROM).
+//
+// Inside a block the V registers and I it touches are locals, loaded on entry and written back
+// on every exit, so the C compiler keeps them in host registers. The budget is checked before
+// every instruction, as in the JIT, so a run stops on exactly the same instruction as the
+// interpreters, and a block ending in a jump to its own start loops without leaving the function.
+//
+// Runtime: the engine picks the registered program compiled for the variant and quirks whose
+// code bytes are all in RAM whenever a ROM is loaded. A write to the bytes of a block marks it to
+// be compared against the ROM again before its next run; if it differs it is left to
+// emulate_instruction until it is written to again.
+
+#define RAM_SIZE (sizeof ((chip8_t*)0)->RAM)
+#define AOT_MAX_BLOCK 64            // instructions per block
+#define AOT_MAX_PROGRAMS 64
+#define AOT_MAX_BODY (1u << 16)
+#define REG_I 16                    // bit of I in the register masks, bits 0-15 are V0-VF
+
+typedef enum {
+    OP_NORMAL,                      // compiled, execution continues with the next instruction
+    OP_TERMINATOR,                  // compiled, sets PC and ends the block
+    OP_FALLBACK,                    // left to emulate_instruction, the block ends before it
+} op_kind_t;
+
+typedef struct {
+    const chip8_t *chip8;
+    const chip8_quirk_set_t *q;
+    uint32_t limit;                 // one past the last byte of the ROM
+    uint16_t start;
+    uint32_t end;                   // one past the last byte read
+    uint32_t count;                 // instructions
+    uint32_t used;                  // registers read or written (bits 0-15 for V, REG_I for I)
+    uint32_t written;
+    bool loops;                     // jumps back to its own start
+    int known[16];                  // constant value of V0-VF set earlier in the block, -1 if unknown
+    uint32_t successors[256];
+    size_t successor_count;
+    char body[AOT_MAX_BODY];
+    size_t length;
+    bool overflow;
+} block_t;
+
+static const char *const V[16] = { "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "va", "vb", "vc", "vd", "ve", "vf" };
+
+static void emit(block_t *b, const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(b->body + b->length, sizeof b->body - b->length, format, args);
+    va_end(args);
+    if(len < 0 || (size_t)len >= sizeof b->body - b->length) {
+        b->overflow = true;
+        return;
+    }
+    b->length += (size_t)len;
+}
+
+static uint16_t fetch(const chip8_t *chip8, uint32_t addr){
+    return (chip8->RAM[addr & 0xFFFF] << 8) | chip8->RAM[(addr + 1) & 0xFFFF];
+}
+
+static void add_successor(block_t *b, uint32_t addr){
+    if(b->successor_count < sizeof b->successors / sizeof b->successors[0]) b->successors[b->successor_count++] = addr & 0xFFFF;
+}
+
+static void read_bytes(block_t *b, uint32_t end){
+    if(end > b->end) b->end = end;
+}
+
+// whether the instruction at `addr` can be compiled, see the list above
+static bool compilable(const block_t *b, uint32_t addr){
+    if(addr + 2 > b->limit) return false;
+    const uint16_t instr = fetch(b->chip8, addr);
+    const uint8_t NN = instr & 0xFF, N = instr & 0xF;
+    const bool xochip = b->chip8->variant == VARIANT_XOCHIP;
+    // an XO-CHIP skip looks at the next instruction to step over F000 NNNN as a whole
+    const bool lookahead = !xochip || addr + 4 <= b->limit;
+    switch(instr >> 12) {
+        case 0x0: return NN == 0xE0 || NN == 0xEE || b->chip8->variant == VARIANT_CHIP8;
+        case 0x3: case 0x4: case 0x9: return lookahead;
+        case 0x5: return !(xochip && (N == 0x2 || N == 0x3)) && lookahead;
+        case 0x8: return N <= 0x7 || N == 0xE;
+        case 0xD: return !b->q->display_wait;
+        case 0xE: return (NN != 0x9E && NN != 0xA1) || lookahead;
+        case 0xF:
+            if(xochip) {
+                if(instr == 0xF000) return addr + 4 <= b->limit;
+                if(NN == 0x01 || NN == 0x3A) return true;
+                if(instr == 0xF002) return false;
+            }
+            if(b->chip8->variant != VARIANT_CHIP8 && (NN == 0x30 || NN == 0x75 || NN == 0x85)) return false;
+            return NN != 0x0A;
+        default: return true;
+    }
+}
+
+// comment, budget check (plus a guard that leaves the instruction to emulate_instruction) and count
+static void begin(block_t *b, uint32_t addr, uint32_t size, const char *guard){
+    char text[32];
+    chip8_disassemble(b->chip8, (uint16_t)addr, text, sizeof text);
+    emit(b, "    // 0x%04X  %02X%02X  %s\n", (unsigned)addr, b->chip8->RAM[addr], b->chip8->RAM[addr + 1], text);
+    emit(b, "    if(n == budget%s%s) { pc = 0x%04X; goto out; }\n", guard ? " || " : "", guard ? guard : "", (unsigned)addr);
+    emit(b, "    n++;\n");
+    read_bytes(b, addr + size);
+    b->count++;
+}
+
+static void emit_jump(block_t *b, uint32_t target, const char *indent, bool loop){
+    target &= 0xFFFF;
+    add_successor(b, target);
+    if(loop && target == b->start) {
+        emit(b, "%sgoto top;\n", indent);
+        b->loops = true;
+    } else {
+        emit(b, "%spc = 0x%04X;\n%sgoto out;\n", indent, (unsigned)target, indent);
+    }
+}
+
+static void emit_skip(block_t *b, uint32_t addr, const char *cond){
+    const uint32_t next = addr + 2;
+    bool long_instr = false;
+    if(b->chip8->variant == VARIANT_XOCHIP) {
+        long_instr = fetch(b->chip8, next) == 0xF000;
+        read_bytes(b, next + 2);
+    }
+    emit(b, "    if(%s) {\n", cond);
+    emit_jump(b, next + (long_instr ? 4 : 2), "        ", true);
+    emit(b, "    }\n");
+    emit_jump(b, next, "    ", true);
+}
+
+// BNNN: the one target if the register holds a constant, else NNN and the table of jumps there
+static void add_computed_targets(block_t *b, uint16_t base, int known){
+    if(known >= 0) {
+        add_successor(b, base + known);
+        return;
+    }
+    add_successor(b, base);
+    for(uint32_t addr = base; addr + 2 <= b->limit && addr < base + 0x100u && (fetch(b->chip8, addr) >> 12) == 0x1; addr += 2) {
+        add_successor(b, addr);
+    }
+}
+
+static op_kind_t emit_instruction(block_t *b, uint32_t addr, uint32_t *size){
+    *size = 2;
+    if(!compilable(b, addr)) return OP_FALLBACK;
+    const chip8_quirk_set_t *q = b->q;
+    const uint16_t instr = fetch(b->chip8, addr);
+    const uint8_t X = (instr >> 8) & 0xF, Y = (instr >> 4) & 0xF, N = instr & 0xF, NN = instr & 0xFF;
+    const uint16_t NNN = instr & 0xFFF;
+    const char *x = V[X], *y = V[Y];
+    const uint32_t vx = 1u << X, vy = 1u << Y, vf = 1u << 0xF, vi = 1u << REG_I;
+    const uint32_t next = addr + 2;
+    const int known_x = b->known[X];
+    uint32_t used = 0, written = 0;
+    op_kind_t kind = OP_NORMAL;
+    char cond[64];
+
+    switch(instr >> 12) {
+        case 0x0:
+            if(NN == 0xE0) {
+                begin(b, addr, 2, NULL);
+                emit(b, "    chip8_clear_display(chip8);\n");
+            } else if(NN == 0xEE) {
+                begin(b, addr, 2, "chip8->SP == 0");
+                emit(b, "    chip8->SP--;\n    pc = chip8->stack[chip8->SP];\n    goto out;\n");
+                kind = OP_TERMINATOR;
+            } else {
+                begin(b, addr, 2, NULL);
+            }
+            break;
+        case 0x1:
+            begin(b, addr, 2, NULL);
+            emit_jump(b, NNN, "    ", true);
+            kind = OP_TERMINATOR;
+            break;
+        case 0x2:
+            begin(b, addr, 2, "chip8->SP >= 12");
+            emit(b, "    chip8->stack[chip8->SP++] = 0x%04X;\n", (unsigned)(next & 0xFFFF));
+            add_successor(b, next);
+            emit_jump(b, NNN, "    ", true);
+            kind = OP_TERMINATOR;
+            break;
+        case 0x3: case 0x4:
+            begin(b, addr, 2, NULL);
+            used = vx;
+            snprintf(cond, sizeof cond, "%s %s 0x%02X", x, (instr >> 12) == 0x3 ? "==" : "!=", NN);
+            emit_skip(b, addr, cond);
+            kind = OP_TERMINATOR;
+            break;
+        case 0x5: case 0x9:
+            begin(b, addr, 2, NULL);
+            used = X != Y ? vx | vy : 0;
+            // a register against itself would only trip the C compiler's self-comparison warnings
+            if(X == Y) snprintf(cond, sizeof cond, "%d", (instr >> 12) == 0x5);
+            else snprintf(cond, sizeof cond, "%s %s %s", x, (instr >> 12) == 0x5 ? "==" : "!=", y);
+            emit_skip(b, addr, cond);
+            kind = OP_TERMINATOR;
+            break;
+        case 0x6:
+            begin(b, addr, 2, NULL);
+            written = vx;
+            emit(b, "    %s = 0x%02X;\n", x, NN);
+            break;
+        case 0x7:
+            begin(b, addr, 2, NULL);
+            written = vx;
+            emit(b, "    %s += 0x%02X;\n", x, NN);
+            break;
+        case 0x8: {
+            // the operand order of the interpreter, so VF as an operand sees the same values
+            const char *s = V[q->shift_vy ? Y : X];
+            const uint32_t vs = 1u << (q->shift_vy ? Y : X);
+            begin(b, addr, 2, NULL);
+            used = vx | vy;
+            written = vx;
+            switch(N) {
+                case 0x0: if(X != Y) emit(b, "    %s = %s;\n", x, y); break;
+                case 0x1: case 0x2: case 0x3:
+                    emit(b, "    %s %s= %s;\n", x, N == 0x1 ? "|" : N == 0x2 ? "&" : "^", y);
+                    if(q->vf_reset) {
+                        emit(b, "    vf = 0;\n");
+                        written |= vf;
+                    }
+                    break;
+                case 0x4: emit(b, "    vf = %s + %s > 0xFF;\n    %s += %s;\n", x, y, x, y); written |= vf; break;
+                case 0x5:
+                    if(X == Y) emit(b, "    vf = 1;\n    %s -= %s;\n", x, y); else emit(b, "    vf = %s >= %s;\n    %s -= %s;\n", x, y, x, y);
+                    written |= vf;
+                    break;
+                case 0x6: emit(b, "    vf = %s & 0x01;\n    %s = %s >> 1;\n", s, x, s); used = vx | vs; written |= vf; break;
+                case 0x7:
+                    if(X == Y) emit(b, "    vf = 1;\n    %s = %s - %s;\n", x, y, x); else emit(b, "    vf = %s >= %s;\n    %s = %s - %s;\n", y, x, x, y, x);
+                    written |= vf;
+                    break;
+                case 0xE: emit(b, "    vf = (%s & 0x80) >> 7;\n    %s = %s << 1;\n", s, x, s); used = vx | vs; written |= vf; break;
+            }
+            break;
+        }
+        case 0xA:
+            begin(b, addr, 2, NULL);
+            written = vi;
+            emit(b, "    i = 0x%03X;\n", NNN);
+            break;
+        case 0xB: {
+            const uint8_t S = q->jump_vx ? X : 0;
+            begin(b, addr, 2, NULL);
+            used = 1u << S;
+            emit(b, "    pc = %s + 0x%03X;\n    goto out;\n", V[S], NNN);
+            add_computed_targets(b, NNN, b->known[S]);
+            kind = OP_TERMINATOR;
+            break;
+        }
+        case 0xC:
+            begin(b, addr, 2, NULL);
+            written = vx;
+            emit(b, "    %s = 0x%02X & (chip8_random(chip8) %% 256 + 1);\n", x, NN);
+            break;
+        case 0xD:
+            // the sprite code reads VX, VY and I from the machine and sets VF there
+            begin(b, addr, 2, NULL);
+            used = vx | vy | vi;
+            written = vf;
+            emit(b, "    chip8->V[0x%X] = %s;\n    chip8->V[0x%X] = %s;\n    chip8->I = i;\n", X, x, Y, y);
+            emit(b, "    chip8_draw_sprite%s(chip8, 0x%X, 0x%X, %u);\n", q->wrap ? "_wrap" : "", X, Y, N);
+            emit(b, "    vf = chip8->V[0xF];\n");
+            break;
+        case 0xE:
+            begin(b, addr, 2, NULL);
+            if(NN == 0x9E || NN == 0xA1) {
+                used = vx;
+                snprintf(cond, sizeof cond, "%schip8->keypad[%s & 0xF]", NN == 0xA1 ? "!" : "", x);
+                emit_skip(b, addr, cond);
+                kind = OP_TERMINATOR;
+            }
+            break;
+        default:
+            if(b->chip8->variant == VARIANT_XOCHIP && instr == 0xF000) {
+                const uint16_t value = fetch(b->chip8, next);
+                *size = 4;
+                begin(b, addr, 4, NULL);
+                written = vi;
+                emit(b, "    i = 0x%04X;\n", value);
+                break;
+            }
+            begin(b, addr, 2, NULL);
+            if(b->chip8->variant == VARIANT_XOCHIP && NN == 0x01) {
+                emit(b, "    chip8->planes = %u;\n", X & 0x03);
+                break;
+            }
+            if(b->chip8->variant == VARIANT_XOCHIP && NN == 0x3A) {
+                used = vx;
+                emit(b, "    chip8->pitch = %s;\n", x);
+                break;
+            }
+            switch(NN) {
+                case 0x07: written = vx; emit(b, "    %s = chip8->delay_timer;\n", x); break;
+                case 0x15: used = vx; emit(b, "    chip8->delay_timer = %s;\n", x); break;
+                case 0x18: used = vx; emit(b, "    chip8->sound_timer = %s;\n", x); break;
+                case 0x1E: used = vx; written = vi; emit(b, "    i += %s;\n", x); break;
+                case 0x29: used = vx; written = vi; emit(b, "    i = 5 * %s;\n", x); break;
+                case 0x33:
+                    used = vx | vi;
+                    emit(b, "    chip8->RAM[i] = %s / 100;\n    chip8->RAM[(i + 1) & 0xFFFF] = (%s / 10) %% 10;\n    chip8->RAM[(i + 2) & 0xFFFF] = %s %% 10;\n", x, x, x);
+                    emit(b, "    chip8_invalidate_code(chip8, i, 3);\n");
+                    // the stores may have hit this block, leave it
+                    emit_jump(b, next, "    ", false);
+                    kind = OP_TERMINATOR;
+                    break;
+                case 0x55:
+                case 0x65:
+                    used = vi;
+                    for(unsigned r = 0; r <= X; r++) {
+                        if(NN == 0x55) {
+                            used |= 1u << r;
+                            emit(b, "    chip8->RAM[(i + %u) & 0xFFFF] = %s;\n", r, V[r]);
+                        } else {
+                            written |= 1u << r;
+                            emit(b, "    %s = chip8->RAM[(i + %u) & 0xFFFF];\n", V[r], r);
+                        }
+                    }
+                    if(NN == 0x55) emit(b, "    chip8_invalidate_code(chip8, i, %u);\n", X + 1u);
+                    if(q->index != INDEX_KEEP) {
+                        written |= vi;
+                        emit(b, "    i += %u;\n", q->index == INDEX_ADD_X1 ? X + 1u : X);
+                    }
+                    if(NN == 0x55) {
+                        emit_jump(b, next, "    ", false);
+                        kind = OP_TERMINATOR;
+                    }
+                    break;
+            }
+            break;
+    }
+
+    b->used |= used | written;
+    b->written |= written;
+    for(int r = 0; r < 16; r++) {
+        if(written & (1u << r)) b->known[r] = -1;
+    }
+    if((instr >> 12) == 0x6) {
+        b->known[X] = NN;
+    } else if((instr >> 12) == 0x7 && known_x >= 0) {
+        b->known[X] = (known_x + NN) & 0xFF;
+    }
+    return kind;
+}
+
+static void compile_block(block_t *b, uint16_t start){
+    b->start = start;
+    b->end = start;
+    b->count = 0;
+    b->used = b->written = 0;
+    b->loops = false;
+    for(int r = 0; r < 16; r++) b->known[r] = -1;
+    b->successor_count = 0;
+    b->length = 0;
+    b->overflow = false;
+    uint32_t addr = start;
+    for(;;) {
+        if(b->count == AOT_MAX_BLOCK) {
+            emit_jump(b, addr, "    ", false);
+            return;
+        }
+        uint32_t size;
+        const op_kind_t kind = emit_instruction(b, addr, &size);
+        if(kind == OP_FALLBACK) {
+            // emulate_instruction runs it, then carries on after it
+            add_successor(b, addr + 2);
+            if(b->count > 0) emit(b, "    pc = 0x%04X;\n    goto out;\n", (unsigned)addr);
+            return;
+        }
+        addr += size;
+        if(kind == OP_TERMINATOR) return;
+    }
+}
+
+static void write_function(FILE *out, const block_t *b){
+    fprintf(out, "// 0x%04X-0x%04X, %u instruction%s\n", (unsigned)b->start, (unsigned)(b->end - 1), b->count, b->count == 1 ? "" : "s");
+    fprintf(out, "static uint32_t block_%04X(chip8_t *chip8, uint32_t budget){\n", (unsigned)b->start);
+    for(int r = 0; r < 16; r++) {
+        if(b->used & (1u << r)) fprintf(out, "    uint8_t %s = chip8->V[0x%X];\n", V[r], r);
+    }
+    if(b->used & (1u << REG_I)) fprintf(out, "    uint16_t i = chip8->I;\n");
+    fprintf(out, "    uint32_t n = 0;\n    uint16_t pc;\n");
+    if(b->loops) fprintf(out, "top:\n");
+    fwrite(b->body, 1, b->length, out);
+    fprintf(out, "out:\n");
+    for(int r = 0; r < 16; r++) {
+        if(b->written & (1u << r)) fprintf(out, "    chip8->V[0x%X] = %s;\n", r, V[r]);
+    }
+    if(b->written & (1u << REG_I)) fprintf(out, "    chip8->I = i;\n");
+    fprintf(out, "    chip8->PC = pc;\n    return n;\n}\n\n");
+}
+
+// the ROM's file name in a comment or string literal
+static void write_name(FILE *out, const char *name){
+    for(const char *p = name; *p != '\0'; p++) {
+        if(*p == '"' || *p == '\\') fputc('\\', out);
+        fputc((unsigned char)*p < 0x20 ? '?' : *p, out);
+    }
+}
+
+bool chip8_aot_compile(const chip8_t *chip8, size_t rom_size, const char *name, FILE *out){
+    static const char *const variant_names[] = {
+        [VARIANT_CHIP8] = "VARIANT_CHIP8", [VARIANT_SCHIP] = "VARIANT_SCHIP", [VARIANT_XOCHIP] = "VARIANT_XOCHIP",
+    };
+    static const char *const quirk_names[] = {
+        [QUIRKS_MODERN] = "QUIRKS_MODERN", [QUIRKS_VIP] = "QUIRKS_VIP", [QUIRKS_CHIP48] = "QUIRKS_CHIP48",
+        [QUIRKS_SCHIP] = "QUIRKS_SCHIP", [QUIRKS_XOCHIP] = "QUIRKS_XOCHIP",
+    };
+    block_t *b = malloc(sizeof *b);
+    bool *start = calloc(RAM_SIZE, sizeof *start);
+    uint16_t *work = malloc(RAM_SIZE * sizeof *work);
+    if(b == NULL || start == NULL || work == NULL) {
+        perror("Could not allocate the compiler");
+        free(b);
+        free(start);
+        free(work);
+        return false;
+    }
+    b->chip8 = chip8;
+    b->q = chip8_quirk_set(chip8);
+    b->limit = 0x200 + (uint32_t)rom_size;
+
+    // every block start reachable from 0x200, compiling each block to find its successors
+    size_t work_count = 0;
+    start[0x200] = true;
+    work[work_count++] = 0x200;
+    while(work_count > 0) {
+        compile_block(b, work[--work_count]);
+        for(size_t s = 0; s < b->successor_count; s++) {
+            const uint32_t addr = b->successors[s];
+            if(addr < 0x200 || addr + 2 > b->limit || start[addr]) continue;
+            start[addr] = true;
+            work[work_count++] = (uint16_t)addr;
+        }
+    }
+
+    fprintf(out, "// ");
+    write_name(out, name);
+    fprintf(out, " compiled ahead of time by chip8 --aot for %s and %s.\n", variant_names[chip8->variant], quirk_names[chip8_quirks(chip8)]);
+    fprintf(out, "// Link it into chip8 (make AOT=<this file>) and run the ROM with -engine aot.\n\n");
+    fprintf(out, "#include \"chip8_aot.h\"\n#include \"chip8_core.h\"\n#include \"chip8_internal.h\"\n\n");
+    fprintf(out, "static const uint8_t rom[%zu] = {", rom_size);
+    for(size_t i = 0; i < rom_size; i++) {
+        fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", chip8->RAM[0x200 + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    size_t block_count = 0;
+    bool ok = true;
+    for(uint32_t addr = 0x200; addr < b->limit && ok; addr++) {
+        if(!start[addr]) continue;
+        compile_block(b, (uint16_t)addr);
+        if(b->overflow) {
+            fprintf(stderr, "The code of the block at 0x%04X is too big\n", (unsigned)addr);
+            ok = false;
+        } else if(b->count > 0) {
+            write_function(out, b);
+            block_count++;
+        } else {
+            start[addr] = false;
+        }
+    }
+    if(ok && block_count == 0) {
+        fprintf(stderr, "No code to compile in %s\n", name);
+        ok = false;
+    }
+    if(ok) {
+        fprintf(out, "static const chip8_aot_block_t blocks[%zu] = {\n", block_count);
+        for(uint32_t addr = 0x200; addr < b->limit; addr++) {
+            if(!start[addr]) continue;
+            compile_block(b, (uint16_t)addr);
+            fprintf(out, "    { 0x%04X, 0x%04X, block_%04X },\n", (unsigned)addr, (unsigned)b->end, (unsigned)addr);
+        }
+        fprintf(out, "};\n\n");
+        fprintf(out, "static const chip8_aot_program_t program = {\n    .name = \"");
+        write_name(out, name);
+        fprintf(out, "\",\n    .variant = %s,\n    .quirks = %s,\n", variant_names[chip8->variant], quirk_names[chip8_quirks(chip8)]);
+        fprintf(out, "    .rom = rom,\n    .rom_size = sizeof rom,\n    .blocks = blocks,\n    .block_count = %zu,\n};\n\n", block_count);
+        fprintf(out, "__attribute__((constructor)) static void register_program(void){\n    chip8_aot_register(&program);\n}\n");
+    }
+    if(ok && ferror(out)) {
+        perror("Could not write the compiled ROM");
+        ok = false;
+    }
+    free(b);
+    free(start);
+    free(work);
+    return ok;
+}
+
+static const chip8_aot_program_t *programs[AOT_MAX_PROGRAMS];
+static size_t program_count;
+
+bool chip8_aot_register(const chip8_aot_program_t *program){
+    if(program_count == AOT_MAX_PROGRAMS) {
+        fprintf(stderr, "Too many compiled ROMs, %s is left out\n", program->name);
+        return false;
+    }
+    programs[program_count++] = program;
+    return true;
+}
+
+size_t chip8_aot_program_count(void){
+    return program_count;
+}
+
+typedef enum {
+    BLOCK_VALID,                    // RAM holds the bytes the block was compiled from
+    BLOCK_CHECK,                    // written to since, compare before running it
+    BLOCK_STALE,                    // differs, interpreted until written to again
+} block_state_t;
+
+struct chip8_aot {
+    bool matched;                   // program looked up since the last load, variant or quirks change
+    const chip8_aot_program_t *program;
+    const chip8_aot_block_t *entry[RAM_SIZE]; // block starting at each address, NULL if none
+    uint8_t state[RAM_SIZE];        // block_state_t of that block
+    bool covered[RAM_SIZE];         // bytes some block was compiled from
+};
+
+static bool block_matches(const chip8_t *chip8, const chip8_aot_program_t *program, const chip8_aot_block_t *block){
+    return memcmp(&chip8->RAM[block->addr], &program->rom[block->addr - 0x200], block->end - block->addr) == 0;
+}
+
+static void match_program(chip8_t *chip8){
+    struct chip8_aot *aot = chip8->aot;
+    aot->matched = true;
+    aot->program = NULL;
+    memset(aot->entry, 0, sizeof aot->entry);
+    memset(aot->covered, 0, sizeof aot->covered);
+    for(size_t p = 0; p < program_count && aot->program == NULL; p++) {
+        const chip8_aot_program_t *program = programs[p];
+        if(program->variant != chip8->variant || program->quirks != chip8_quirks(chip8)) continue;
+        bool match = true;
+        for(uint32_t b = 0; b < program->block_count && match; b++) match = block_matches(chip8, program, &program->blocks[b]);
+        if(match) aot->program = program;
+    }
+    if(aot->program == NULL) return;
+    for(uint32_t b = 0; b < aot->program->block_count; b++) {
+        const chip8_aot_block_t *block = &aot->program->blocks[b];
+        aot->entry[block->addr] = block;
+        aot->state[block->addr] = BLOCK_VALID;
+        memset(&aot->covered[block->addr], true, block->end - block->addr);
+    }
+}
+
+const chip8_aot_program_t *chip8_aot_program(chip8_t *chip8){
+    if(chip8->aot == NULL) return NULL;
+    if(!chip8->aot->matched) match_program(chip8);
+    return chip8->aot->program;
+}
+
+bool aot_init(chip8_t *chip8){
+    if(chip8->aot != NULL) {
+        chip8->aot->matched = false;
+        return true;
+    }
+    if(program_count == 0) {
+        fprintf(stderr, "No ROMs were compiled into this binary, see --aot\n");
+        return false;
+    }
+    chip8->aot = calloc(1, sizeof *chip8->aot);
+    if(chip8->aot == NULL) {
+        perror("Could not allocate the compiled block table");
+        return false;
+    }
+    return true;
+}
+
+void aot_free(chip8_t *chip8){
+    free(chip8->aot);
+    chip8->aot = NULL;
+}
+
+void aot_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len){
+    struct chip8_aot *aot = chip8->aot;
+    // a ROM load or variant/quirks change, look the program up again
+    if(addr == 0 && len >= RAM_SIZE) {
+        aot->matched = false;
+        return;
+    }
+    if(!aot->matched || aot->program == NULL) return;
+    uint32_t end = (uint32_t)addr + len;
+    if(end > RAM_SIZE) end = RAM_SIZE;
+    bool hit = false;
+    for(uint32_t a = addr; a < end && !hit; a++) hit = aot->covered[a];
+    if(!hit) return;
+    for(uint32_t b = 0; b < aot->program->block_count; b++) {
+        const chip8_aot_block_t *block = &aot->program->blocks[b];
+        if(block->addr < end && block->end > addr) aot->state[block->addr] = BLOCK_CHECK;
+    }
+}
+
+uint64_t aot_run(chip8_t *chip8, uint64_t cycles){
+    struct chip8_aot *aot = chip8->aot;
+    if(!aot->matched) match_program(chip8);
+    uint64_t done = 0;
+    while(done < cycles) {
+        const uint16_t pc = chip8->PC;
+        const chip8_aot_block_t *block = aot->entry[pc];
+        uint32_t executed = 0;
+        if(block != NULL && aot->state[pc] == BLOCK_CHECK) {
+            aot->state[pc] = block_matches(chip8, aot->program, block) ? BLOCK_VALID : BLOCK_STALE;
+        }
+        if(block != NULL && aot->state[pc] == BLOCK_VALID) {
+            const uint64_t budget = cycles - done;
+            executed = block->run(chip8, budget > UINT32_MAX ? UINT32_MAX : (uint32_t)budget);
+            chip8->cycles += executed;
+        }
+        if(executed == 0) {
+            // no block here (or a stale one, or a stack fault to report), interpret a single instruction
+            emulate_instruction(chip8);
+            executed = 1;
+        }
+        done += executed;
+        // blocks leave anything that can stop the machine to the interpreter
+        if(chip8->state != RUNNING) break;
+    }
+    return done;
+}
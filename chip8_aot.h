@@ -0,0 +1,49 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_core.h"
+
+// Ahead-of-time compilation: chip8_aot_compile walks the control flow of a loaded ROM from 0x200
+// and writes a C translation unit with one function per basic block, specialized for the variant
+// and quirk profile. Linking that file into a binary registers its program before main runs, and
+// the aot engine then runs any loaded ROM whose code bytes match a registered program on the
+// compiled blocks. Addresses without a block (data jumped into, targets of computed jumps that
+// could not be resolved) and blocks whose bytes were overwritten since are run by
+// emulate_instruction, so the result is always exactly what the interpreter does.
+
+// runs the block starting at PC for at most `budget` instructions, sets PC and returns how many
+// ran; 0 if the first one has to be left to emulate_instruction (a stack fault)
+typedef uint32_t (*chip8_aot_block_fn)(chip8_t *chip8, uint32_t budget);
+
+typedef struct {
+    uint16_t addr;                  // first instruction
+    uint32_t end;                   // one past the last byte the block was compiled from
+    chip8_aot_block_fn run;
+} chip8_aot_block_t;
+
+typedef struct {
+    const char *name;               // file name of the ROM it was compiled from
+    chip8_variant_t variant;
+    chip8_quirks_t quirks;          // profile the blocks were compiled for, never QUIRKS_AUTO
+    const uint8_t *rom;             // loaded at 0x200
+    uint32_t rom_size;
+    const chip8_aot_block_t *blocks; // sorted by address
+    uint32_t block_count;
+} chip8_aot_program_t;
+
+// compile the `rom_size` byte ROM loaded into `chip8` for its variant and quirks; `name` is the
+// ROM's file name. False (with a message) if there is no code to compile or writing fails
+bool chip8_aot_compile(const chip8_t *chip8, size_t rom_size, const char *name, FILE *out);
+
+// called by every compiled file before main, false if there are too many
+bool chip8_aot_register(const chip8_aot_program_t *program);
+size_t chip8_aot_program_count(void);
+// the program the aot engine runs the loaded ROM on, NULL if none matches and it is interpreted
+const chip8_aot_program_t *chip8_aot_program(chip8_t *chip8);
+
+#endif
@@ -0,0 +1,193 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8_audio.h"
+
+// The ring holds int16 samples; head counts every sample the producer published, tail every sample
+// the consumer took, both only ever grow and each is written by one side only. The producer
+// publishes with a release store of head after writing the samples, the consumer frees them with a
+// release store of tail after copying them out.
+//
+// The oscillator walks a bit pattern at a bit rate: the beeper is the pattern 10 at twice the tone
+// frequency, XO-CHIP plays its 128 bit pattern at 4000 * 2^((pitch - 64) / 48) bits per second.
+// Every change between two bits is a step of the naive waveform; PolyBLEP replaces the step with a
+// two sample polynomial, which is why the synthesizer outputs each sample one sample late.
+
+#define GATE_RAMP_SECONDS 0.002     // the beeper fades in and out over 2 ms instead of clicking
+
+struct chip8_audio {
+    int16_t *ring;
+    size_t mask;                    // capacity - 1
+    size_t prefill;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    _Atomic bool idle;              // the producer stopped on purpose, running dry is no underrun
+
+    // consumer side
+    bool playing;                   // prefilled, cleared again by an underrun
+
+    // producer side
+    uint32_t sample_rate;
+    uint32_t tone_freq;
+    int16_t volume;
+    uint64_t owed;                  // fraction of a sample carried over, in 1/instr_rate samples
+    double pos;                     // position in the pattern, in bits
+    float level;                    // naive waveform after the last edge, -1 or +1
+    float prev;                     // band-limited sample waiting for the next one's correction
+    float prev_gain;
+    float gain;                     // gate envelope, 0 silent to 1 beeping
+
+    _Atomic uint64_t produced;
+    _Atomic uint64_t consumed;
+    _Atomic uint64_t underruns;
+    _Atomic uint64_t underrun_samples;
+    _Atomic uint64_t dropped_samples;
+    _Atomic size_t max_depth;
+};
+
+chip8_audio_t *chip8_audio_create(uint32_t sample_rate, size_t capacity, size_t prefill, uint32_t tone_freq, int16_t volume){
+    size_t size = 1;
+    while(size < capacity) size <<= 1;
+    chip8_audio_t *audio = calloc(1, sizeof *audio);
+    int16_t *ring = calloc(size, sizeof *ring);
+    if(audio == NULL || ring == NULL){
+        perror("Could not allocate the audio queue");
+        free(audio);
+        free(ring);
+        return NULL;
+    }
+    audio->ring = ring;
+    audio->mask = size - 1;
+    audio->prefill = prefill < size ? prefill : size;
+    audio->sample_rate = sample_rate;
+    audio->tone_freq = tone_freq;
+    audio->volume = volume;
+    audio->level = 1.0f;
+    atomic_init(&audio->head, 0);
+    atomic_init(&audio->tail, 0);
+    return audio;
+}
+
+void chip8_audio_destroy(chip8_audio_t *audio){
+    if(audio == NULL) return;
+    free(audio->ring);
+    free(audio);
+}
+
+void chip8_audio_idle(chip8_audio_t *audio){
+    atomic_store_explicit(&audio->idle, true, memory_order_relaxed);
+}
+
+void chip8_audio_set_volume(chip8_audio_t *audio, int16_t volume){
+    audio->volume = volume;
+}
+
+static bool pattern_bit(const chip8_t *chip8, bool pattern, uint64_t bit){
+    if(!pattern) return (bit & 1) == 0;
+    bit &= 127;
+    return (chip8->audio_pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+void chip8_audio_render(chip8_audio_t *audio, const chip8_t *chip8, uint64_t cycles, uint32_t instr_rate, bool sound){
+    if(instr_rate == 0) return;
+    atomic_store_explicit(&audio->idle, false, memory_order_relaxed);
+    audio->owed += cycles * audio->sample_rate;
+    const uint64_t count = audio->owed / instr_rate;
+    audio->owed %= instr_rate;
+
+    // an XO-CHIP program that loaded a pattern plays it, everything else beeps
+    bool pattern = false;
+    if(chip8->variant == VARIANT_XOCHIP){
+        for(int i = 0; i < 16; i++) pattern |= chip8->audio_pattern[i] != 0;
+    }
+    const uint32_t bits = pattern ? 128 : 2;
+    const double bit_rate = pattern ? 4000.0 * exp2((chip8->pitch - 64) / 48.0) : 2.0 * audio->tone_freq;
+    const double dt = bit_rate / audio->sample_rate;
+    if(audio->pos >= bits) audio->pos = fmod(audio->pos, bits);
+    const float target = sound ? 1.0f : 0.0f;
+    const float ramp = 1.0f / (float)(audio->sample_rate * GATE_RAMP_SECONDS);
+
+    const size_t head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    const size_t space = audio->mask + 1 - (head - tail);
+    size_t written = 0;
+    for(uint64_t n = 0; n < count; n++){
+        if(audio->gain < target) audio->gain = fminf(audio->gain + ramp, target);
+        if(audio->gain > target) audio->gain = fmaxf(audio->gain - ramp, target);
+
+        // every edge crossed on the way to this sample, at distance x (in samples) before it
+        const double next = audio->pos + dt;
+        float correction = 0.0f;
+        for(double edge = floor(audio->pos) + 1.0; edge <= next; edge += 1.0){
+            const float level = pattern_bit(chip8, pattern, (uint64_t)edge % bits) ? 1.0f : -1.0f;
+            if(level == audio->level) continue;
+            const float step = level - audio->level;
+            const float x = (float)((next - edge) / dt);
+            audio->prev += step * x * x / 2.0f;
+            correction -= step * (1.0f - x) * (1.0f - x) / 2.0f;
+            audio->level = level;
+        }
+        audio->pos = next >= bits ? next - bits : next;
+
+        const float out = audio->prev * audio->prev_gain * audio->volume;
+        audio->prev = audio->level + correction;
+        audio->prev_gain = audio->gain;
+        if(written < space){
+            audio->ring[(head + written) & audio->mask] = (int16_t)fmaxf(fminf(out, INT16_MAX), INT16_MIN);
+            written++;
+        }
+    }
+    atomic_store_explicit(&audio->head, head + written, memory_order_release);
+
+    atomic_fetch_add_explicit(&audio->produced, written, memory_order_relaxed);
+    atomic_fetch_add_explicit(&audio->dropped_samples, count - written, memory_order_relaxed);
+    const size_t depth = head + written - tail;
+    if(depth > atomic_load_explicit(&audio->max_depth, memory_order_relaxed)){
+        atomic_store_explicit(&audio->max_depth, depth, memory_order_relaxed);
+    }
+}
+
+void chip8_audio_read(chip8_audio_t *audio, int16_t *out, size_t count){
+    const size_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&audio->head, memory_order_acquire);
+    const size_t available = head - tail;
+    if(!audio->playing && available >= audio->prefill) audio->playing = true;
+    size_t taken = 0;
+    if(audio->playing){
+        taken = available < count ? available : count;
+        for(size_t i = 0; i < taken; i++) out[i] = audio->ring[(tail + i) & audio->mask];
+        atomic_store_explicit(&audio->tail, tail + taken, memory_order_release);
+        if(taken < count){
+            // start over with a full prefill instead of stuttering on every callback
+            audio->playing = false;
+            if(!atomic_load_explicit(&audio->idle, memory_order_relaxed)){
+                atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&audio->underrun_samples, count - taken, memory_order_relaxed);
+            }
+        }
+    }
+    for(size_t i = taken; i < count; i++) out[i] = 0;
+    atomic_fetch_add_explicit(&audio->consumed, count, memory_order_relaxed);
+}
+
+void chip8_audio_flush(chip8_audio_t *audio){
+    atomic_store_explicit(&audio->tail, atomic_load_explicit(&audio->head, memory_order_acquire), memory_order_release);
+    audio->playing = false;
+}
+
+chip8_audio_stats_t chip8_audio_stats(const chip8_audio_t *audio){
+    chip8_audio_t *a = (chip8_audio_t *)audio;
+    const size_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+    const size_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+    return (chip8_audio_stats_t){
+        .produced = atomic_load_explicit(&a->produced, memory_order_relaxed),
+        .consumed = atomic_load_explicit(&a->consumed, memory_order_relaxed),
+        .underruns = atomic_load_explicit(&a->underruns, memory_order_relaxed),
+        .underrun_samples = atomic_load_explicit(&a->underrun_samples, memory_order_relaxed),
+        .dropped_samples = atomic_load_explicit(&a->dropped_samples, memory_order_relaxed),
+        .depth = head - tail,
+        .max_depth = atomic_load_explicit(&a->max_depth, memory_order_relaxed),
+    };
+}
@@ -0,0 +1,47 @@
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Beeper audio. The emulation thread renders the samples of every span of emulated time it ran,
+// with the sound state of that span, into a lock-free single producer / single consumer ring;
+// the audio callback only copies samples out of it. Neither side ever blocks or takes a lock.
+// The waveform is a square wave (or the XO-CHIP 128 bit pattern at its pitch) whose edges are
+// band-limited with PolyBLEP, and the beeper is gated with a short ramp so it never clicks.
+typedef struct chip8_audio chip8_audio_t;
+
+typedef struct {
+    uint64_t produced;              // samples written by the emulation thread
+    uint64_t consumed;              // samples handed to the device, silence included
+    uint64_t underruns;             // callbacks that found the ring short
+    uint64_t underrun_samples;      // silence played because of them
+    uint64_t dropped_samples;       // samples rendered while the ring was full
+    size_t depth;                   // samples queued right now
+    size_t max_depth;               // most samples ever queued
+} chip8_audio_stats_t;
+
+// `capacity` samples of queue (rounded up to a power of two), playback starts once `prefill` are queued;
+// NULL on allocation failure
+chip8_audio_t *chip8_audio_create(uint32_t sample_rate, size_t capacity, size_t prefill, uint32_t tone_freq, int16_t volume);
+void chip8_audio_destroy(chip8_audio_t *audio);
+
+// producer: render `cycles` instructions worth of samples at instr_rate, beeping if `sound`
+void chip8_audio_render(chip8_audio_t *audio, const chip8_t *chip8, uint64_t cycles, uint32_t instr_rate, bool sound);
+// producer: no samples follow for a while, the consumer plays out the queue and then silence
+// without counting an underrun; the next render ends it
+void chip8_audio_idle(chip8_audio_t *audio);
+// producer: volume of the samples rendered from now on
+void chip8_audio_set_volume(chip8_audio_t *audio, int16_t volume);
+// consumer, safe to call from the audio callback: fill `out` with `count` samples
+void chip8_audio_read(chip8_audio_t *audio, int16_t *out, size_t count);
+// drop everything queued, call only while the consumer is stopped
+void chip8_audio_flush(chip8_audio_t *audio);
+
+// counters, readable from either thread
+chip8_audio_stats_t chip8_audio_stats(const chip8_audio_t *audio);
+
+#endif
@@ -0,0 +1,335 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "chip8_batch.h"
+
+// Batch runner: every job gets its own chip8 instance, so the only thing shared between workers
+// is the job array (each job is written by exactly one worker) and the work queues.
+// Work stealing: each worker owns a contiguous range of job indices packed into one atomic word
+// as (head << 32 | tail). The owner takes jobs from the head, idle workers steal from the tail
+// of the others; both sides claim a job with a single compare-and-swap on the same word.
+
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];  // keep every queue on its own cache line
+} job_queue_t;
+
+typedef struct {
+    chip8_job_t *jobs;
+    job_queue_t *queues;
+    unsigned worker_count;
+    chip8_engine_t engine;
+    chip8_variant_t variant;
+    chip8_quirks_t quirks;
+    uint32_t instr_rate;
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    unsigned index;
+} worker_t;
+
+#define RANGE(head, tail) (((uint64_t)(head) << 32) | (uint32_t)(tail))
+#define RANGE_HEAD(range) ((uint32_t)((range) >> 32))
+#define RANGE_TAIL(range) ((uint32_t)(range))
+
+// take the next job from the front of our own queue, false once it is empty
+static bool queue_pop(job_queue_t *queue, uint32_t *job){
+    uint64_t range = atomic_load(&queue->range);
+    while(RANGE_HEAD(range) < RANGE_TAIL(range)){
+        if(atomic_compare_exchange_weak(&queue->range, &range, RANGE(RANGE_HEAD(range) + 1, RANGE_TAIL(range)))){
+            *job = RANGE_HEAD(range);
+            return true;
+        }
+    }
+    return false;
+}
+
+// take the last job from the back of another worker's queue
+static bool queue_steal(job_queue_t *queue, uint32_t *job){
+    uint64_t range = atomic_load(&queue->range);
+    while(RANGE_HEAD(range) < RANGE_TAIL(range)){
+        if(atomic_compare_exchange_weak(&queue->range, &range, RANGE(RANGE_HEAD(range), RANGE_TAIL(range) - 1))){
+            *job = RANGE_TAIL(range) - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_job(chip8_job_t *job, const batch_t *batch){
+    const double start = now_seconds();
+    chip8_t *chip8 = chip8_create();
+    if(chip8 != NULL){
+        chip8_set_variant(chip8, batch->variant);
+        chip8_set_quirks(chip8, batch->quirks);
+    }
+    if(chip8 != NULL && chip8_set_engine(chip8, batch->engine) && init_chip8(chip8, job->rom_path)){
+        chip8_schedule_t schedule = { .instr_rate = batch->instr_rate };
+        chip8_run_script(chip8, &schedule, job->keys, job->key_count, job->cycle_budget);
+        job->ok = true;
+        job->cycles = chip8->cycles;
+        job->fault = chip8->fault;
+        job->fault_pc = chip8->fault != FAULT_NONE ? chip8->PC : 0;
+        job->framebuffer_hash = chip8_framebuffer_hash(chip8);
+        memcpy(job->V, chip8->V, sizeof job->V);
+        job->I = chip8->I;
+        job->PC = chip8->PC;
+        job->SP = chip8->SP;
+    }
+    chip8_destroy(chip8);
+    job->wall_time = now_seconds() - start;
+}
+
+static void *worker_main(void *arg){
+    const worker_t *worker = arg;
+    batch_t *batch = worker->batch;
+    uint32_t job;
+    for(;;){
+        if(queue_pop(&batch->queues[worker->index], &job)){
+            run_job(&batch->jobs[job], batch);
+            continue;
+        }
+        // our queue is empty, steal from the others; jobs are never added, so when every
+        // queue is empty we are done
+        bool stole = false;
+        for(unsigned i = 1; i < batch->worker_count && !stole; i++){
+            stole = queue_steal(&batch->queues[(worker->index + i) % batch->worker_count], &job);
+        }
+        if(!stole) return NULL;
+        run_job(&batch->jobs[job], batch);
+    }
+}
+
+bool chip8_batch_run(chip8_job_t *jobs, size_t job_count, chip8_engine_t engine, chip8_variant_t variant, chip8_quirks_t quirks, uint32_t instr_rate, unsigned threads){
+    if(job_count > UINT32_MAX){
+        fprintf(stderr, "Too many batch jobs\n");
+        return false;
+    }
+    if(threads == 0){
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (unsigned)cores : 1;
+    }
+    if(threads > job_count) threads = job_count > 0 ? job_count : 1;
+
+    batch_t batch = {
+        .jobs = jobs,
+        .queues = calloc(threads, sizeof(job_queue_t)),
+        .worker_count = threads,
+        .engine = engine,
+        .variant = variant,
+        .quirks = quirks,
+        .instr_rate = instr_rate,
+    };
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if(batch.queues == NULL || workers == NULL || tids == NULL){
+        perror("Could not allocate the batch workers");
+        free(batch.queues);
+        free(workers);
+        free(tids);
+        return false;
+    }
+    for(unsigned i = 0; i < threads; i++){
+        atomic_init(&batch.queues[i].range, RANGE(job_count * i / threads, job_count * (i + 1) / threads));
+        workers[i] = (worker_t){ .batch = &batch, .index = i };
+    }
+    // the calling thread is worker 0
+    unsigned started = 1;
+    for(; started < threads; started++){
+        if(pthread_create(&tids[started], NULL, worker_main, &workers[started]) != 0){
+            perror("Could not start a batch worker");
+            break;
+        }
+    }
+    worker_main(&workers[0]);
+    for(unsigned i = 1; i < started; i++){
+        pthread_join(tids[i], NULL);
+    }
+    free(batch.queues);
+    free(workers);
+    free(tids);
+    return true;
+}
+
+static int compare_key_events(const void *a, const void *b){
+    const chip8_key_event_t *x = a, *y = b;
+    return (x->cycle > y->cycle) - (x->cycle < y->cycle);
+}
+
+static int compare_jobs(const void *a, const void *b){
+    return strcmp(((const chip8_job_t*)a)->rom_path, ((const chip8_job_t*)b)->rom_path);
+}
+
+static bool add_job(chip8_job_t **jobs, size_t *job_count, size_t *capacity, const chip8_job_t *job){
+    if(*job_count == *capacity){
+        const size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        chip8_job_t *grown = realloc(*jobs, new_capacity * sizeof(chip8_job_t));
+        if(grown == NULL){
+            perror("Could not allocate the batch jobs");
+            return false;
+        }
+        *jobs = grown;
+        *capacity = new_capacity;
+    }
+    (*jobs)[(*job_count)++] = *job;
+    return true;
+}
+
+// parse "rom_path [cycle_budget] [cycle:key+ ...]"
+static bool parse_job_line(char *line, uint64_t default_budget, chip8_job_t *job){
+    const char *delim = " \t\r\n";
+    char *token = strtok(line, delim);
+    *job = (chip8_job_t){ .cycle_budget = default_budget };
+    job->rom_path = strdup(token);
+    if(job->rom_path == NULL) return false;
+    size_t capacity = 0;
+    while((token = strtok(NULL, delim)) != NULL){
+        char *end;
+        const uint64_t value = strtoull(token, &end, 10);
+        if(*end == '\0'){
+            job->cycle_budget = value;
+            continue;
+        }
+        unsigned key;
+        char action;
+        if(*end != ':' || sscanf(end + 1, "%x%c", &key, &action) != 2 || key > 0xF || (action != '+' && action != '-')){
+            fprintf(stderr, "Invalid key event %s for %s\n", token, job->rom_path);
+            return false;
+        }
+        if(job->key_count == capacity){
+            capacity = capacity ? capacity * 2 : 8;
+            chip8_key_event_t *grown = realloc(job->keys, capacity * sizeof(chip8_key_event_t));
+            if(grown == NULL) return false;
+            job->keys = grown;
+        }
+        job->keys[job->key_count++] = (chip8_key_event_t){ .cycle = value, .key = key, .pressed = action == '+' };
+    }
+    qsort(job->keys, job->key_count, sizeof(chip8_key_event_t), compare_key_events);
+    return true;
+}
+
+bool chip8_batch_load(const char *path, uint64_t default_budget, chip8_job_t **jobs, size_t *job_count){
+    size_t capacity = 0;
+    *jobs = NULL;
+    *job_count = 0;
+
+    struct stat st;
+    if(stat(path, &st) != 0){
+        perror("Could not open the batch path");
+        return false;
+    }
+    if(S_ISDIR(st.st_mode)){
+        DIR *dir = opendir(path);
+        if(dir == NULL){
+            perror("Could not open the ROM directory");
+            return false;
+        }
+        struct dirent *entry;
+        while((entry = readdir(dir)) != NULL){
+            chip8_job_t job = { .cycle_budget = default_budget };
+            const size_t len = strlen(path) + strlen(entry->d_name) + 2;
+            job.rom_path = malloc(len);
+            if(job.rom_path == NULL) break;
+            snprintf(job.rom_path, len, "%s/%s", path, entry->d_name);
+            if(stat(job.rom_path, &st) != 0 || !S_ISREG(st.st_mode) || !add_job(jobs, job_count, &capacity, &job)){
+                free(job.rom_path);
+            }
+        }
+        closedir(dir);
+        // directory order is arbitrary, keep the results stable between runs
+        qsort(*jobs, *job_count, sizeof(chip8_job_t), compare_jobs);
+        return true;
+    }
+
+    FILE *list = fopen(path, "r");
+    if(list == NULL){
+        perror("Could not open the ROM list");
+        return false;
+    }
+    char line[4096];
+    bool ok = true;
+    while(ok && fgets(line, sizeof line, list) != NULL){
+        const char *start = line + strspn(line, " \t\r\n");
+        if(*start == '\0' || *start == '#') continue;
+        chip8_job_t job;
+        ok = parse_job_line(line, default_budget, &job) && add_job(jobs, job_count, &capacity, &job);
+        if(!ok){
+            free(job.rom_path);
+            free(job.keys);
+        }
+    }
+    fclose(list);
+    if(!ok){
+        chip8_batch_free(*jobs, *job_count);
+        *jobs = NULL;
+        *job_count = 0;
+    }
+    return ok;
+}
+
+void chip8_batch_free(chip8_job_t *jobs, size_t job_count){
+    for(size_t i = 0; i < job_count; i++){
+        free(jobs[i].rom_path);
+        free(jobs[i].keys);
+    }
+    free(jobs);
+}
+
+void chip8_batch_write_csv(FILE *out, const chip8_job_t *jobs, size_t job_count){
+    fprintf(out, "rom,ok,cycles,fault,fault_pc,framebuffer_hash,PC,I,SP");
+    for(int i = 0; i < 16; i++) fprintf(out, ",V%X", i);
+    fprintf(out, ",wall_time\n");
+    for(size_t j = 0; j < job_count; j++){
+        const chip8_job_t *job = &jobs[j];
+        // quote the path, doubling any quotes inside it
+        fputc('"', out);
+        for(const char *c = job->rom_path; *c; c++){
+            if(*c == '"') fputc('"', out);
+            fputc(*c, out);
+        }
+        // the fault columns stay empty when there was none
+        fprintf(out, "\",%d,%" PRIu64 ",", job->ok, job->cycles);
+        if(job->fault != FAULT_NONE) fprintf(out, "%s,%u", chip8_fault_name(job->fault), job->fault_pc); else fputc(',', out);
+        fprintf(out, ",%016" PRIx64 ",%u,%u,%u", job->framebuffer_hash, job->PC, job->I, job->SP);
+        for(int i = 0; i < 16; i++) fprintf(out, ",%u", job->V[i]);
+        fprintf(out, ",%.6f\n", job->wall_time);
+    }
+}
+
+void chip8_batch_write_json(FILE *out, const chip8_job_t *jobs, size_t job_count){
+    fprintf(out, "[\n");
+    for(size_t j = 0; j < job_count; j++){
+        const chip8_job_t *job = &jobs[j];
+        fprintf(out, "  {\"rom\": \"");
+        for(const unsigned char *c = (const unsigned char*)job->rom_path; *c; c++){
+            if(*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+            else if(*c < 0x20) fprintf(out, "\\u%04x", *c);
+            else fputc(*c, out);
+        }
+        fprintf(out, "\", \"ok\": %s, \"cycles\": %" PRIu64 ", ", job->ok ? "true" : "false", job->cycles);
+        if(job->fault != FAULT_NONE) fprintf(out, "\"fault\": \"%s\", \"fault_pc\": %u, ", chip8_fault_name(job->fault), job->fault_pc);
+        else fprintf(out, "\"fault\": null, \"fault_pc\": null, ");
+        fprintf(out, "\"framebuffer_hash\": \"%016" PRIx64 "\", \"PC\": %u, \"I\": %u, \"SP\": %u, \"V\": [",
+                job->framebuffer_hash, job->PC, job->I, job->SP);
+        for(int i = 0; i < 16; i++) fprintf(out, i ? ", %u" : "%u", job->V[i]);
+        fprintf(out, "], \"wall_time\": %.6f}%s\n", job->wall_time, j + 1 < job_count ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
@@ -0,0 +1,43 @@
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_core.h"
+
+// one ROM to run headless, and its results once chip8_batch_run returns
+typedef struct {
+    char *rom_path;
+    uint64_t cycle_budget;          // stop after this many instructions
+    chip8_key_event_t *keys;        // sorted by cycle
+    size_t key_count;
+
+    bool ok;                        // false if the ROM could not be loaded
+    uint64_t cycles;                // instructions actually executed
+    chip8_fault_t fault;            // what stopped the ROM before its budget, FAULT_NONE if nothing did
+    uint16_t fault_pc;              // the faulting instruction
+    uint64_t framebuffer_hash;
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    double wall_time;               // seconds
+} chip8_job_t;
+
+// Build the job list from `path`: either a directory (every regular file is a ROM, run for
+// default_budget instructions) or a list file with one job per line:
+//     rom_path [cycle_budget] [cycle:key+|cycle:key- ...]
+// e.g. "roms/pong.ch8 100000 5000:5+ 5200:5-". Empty lines and lines starting with # are skipped.
+bool chip8_batch_load(const char *path, uint64_t default_budget, chip8_job_t **jobs, size_t *job_count);
+void chip8_batch_free(chip8_job_t *jobs, size_t job_count);
+
+// run every job on its own chip8 instance, spread over `threads` worker threads (0 = one per core)
+bool chip8_batch_run(chip8_job_t *jobs, size_t job_count, chip8_engine_t engine, chip8_variant_t variant, chip8_quirks_t quirks, uint32_t instr_rate, unsigned threads);
+
+void chip8_batch_write_csv(FILE *out, const chip8_job_t *jobs, size_t job_count);
+void chip8_batch_write_json(FILE *out, const chip8_job_t *jobs, size_t job_count);
+
+#endif
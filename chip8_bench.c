@@ -0,0 +1,223 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_aot.h"
+#include "chip8_core.h"
+
+// Headless micro-benchmarks: every ROM runs a fixed number of instructions on every engine of every
+// machine (CHIP-8, SUPER-CHIP, XO-CHIP) under a 700Hz schedule (timers included), best of a few
+// runs, then every renderer converts a framebuffer to pixels. Usage: chip8_bench [-c cycles] [rom ...], `make bench` runs the defaults.
+// Built with ROMs compiled by chip8 --aot (make bench AOT=...), the aot engine runs too; ROMs it has
+// no compiled code for are interpreted by it.
+
+#define BENCH_RATE 700
+#define BENCH_RUNS 3
+#define RENDER_FRAMES 200000
+
+// synthetic ROMs, each an endless loop stressing one part of the interpreter
+static const uint16_t alu_rom[] = {
+    0x6001, 0x6103,                 // V0 = 1, V1 = 3
+    0x7001, 0x8014, 0x8105, 0x820E, // loop: V0 += 1, V0 += V1, V1 -= V0, V2 = V0 << 1
+    0x8312, 0x8423, 0x3000, 0x1204, //       V3 &= V1, V4 ^= V2, skip if V0 == 0, jump loop
+    0x1200,
+};
+static const uint16_t draw_rom[] = {
+    0x6000, 0x6100, 0x6200,         // x, y, digit
+    0xF229, 0xD015, 0x7005, 0x7103, // loop: I = font(digit), draw at x, y, step x and y
+    0x7201, 0x6F0F, 0x82F2, 0x1206, //       digit = (digit + 1) & 0xF, jump loop
+};
+static const uint16_t memory_rom[] = {
+    0x6A00,                         // VA = 0
+    0xA300, 0xFA33, 0xF255, 0xF265, // loop: I = 0x300, BCD of VA, store and load V0-V2
+    0xF01E, 0x7A01, 0x1202,         //       I += V0, VA += 1, jump loop
+};
+static const uint16_t call_rom[] = {
+    0x2208, 0x7001, 0x1200, 0x0000, // call, V0 += 1, jump back
+    0x220C, 0x00EE,                 // nested call, return
+    0x7101, 0x00EE,                 // V1 += 1, return
+};
+static const uint16_t random_rom[] = {
+    0xC0FF, 0x4000, 0x7101, 0xC17F, // V0 = rand, skip if V0 != 0, V1 += 1, V1 = rand & 0x7F
+    0x8014, 0x1200,                 // V0 += V1, jump back
+};
+static const uint16_t keywait_rom[] = {
+    0xF00A, 0x1200,                 // wait for a key that never comes
+};
+// SUPER-CHIP and XO-CHIP instructions, plain CHIP-8 ignores the 00XX ones and draws nothing for N = 0
+static const uint16_t hires_rom[] = {
+    0x00FF, 0xF301, 0x6000, 0x6100, // hires, both planes (XO-CHIP), x, y
+    0x6200, 0xF230, 0xD010, 0x00C1, // digit; loop: I = big font(digit), draw 16x16, scroll down
+    0x00FB, 0x7009, 0x7105, 0x7201, //       scroll right, step x, y and digit
+    0x6F0F, 0x82F2, 0x120A,         //       digit &= 0xF, jump loop
+};
+
+typedef struct {
+    const char *name;
+    uint8_t rom[512];
+    size_t size;
+} bench_rom_t;
+
+// what a run leaves behind, every engine must leave the same
+typedef struct {
+    uint64_t framebuffer_hash;
+    uint64_t ram_hash;
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+} bench_result_t;
+
+static void add_synthetic(bench_rom_t *roms, size_t *count, const char *name, const uint16_t *words, size_t word_count){
+    bench_rom_t *rom = &roms[(*count)++];
+    rom->name = name;
+    rom->size = word_count * 2;
+    for(size_t i = 0; i < word_count; i++){
+        rom->rom[2 * i] = words[i] >> 8;
+        rom->rom[2 * i + 1] = words[i] & 0xFF;
+    }
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_result(const chip8_t *chip8, bench_result_t *result){
+    result->framebuffer_hash = chip8_framebuffer_hash(chip8);
+    result->ram_hash = chip8_ram_hash(chip8);
+    memcpy(result->V, chip8->V, sizeof result->V);
+    result->I = chip8->I;
+    result->PC = chip8->PC;
+    result->SP = chip8->SP;
+    result->delay_timer = chip8->delay_timer;
+    result->sound_timer = chip8->sound_timer;
+}
+
+// the first part of the machine that differs, NULL if the results agree
+static const char *bench_difference(const bench_result_t *a, const bench_result_t *b){
+    if(a->framebuffer_hash != b->framebuffer_hash) return "framebuffer";
+    if(a->ram_hash != b->ram_hash) return "RAM";
+    if(memcmp(a->V, b->V, sizeof a->V) != 0) return "V";
+    if(a->I != b->I) return "I";
+    if(a->PC != b->PC) return "PC";
+    if(a->SP != b->SP) return "SP";
+    if(a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer) return "timers";
+    return NULL;
+}
+
+// best time over BENCH_RUNS for `cycles` instructions on a freshly loaded machine
+static bool time_engine(chip8_t *chip8, const char *path, const bench_rom_t *rom, uint64_t cycles, double *best, bench_result_t *result){
+    *best = 0;
+    for(int run = 0; run < BENCH_RUNS; run++){
+        if(path != NULL ? !init_chip8(chip8, (char *)path) : !chip8_load_rom(chip8, rom->rom, rom->size)){
+            return false;
+        }
+        chip8_schedule_t schedule = { .instr_rate = BENCH_RATE };
+        const double start = now_seconds();
+        chip8_run_schedule(chip8, &schedule, cycles);
+        const double elapsed = now_seconds() - start;
+        if(run == 0 || elapsed < *best) *best = elapsed;
+        bench_result(chip8, result);
+    }
+    return true;
+}
+
+static void bench_renderers(const chip8_t *chip8){
+    static uint32_t pixels[CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT];
+    const struct {
+        const char *name;
+        void (*render)(const chip8_t *, const uint32_t[4], void *, int);
+    } renderers[] = {
+        { "rgba", chip8_framebuffer_to_rgba },
+        { "rgba_scalar", chip8_framebuffer_to_rgba_scalar },
+    };
+    printf("\n%-12s %10s\n", "renderer", "ns/frame");
+    for(size_t r = 0; r < sizeof renderers / sizeof renderers[0]; r++){
+        double best = 0;
+        for(int run = 0; run < BENCH_RUNS; run++){
+            const double start = now_seconds();
+            for(int frame = 0; frame < RENDER_FRAMES; frame++){
+                const uint32_t palette[4] = { (uint32_t)frame, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF };
+                renderers[r].render(chip8, palette, pixels, CHIP8_HIRES_WIDTH * 4);
+                __asm__ volatile("" : : "r"(pixels) : "memory");
+            }
+            const double elapsed = now_seconds() - start;
+            if(run == 0 || elapsed < best) best = elapsed;
+        }
+        printf("%-12s %10.1f\n", renderers[r].name, best * 1e9 / RENDER_FRAMES);
+    }
+}
+
+int main(int argc, char **argv){
+    uint64_t cycles = 10000000;
+    bench_rom_t synthetic[8];
+    size_t synthetic_count = 0;
+    add_synthetic(synthetic, &synthetic_count, "alu", alu_rom, sizeof alu_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "draw", draw_rom, sizeof draw_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "memory", memory_rom, sizeof memory_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "call", call_rom, sizeof call_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "random", random_rom, sizeof random_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "keywait", keywait_rom, sizeof keywait_rom / 2);
+    add_synthetic(synthetic, &synthetic_count, "hires", hires_rom, sizeof hires_rom / 2);
+
+    int first_path = 1;
+    if(argc > 2 && strcmp(argv[1], "-c") == 0){
+        cycles = strtoull(argv[2], NULL, 10);
+        first_path = 3;
+    }
+    const size_t total = synthetic_count + (size_t)(argc - first_path);
+
+    const chip8_engine_t engines[] = { ENGINE_SWITCH, ENGINE_PREDECODE, ENGINE_JIT, ENGINE_AOT };
+    const char *const engine_names[] = { "switch", "predecode", "jit", "aot" };
+    const int engine_count = chip8_aot_program_count() > 0 ? 4 : 3;
+    const chip8_variant_t variants[] = { VARIANT_CHIP8, VARIANT_SCHIP, VARIANT_XOCHIP };
+    const char *const variant_names[] = { "chip8", "schip", "xochip" };
+    chip8_t *machines[4];
+    for(int e = 0; e < engine_count; e++){
+        machines[e] = chip8_create();
+        if(machines[e] == NULL || !chip8_set_engine(machines[e], engines[e])){
+            fprintf(stderr, "Could not set up the %s engine\n", engine_names[e]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%" PRIu64 " instructions per run at %d instructions/s, best of %d\n", cycles, BENCH_RATE, BENCH_RUNS);
+    printf("%-16s %-8s %-10s %12s %10s\n", "rom", "machine", "engine", "Minstr/s", "ns/instr");
+    for(size_t i = 0; i < total; i++){
+        const char *path = i < synthetic_count ? NULL : argv[first_path + (i - synthetic_count)];
+        const char *name = path != NULL ? (strrchr(path, '/') ? strrchr(path, '/') + 1 : path) : synthetic[i].name;
+        for(size_t v = 0; v < sizeof variants / sizeof variants[0]; v++){
+            bench_result_t results[4];
+            for(int e = 0; e < engine_count; e++){
+                chip8_set_variant(machines[e], variants[v]);
+                double elapsed;
+                if(!time_engine(machines[e], path, &synthetic[i < synthetic_count ? i : 0], cycles, &elapsed, &results[e])){
+                    return EXIT_FAILURE;
+                }
+                // engines must agree on the whole machine, or the numbers mean nothing
+                const char *differs = bench_difference(&results[e], &results[0]);
+                printf("%-16s %-8s %-10s %12.1f %10.2f", name, variant_names[v], engine_names[e], cycles / elapsed / 1e6,
+                       elapsed * 1e9 / cycles);
+                if(differs != NULL) printf("  (%s differs from switch)", differs);
+                printf("\n");
+            }
+        }
+    }
+
+    // the draw ROM leaves a busy framebuffer behind
+    chip8_set_variant(machines[0], VARIANT_CHIP8);
+    chip8_load_rom(machines[0], synthetic[1].rom, synthetic[1].size);
+    chip8_run_cycles(machines[0], 10000);
+    bench_renderers(machines[0]);
+
+    for(int e = 0; e < engine_count; e++) chip8_destroy(machines[e]);
+    return 0;
+}
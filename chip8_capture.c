@@ -0,0 +1,367 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_capture.h"
+
+// The queue is single producer, single consumer like the trace ring: head counts the frames the
+// emulation thread queued, tail the ones the encoder took, each written by one side only. The
+// producer takes the mutex once per frame to wake the encoder, which sleeps while the queue is
+// empty; a frame is a 2 KB copy of the display, everything else happens on the encoder thread.
+//
+// The encoder keeps the last frame pending until the next one arrives, since both formats need to
+// know how long a frame lasts before it is written.
+
+#define CAPTURE_QUEUE 64            // frames, a power of two
+#define GIF_MIN_DELAY 2             // 1/100 s, players slow shorter delays down
+
+typedef struct {
+    uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][CHIP8_ROW_WORDS];
+    bool hires;
+    uint64_t frame;
+} capture_frame_t;
+
+struct chip8_capture {
+    capture_frame_t *queue;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;          // a frame was queued, or stopping
+    pthread_cond_t drained;         // the encoder took a frame
+    bool stopping;                  // under lock
+    pthread_t encoder;
+    bool lossless;
+    uint64_t last_frame;            // producer side: frame number of the last frame queued
+    chip8_capture_stats_t stats;    // frames and dropped by the producer, written by the encoder
+
+    // encoder side
+    FILE *file;
+    bool gif;
+    bool failed;                    // a write failed, the rest is drained without writing
+    uint32_t width, height, fps;
+    uint32_t palette[4];
+    uint8_t *pending;               // color indices of the frame not written yet, width x height
+    uint64_t pending_frame;
+    bool has_pending;
+    uint8_t *planes;                // Y4M: the pending frame's Y, Cb and Cr planes
+    bool planes_valid;
+    uint8_t ycbcr[3][4];            // Y4M: each palette color, BT.601 limited range
+    uint64_t gif_time;              // GIF: 1/100 s the written frames last
+    uint16_t lzw[4096][4];          // GIF: the LZW string table as a trie, see gif_write
+};
+
+static void write_bytes(struct chip8_capture *capture, const void *data, size_t size){
+    if(!capture->failed && fwrite(data, 1, size, capture->file) != size){
+        perror("Could not write the capture");
+        capture->failed = true;
+    }
+}
+
+// scale the display of `frame` to fill width x height, nearest neighbour
+static void scale_frame(struct chip8_capture *capture, const capture_frame_t *frame, uint8_t *out){
+    const uint32_t mode_width = frame->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    const uint32_t mode_height = frame->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    for(uint32_t y = 0; y < capture->height; y++){
+        const uint32_t sy = (uint32_t)((uint64_t)y * mode_height / capture->height);
+        for(uint32_t x = 0; x < capture->width; x++){
+            const uint32_t sx = (uint32_t)((uint64_t)x * mode_width / capture->width);
+            const uint32_t shift = 63 - (sx & 63);
+            *out++ = ((frame->display[0][sy][sx >> 6] >> shift) & 1) | ((frame->display[1][sy][sx >> 6] >> shift) & 1) << 1;
+        }
+    }
+}
+
+// --- Y4M ---
+
+static void y4m_header(struct chip8_capture *capture){
+    char header[96];
+    const int len = snprintf(header, sizeof header, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", capture->width, capture->height, capture->fps);
+    write_bytes(capture, header, (size_t)len);
+    for(int c = 0; c < 4; c++){
+        const int r = capture->palette[c] >> 24, g = (capture->palette[c] >> 16) & 0xFF, b = (capture->palette[c] >> 8) & 0xFF;
+        capture->ycbcr[0][c] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        capture->ycbcr[1][c] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        capture->ycbcr[2][c] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+// the pending frame `count` times
+static void y4m_write(struct chip8_capture *capture, uint64_t count){
+    const size_t size = (size_t)capture->width * capture->height;
+    if(!capture->planes_valid){
+        for(int p = 0; p < 3; p++){
+            for(size_t i = 0; i < size; i++) capture->planes[p * size + i] = capture->ycbcr[p][capture->pending[i]];
+        }
+        capture->planes_valid = true;
+    }
+    for(uint64_t i = 0; i < count; i++){
+        write_bytes(capture, "FRAME\n", 6);
+        write_bytes(capture, capture->planes, 3 * size);
+    }
+    capture->stats.written += count;
+}
+
+// --- GIF ---
+
+// LZW codes packed from the least significant bit, in sub-blocks of up to 255 bytes
+typedef struct {
+    struct chip8_capture *capture;
+    uint8_t block[256];             // length byte and data
+    uint32_t bits;
+    int bit_count;
+} gif_writer_t;
+
+static void gif_flush_block(gif_writer_t *out){
+    if(out->block[0] == 0) return;
+    write_bytes(out->capture, out->block, out->block[0] + 1u);
+    out->block[0] = 0;
+}
+
+static void gif_put_code(gif_writer_t *out, uint32_t code, int size){
+    out->bits |= code << out->bit_count;
+    out->bit_count += size;
+    while(out->bit_count >= 8){
+        out->block[++out->block[0]] = (uint8_t)out->bits;
+        if(out->block[0] == 255) gif_flush_block(out);
+        out->bits >>= 8;
+        out->bit_count -= 8;
+    }
+}
+
+static void gif_put16(uint8_t *p, uint32_t value){
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void gif_header(struct chip8_capture *capture){
+    uint8_t header[13 + 12 + 19] = { 'G', 'I', 'F', '8', '9', 'a' };
+    gif_put16(header + 6, capture->width);
+    gif_put16(header + 8, capture->height);
+    header[10] = 0x80 | 0x10 | 0x01;    // global color table of 4 colors, 2 bits of color resolution
+    for(int c = 0; c < 4; c++){
+        header[13 + 3 * c] = capture->palette[c] >> 24;
+        header[14 + 3 * c] = (capture->palette[c] >> 16) & 0xFF;
+        header[15 + 3 * c] = (capture->palette[c] >> 8) & 0xFF;
+    }
+    // NETSCAPE2.0 application extension: loop forever
+    static const uint8_t loop[19] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 };
+    memcpy(header + 25, loop, sizeof loop);
+    write_bytes(capture, header, sizeof header);
+}
+
+// the pending frame, shown for `delay` 1/100 s
+static void gif_write(struct chip8_capture *capture, uint32_t delay){
+    uint8_t head[8 + 10 + 1] = { 0x21, 0xF9, 0x04, 0x04 };     // graphic control: keep the frame, no transparency
+    gif_put16(head + 4, delay > 0xFFFF ? 0xFFFF : delay);
+    head[8] = 0x2C;                                             // image descriptor, the whole screen
+    gif_put16(head + 13, capture->width);
+    gif_put16(head + 15, capture->height);
+    head[18] = 2;                                               // LZW minimum code size for 4 colors
+    write_bytes(capture, head, sizeof head);
+
+    // the string table as a trie: child[code][color] is the code of that string plus the color, 0 if none
+    enum { CLEAR = 4, END = 5, FIRST = 6, MAX_CODES = 4096 };
+    uint16_t (*child)[4] = capture->lzw;
+    gif_writer_t out = { .capture = capture };
+    memset(child, 0, sizeof capture->lzw);
+    uint32_t next = FIRST;
+    int size = 3;
+    gif_put_code(&out, CLEAR, size);
+    const size_t count = (size_t)capture->width * capture->height;
+    uint32_t code = capture->pending[0];
+    for(size_t i = 1; i < count; i++){
+        const uint8_t color = capture->pending[i];
+        if(child[code][color] != 0){
+            code = child[code][color];
+            continue;
+        }
+        gif_put_code(&out, code, size);
+        if(next < MAX_CODES){
+            if(next == (1u << size)) size++;
+            child[code][color] = (uint16_t)next++;
+        } else {
+            // the table is full, start over
+            gif_put_code(&out, CLEAR, size);
+            memset(child, 0, sizeof capture->lzw);
+            next = FIRST;
+            size = 3;
+        }
+        code = color;
+    }
+    gif_put_code(&out, code, size);
+    gif_put_code(&out, END, size);
+    if(out.bit_count > 0) gif_put_code(&out, 0, 8 - out.bit_count);
+    gif_flush_block(&out);
+    write_bytes(capture, "", 1);                                // block terminator
+    capture->stats.written++;
+}
+
+// write the pending frame if it lasts until frame number `until`; false if a GIF frame would be
+// too short and gives way to the next one instead
+static bool write_pending(struct chip8_capture *capture, uint64_t until, bool last){
+    if(!capture->gif){
+        const uint64_t count = until - capture->pending_frame;
+        y4m_write(capture, count > 0 || !last ? count : 1);
+        return true;
+    }
+    const uint64_t end = until * 100 / capture->fps;
+    if(end < capture->gif_time + GIF_MIN_DELAY && !last) return false;
+    const uint64_t delay = end > capture->gif_time + GIF_MIN_DELAY ? end - capture->gif_time : GIF_MIN_DELAY;
+    gif_write(capture, (uint32_t)(delay > 0xFFFF ? 0xFFFF : delay));
+    capture->gif_time += delay;
+    return true;
+}
+
+static void encode(struct chip8_capture *capture, const capture_frame_t *frame){
+    if(capture->has_pending) write_pending(capture, frame->frame, false);
+    else if(capture->gif) capture->gif_time = frame->frame * 100 / capture->fps;
+    scale_frame(capture, frame, capture->pending);
+    capture->pending_frame = frame->frame;
+    capture->has_pending = true;
+    capture->planes_valid = false;
+}
+
+// encode everything queued so far
+static void drain(struct chip8_capture *capture){
+    size_t tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&capture->head, memory_order_acquire);
+    for(; tail != head; tail++){
+        encode(capture, &capture->queue[tail & (CAPTURE_QUEUE - 1)]);
+        atomic_store_explicit(&capture->tail, tail + 1, memory_order_release);
+        if(capture->lossless){
+            pthread_mutex_lock(&capture->lock);
+            pthread_cond_signal(&capture->drained);
+            pthread_mutex_unlock(&capture->lock);
+        }
+    }
+}
+
+static void *encoder_main(void *arg){
+    struct chip8_capture *capture = arg;
+    pthread_mutex_lock(&capture->lock);
+    while(!capture->stopping){
+        if(atomic_load_explicit(&capture->head, memory_order_acquire) == atomic_load_explicit(&capture->tail, memory_order_relaxed)){
+            pthread_cond_wait(&capture->filled, &capture->lock);
+        }
+        pthread_mutex_unlock(&capture->lock);
+        drain(capture);
+        pthread_mutex_lock(&capture->lock);
+    }
+    pthread_mutex_unlock(&capture->lock);
+    drain(capture);
+    return NULL;
+}
+
+chip8_capture_t *chip8_capture_start(const char *path, uint32_t width, uint32_t height, uint32_t fps,
+                                     const uint32_t palette[4], bool lossless){
+    const size_t len = strlen(path);
+    const bool gif = len >= 4 && strcmp(path + len - 4, ".gif") == 0;
+    if(width == 0 || height == 0 || fps == 0 || (gif && (width > 0xFFFF || height > 0xFFFF))){
+        fprintf(stderr, "Cannot capture %ux%u frames at %u frames per second\n", width, height, fps);
+        return NULL;
+    }
+    struct chip8_capture *capture = calloc(1, sizeof *capture);
+    capture_frame_t *queue = calloc(CAPTURE_QUEUE, sizeof *queue);
+    uint8_t *pending = malloc((size_t)width * height);
+    uint8_t *planes = gif ? NULL : malloc(3 * (size_t)width * height);
+    if(capture == NULL || queue == NULL || pending == NULL || (!gif && planes == NULL)){
+        perror("Could not allocate the capture buffers");
+        free(capture);
+        free(queue);
+        free(pending);
+        free(planes);
+        return NULL;
+    }
+    capture->file = fopen(path, "wb");
+    if(capture->file == NULL){
+        perror("Could not create the capture file");
+        free(capture);
+        free(queue);
+        free(pending);
+        free(planes);
+        return NULL;
+    }
+    capture->queue = queue;
+    capture->pending = pending;
+    capture->planes = planes;
+    capture->gif = gif;
+    capture->lossless = lossless;
+    capture->width = width;
+    capture->height = height;
+    capture->fps = fps;
+    memcpy(capture->palette, palette, sizeof capture->palette);
+    if(gif) gif_header(capture); else y4m_header(capture);
+    atomic_init(&capture->head, 0);
+    atomic_init(&capture->tail, 0);
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->filled, NULL);
+    pthread_cond_init(&capture->drained, NULL);
+    if(pthread_create(&capture->encoder, NULL, encoder_main, capture) != 0){
+        fprintf(stderr, "Could not start the capture encoder thread\n");
+        pthread_cond_destroy(&capture->drained);
+        pthread_cond_destroy(&capture->filled);
+        pthread_mutex_destroy(&capture->lock);
+        fclose(capture->file);
+        free(capture);
+        free(queue);
+        free(pending);
+        free(planes);
+        return NULL;
+    }
+    return capture;
+}
+
+bool chip8_capture_frame(chip8_capture_t *capture, const chip8_t *chip8, uint64_t frame){
+    const size_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&capture->tail, memory_order_acquire) == CAPTURE_QUEUE){
+        if(!capture->lossless){
+            capture->stats.dropped++;
+            return false;
+        }
+        pthread_mutex_lock(&capture->lock);
+        while(head - atomic_load_explicit(&capture->tail, memory_order_acquire) == CAPTURE_QUEUE){
+            pthread_cond_wait(&capture->drained, &capture->lock);
+        }
+        pthread_mutex_unlock(&capture->lock);
+    }
+    if(capture->stats.frames > 0 && frame <= capture->last_frame) frame = capture->last_frame + 1;
+    capture->last_frame = frame;
+    capture_frame_t *slot = &capture->queue[head & (CAPTURE_QUEUE - 1)];
+    memcpy(slot->display, chip8->display, sizeof slot->display);
+    slot->hires = chip8->hires;
+    slot->frame = frame;
+    capture->stats.frames++;
+    atomic_store_explicit(&capture->head, head + 1, memory_order_release);
+    pthread_mutex_lock(&capture->lock);
+    pthread_cond_signal(&capture->filled);
+    pthread_mutex_unlock(&capture->lock);
+    return true;
+}
+
+bool chip8_capture_stop(chip8_capture_t *capture, uint64_t end, chip8_capture_stats_t *stats){
+    pthread_mutex_lock(&capture->lock);
+    capture->stopping = true;
+    pthread_cond_signal(&capture->filled);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->encoder, NULL);
+    if(capture->has_pending){
+        write_pending(capture, end > capture->pending_frame ? end : capture->pending_frame, true);
+    }
+    if(capture->gif) write_bytes(capture, ";", 1);              // trailer
+    bool ok = !capture->failed;
+    if(fclose(capture->file) != 0 && ok){
+        perror("Could not write the capture");
+        ok = false;
+    }
+    if(stats != NULL) *stats = capture->stats;
+    pthread_cond_destroy(&capture->drained);
+    pthread_cond_destroy(&capture->filled);
+    pthread_mutex_destroy(&capture->lock);
+    free(capture->queue);
+    free(capture->pending);
+    free(capture->planes);
+    free(capture);
+    return ok;
+}
@@ -0,0 +1,36 @@
+#ifndef CHIP8_CAPTURE_H
+#define CHIP8_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Frame capture to a YUV4MPEG2 video (.y4m, 4:4:4) or an animated GIF (.gif): the emulation thread
+// hands each changed frame, the raw display planes and the frame number it appears at, to an
+// encoder thread through a bounded queue. The encoder scales the frame, converts it and writes it
+// out; unchanged frames in between are repeated (Y4M) or become the previous frame's delay (GIF).
+// GIF delays are in 1/100 s, frames shown for less than 2/100 s give way to the next one.
+
+typedef struct {
+    uint64_t frames;                // handed over
+    uint64_t dropped;               // not handed over, the queue was full
+    uint64_t written;               // frames in the file
+} chip8_capture_stats_t;
+
+typedef struct chip8_capture chip8_capture_t;
+
+// start capturing to `path`, GIF if it ends in .gif and Y4M otherwise, at width x height (every mode
+// is scaled to fill it) and `fps` frame numbers per second, palette[chip8_pixel(x, y)] as 0xRRGGBBAA.
+// With `lossless` a full queue makes chip8_capture_frame wait instead of dropping the frame.
+// NULL (with a message) on failure
+chip8_capture_t *chip8_capture_start(const char *path, uint32_t width, uint32_t height, uint32_t fps,
+                                     const uint32_t palette[4], bool lossless);
+// queue the display of `chip8`, shown from frame number `frame` on (earlier or equal numbers than
+// the last frame's count as the next one); false if it was dropped
+bool chip8_capture_frame(chip8_capture_t *capture, const chip8_t *chip8, uint64_t frame);
+// write out the queued frames, the last one lasting until frame number `end`, and close the file;
+// false if writing failed. `stats` may be NULL
+bool chip8_capture_stop(chip8_capture_t *capture, uint64_t end, chip8_capture_stats_t *stats);
+
+#endif
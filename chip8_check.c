@@ -0,0 +1,202 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_core.h"
+
+// Differential check of the engines: random ROMs, whose stores often land on their own code, run on
+// every engine under a scheduled clock with scripted key presses, and every engine must leave
+// exactly the same machine (RAM, display, registers, stack, timers, instruction count, ...) as the
+// switch interpreter. ROM k runs as machine k % 3 with quirk profile k / 3 % 6, every other one
+// at a clock fast enough for long uninterrupted runs. Usage: chip8_check [-n roms] [-c cycles]
+// [-s first seed], `make check` runs the defaults. Exits with 0 if all engines agree, 1 if one
+// differs (the seed and machine are printed, -s seed -n 1 repeats it) and 2 on errors.
+
+#define CHECK_INSTRUCTIONS 200      // random instructions per ROM, the rest jumps to itself
+#define CHECK_ROM_SIZE 0xE00
+#define CHECK_KEY_EVENTS 16
+
+static const char *const engine_names[] = { "switch", "predecode", "jit", "aot" };
+static const char *const variant_names[] = { "chip8", "schip", "xochip" };
+static const char *const quirks_names[] = { "auto", "modern", "vip", "chip48", "schip", "xochip" };
+
+static uint64_t next_random(uint64_t *state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint32_t pick(uint64_t *state, uint32_t n){
+    return (uint32_t)(next_random(state) % n);
+}
+
+#define PICK(state, list) ((list)[pick(state, sizeof (list) / sizeof (list)[0])])
+
+// every opcode of every variant, jumps and calls into the ROM, I anywhere in the program and the
+// data after it, idle loops (delay timer polls, jumps to self, key waits) the engines skip and
+// FX33/FX55 patching the program itself or, on XO-CHIP, wrapping from the end of RAM to address 0
+static size_t generate_rom(uint64_t seed, uint8_t *rom){
+    const bool xochip = seed % 3 == VARIANT_XOCHIP;
+    static const uint16_t ops[] = { 0, 0, 1, 2, 3, 4, 5, 5, 6, 7, 8, 8, 8, 9, 0xA, 0xB, 0xC, 0xD, 0xD, 0xF, 0xF, 0xF, 0x10, 0x11, 0x11, 0x12 };
+    static const uint16_t system[] = { 0x00E0, 0x0123, 0x00C3, 0x00D2, 0x00FB, 0x00FC, 0x00FE, 0x00FF, 0x00FF,
+                                       0x04FD, 0x03FF, 0x01FB, 0x02FE };
+    static const uint8_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    static const uint8_t sprite_rows[] = { 0x0, 0x0, 0x1, 0x5, 0xF };
+    static const uint8_t misc[] = { 0x07, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65, 0x30, 0x75, 0x85, 0x3A, 0x01, 0x02 };
+    static const uint8_t pairs[] = { 0x0, 0x2, 0x3 };
+    uint16_t words[CHECK_ROM_SIZE / 2];
+    size_t count = 0;
+    while(count < CHECK_INSTRUCTIONS){
+        const uint16_t op = PICK(&seed, ops);
+        const uint16_t at = 0x200 + 2 * count;
+        const uint16_t x = pick(&seed, 16) << 8;
+        uint16_t word;
+        switch(op){
+            case 0x0: word = PICK(&seed, system); break;
+            case 0x1: case 0x2: word = op << 12 | (0x200 + 2 * pick(&seed, CHECK_INSTRUCTIONS)); break;
+            case 0x5: word = 0x5000 | pick(&seed, 0x100) << 4 | PICK(&seed, pairs); break;
+            case 0x8: word = 0x8000 | (pick(&seed, 0x1000) & 0xFF0) | PICK(&seed, alu); break;
+            case 0xA: word = 0xA000 | (0x200 + pick(&seed, 0xD00)); break;
+            case 0xB: word = 0xB200 | 2 * pick(&seed, 0x40); break;
+            case 0xD: word = 0xD000 | pick(&seed, 0x100) << 4 | PICK(&seed, sprite_rows); break;
+            case 0xF: word = 0xF000 | x | PICK(&seed, misc); break;
+            case 0x10:
+                // idle loops, a few instructions each
+                if(count + 5 > CHECK_INSTRUCTIONS) continue;
+                switch(pick(&seed, 3)){
+                    case 0:
+                        words[count++] = 0x6000 | x | (1 + pick(&seed, 20));
+                        words[count++] = 0xF015 | x;
+                        words[count++] = 0xF007 | x;
+                        words[count++] = 0x3000 | x;
+                        words[count++] = 0x1000 | (at + 4);
+                        continue;
+                    case 1: word = 0x1000 | at; break;
+                    default: word = 0xF00A | x; break;
+                }
+                break;
+            case 0x11:
+                // I somewhere in the program, then overwrite a few bytes of it
+                if(count + 2 > CHECK_INSTRUCTIONS) continue;
+                words[count++] = 0xA000 | (0x200 + pick(&seed, 2 * CHECK_INSTRUCTIONS));
+                word = 0xF000 | (x & 0x300) | (pick(&seed, 2) ? 0x55 : 0x33);
+                break;
+            case 0x12:
+                // XO-CHIP: a store from I = FFFE wrapping into address 0 puts a routine there (6XNN,
+                // 00EE), which is called, rewritten the same way with another NN and called again
+                if(!xochip || count + 13 > CHECK_INSTRUCTIONS) continue;
+                words[count++] = 0x6260 | pick(&seed, 16);
+                words[count++] = 0x6300 | pick(&seed, 0x100);
+                words[count++] = 0x6400;
+                words[count++] = 0x65EE;
+                for(int pass = 0; pass < 2; pass++){
+                    if(pass == 1) words[count++] = 0x6300 | pick(&seed, 0x100);
+                    words[count++] = 0xF000;
+                    words[count++] = 0xFFFE;
+                    words[count++] = 0xF555;
+                    if(pass == 0) words[count++] = 0x2000;
+                }
+                word = 0x2000;
+                break;
+            default: word = op << 12 | pick(&seed, 0x1000); break;
+        }
+        words[count++] = word;
+    }
+    // anything running off the program lands on a jump to itself
+    while(count < CHECK_ROM_SIZE / 2) words[count++] = 0x1212;
+    for(size_t i = 0; i < count; i++){
+        rom[2 * i] = words[i] >> 8;
+        rom[2 * i + 1] = words[i] & 0xFF;
+    }
+    return 2 * count;
+}
+
+// key presses and releases spread over the run, sorted by cycle
+static void generate_keys(uint64_t seed, uint64_t cycles, chip8_key_event_t *events){
+    for(int i = 0; i < CHECK_KEY_EVENTS; i++){
+        events[i] = (chip8_key_event_t){
+            .cycle = cycles * i / CHECK_KEY_EVENTS + pick(&seed, 64),
+            .key = pick(&seed, 16),
+            .pressed = i % 2 == 0,
+        };
+    }
+}
+
+static bool run_rom(chip8_t *chip8, const uint8_t *rom, size_t size, uint32_t rate, const chip8_key_event_t *events,
+                    uint64_t cycles, chip8_snapshot_t *result){
+    if(!chip8_load_rom(chip8, rom, size)) return false;
+    chip8_schedule_t schedule = { .instr_rate = rate };
+    chip8_run_script(chip8, &schedule, events, CHECK_KEY_EVENTS, cycles);
+    chip8_snapshot(chip8, result);
+    return true;
+}
+
+int main(int argc, char **argv){
+    uint64_t roms = 1000, cycles = 20000, first = 0;
+    for(int i = 1; i + 1 < argc; i += 2){
+        if(strcmp(argv[i], "-n") == 0) roms = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-c") == 0) cycles = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-s") == 0) first = strtoull(argv[i + 1], NULL, 10);
+        else {
+            fprintf(stderr, "Usage: %s [-n roms] [-c cycles] [-s first seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const chip8_engine_t engines[] = { ENGINE_SWITCH, ENGINE_PREDECODE, ENGINE_JIT, ENGINE_AOT };
+    const int engine_count = chip8_aot_program_count() > 0 ? 4 : 3;
+    chip8_t *machines[4] = { NULL };
+    for(int e = 0; e < engine_count; e++){
+        machines[e] = chip8_create();
+        if(machines[e] == NULL) return 2;
+        // engines this host has no support for are left out
+        if(!chip8_set_engine(machines[e], engines[e])){
+            if(e == 0) return 2;
+            fprintf(stderr, "Skipping the %s engine\n", engine_names[e]);
+            chip8_destroy(machines[e]);
+            machines[e] = NULL;
+        }
+    }
+
+    static uint8_t rom[CHECK_ROM_SIZE];
+    static chip8_snapshot_t reference, result;
+    chip8_key_event_t events[CHECK_KEY_EVENTS];
+    uint16_t ref_pc = 0, ref_i = 0;
+    uint64_t ref_cycles = 0, mismatches = 0, stopped = 0;
+    for(uint64_t seed = first; seed < first + roms; seed++){
+        const chip8_variant_t variant = seed % 3;
+        const chip8_quirks_t quirks = seed / 3 % 6;
+        const uint32_t rate = seed % 2 == 0 ? 700 : 1000000;
+        const size_t size = generate_rom(seed, rom);
+        generate_keys(seed ^ 0x5EED, cycles, events);
+        for(int e = 0; e < engine_count; e++){
+            chip8_t *chip8 = machines[e];
+            if(chip8 == NULL) continue;
+            chip8_set_variant(chip8, variant);
+            chip8_set_quirks(chip8, quirks);
+            chip8_seed(chip8, seed);
+            if(!run_rom(chip8, rom, size, rate, events, cycles, e == 0 ? &reference : &result)) return 2;
+            if(e == 0){
+                ref_pc = chip8->PC;
+                ref_i = chip8->I;
+                ref_cycles = chip8->cycles;
+                if(chip8->state != RUNNING) stopped++;
+                continue;
+            }
+            if(memcmp(&result, &reference, sizeof result) == 0) continue;
+            mismatches++;
+            printf("seed %" PRIu64 " (%s, quirks %s, %" PRIu32 " instructions/s): %s differs from switch, "
+                   "PC %04X/%04X I %04X/%04X cycles %" PRIu64 "/%" PRIu64 "\n", seed, variant_names[variant],
+                   quirks_names[quirks], rate, engine_names[engines[e]], chip8->PC, ref_pc, chip8->I, ref_i,
+                   chip8->cycles, ref_cycles);
+        }
+    }
+    printf("%" PRIu64 " ROMs, up to %" PRIu64 " instructions each (%" PRIu64 " stopped early on a fault or 00FD): %s\n",
+           roms, cycles, stopped, mismatches == 0 ? "all engines agree" : "engines differ");
+
+    for(int e = 0; e < engine_count; e++) if(machines[e] != NULL) chip8_destroy(machines[e]);
+    return mismatches == 0 ? 0 : 1;
+}
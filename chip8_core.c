@@ -0,0 +1,951 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_core.h"
+#include "chip8_debug.h"
+#include "chip8_internal.h"
+#include "chip8_library.h"
+#include "chip8_profile.h"
+#include "chip8_trace.h"
+
+chip8_t *chip8_create(void){
+    return calloc(1, sizeof(chip8_t));
+}
+
+void chip8_destroy(chip8_t *chip8){
+    if(chip8 == NULL) return;
+    predecode_free(chip8);
+    jit_free(chip8);
+    aot_free(chip8);
+    chip8_profile_disable(chip8);
+    chip8_debug_disable(chip8);
+    chip8_trace_stop(chip8);
+    free(chip8);
+}
+
+bool chip8_set_engine(chip8_t *chip8, chip8_engine_t engine){
+    switch(engine){
+        case ENGINE_SWITCH: break;
+        case ENGINE_PREDECODE:
+            if(!predecode_init(chip8)) return false;
+            break;
+        case ENGINE_JIT:
+            if(!jit_init(chip8)) return false;
+            break;
+        case ENGINE_AOT:
+            if(!aot_init(chip8)) return false;
+            break;
+        default: return false;
+    }
+    chip8->engine = engine;
+    return true;
+}
+
+void chip8_set_variant(chip8_t *chip8, chip8_variant_t variant){
+    chip8->variant = variant;
+    // the engines decode differently per variant
+    chip8_invalidate_code(chip8, 0, sizeof chip8->RAM);
+}
+
+bool chip8_variant_from_name(const char *name, chip8_variant_t *variant){
+    if(strcmp(name, "chip8") == 0) {
+        *variant = VARIANT_CHIP8;
+    } else if(strcmp(name, "schip") == 0) {
+        *variant = VARIANT_SCHIP;
+    } else if(strcmp(name, "xochip") == 0) {
+        *variant = VARIANT_XOCHIP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void chip8_set_quirks(chip8_t *chip8, chip8_quirks_t quirks){
+    chip8->quirks = quirks;
+    // predecoded handlers and translated code bake the quirks in
+    chip8_invalidate_code(chip8, 0, sizeof chip8->RAM);
+}
+
+bool chip8_quirks_from_name(const char *name, chip8_quirks_t *quirks){
+    if(strcmp(name, "auto") == 0) {
+        *quirks = QUIRKS_AUTO;
+    } else if(strcmp(name, "modern") == 0) {
+        *quirks = QUIRKS_MODERN;
+    } else if(strcmp(name, "vip") == 0) {
+        *quirks = QUIRKS_VIP;
+    } else if(strcmp(name, "chip48") == 0) {
+        *quirks = QUIRKS_CHIP48;
+    } else if(strcmp(name, "schip") == 0) {
+        *quirks = QUIRKS_SCHIP;
+    } else if(strcmp(name, "xochip") == 0) {
+        *quirks = QUIRKS_XOCHIP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+chip8_quirks_t chip8_quirks(const chip8_t *chip8){
+    if(chip8->quirks != QUIRKS_AUTO) return chip8->quirks;
+    switch(chip8->variant){
+        case VARIANT_SCHIP: return QUIRKS_SCHIP;
+        case VARIANT_XOCHIP: return QUIRKS_XOCHIP;
+        default: return QUIRKS_MODERN;
+    }
+}
+
+static const chip8_quirk_set_t quirk_sets[] = {
+    [QUIRKS_MODERN] = { .index = INDEX_KEEP },
+    [QUIRKS_VIP] = { .shift_vy = true, .index = INDEX_ADD_X1, .vf_reset = true, .display_wait = true },
+    [QUIRKS_CHIP48] = { .index = INDEX_ADD_X, .jump_vx = true },
+    [QUIRKS_SCHIP] = { .index = INDEX_KEEP, .jump_vx = true },
+    [QUIRKS_XOCHIP] = { .shift_vy = true, .index = INDEX_ADD_X1, .wrap = true },
+};
+
+const chip8_quirk_set_t *chip8_quirk_set(const chip8_t *chip8){
+    return &quirk_sets[chip8_quirks(chip8)];
+}
+
+size_t chip8_ram_size(const chip8_t *chip8){
+    return chip8->variant == VARIANT_XOCHIP ? CHIP8_RAM_SIZE : 4096;
+}
+
+bool chip8_engine_from_name(const char *name, chip8_engine_t *engine){
+    if(strcmp(name, "switch") == 0) {
+        *engine = ENGINE_SWITCH;
+    } else if(strcmp(name, "predecode") == 0) {
+        *engine = ENGINE_PREDECODE;
+    } else if(strcmp(name, "jit") == 0) {
+        *engine = ENGINE_JIT;
+    } else if(strcmp(name, "aot") == 0) {
+        *engine = ENGINE_AOT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void chip8_invalidate_code(chip8_t *chip8, uint16_t addr, uint32_t len){
+    // stores wrap at the end of RAM, the part past it lands at 0; the engines take plain ranges
+    if((uint32_t)addr + len > sizeof chip8->RAM){
+        const uint32_t head = sizeof chip8->RAM - addr;
+        chip8_invalidate_code(chip8, addr, head);
+        chip8_invalidate_code(chip8, 0, len - head);
+        return;
+    }
+    if(chip8->decoded != NULL) predecode_invalidate(chip8, addr, len);
+    if(chip8->jit != NULL) jit_invalidate(chip8, addr, len);
+    if(chip8->aot != NULL) aot_invalidate(chip8, addr, len);
+}
+
+#define BIG_FONT_ADDR 0x50        // right after the 5 byte font
+
+static void reset_chip8(chip8_t *chip8){
+    const uint8_t font[] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
+        0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
+        0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
+        0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
+        0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
+    };
+    // SUPER-CHIP 8x10 digits for FX30, XO-CHIP adds A-F
+    const uint8_t big_font[] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,   // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,   // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,   // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,   // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,   // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,   // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,   // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,   // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,   // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,   // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,   // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,   // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,   // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,   // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,   // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0,   // F
+    };
+    // only the emulated machine is cleared, the selected engine and its caches are kept
+    memset(chip8, 0, CHIP8_MACHINE_SIZE);
+    memcpy(&(chip8->RAM[0]), font, sizeof(font));
+    if(chip8->variant != VARIANT_CHIP8){
+        memcpy(&(chip8->RAM[BIG_FONT_ADDR]), big_font, sizeof(big_font));
+    }
+    chip8->planes = 1;
+    chip8->state = RUNNING;
+    chip8->display_dirty = true;
+    chip8->PC = 0x200;
+    chip8->SP = 0;
+    chip8->wait_key = 0xFF;
+    chip8->pitch = 64;              // 4000 Hz pattern playback
+    chip8->rng = chip8->seed;
+}
+
+void chip8_seed(chip8_t *chip8, uint64_t seed){
+    chip8->seed = seed;
+    chip8->rng = seed;
+}
+
+bool init_chip8(chip8_t *chip8, char rom_path[]){
+    reset_chip8(chip8);
+
+    // mapped read-only, the one copy is the load into RAM itself
+    chip8_rom_t rom;
+    if(!chip8_rom_map(rom_path, &rom)){
+        return false;
+    }
+    const size_t max_size = chip8_ram_size(chip8) - 0x200;
+    if(rom.size > max_size) {
+        fprintf(stderr, "ROM file %s is too big; ROM size: %zu; Max size allowed %zu\n", rom_path, rom.size, max_size);
+        chip8_rom_unmap(&rom);
+        return false;
+    }
+    if(rom.size > 0) memcpy(&(chip8->RAM[0x200]), rom.data, rom.size);
+    chip8_rom_unmap(&rom);
+    chip8->rom_path = rom_path;
+    chip8_invalidate_code(chip8, 0, sizeof chip8->RAM);
+    return true;
+}
+
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, size_t rom_size){
+    const size_t max_size = chip8_ram_size(chip8) - 0x200;
+    if(rom_size > max_size) {
+        fprintf(stderr, "ROM is too big; ROM size: %zu; Max size allowed %zu\n", rom_size, max_size);
+        return false;
+    }
+    reset_chip8(chip8);
+    memcpy(&(chip8->RAM[0x200]), rom, rom_size);
+    chip8_invalidate_code(chip8, 0, sizeof chip8->RAM);
+    return true;
+}
+
+const char *chip8_fault_name(chip8_fault_t fault){
+    static const char *const names[] = {
+        [FAULT_NONE] = "no fault",
+        [FAULT_STACK_OVERFLOW] = "stack overflow",
+        [FAULT_STACK_UNDERFLOW] = "stack underflow",
+        [FAULT_MEMORY] = "memory access past the end of RAM",
+    };
+    return (size_t)fault < sizeof names / sizeof names[0] ? names[fault] : "unknown fault";
+}
+
+void chip8_fault(chip8_t *chip8, chip8_fault_t fault){
+    chip8->PC -= 2;
+    if(chip8->debug != NULL){
+        debug_fault(chip8, chip8_fault_name(fault), chip8->PC);
+        return;
+    }
+    chip8->fault = fault;
+    chip8->state = QUIT;
+}
+
+// The general DXYN: hires rows are two words, DXY0 draws a 16x16 sprite (SUPER-CHIP and up) and on XO-CHIP every
+// selected plane gets its own sprite, one after the other in memory. Each sprite row is placed into the two words of a
+// 128 pixel row with shifts, then collides and XORs a word at a time. When wrapping, the part past the right edge is
+// placed a second time one display width further left, where the shifts drop everything but that part.
+static void place_row(uint64_t sprite, int shift, bool hires, uint64_t *left, uint64_t *right){
+    if(shift >= 64){
+        *left = sprite << (shift - 64);
+        *right = 0;
+    } else if(shift > 0){
+        *left = sprite >> (64 - shift);
+        *right = sprite << shift;
+    } else {
+        *left = 0;
+        *right = sprite >> -shift;
+    }
+    if(!hires) *right = 0;              // past the right edge of a 64 pixel row
+}
+
+static void draw_sprite_extended(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N, bool wrap){
+    const uint32_t width = chip8_display_width(chip8), height = chip8_display_height(chip8);
+    const bool big = N == 0 && chip8->variant != VARIANT_CHIP8;
+    const uint32_t sprite_width = big ? 16 : 8;
+    const uint32_t rows = big ? 16 : N;
+    const uint32_t x = chip8->V[X] % width;
+    const uint32_t y0 = chip8->V[Y] % height;
+    // columns are counted from bit 127 of the row; shift < 0 means the right part is clipped
+    const int shift = 128 - (int)sprite_width - (int)x;
+    uint16_t addr = chip8->I;
+    bool collision = false;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++){
+        if(!(chip8->planes & (1 << plane))) continue;
+        for(uint32_t i = 0; i < rows; i++, addr += sprite_width / 8){
+            const uint32_t y = wrap ? (y0 + i) % height : y0 + i;
+            if(y >= height) continue;
+            const uint64_t sprite = big ? (uint64_t)chip8->RAM[addr] << 8 | chip8->RAM[(addr + 1) & 0xFFFF] : chip8->RAM[addr];
+            uint64_t left, right;
+            place_row(sprite, shift, chip8->hires, &left, &right);
+            if(wrap && x + sprite_width > width){
+                uint64_t wrapped_left, wrapped_right;
+                place_row(sprite, shift + (int)width, chip8->hires, &wrapped_left, &wrapped_right);
+                left |= wrapped_left;
+                right |= wrapped_right;
+            }
+            uint64_t *row = chip8->display[plane][y];
+            collision |= (row[0] & left) | (row[1] & right);
+            row[0] ^= left;
+            row[1] ^= right;
+        }
+    }
+    chip8->V[0x0F] = collision;
+    chip8->display_dirty = true;
+}
+
+void chip8_clear_display(chip8_t *chip8){
+    for(int plane = 0; plane < CHIP8_PLANES; plane++){
+        if(chip8->planes & (1 << plane)) memset(chip8->display[plane], 0, sizeof chip8->display[plane]);
+    }
+    chip8->display_dirty = true;
+}
+
+// 00CN / 00DN: move the rows of the selected planes down / up by n, whole rows at a time
+static void scroll_vertical(chip8_t *chip8, int n){
+    const int height = (int)chip8_display_height(chip8);
+    const int count = abs(n) < height ? height - abs(n) : 0;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++){
+        if(!(chip8->planes & (1 << plane))) continue;
+        uint64_t (*rows)[CHIP8_ROW_WORDS] = chip8->display[plane];
+        if(n > 0){
+            memmove(rows[n], rows[0], count * sizeof rows[0]);
+            memset(rows[0], 0, (height - count) * sizeof rows[0]);
+        } else {
+            memmove(rows[0], rows[-n], count * sizeof rows[0]);
+            memset(rows[count], 0, (height - count) * sizeof rows[0]);
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+// 00FB / 00FC: move every row of the selected planes right / left by 4 pixels, a word shift per row
+static void scroll_horizontal(chip8_t *chip8, bool right){
+    const int height = (int)chip8_display_height(chip8);
+    for(int plane = 0; plane < CHIP8_PLANES; plane++){
+        if(!(chip8->planes & (1 << plane))) continue;
+        for(int y = 0; y < height; y++){
+            uint64_t *row = chip8->display[plane][y];
+            if(!chip8->hires){
+                row[0] = right ? row[0] >> 4 : row[0] << 4;
+            } else if(right){
+                row[1] = (row[1] >> 4) | (row[0] << 60);
+                row[0] >>= 4;
+            } else {
+                row[0] = (row[0] << 4) | (row[1] >> 60);
+                row[1] <<= 4;
+            }
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+// Opcode is DXYN: reads N bytes from memory, starting at position I and XORs them with the display bits starting at coordinate
+// X, Y. If any pixel is erase/ set off, VF is set to 1, otherwise, it is set to 0. The starting coordinate wraps around the
+// display, the part of the sprite past the right or bottom edge is clipped (or wraps around too, with the wrap quirk).
+// Each display row is one 64 bit word with x=0 in the most significant bit, so a sprite row is a shift (a rotate when
+// wrapping), an AND for the collision and an XOR.
+static inline void draw_sprite(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N, const bool wrap){
+    if(chip8->hires || chip8->planes != 1 || (N == 0 && chip8->variant != VARIANT_CHIP8)){
+        draw_sprite_extended(chip8, X, Y, N, wrap);
+        return;
+    }
+    const uint8_t X_coord = chip8->V[X] % CHIP8_DISPLAY_WIDTH;
+    uint8_t Y_coord = chip8->V[Y] % CHIP8_DISPLAY_HEIGHT;
+    chip8->V[0x0F] = 0;
+    for (uint8_t i =0; i< N && (wrap || Y_coord < CHIP8_DISPLAY_HEIGHT); i++, Y_coord++) {
+        const uint64_t sprite = chip8->RAM[(chip8->I + i) & 0xFFFF];
+        uint64_t row;
+        if(wrap) {
+            const uint64_t placed = sprite << (CHIP8_DISPLAY_WIDTH - 8);
+            row = X_coord == 0 ? placed : placed >> X_coord | placed << (CHIP8_DISPLAY_WIDTH - X_coord);
+        } else {
+            row = X_coord <= CHIP8_DISPLAY_WIDTH - 8 ? sprite << (CHIP8_DISPLAY_WIDTH - 8 - X_coord)
+                                                     : sprite >> (X_coord - (CHIP8_DISPLAY_WIDTH - 8));
+        }
+        uint64_t *display_row = &chip8->display[0][Y_coord % CHIP8_DISPLAY_HEIGHT][0];
+        if (*display_row & row) {
+            chip8->V[0x0F] = 1;
+        }
+        *display_row ^= row;
+    }
+    chip8->display_dirty = true;
+}
+
+void chip8_draw_sprite(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N){
+    draw_sprite(chip8, X, Y, N, false);
+}
+
+void chip8_draw_sprite_wrap(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N){
+    draw_sprite(chip8, X, Y, N, true);
+}
+
+// Opcode is FX0A: awaits a keypress and blocks, then stores key value in VX
+void chip8_wait_key(chip8_t *chip8, uint8_t X){
+    // check if any key on the keypad was pressed
+    for(uint8_t i =0; i < 16 && chip8->wait_key == 0xFF; i++) {
+        if(chip8->keypad[i]){
+            chip8->wait_key = i;
+        }
+    }
+    // if no key was pressed, or the key is still pressed, repeat this instruction
+    if(chip8->wait_key == 0xFF || chip8->keypad[chip8->wait_key]){
+        chip8->PC -= 2;
+    } else {
+        chip8->V[X] = chip8->wait_key;
+        chip8->wait_key = 0xFF;
+    }
+}
+
+// the interpreter, instantiated once per quirk profile with `q` a constant (see QUIRK_ENGINE)
+static inline __attribute__((always_inline)) void execute_instruction(chip8_t* chip8, const chip8_quirk_set_t q){
+    // get the instruction to be executed
+    // I have a little endian machine, so the program would first get the larger 8 bits
+    // then they need to be shifted and bitwise ORed with the lower 8 bits stored at the next memory address
+    uint16_t instr = (chip8->RAM[chip8->PC] << 8) | chip8->RAM[(chip8->PC + 1) & 0xFFFF];
+    
+    // increment program counter for the next 16 bit instruction
+    chip8->PC += 2;
+    chip8->cycles++;
+
+    uint16_t first4bits = (instr & 0xF000) >> 12;
+    uint16_t NNN = (instr & 0x0FFF);
+    uint16_t NN = (instr & 0x00FF);
+    uint16_t X = (instr & 0x0F00) >> 8;
+    uint16_t Y = (instr & 0x00F0) >> 4;
+    uint16_t N = (instr & 0x000F);
+    switch(first4bits) {
+        case 0x00: 
+            if (NN == 0xE0) {
+                chip8_clear_display(chip8);
+            } else if(NN == 0xEE) {
+                if(chip8->SP == 0) {
+                    chip8_fault(chip8, FAULT_STACK_UNDERFLOW);
+                    break;
+                }
+                chip8->SP--;
+                chip8->PC = chip8->stack[chip8->SP];
+                
+            } else if(chip8->variant != VARIANT_CHIP8) {
+                // Opcodes 00CN/00DN: scroll down/up N rows (00DN is XO-CHIP), 00FB/00FC: scroll right/left 4 pixels,
+                // 00FD: exit, 00FE/00FF: low/high resolution, which also clears the screen
+                if((instr & 0xFFF0) == 0x00C0) {
+                    scroll_vertical(chip8, N);
+                } else if((instr & 0xFFF0) == 0x00D0 && chip8->variant == VARIANT_XOCHIP) {
+                    scroll_vertical(chip8, -(int)N);
+                } else if(instr == 0x00FB || instr == 0x00FC) {
+                    scroll_horizontal(chip8, instr == 0x00FB);
+                } else if(instr == 0x00FD) {
+                    // stays on the instruction, whatever runs the machine stops on QUIT
+                    chip8->state = QUIT;
+                    chip8->PC -= 2;
+                } else if(instr == 0x00FE || instr == 0x00FF) {
+                    chip8->hires = instr == 0x00FF;
+                    memset(chip8->display, 0, sizeof chip8->display);
+                    chip8->display_dirty = true;
+                }
+            }
+            break;
+        case 0x01: 
+            // Opcode is 1NNN: Jumps to address NNN
+            chip8->PC = NNN;
+            break;
+        case 0x02: 
+            // Opcode is 2NNN: Calls subroutin at NNN
+            
+            // only allow a maximum recurive detpth of 12
+            if(chip8->SP < 12){
+                chip8->stack[chip8->SP] = chip8->PC;
+                chip8->SP ++;
+                chip8->PC = NNN;
+            } else {
+                chip8_fault(chip8, FAULT_STACK_OVERFLOW);
+            }
+            return;
+
+        case 0x03: 
+            // Opcode is 3XNN: skips next instruction if VX == NN
+            if(chip8->V[X] == NN) {
+                chip8_skip_next(chip8);
+            }
+            return;
+        case 0x04: 
+            // Opcode is 4XNN: skips next instruction if VX != NN
+            if(chip8->V[X] != NN) {
+                chip8_skip_next(chip8);
+            }
+            return;
+        case 0x05:
+            // Opcodes 5XY2/5XY3 (XO-CHIP): store/load VX to VY, in either order, at I; I is left as is
+            if(chip8->variant == VARIANT_XOCHIP && (N == 0x02 || N == 0x03)) {
+                const int step = X <= Y ? 1 : -1;
+                const int count = abs((int)Y - (int)X) + 1;
+                for(int i = 0; i < count; i++) {
+                    uint8_t *mem = &chip8->RAM[(chip8->I + i) & 0xFFFF];
+                    uint8_t *reg = &chip8->V[X + i * step];
+                    if(N == 0x02) *mem = *reg; else *reg = *mem;
+                }
+                if(N == 0x02) chip8_invalidate_code(chip8, chip8->I, count);
+                return;
+            }
+            // Opcode is 5XY0: skips next instruction if VX == VY
+            if(chip8->V[X] == chip8->V[Y]){
+                chip8_skip_next(chip8);
+            }
+            return;
+        case 0x06: 
+            // Opcode is 6XNN: sets value of register VX to NN
+            chip8->V[X] = NN;
+            return;
+        case 0x07: 
+            // Opcode is 7XNN: increments value of register VX to NN
+            chip8->V[X] += NN;
+            return;
+        case 0x08: 
+            switch(N) {
+                //Opcode is 8XY0: set register VX to the value of VY
+                case 0x00: chip8->V[X] = chip8->V[Y]; break;
+                // Opcode is 8XY1: set register VX to VX OR VY (VF reset quirk: VF = 0)
+                case 0x01: chip8->V[X] |= chip8->V[Y]; if(q.vf_reset) chip8->V[0x0F] = 0; break;
+                // Opcode is 8XY2: set register VX to VX AND VY
+                case 0x02: chip8->V[X] &= chip8->V[Y]; if(q.vf_reset) chip8->V[0x0F] = 0; break;
+                // Opcode is 8XY3: set register VX to VX XOR VY
+                case 0x03: chip8->V[X] ^= chip8->V[Y]; if(q.vf_reset) chip8->V[0x0F] = 0; break;
+                // Opcode is 8XY4: set register VX to VX + VY, if overflow, set VF to 1, otherwise to 0
+                case 0x04: 
+                    if(chip8->V[X] + chip8->V[Y] > 0xFF) {
+                        chip8->V[0x0F] = 0x01;
+                    } else {
+                        chip8->V[0x0F] = 0x00;
+                    } 
+                    chip8->V[X] += chip8->V[Y];
+                    break;
+                // Opcode is 8XY5: set register VX to VX - VY, if underflow, set VF to 0, otherwise to 1
+                case 0x05: 
+                    if(chip8->V[X] >= chip8->V[Y]) {
+                        chip8->V[0x0F] = 0x01;
+                        
+                    } else {
+                        chip8->V[0x0F] = 0x00;
+                    }    
+                    chip8->V[X] -= chip8->V[Y];
+                    break;
+                // Opcode is 8XY6: set register VX to VX >>1 (shift to right by 1); set VF to the last bit of VX
+                // (shift quirk: VX = VY >> 1, VF the last bit of VY)
+                case 0x06:
+                    chip8->V[0x0F] = chip8->V[q.shift_vy ? Y : X] & 0x01;
+                    chip8->V[X] = chip8->V[q.shift_vy ? Y : X] >> 1;
+                    break;
+                // Opcode is 8XY7: set register VX to VY - VX, if underflow, set VF to 0, otherwise to 1
+                case 0x07: 
+                    if(chip8->V[Y] >= chip8->V[X]) {
+                        chip8->V[0x0F] = 0x01;
+                    } else {
+                        
+                        chip8->V[0x0F] = 0x00;
+                    } 
+                    chip8->V[X] = chip8->V[Y] - chip8->V[X];
+                    break;
+
+                // Opcode is 8XYE: set register VX to VX << 1; set VF to the first bit of VX (shift quirk: from VY)
+                case 0x0E:
+                    chip8->V[0x0F] = (chip8->V[q.shift_vy ? Y : X] & 0x80) >> 7;
+                    chip8->V[X] = chip8->V[q.shift_vy ? Y : X] << 1;
+                    break;
+                default:
+                    if(chip8->debug != NULL) debug_fault(chip8, "invalid opcode", chip8->PC - 2); else printf("Invalid opcode 0x8%d%d%d\n", X, Y, N);
+            }    
+            return;
+        case 0x09: 
+            // Opcode is 9XY0: skips next instruction if VX != VY
+            if(chip8->V[X] != chip8->V[Y]){
+                chip8_skip_next(chip8);
+            }
+            return;
+        case 0xA: 
+            // Opcode is ANNN: sets the register I to value NNN
+            chip8->I = NNN;
+            return;
+        case 0xB: 
+            // Opcode is BNNN: sets the value of the program counter to V0 plus NNN (jump quirk: BXNN, VX plus XNN)
+            chip8->PC = chip8->V[q.jump_vx ? X : 0] + NNN;
+            return;
+        case 0xC: 
+            // Opcode is CXNN: sets value of register VX to the bitwise and of NN and a random number between 0 and 255
+            chip8->V[X] = NN & (chip8_random(chip8) % 256 + 1);
+            return;
+        case 0xD: 
+            // Opcode is DXYN: draws an 8xN sprite (DXY0: 16x16) from memory at I to coordinate VX, VY; VF is set if any pixel is erased
+            if(q.display_wait && chip8_wait_vblank(chip8)) {
+                break;
+            }
+            draw_sprite(chip8, X, Y, N, q.wrap);
+            break;
+        case 0xE:
+            // Opcode is EX9E: skip next instruction if key stored in VX is pressed (the low 4 bits of VX, as on the VIP)
+            if(NN == 0x9E) {
+                if(chip8->keypad[chip8->V[X] & 0xF]){
+                    chip8_skip_next(chip8);
+                }
+            // Opcode is EXA1: skip next instruction if key stored in VX is not pressed
+            } else if (NN == 0xA1){
+                if(!chip8->keypad[chip8->V[X] & 0xF]){
+                    chip8_skip_next(chip8);
+                }
+            }
+            break;
+        case 0xF: 
+             
+            if(chip8->variant == VARIANT_XOCHIP) {
+                // Opcode is F000 NNNN: sets I to the 16 bit address in the next word
+                if(instr == 0xF000) {
+                    chip8->I = (chip8->RAM[chip8->PC] << 8) | chip8->RAM[(chip8->PC + 1) & 0xFFFF];
+                    chip8->PC += 2;
+                    return;
+                }
+                // Opcode is FN01: selects the planes drawn to, cleared and scrolled
+                if(NN == 0x01) {
+                    chip8->planes = X & 0x03;
+                    return;
+                }
+                // Opcode is F002: loads the 16 byte audio pattern from I
+                if(instr == 0xF002) {
+                    for(int i = 0; i < 16; i++) chip8->audio_pattern[i] = chip8->RAM[(chip8->I + i) & 0xFFFF];
+                    return;
+                }
+                // Opcode is FX3A: sets the audio pattern playback pitch to VX
+                if(NN == 0x3A) {
+                    chip8->pitch = chip8->V[X];
+                    return;
+                }
+            }
+            if(chip8->variant != VARIANT_CHIP8) {
+                // Opcode is FX30: set I to the location of the 8x10 sprite for the digit in VX
+                if(NN == 0x30) {
+                    chip8->I = BIG_FONT_ADDR + 10 * (chip8->V[X] & 0x0F);
+                    return;
+                }
+                // Opcodes FX75/FX85: store/load V0 - VX in the RPL flags (V0 - V7 on SUPER-CHIP)
+                if(NN == 0x75 || NN == 0x85) {
+                    const uint8_t last = chip8->variant == VARIANT_XOCHIP ? X : X & 0x07;
+                    for(uint8_t i = 0; i <= last; i++) {
+                        if(NN == 0x75) chip8->rpl[i] = chip8->V[i]; else chip8->V[i] = chip8->rpl[i];
+                    }
+                    return;
+                }
+            }
+            switch(NN) {
+                // Opcode is FX07: sets value of ragister VX to the value of the delay timer
+                case 0x07:
+                    chip8->V[X] = chip8->delay_timer;
+                    break;
+                // Opcode is FX0A: awaits a keypress and blocks, then stores key value in VX
+                case 0x0A:
+                    chip8_wait_key(chip8, X);
+                    break;
+                
+                // Opcode is FX15: set the delay timer to VX
+                case 0x15:
+                    chip8->delay_timer = chip8->V[X];
+                    break;
+                // Opcode is FX18: set the sound timer to VX
+                case 0x18:
+                    chip8->sound_timer = chip8->V[X];
+                    break;
+                // Opcode is FX1E: set I = I + VX
+                case 0x1E:
+                    chip8->I += chip8->V[X];
+                    break;
+                // Opcode is FX29: set I to the location in memory of the sprite for the character in VX
+                case 0x29:
+                    chip8->I = 5 * chip8->V[X];
+                    break;
+                // Opcode is FX33: stores the binary coded decimal representation of VX with hundreds digit at I, tens at I+1, ones digit at I+2
+                case 0x33:
+                    chip8->RAM[chip8->I] = chip8->V[X] / 100;
+                    chip8->RAM[(chip8->I + 1) & 0xFFFF] = (chip8->V[X] / 10) % 10;
+                    chip8->RAM[(chip8->I + 2) & 0xFFFF] = chip8->V[X] % 10;
+                    chip8_invalidate_code(chip8, chip8->I, 3);
+                    break;
+                // Opcode is FX55: stores V0 - VX in memory starting at address I
+                case 0x55:
+                    for(uint8_t i =0; i<= X; i++) {
+                        chip8->RAM[(chip8->I + i) & 0xFFFF] = chip8->V[i];
+                    }
+                    chip8_invalidate_code(chip8, chip8->I, X + 1);
+                    if(q.index != INDEX_KEEP) chip8->I += q.index == INDEX_ADD_X1 ? X + 1 : X;
+                    break;
+                // Opcode is FX65: fills V0-VX with values from memory starting at I
+                case 0x65:
+                    for(uint8_t i =0; i<= X; i++) {
+                        chip8->V[i] = chip8->RAM[(chip8->I + i) & 0xFFFF];
+                    }
+                    if(q.index != INDEX_KEEP) chip8->I += q.index == INDEX_ADD_X1 ? X + 1 : X;
+                    break;
+            }   
+            break;
+
+    }
+}
+
+// one single step function and one run loop per quirk profile, each with the profile's quirks folded in
+#define QUIRK_ENGINE(name, profile) \
+    static void step_##name(chip8_t *chip8){ execute_instruction(chip8, quirk_sets[profile]); } \
+    static uint64_t run_##name(chip8_t *chip8, uint64_t cycles){ \
+        for(uint64_t i=0; i < cycles; i++){ \
+            execute_instruction(chip8, quirk_sets[profile]); \
+            if(chip8->state != RUNNING) return i + 1; \
+        } \
+        return cycles; \
+    }
+QUIRK_ENGINE(modern, QUIRKS_MODERN)
+QUIRK_ENGINE(vip, QUIRKS_VIP)
+QUIRK_ENGINE(chip48, QUIRKS_CHIP48)
+QUIRK_ENGINE(schip, QUIRKS_SCHIP)
+QUIRK_ENGINE(xochip, QUIRKS_XOCHIP)
+
+static const struct {
+    void (*step)(chip8_t *chip8);
+    uint64_t (*run)(chip8_t *chip8, uint64_t cycles);
+} quirk_engines[] = {
+    [QUIRKS_MODERN] = { step_modern, run_modern },
+    [QUIRKS_VIP] = { step_vip, run_vip },
+    [QUIRKS_CHIP48] = { step_chip48, run_chip48 },
+    [QUIRKS_SCHIP] = { step_schip, run_schip },
+    [QUIRKS_XOCHIP] = { step_xochip, run_xochip },
+};
+
+// time one instruction and charge it to its opcode and PC
+static void __attribute__((noinline)) execute_profiled(chip8_t* chip8){
+    const uint16_t pc = chip8->PC;
+    const uint16_t instr = (chip8->RAM[pc] << 8) | chip8->RAM[(pc + 1) & 0xFFFF];
+    void (*step)(chip8_t *) = quirk_engines[chip8_quirks(chip8)].step;
+    const uint64_t start = profile_clock();
+    step(chip8);
+    profile_count(chip8->profile, chip8->variant, pc, instr, profile_clock() - start);
+}
+
+void emulate_instruction(chip8_t* chip8){
+    if(__builtin_expect(chip8->profile != NULL, 0)){
+        execute_profiled(chip8);
+        return;
+    }
+    quirk_engines[chip8_quirks(chip8)].step(chip8);
+}
+
+// Idle loops: code that leaves the machine exactly as it found it on every pass until a timer
+// tick or a key changes something. Timers and keys only change between chip8_run_cycles calls, so
+// once PC is inside one, whole passes are skipped by just counting their instructions.
+#define IDLE_CHECK_SLICE 256        // instructions run between looks for an idle loop
+
+static uint16_t fetch(const chip8_t *chip8, uint32_t addr){
+    return (chip8->RAM[addr & 0xFFFF] << 8) | chip8->RAM[(addr + 1) & 0xFFFF];
+}
+
+bool chip8_waiting_for_key(const chip8_t *chip8){
+    const uint16_t instr = fetch(chip8, chip8->PC);
+    if((instr & 0xF0FF) != 0xF00A) return false;
+    if(chip8->wait_key != 0xFF) return chip8->keypad[chip8->wait_key];
+    for(int i = 0; i < 16; i++) if(chip8->keypad[i]) return false;
+    return true;
+}
+
+// FX07, 3XNN/4XNN, 1NNN back to the FX07 at `start`, with VX already holding the delay timer and
+// the skip not taken: 3 instructions per pass, else 0
+static uint32_t delay_poll_loop(const chip8_t *chip8, uint32_t start){
+    if(start > 0xFFF) return 0;
+    const uint16_t load = fetch(chip8, start), test = fetch(chip8, start + 2);
+    const uint8_t X = (load >> 8) & 0xF, NN = test & 0xFF;
+    if((load & 0xF0FF) != 0xF007 || ((test >> 12) != 0x3 && (test >> 12) != 0x4) || ((test >> 8) & 0xF) != X ||
+       fetch(chip8, start + 4) != (0x1000 | start) || chip8->V[X] != chip8->delay_timer) return 0;
+    return ((test >> 12) == 0x3) == (chip8->V[X] != NN) ? 3 : 0;
+}
+
+// instructions per pass of the idle loop PC is in, 0 if it is not in one
+static uint32_t idle_loop_length(const chip8_t *chip8){
+    const uint16_t pc = chip8->PC;
+    const uint16_t instr = fetch(chip8, pc);
+    switch(instr >> 12){
+        case 0x1: return (instr & 0xFFF) == pc ? 1 : delay_poll_loop(chip8, pc - 4u);
+        case 0x3:
+        case 0x4: return delay_poll_loop(chip8, pc - 2u);
+        case 0xF:
+            if((instr & 0xFF) == 0x07) return delay_poll_loop(chip8, pc);
+            return chip8_waiting_for_key(chip8) ? 1 : 0;
+        default: return 0;
+    }
+}
+
+static uint64_t run_engine(chip8_t *chip8, uint64_t cycles){
+    if(chip8->engine == ENGINE_PREDECODE) {
+        return predecode_run(chip8, cycles);
+    }
+    if(chip8->engine == ENGINE_JIT) {
+        return jit_run(chip8, cycles);
+    }
+    if(chip8->engine == ENGINE_AOT) {
+        return aot_run(chip8, cycles);
+    }
+    return quirk_engines[chip8_quirks(chip8)].run(chip8, cycles);
+}
+
+// one instruction, on the selected engine or through emulate_instruction, and its trace record;
+// 0 if the engine did not run it
+static uint64_t traced_instruction(chip8_t *chip8, bool interpret){
+    const uint16_t pc = chip8->PC;
+    const uint16_t instr = fetch(chip8, pc);
+    uint8_t V[16];
+    memcpy(V, chip8->V, sizeof V);
+    uint64_t ran = 1;
+    if(interpret) emulate_instruction(chip8); else ran = run_engine(chip8, 1);
+    if(ran > 0) trace_record(chip8, pc, instr, V);
+    return ran;
+}
+
+// one instruction at a time between the debugger's checks; the engines themselves never look at
+// the debugger, chip8_run_cycles only comes here while it has something to check
+static uint64_t __attribute__((noinline)) run_debugged(chip8_t *chip8, uint64_t cycles){
+    for(uint64_t i = 0; i < cycles; i++){
+        if(debug_before(chip8)) return i;
+        if(chip8->trace != NULL) traced_instruction(chip8, true); else emulate_instruction(chip8);
+        if(debug_after(chip8) || chip8->state != RUNNING) return i + 1;
+    }
+    return cycles;
+}
+
+// every instruction recorded, so no idle loop is skipped; the profiler still sees them all
+static uint64_t __attribute__((noinline)) run_traced(chip8_t *chip8, uint64_t cycles){
+    for(uint64_t i = 0; i < cycles; i++){
+        const uint64_t ran = traced_instruction(chip8, chip8->profile != NULL);
+        if(ran == 0 || chip8->state != RUNNING) return i + ran;
+    }
+    return cycles;
+}
+
+uint64_t chip8_run_cycles(chip8_t *chip8, uint64_t cycles){
+    // stopped on a fault, 00FD or in the debugger: nothing runs until it is resumed
+    if(chip8->state != RUNNING) return 0;
+    if(chip8->debug != NULL && debug_armed(chip8->debug)) {
+        return run_debugged(chip8, cycles);
+    }
+    if(chip8->trace != NULL) {
+        return run_traced(chip8, cycles);
+    }
+    if(chip8->profile != NULL) {
+        for(uint64_t i=0; i < cycles; i++){
+            execute_profiled(chip8);
+            if(chip8->state != RUNNING) return i + 1;
+        }
+        return cycles;
+    }
+    uint64_t done = 0;
+    while(done < cycles){
+        const uint32_t idle = idle_loop_length(chip8);
+        if(idle > 0){
+            const uint64_t skipped = (cycles - done) / idle * idle;
+            chip8->cycles += skipped;
+            done += skipped;
+            if(done == cycles) break;
+        }
+        // a partial pass, or real work until the next look
+        const uint64_t slice = cycles - done < IDLE_CHECK_SLICE ? cycles - done : IDLE_CHECK_SLICE;
+        const uint64_t ran = run_engine(chip8, slice);
+        done += ran;
+        if(ran < slice) break;
+    }
+    return done;
+}
+
+bool update_timers(chip8_t* chip8){
+    chip8->vblank = true;
+    if(chip8->delay_timer > 0){
+        chip8->delay_timer--;
+    }
+    if(chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+        return true;
+    }
+    return false;
+}
+
+bool chip8_run_schedule(chip8_t *chip8, chip8_schedule_t *schedule, uint64_t cycles){
+    while(cycles > 0){
+        const uint64_t until_tick = chip8_schedule_until_tick(schedule);
+        const uint64_t next_tick = schedule->cycles + until_tick;
+        const uint64_t run = until_tick < cycles ? until_tick : cycles;
+        const uint64_t ran = chip8_run_cycles(chip8, run);
+        schedule->cycles += ran;
+        cycles -= ran;
+        // a stopped machine keeps its timers, a due tick happens once it is resumed
+        if(chip8->state != RUNNING) break;
+        if(schedule->cycles == next_tick){
+            schedule->sound = update_timers(chip8);
+            schedule->timer_ticks++;
+        }
+        if(ran < run) break;
+    }
+    return schedule->sound;
+}
+
+bool chip8_run_script(chip8_t *chip8, chip8_schedule_t *schedule, const chip8_key_event_t *events, size_t event_count, uint64_t until){
+    size_t next = 0;
+    while(chip8->state != QUIT && chip8->cycles < until){
+        // apply every event that is due, then run up to the next one
+        for(; next < event_count && events[next].cycle <= chip8->cycles; next++){
+            chip8->keypad[events[next].key & 0xF] = events[next].pressed;
+        }
+        uint64_t cycles = until - chip8->cycles;
+        if(next < event_count && events[next].cycle - chip8->cycles < cycles){
+            cycles = events[next].cycle - chip8->cycles;
+        }
+        const uint64_t before = chip8->cycles;
+        chip8_run_schedule(chip8, schedule, cycles);
+        if(chip8->cycles == before) break;
+    }
+    return chip8->cycles >= until;
+}
+
+const uint64_t (*chip8_framebuffer(const chip8_t *chip8, int plane))[CHIP8_ROW_WORDS]{
+    return chip8->display[plane];
+}
+
+uint64_t chip8_framebuffer_hash(const chip8_t *chip8){
+    // FNV-1a over the row words of the current mode, the second plane only once it was drawn to
+    const uint32_t height = chip8_display_height(chip8);
+    const int words = chip8->hires ? CHIP8_ROW_WORDS : 1;
+    uint64_t second = 0;
+    for(uint32_t y = 0; y < height; y++) second |= chip8->display[1][y][0] | chip8->display[1][y][1];
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(int plane = 0; plane < (second ? CHIP8_PLANES : 1); plane++){
+        for(uint32_t y = 0; y < height; y++){
+            for(int w = 0; w < words; w++){
+                hash ^= chip8->display[plane][y][w];
+                hash *= 0x100000001b3ull;
+            }
+        }
+    }
+    return hash;
+}
+
+uint64_t chip8_ram_hash(const chip8_t *chip8){
+    // FNV-1a over the bytes
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < chip8_ram_size(chip8); i++){
+        hash ^= chip8->RAM[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -0,0 +1,216 @@
+#ifndef CHIP8_CORE_H
+#define CHIP8_CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// original chip8 resolution
+#define CHIP8_DISPLAY_WIDTH 64
+#define CHIP8_DISPLAY_HEIGHT 32
+// SUPER-CHIP / XO-CHIP high resolution mode
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+#define CHIP8_ROW_WORDS 2           // 64 bit words per display row in hires mode, lores rows use the first
+#define CHIP8_PLANES 2              // XO-CHIP bit planes, a pixel is a 2 bit color index
+#define CHIP8_RAM_SIZE 0x10000      // XO-CHIP address space, CHIP-8 and SUPER-CHIP only use the first 4 KB
+
+typedef enum {
+    QUIT,
+    PAUSED,
+    RUNNING,
+} emulator_state_t;
+
+// why a machine stopped (state QUIT) when the ROM did something no interpreter can carry out; the
+// faulting instruction stays at PC. With a debugger attached it stops there instead, see chip8_debug.h
+typedef enum {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW,           // 2NNN with all 12 stack entries in use
+    FAULT_STACK_UNDERFLOW,          // 00EE with an empty stack
+    FAULT_MEMORY,                   // an access past the variant's RAM; the engines wrap these at 64 KB,
+                                    // only the fuzzer (chip8_fuzz.h) reports them
+} chip8_fault_t;
+
+typedef enum {
+    ENGINE_SWITCH,                  // decode every instruction with a switch (emulate_instruction)
+    ENGINE_PREDECODE,               // dispatch through a per-address table of predecoded handlers
+    ENGINE_JIT,                     // translate basic blocks to native x86-64 code
+    ENGINE_AOT,                     // run ROMs compiled to C ahead of time and linked in, see chip8_aot.h
+} chip8_engine_t;
+
+typedef enum {
+    VARIANT_CHIP8,                  // original CHIP-8, 64x32
+    VARIANT_SCHIP,                  // SUPER-CHIP 1.1: 128x64 hires mode, scrolling, 16x16 sprites, RPL flags
+    VARIANT_XOCHIP,                 // XO-CHIP: SUPER-CHIP plus 64 KB of RAM, two bit planes and audio patterns
+} chip8_variant_t;
+
+// behaviors the CHIP-8 descendants disagree on; each profile runs its own specialized copy of
+// the interpreter, see chip8_internal.h for the individual quirks
+typedef enum {
+    QUIRKS_AUTO,                    // follow the variant: MODERN for CHIP-8, SCHIP, XOCHIP
+    QUIRKS_MODERN,                  // this interpreter's classic behavior: shifts VX, I kept, BNNN, clipping
+    QUIRKS_VIP,                     // COSMAC VIP: shifts VY, I advanced, VF reset, clipping, display wait
+    QUIRKS_CHIP48,                  // CHIP-48: shifts VX, I advanced by X, BXNN, clipping
+    QUIRKS_SCHIP,                   // SUPER-CHIP 1.1: shifts VX, I kept, BXNN, clipping
+    QUIRKS_XOCHIP,                  // XO-CHIP: shifts VY, I advanced, BNNN, wrapping
+} chip8_quirks_t;
+
+struct chip8_decoded;
+struct chip8_jit;
+struct chip8_aot;
+struct chip8_profile;
+struct chip8_debug;
+struct chip8_trace;
+
+typedef struct {
+    emulator_state_t state;
+    uint8_t RAM[CHIP8_RAM_SIZE];
+    // [plane][row][word], x=0 is the most significant bit of word 0; only the rows and words of the
+    // current resolution are used, the rest stays zero
+    uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][CHIP8_ROW_WORDS];
+    uint16_t stack[12];
+    uint8_t SP;
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    bool keypad[16];
+    uint8_t wait_key;               // FX0A: key seen pressed and waited on to be released, 0xFF if none
+    bool display_dirty;             // set by DXYN/00E0, cleared by whoever presents the frame
+    uint64_t cycles;                // number of instructions executed since the ROM was loaded
+    uint64_t rng;                   // CXNN random number state, reset to `seed`
+    bool hires;                     // 128x64 mode (00FF), SUPER-CHIP and XO-CHIP only
+    uint8_t planes;                 // XO-CHIP planes drawn and cleared (FN01), 1 otherwise
+    uint8_t rpl[16];                // SUPER-CHIP RPL user flags (FX75/FX85)
+    uint8_t audio_pattern[16];      // XO-CHIP 1 bit audio samples (F002)
+    uint8_t pitch;                  // XO-CHIP playback rate of the pattern (FX3A)
+    bool vblank;                    // set by every 60Hz tick, DXYN waits for it under the display wait quirk
+    chip8_fault_t fault;            // what stopped the machine, FAULT_NONE while it runs or after 00FD
+
+    // host-side state below is not part of the emulated machine and survives resets
+    char *rom_path;
+    uint64_t seed;                  // see chip8_seed
+    chip8_variant_t variant;        // see chip8_set_variant
+    chip8_quirks_t quirks;          // see chip8_set_quirks
+    chip8_engine_t engine;
+    struct chip8_decoded *decoded;  // predecoded instruction table, ENGINE_PREDECODE only
+    struct chip8_jit *jit;          // translated block cache, ENGINE_JIT only
+    struct chip8_aot *aot;          // compiled program of the loaded ROM, ENGINE_AOT only
+    struct chip8_profile *profile;  // per-opcode and per-PC counters, see chip8_profile.h
+    struct chip8_debug *debug;      // breakpoints and watchpoints, see chip8_debug.h
+    struct chip8_trace *trace;      // execution trace being written, see chip8_trace.h
+} chip8_t;
+
+// the emulated machine is everything in chip8_t in front of the host-side state
+#define CHIP8_MACHINE_SIZE offsetof(chip8_t, rom_path)
+
+// in-memory save state, taking and restoring one is a single flat copy
+typedef struct {
+    unsigned char machine[CHIP8_MACHINE_SIZE];
+} chip8_snapshot_t;
+
+// emulated time is measured in instructions: at instr_rate instructions per second, 60Hz timer
+// tick k falls after instruction k*instr_rate/60, so the timers never drift from the CPU
+typedef struct {
+    uint32_t instr_rate;            // instructions per emulated second
+    uint64_t cycles;                // instructions run under this schedule
+    uint64_t timer_ticks;           // 60Hz timer ticks delivered
+    bool sound;                     // sound timer state after the last tick
+} chip8_schedule_t;
+
+// scripted keypad input: set keypad[key] to `pressed` once `cycle` instructions have run
+typedef struct {
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+} chip8_key_event_t;
+
+// allocate a zeroed chip8 instance, NULL on allocation failure
+chip8_t *chip8_create(void);
+void chip8_destroy(chip8_t *chip8);
+
+// select the engine used by chip8_run_cycles, false if it could not be set up
+bool chip8_set_engine(chip8_t *chip8, chip8_engine_t engine);
+// parse an engine name ("switch", "predecode", "jit", "aot"), false if unknown
+bool chip8_engine_from_name(const char *name, chip8_engine_t *engine);
+// drop any cached translation of RAM[addr, addr+len), wrapping past the end of RAM to address 0 like
+// the stores do; call after writing to RAM from outside the core
+void chip8_invalidate_code(chip8_t *chip8, uint16_t addr, uint32_t len);
+
+// select the instruction set, drops any translated code; takes effect on the next reset (ROM load)
+void chip8_set_variant(chip8_t *chip8, chip8_variant_t variant);
+// parse a variant name ("chip8", "schip", "xochip"), false if unknown
+bool chip8_variant_from_name(const char *name, chip8_variant_t *variant);
+// bytes of RAM the variant addresses, the largest ROM is this minus 0x200
+size_t chip8_ram_size(const chip8_t *chip8);
+
+// select the quirk profile, drops any translated code; takes effect immediately
+void chip8_set_quirks(chip8_t *chip8, chip8_quirks_t quirks);
+// parse a profile name ("auto", "modern", "vip", "chip48", "schip", "xochip"), false if unknown
+bool chip8_quirks_from_name(const char *name, chip8_quirks_t *quirks);
+// the profile in effect, QUIRKS_AUTO resolved through the variant
+chip8_quirks_t chip8_quirks(const chip8_t *chip8);
+
+// seed the CXNN random numbers; takes effect now and on every later reset (default seed is 0)
+void chip8_seed(chip8_t *chip8, uint64_t seed);
+
+// reset the machine and load the ROM from a file / from a memory buffer
+bool init_chip8(chip8_t *chip8, char rom_path[]);
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, size_t rom_size);
+
+// "stack overflow", "stack underflow", ...
+const char *chip8_fault_name(chip8_fault_t fault);
+
+// execute a single instruction at PC with the switch interpreter
+void emulate_instruction(chip8_t *chip8);
+// execute up to `cycles` instructions with the selected engine (the switch interpreter while
+// profiling or while the debugger has anything set), returns the number actually executed, fewer
+// if the debugger stopped the machine. Passes through idle loops (jumps to self, FX0A waits,
+// delay timer polling) are counted without being executed, except while profiling or debugging
+uint64_t chip8_run_cycles(chip8_t *chip8, uint64_t cycles);
+// true while FX0A at PC waits and will keep waiting until the keypad changes
+bool chip8_waiting_for_key(const chip8_t *chip8);
+// decrement the 60Hz timers and flag the vertical blank, returns true while the sound timer is active
+bool update_timers(chip8_t *chip8);
+// execute `cycles` instructions, ticking the timers whenever the schedule says a tick is due;
+// returns true while the sound timer is active
+bool chip8_run_schedule(chip8_t *chip8, chip8_schedule_t *schedule, uint64_t cycles);
+// instructions left before the schedule's next timer tick
+static inline uint64_t chip8_schedule_until_tick(const chip8_schedule_t *schedule){
+    return (schedule->timer_ticks + 1) * schedule->instr_rate / 60 - schedule->cycles;
+}
+// run the schedule until chip8->cycles reaches `until`, setting the keypad from `events` (sorted
+// by cycle) as each one comes due; returns false if the machine stopped before `until`
+bool chip8_run_script(chip8_t *chip8, chip8_schedule_t *schedule, const chip8_key_event_t *events, size_t event_count, uint64_t until);
+
+// save states, chip8_state.c. Restoring keeps the run state (paused/running) and only
+// invalidates translated code if RAM actually differs
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot);
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot);
+// versioned, layout independent on-disk format
+bool chip8_save_state(const chip8_t *chip8, const char *path);
+bool chip8_load_state(chip8_t *chip8, const char *path);
+
+// resolution of the current mode, 64x32 or 128x64
+static inline uint32_t chip8_display_width(const chip8_t *chip8){
+    return chip8->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+}
+static inline uint32_t chip8_display_height(const chip8_t *chip8){
+    return chip8->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+}
+// rows of one plane, CHIP8_ROW_WORDS words each, x=0 is the most significant bit of the first word
+const uint64_t (*chip8_framebuffer(const chip8_t *chip8, int plane))[CHIP8_ROW_WORDS];
+// color index of a pixel: bit 0 from plane 0, bit 1 from plane 1
+static inline uint8_t chip8_pixel(const chip8_t *chip8, uint32_t x, uint32_t y){
+    const uint32_t shift = 63 - (x & 63);
+    return ((chip8->display[0][y][x >> 6] >> shift) & 1) | ((chip8->display[1][y][x >> 6] >> shift) & 1) << 1;
+}
+uint64_t chip8_framebuffer_hash(const chip8_t *chip8);
+uint64_t chip8_ram_hash(const chip8_t *chip8);
+// expand the framebuffer of the current mode into 32 bit pixels, palette[chip8_pixel(x, y)] each;
+// pitch is in bytes. Uses SSE2 where available, the _scalar variant is the portable reference
+void chip8_framebuffer_to_rgba(const chip8_t *chip8, const uint32_t palette[4], void *pixels, int pitch);
+void chip8_framebuffer_to_rgba_scalar(const chip8_t *chip8, const uint32_t palette[4], void *pixels, int pitch);
+
+#endif
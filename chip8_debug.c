@@ -0,0 +1,373 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "chip8_debug.h"
+#include "chip8_internal.h"
+
+#define MAX_WATCHPOINTS 16
+#define MAX_WATCH_LEN 256           // bytes one memory watchpoint covers
+#define LISTING_LENGTH 8            // instructions shown from PC when the machine stops
+
+typedef enum { REG_V0, REG_VF = 15, REG_I, REG_SP, REG_DT, REG_ST, REG_MEMORY } watch_kind_t;
+
+typedef struct {
+    watch_kind_t kind;
+    uint16_t addr, len;             // REG_MEMORY only
+    uint8_t old[MAX_WATCH_LEN];     // value after the last checked instruction, one entry for a register
+    uint16_t old_reg;
+} watch_t;
+
+struct chip8_debug {
+    uint8_t breakpoints[CHIP8_RAM_SIZE / 8];    // one bit per address
+    size_t breakpoint_count;
+    watch_t watches[MAX_WATCHPOINTS];
+    size_t watch_count;
+    uint64_t steps;                 // instructions left before a DEBUG_STEP stop, 0 when not stepping
+    bool resume;                    // PC is the breakpoint just reported, run it once before checking again
+    uint16_t last_pc;               // PC of the instruction being checked
+    chip8_debug_stop_t stop;
+    char message[128];
+};
+
+static const char *const reg_names[] = {
+    "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9", "VA", "VB", "VC", "VD", "VE", "VF", "I", "SP", "DT", "ST",
+};
+
+bool chip8_debug_enable(chip8_t *chip8){
+    if(chip8->debug != NULL) return true;
+    chip8->debug = calloc(1, sizeof(struct chip8_debug));
+    if(chip8->debug == NULL){
+        perror("Could not allocate the debugger");
+        return false;
+    }
+    return true;
+}
+
+void chip8_debug_disable(chip8_t *chip8){
+    free(chip8->debug);
+    chip8->debug = NULL;
+}
+
+static bool is_breakpoint(const struct chip8_debug *debug, uint16_t addr){
+    return (debug->breakpoints[addr >> 3] >> (addr & 7)) & 1;
+}
+
+void chip8_debug_breakpoint(chip8_t *chip8, uint16_t addr, bool set){
+    struct chip8_debug *debug = chip8->debug;
+    if(is_breakpoint(debug, addr) == set) return;
+    debug->breakpoints[addr >> 3] ^= 1 << (addr & 7);
+    debug->breakpoint_count += set ? 1 : -1;
+}
+
+void chip8_debug_clear_breakpoints(chip8_t *chip8){
+    memset(chip8->debug->breakpoints, 0, sizeof chip8->debug->breakpoints);
+    chip8->debug->breakpoint_count = 0;
+}
+
+static uint16_t reg_value(const chip8_t *chip8, watch_kind_t kind){
+    switch(kind){
+        case REG_I: return chip8->I;
+        case REG_SP: return chip8->SP;
+        case REG_DT: return chip8->delay_timer;
+        case REG_ST: return chip8->sound_timer;
+        default: return chip8->V[kind];
+    }
+}
+
+// take the current values as the ones to compare against
+static void sync_watch(const chip8_t *chip8, watch_t *watch){
+    if(watch->kind == REG_MEMORY){
+        for(uint16_t i = 0; i < watch->len; i++) watch->old[i] = chip8->RAM[(watch->addr + i) & 0xFFFF];
+    } else {
+        watch->old_reg = reg_value(chip8, watch->kind);
+    }
+}
+
+bool chip8_debug_watch_memory(chip8_t *chip8, uint16_t addr, uint16_t len){
+    struct chip8_debug *debug = chip8->debug;
+    if(debug->watch_count == MAX_WATCHPOINTS || len == 0 || len > MAX_WATCH_LEN) return false;
+    watch_t *watch = &debug->watches[debug->watch_count++];
+    *watch = (watch_t){ .kind = REG_MEMORY, .addr = addr, .len = len };
+    sync_watch(chip8, watch);
+    return true;
+}
+
+bool chip8_debug_watch_register(chip8_t *chip8, const char *name){
+    struct chip8_debug *debug = chip8->debug;
+    for(size_t r = 0; r < sizeof reg_names / sizeof reg_names[0]; r++){
+        if(strcasecmp(name, reg_names[r]) != 0) continue;
+        if(debug->watch_count == MAX_WATCHPOINTS) return false;
+        watch_t *watch = &debug->watches[debug->watch_count++];
+        *watch = (watch_t){ .kind = (watch_kind_t)r };
+        sync_watch(chip8, watch);
+        return true;
+    }
+    return false;
+}
+
+void chip8_debug_clear_watchpoints(chip8_t *chip8){
+    chip8->debug->watch_count = 0;
+}
+
+void chip8_debug_step(chip8_t *chip8, uint64_t steps){
+    chip8->debug->steps = steps;
+}
+
+chip8_debug_stop_t chip8_debug_stopped(const chip8_t *chip8, const char **message){
+    if(chip8->debug == NULL) return DEBUG_RUNNING;
+    if(message != NULL) *message = chip8->debug->message;
+    return chip8->debug->stop;
+}
+
+static void stop(struct chip8_debug *debug, chip8_debug_stop_t reason, const char *format, ...){
+    // the first reason sticks until the prompt has shown it
+    if(debug->stop != DEBUG_RUNNING) return;
+    debug->stop = reason;
+    debug->steps = 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(debug->message, sizeof debug->message, format, args);
+    va_end(args);
+}
+
+bool debug_armed(const struct chip8_debug *debug){
+    return debug->breakpoint_count > 0 || debug->watch_count > 0 || debug->steps > 0;
+}
+
+bool debug_before(chip8_t *chip8){
+    struct chip8_debug *debug = chip8->debug;
+    debug->last_pc = chip8->PC;
+    if(debug->stop != DEBUG_RUNNING) return true;
+    if(debug->resume){
+        debug->resume = false;
+        return false;
+    }
+    if(is_breakpoint(debug, chip8->PC)){
+        stop(debug, DEBUG_BREAKPOINT, "breakpoint at 0x%03X", chip8->PC);
+        return true;
+    }
+    return false;
+}
+
+bool debug_after(chip8_t *chip8){
+    struct chip8_debug *debug = chip8->debug;
+    for(size_t w = 0; w < debug->watch_count; w++){
+        watch_t *watch = &debug->watches[w];
+        if(watch->kind == REG_MEMORY){
+            for(uint16_t i = 0; i < watch->len; i++){
+                const uint16_t addr = (watch->addr + i) & 0xFFFF;
+                if(chip8->RAM[addr] == watch->old[i]) continue;
+                stop(debug, DEBUG_WATCHPOINT, "RAM[0x%03X] 0x%02X -> 0x%02X by the instruction at 0x%03X",
+                     addr, watch->old[i], chip8->RAM[addr], debug->last_pc);
+                watch->old[i] = chip8->RAM[addr];
+            }
+        } else if(reg_value(chip8, watch->kind) != watch->old_reg){
+            const uint16_t value = reg_value(chip8, watch->kind);
+            stop(debug, DEBUG_WATCHPOINT, "%s 0x%02X -> 0x%02X by the instruction at 0x%03X",
+                 reg_names[watch->kind], watch->old_reg, value, debug->last_pc);
+            watch->old_reg = value;
+        }
+    }
+    if(debug->steps > 0 && --debug->steps == 0) stop(debug, DEBUG_STEP, "stepped to 0x%03X", chip8->PC);
+    return debug->stop != DEBUG_RUNNING;
+}
+
+void debug_fault(chip8_t *chip8, const char *what, uint16_t addr){
+    stop(chip8->debug, DEBUG_FAULT, "%s at 0x%03X", what, addr);
+    // whichever engine is running returns after this instruction, the prompt resumes the machine
+    chip8->state = PAUSED;
+}
+
+int chip8_disassemble(const chip8_t *chip8, uint16_t addr, char *text, size_t size){
+    const uint16_t instr = (chip8->RAM[addr] << 8) | chip8->RAM[(addr + 1) & 0xFFFF];
+    const unsigned NNN = instr & 0xFFF, NN = instr & 0xFF, X = (instr >> 8) & 0xF, Y = (instr >> 4) & 0xF, N = instr & 0xF;
+    const bool schip = chip8->variant != VARIANT_CHIP8, xochip = chip8->variant == VARIANT_XOCHIP;
+    const chip8_quirk_set_t *q = chip8_quirk_set(chip8);
+    static const char *const alu[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", [0xE] = "SHL" };
+    switch(instr >> 12){
+        case 0x0:
+            if(instr == 0x00E0) return snprintf(text, size, "CLS"), 2;
+            if(instr == 0x00EE) return snprintf(text, size, "RET"), 2;
+            if(schip && (instr & 0xFFF0) == 0x00C0) return snprintf(text, size, "SCD %u", N), 2;
+            if(xochip && (instr & 0xFFF0) == 0x00D0) return snprintf(text, size, "SCU %u", N), 2;
+            if(schip && instr == 0x00FB) return snprintf(text, size, "SCR"), 2;
+            if(schip && instr == 0x00FC) return snprintf(text, size, "SCL"), 2;
+            if(schip && instr == 0x00FD) return snprintf(text, size, "EXIT"), 2;
+            if(schip && instr == 0x00FE) return snprintf(text, size, "LOW"), 2;
+            if(schip && instr == 0x00FF) return snprintf(text, size, "HIGH"), 2;
+            return snprintf(text, size, "SYS 0x%03X", NNN), 2;
+        case 0x1: return snprintf(text, size, "JP 0x%03X", NNN), 2;
+        case 0x2: return snprintf(text, size, "CALL 0x%03X", NNN), 2;
+        case 0x3: return snprintf(text, size, "SE V%X, 0x%02X", X, NN), 2;
+        case 0x4: return snprintf(text, size, "SNE V%X, 0x%02X", X, NN), 2;
+        case 0x5:
+            if(N == 0) return snprintf(text, size, "SE V%X, V%X", X, Y), 2;
+            if(xochip && N == 2) return snprintf(text, size, "LD [I], V%X-V%X", X, Y), 2;
+            if(xochip && N == 3) return snprintf(text, size, "LD V%X-V%X, [I]", X, Y), 2;
+            break;
+        case 0x6: return snprintf(text, size, "LD V%X, 0x%02X", X, NN), 2;
+        case 0x7: return snprintf(text, size, "ADD V%X, 0x%02X", X, NN), 2;
+        case 0x8:
+            if(alu[N] == NULL) break;
+            // the shift quirk shifts VY, otherwise the VY of a shift is ignored
+            if((N == 0x6 || N == 0xE) && !q->shift_vy) return snprintf(text, size, "%s V%X", alu[N], X), 2;
+            return snprintf(text, size, "%s V%X, V%X", alu[N], X, Y), 2;
+        case 0x9:
+            if(N == 0) return snprintf(text, size, "SNE V%X, V%X", X, Y), 2;
+            break;
+        case 0xA: return snprintf(text, size, "LD I, 0x%03X", NNN), 2;
+        case 0xB:
+            if(q->jump_vx) return snprintf(text, size, "JP V%X, 0x%03X", X, NNN), 2;
+            return snprintf(text, size, "JP V0, 0x%03X", NNN), 2;
+        case 0xC: return snprintf(text, size, "RND V%X, 0x%02X", X, NN), 2;
+        case 0xD: return snprintf(text, size, "DRW V%X, V%X, %u", X, Y, N), 2;
+        case 0xE:
+            if(NN == 0x9E) return snprintf(text, size, "SKP V%X", X), 2;
+            if(NN == 0xA1) return snprintf(text, size, "SKNP V%X", X), 2;
+            break;
+        case 0xF:
+            if(xochip && instr == 0xF000){
+                const uint16_t long_addr = (chip8->RAM[(addr + 2) & 0xFFFF] << 8) | chip8->RAM[(addr + 3) & 0xFFFF];
+                return snprintf(text, size, "LD I, 0x%04X", long_addr), 4;
+            }
+            if(xochip && NN == 0x01) return snprintf(text, size, "PLANE %u", X), 2;
+            if(xochip && instr == 0xF002) return snprintf(text, size, "AUDIO"), 2;
+            if(xochip && NN == 0x3A) return snprintf(text, size, "PITCH V%X", X), 2;
+            if(schip && NN == 0x30) return snprintf(text, size, "LD HF, V%X", X), 2;
+            if(schip && NN == 0x75) return snprintf(text, size, "LD R, V%X", X), 2;
+            if(schip && NN == 0x85) return snprintf(text, size, "LD V%X, R", X), 2;
+            switch(NN){
+                case 0x07: return snprintf(text, size, "LD V%X, DT", X), 2;
+                case 0x0A: return snprintf(text, size, "LD V%X, K", X), 2;
+                case 0x15: return snprintf(text, size, "LD DT, V%X", X), 2;
+                case 0x18: return snprintf(text, size, "LD ST, V%X", X), 2;
+                case 0x1E: return snprintf(text, size, "ADD I, V%X", X), 2;
+                case 0x29: return snprintf(text, size, "LD F, V%X", X), 2;
+                case 0x33: return snprintf(text, size, "LD B, V%X", X), 2;
+                case 0x55: return snprintf(text, size, "LD [I], V%X", X), 2;
+                case 0x65: return snprintf(text, size, "LD V%X, [I]", X), 2;
+                default: break;
+            }
+            break;
+    }
+    // not an instruction of this variant, most likely data
+    return snprintf(text, size, "DW 0x%04X", instr), 2;
+}
+
+void chip8_debug_print_state(const chip8_t *chip8, FILE *out){
+    fprintf(out, "PC 0x%03X  I 0x%03X  SP %u  DT %u  ST %u  cycles %" PRIu64 "\n",
+            chip8->PC, chip8->I, chip8->SP, chip8->delay_timer, chip8->sound_timer, chip8->cycles);
+    for(int r = 0; r < 16; r++) fprintf(out, "V%X %02X%s", r, chip8->V[r], r % 8 == 7 ? "\n" : "  ");
+    fprintf(out, "stack:");
+    for(int i = chip8->SP - 1; i >= 0 && i < 12; i--) fprintf(out, " 0x%03X", chip8->stack[i]);
+    fprintf(out, "%s\nkeys: ", chip8->SP == 0 ? " empty" : "");
+    for(int k = 0; k < 16; k++) fputc(chip8->keypad[k] ? "0123456789ABCDEF"[k] : '-', out);
+    fputc('\n', out);
+}
+
+// `count` instructions from `addr`, marking PC and breakpoints
+static void print_listing(const chip8_t *chip8, uint32_t addr, int count, FILE *out){
+    for(int i = 0; i < count && addr < chip8_ram_size(chip8); i++){
+        char text[32];
+        const int len = chip8_disassemble(chip8, (uint16_t)addr, text, sizeof text);
+        fprintf(out, "%s%c 0x%03X  %02X%02X  %s\n", addr == chip8->PC ? "=>" : "  ",
+                chip8->debug != NULL && is_breakpoint(chip8->debug, (uint16_t)addr) ? '*' : ' ',
+                (unsigned)addr, chip8->RAM[addr], chip8->RAM[(addr + 1) & 0xFFFF], text);
+        addr += len;
+    }
+}
+
+static void print_help(FILE *out){
+    fputs("c                continue\n"
+          "s [n]            step n instructions (default 1), also an empty line\n"
+          "b addr           set a breakpoint          d [addr]   delete one, or all\n"
+          "w addr [len]     watch memory              w reg      watch V0-VF, I, SP, DT or ST\n"
+          "dw               delete all watchpoints\n"
+          "r                registers, stack and keys\n"
+          "l [addr [n]]     disassemble n instructions (default from PC)\n"
+          "x addr [len]     dump memory\n"
+          "q                quit\n", out);
+}
+
+// a number in hex (with or without 0x) or decimal with a leading #; false if it is not one
+static bool parse_number(const char *text, unsigned long *value){
+    if(text == NULL) return false;
+    char *end;
+    *value = text[0] == '#' ? strtoul(text + 1, &end, 10) : strtoul(text, &end, 16);
+    return end != text && *end == '\0';
+}
+
+void chip8_debug_prompt(chip8_t *chip8, FILE *in, FILE *out){
+    struct chip8_debug *debug = chip8->debug;
+    const char *reason = debug->stop != DEBUG_RUNNING ? debug->message : "stopped";
+    fprintf(out, "==%s==\n", reason);
+    debug->stop = DEBUG_RUNNING;
+    // a fault paused the machine (on the faulting instruction, so going on retries it)
+    if(chip8->state == PAUSED) chip8->state = RUNNING;
+    print_listing(chip8, chip8->PC, 1, out);
+
+    char line[256];
+    while(true){
+        fputs("(chip8) ", out);
+        fflush(out);
+        if(fgets(line, sizeof line, in) == NULL){
+            chip8->state = QUIT;
+            break;
+        }
+        char *save;
+        const char *cmd = strtok_r(line, " \t\r\n", &save);
+        const char *arg1 = cmd != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+        const char *arg2 = arg1 != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+        unsigned long a, n;
+        if(cmd == NULL || strcmp(cmd, "s") == 0){
+            chip8_debug_step(chip8, parse_number(arg1, &n) && n > 0 ? n : 1);
+            break;
+        } else if(strcmp(cmd, "c") == 0){
+            break;
+        } else if(strcmp(cmd, "q") == 0){
+            chip8->state = QUIT;
+            break;
+        } else if(strcmp(cmd, "b") == 0 && parse_number(arg1, &a) && a < chip8_ram_size(chip8)){
+            chip8_debug_breakpoint(chip8, (uint16_t)a, true);
+        } else if(strcmp(cmd, "d") == 0 && arg1 == NULL){
+            chip8_debug_clear_breakpoints(chip8);
+        } else if(strcmp(cmd, "d") == 0 && parse_number(arg1, &a) && a < chip8_ram_size(chip8)){
+            chip8_debug_breakpoint(chip8, (uint16_t)a, false);
+        } else if(strcmp(cmd, "w") == 0 && arg1 != NULL && chip8_debug_watch_register(chip8, arg1)){
+            // a register name
+        } else if(strcmp(cmd, "w") == 0 && parse_number(arg1, &a) && a < chip8_ram_size(chip8)){
+            if(!parse_number(arg2, &n)) n = 1;
+            if(!chip8_debug_watch_memory(chip8, (uint16_t)a, (uint16_t)(n <= MAX_WATCH_LEN ? n : 0))){
+                fprintf(out, "At most %d watchpoints of up to %d bytes\n", MAX_WATCHPOINTS, MAX_WATCH_LEN);
+            }
+        } else if(strcmp(cmd, "dw") == 0){
+            chip8_debug_clear_watchpoints(chip8);
+        } else if(strcmp(cmd, "r") == 0){
+            chip8_debug_print_state(chip8, out);
+        } else if(strcmp(cmd, "l") == 0){
+            if(!parse_number(arg1, &a)) a = chip8->PC;
+            if(!parse_number(arg2, &n)) n = LISTING_LENGTH;
+            print_listing(chip8, (uint32_t)a, (int)(n < 4096 ? n : 4096), out);
+        } else if(strcmp(cmd, "x") == 0 && parse_number(arg1, &a) && a < chip8_ram_size(chip8)){
+            if(!parse_number(arg2, &n)) n = 16;
+            for(unsigned long i = 0; i < n && a + i < chip8_ram_size(chip8); i++){
+                if(i % 16 == 0) fprintf(out, "%s0x%03lX ", i > 0 ? "\n" : "", a + i);
+                fprintf(out, " %02X", chip8->RAM[a + i]);
+            }
+            fputc('\n', out);
+        } else if(strcmp(cmd, "h") == 0){
+            print_help(out);
+        } else {
+            fputs("Unknown command, h lists them\n", out);
+        }
+    }
+    // resuming runs the instruction at PC even if it is a breakpoint, and the watchpoints compare
+    // against what the machine holds now rather than before the stop
+    debug->resume = true;
+    for(size_t w = 0; w < debug->watch_count; w++) sync_watch(chip8, &debug->watches[w]);
+}
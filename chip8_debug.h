@@ -0,0 +1,53 @@
+#ifndef CHIP8_DEBUG_H
+#define CHIP8_DEBUG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_core.h"
+
+// Opt-in debugger: PC breakpoints, memory and register watchpoints, single stepping and a
+// disassembler. While a breakpoint, watchpoint or step is pending, chip8_run_cycles runs the
+// switch interpreter one checked instruction at a time and returns early when the machine stops;
+// with none pending it runs the selected engine, which never looks at the debugger. Faults
+// (chip8_fault_t) and invalid opcodes stop in the debugger while one is attached, instead of
+// ending the run: they pause the machine, so the selected engine returns right after the
+// instruction, and chip8_debug_prompt resumes it.
+typedef enum {
+    DEBUG_RUNNING,                  // not stopped
+    DEBUG_BREAKPOINT,               // PC reached a breakpoint, the instruction there has not run
+    DEBUG_WATCHPOINT,               // the last instruction changed a watched byte or register
+    DEBUG_STEP,                     // the requested number of instructions ran
+    DEBUG_FAULT,                    // stack overflow or underflow, or invalid opcode at PC
+} chip8_debug_stop_t;
+
+// attach a debugger with nothing set, false on allocation failure
+bool chip8_debug_enable(chip8_t *chip8);
+void chip8_debug_disable(chip8_t *chip8);
+
+// set or clear a breakpoint on `addr`
+void chip8_debug_breakpoint(chip8_t *chip8, uint16_t addr, bool set);
+void chip8_debug_clear_breakpoints(chip8_t *chip8);
+// stop after any instruction that changes RAM[addr, addr+len), false if there is no room for it
+bool chip8_debug_watch_memory(chip8_t *chip8, uint16_t addr, uint16_t len);
+// same for a register: "V0"-"VF", "I", "SP", "DT" or "ST"; false if unknown or no room
+bool chip8_debug_watch_register(chip8_t *chip8, const char *name);
+void chip8_debug_clear_watchpoints(chip8_t *chip8);
+// run `steps` more instructions, then stop
+void chip8_debug_step(chip8_t *chip8, uint64_t steps);
+
+// why the machine stopped, DEBUG_RUNNING if it did not; `message` (if not NULL) describes it
+chip8_debug_stop_t chip8_debug_stopped(const chip8_t *chip8, const char **message);
+// Show why the machine stopped and where, then read commands from `in` until one resumes
+// (continue, step) or quits the machine; `h` lists them. End of input quits.
+void chip8_debug_prompt(chip8_t *chip8, FILE *in, FILE *out);
+
+// disassemble the instruction at `addr` as the machine's variant and quirks decode it, returns
+// its length: 4 for the XO-CHIP F000 NNNN, 2 otherwise
+int chip8_disassemble(const chip8_t *chip8, uint16_t addr, char *text, size_t size);
+// registers, timers, stack and keypad
+void chip8_debug_print_state(const chip8_t *chip8, FILE *out);
+
+#endif
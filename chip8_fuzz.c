@@ -0,0 +1,394 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_fuzz.h"
+#include "chip8_movie.h"
+
+// Every thread is a fuzzer of its own with its own machine, corpus and coverage map, they only
+// share the boot snapshot and the fault list. Coverage is AFL's: the edge from PC a to PC b bumps
+// the counter at b ^ (a >> 1) of a map with one byte per address of RAM, and after the execution
+// each counter is put in a bucket (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ times). An input is
+// interesting if it hit a bucket of an edge no earlier input of this thread did; `virgin` keeps
+// the bits of the buckets not seen yet.
+
+#define MAX_EVENTS 256              // key events per input
+#define MAX_CORPUS 4096             // inputs kept per thread, further coverage is still counted
+#define HAVOC_ROUNDS 4              // mutations stacked on an input at most
+
+typedef struct {
+    chip8_key_event_t *events;
+    size_t count;
+} input_t;
+
+typedef struct {
+    const chip8_fuzz_config_t *config;
+    chip8_snapshot_t boot;
+    const chip8_t *image;           // variant, quirks and seed of the machines
+    size_t map_size;                // chip8_ram_size, a power of two
+    uint8_t buckets[256];           // hit count to bucket bit
+    double deadline;
+    pthread_mutex_t lock;           // the faults in stats
+    chip8_fuzz_stats_t *stats;
+} fuzz_t;
+
+typedef struct {
+    fuzz_t *fuzz;
+    chip8_t *chip8;
+    uint64_t rng;
+    uint8_t *trace;                 // hit counts of the current execution
+    uint8_t *virgin;
+    input_t *corpus;
+    size_t corpus_count;
+    chip8_key_event_t events[MAX_EVENTS];   // the input being run, sorted by cycle
+    size_t event_count;
+    uint64_t executions;
+    uint64_t instructions;
+} worker_t;
+
+static const char *const fault_files[] = {
+    [FAULT_STACK_OVERFLOW] = "stack-overflow",
+    [FAULT_STACK_UNDERFLOW] = "stack-underflow",
+    [FAULT_MEMORY] = "memory",
+};
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// splitmix64
+static uint64_t next_random(uint64_t *state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+// uniform enough below n, 0 if n is 0
+static uint64_t below(worker_t *w, uint64_t n){
+    return n ? next_random(&w->rng) % n : 0;
+}
+
+// whether the instruction at PC would read or write past the end of RAM, or run off it,
+// as the switch interpreter decodes it
+static bool past_ram(const chip8_t *chip8, uint32_t ram_size){
+    const uint32_t pc = chip8->PC;
+    if(pc + 2 > ram_size) return true;
+    const uint16_t instr = (chip8->RAM[pc] << 8) | chip8->RAM[pc + 1];
+    const uint8_t X = (instr >> 8) & 0xF, Y = (instr >> 4) & 0xF, N = instr & 0xF, NN = instr & 0xFF;
+    const bool xochip = chip8->variant == VARIANT_XOCHIP;
+    uint32_t len = 0;
+    switch(instr >> 12){
+        case 0x5:
+            if(xochip && (N == 0x2 || N == 0x3)) len = (X <= Y ? Y - X : X - Y) + 1u;
+            break;
+        case 0xD: {
+            // a sprite per selected plane, DXY0 is 16x16 on SUPER-CHIP and XO-CHIP
+            const bool big = N == 0 && chip8->variant != VARIANT_CHIP8;
+            len = (big ? 32u : N) * (uint32_t)__builtin_popcount(chip8->planes & 0x3);
+            break;
+        }
+        case 0xF:
+            if(xochip && instr == 0xF000) return pc + 4 > ram_size;
+            if(xochip && instr == 0xF002) len = 16;
+            else if(NN == 0x33) len = 3;
+            else if(NN == 0x55 || NN == 0x65) len = X + 1u;
+            break;
+        default: break;
+    }
+    return len > 0 && chip8->I + len > ram_size;
+}
+
+// chip8_restore of the boot snapshot without the RAM past the variant's end: every access there is
+// a fault that ends the execution before it happens, so after the first full restore it never
+// differs from the snapshot
+static void restore(chip8_t *chip8, const fuzz_t *fuzz){
+    const unsigned char *boot = fuzz->boot.machine;
+    const size_t ram = offsetof(chip8_t, RAM), rest = ram + sizeof chip8->RAM;
+    memcpy(chip8, boot, ram);
+    memcpy(chip8->RAM, boot + ram, fuzz->map_size);
+    memcpy((unsigned char *)chip8 + rest, boot + rest, CHIP8_MACHINE_SIZE - rest);
+}
+
+// run the worker's input from the boot snapshot, with the timers and key events applied as
+// chip8_run_script does; returns the fault it stopped on and in `before` the instructions run
+// ahead of the faulting one
+static chip8_fault_t execute(worker_t *w, uint64_t *before){
+    const fuzz_t *fuzz = w->fuzz;
+    chip8_t *chip8 = w->chip8;
+    restore(chip8, fuzz);
+    chip8->state = RUNNING;
+    memset(w->trace, 0, fuzz->map_size);
+    const uint32_t ram_size = (uint32_t)fuzz->map_size, rate = fuzz->config->instr_rate;
+    const uint64_t until = fuzz->config->cycles;
+    uint64_t ticks = 0, next_tick = rate / 60;
+    size_t next = 0;
+    uint32_t prev = 0;
+    chip8_fault_t fault = FAULT_NONE;
+    while(chip8->cycles < until){
+        for(; next < w->event_count && w->events[next].cycle <= chip8->cycles; next++){
+            chip8->keypad[w->events[next].key & 0xF] = w->events[next].pressed;
+        }
+        *before = chip8->cycles;
+        if(past_ram(chip8, ram_size)){
+            fault = FAULT_MEMORY;
+            break;
+        }
+        const uint32_t pc = chip8->PC;
+        w->trace[(pc ^ prev) & (ram_size - 1)]++;
+        prev = pc >> 1;
+        emulate_instruction(chip8);
+        // a fault, or 00FD
+        if(chip8->state != RUNNING){
+            fault = chip8->fault;
+            break;
+        }
+        if(chip8->cycles == next_tick){
+            update_timers(chip8);
+            ticks++;
+            next_tick = (ticks + 1) * rate / 60;
+        }
+    }
+    w->instructions += chip8->cycles;
+    return fault;
+}
+
+// bucket the hit counts and clear what is new from virgin, true if anything was
+static bool new_coverage(worker_t *w){
+    const fuzz_t *fuzz = w->fuzz;
+    bool found = false;
+    for(size_t i = 0; i < fuzz->map_size; i += 8){
+        uint64_t word;
+        memcpy(&word, w->trace + i, 8);
+        if(word == 0) continue;
+        for(size_t j = i; j < i + 8; j++){
+            const uint8_t bucket = fuzz->buckets[w->trace[j]];
+            if(bucket & w->virgin[j]){
+                w->virgin[j] &= ~bucket;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+static void keep_input(worker_t *w){
+    if(w->corpus_count == MAX_CORPUS) return;
+    chip8_key_event_t *events = malloc((w->event_count ? w->event_count : 1) * sizeof *events);
+    if(events == NULL) return;
+    memcpy(events, w->events, w->event_count * sizeof *events);
+    w->corpus[w->corpus_count++] = (input_t){ events, w->event_count };
+}
+
+// save a movie of the input up to the fault, which chip8 -replay plays back to the same machine
+static void save_fault(worker_t *w, chip8_fuzz_fault_t *fault){
+    const fuzz_t *fuzz = w->fuzz;
+    const char *dir = fuzz->config->fault_dir;
+    if(dir == NULL) return;
+    char path[sizeof fault->movie_path];
+    const int len = snprintf(path, sizeof path, "%s/fault-%s-%04X.movie", dir, fault_files[fault->kind], fault->pc);
+    if(len < 0 || (size_t)len >= sizeof path) return;
+    size_t applied = 0;
+    while(applied < w->event_count && w->events[applied].cycle <= fault->cycle) applied++;
+    chip8_movie_t movie = {
+        .seed = fuzz->image->seed,
+        .instr_rate = fuzz->config->instr_rate,
+        .events = w->events,
+        .event_count = applied,
+    };
+    chip8_movie_finish(&movie, w->chip8);
+    if(chip8_movie_save(&movie, path)) memcpy(fault->movie_path, path, sizeof path);
+}
+
+static void report_fault(worker_t *w, chip8_fault_t kind, uint64_t before){
+    fuzz_t *fuzz = w->fuzz;
+    const chip8_t *chip8 = w->chip8;
+    chip8_fuzz_stats_t *stats = fuzz->stats;
+    pthread_mutex_lock(&fuzz->lock);
+    bool known = stats->fault_count == CHIP8_FUZZ_MAX_FAULTS;
+    for(size_t i = 0; i < stats->fault_count && !known; i++){
+        known = stats->faults[i].kind == kind && stats->faults[i].pc == chip8->PC;
+    }
+    if(!known){
+        chip8_fuzz_fault_t *fault = &stats->faults[stats->fault_count++];
+        *fault = (chip8_fuzz_fault_t){
+            .kind = kind,
+            .pc = chip8->PC,
+            .instr = (chip8->RAM[chip8->PC] << 8) | chip8->RAM[(chip8->PC + 1) & 0xFFFF],
+            .cycle = before,
+        };
+        save_fault(w, fault);
+    }
+    pthread_mutex_unlock(&fuzz->lock);
+}
+
+// sorted insert, dropped if the input is full
+static void insert_event(worker_t *w, chip8_key_event_t event){
+    if(w->event_count == MAX_EVENTS) return;
+    size_t at = w->event_count++;
+    for(; at > 0 && w->events[at - 1].cycle > event.cycle; at--) w->events[at] = w->events[at - 1];
+    w->events[at] = event;
+}
+
+static chip8_key_event_t remove_event(worker_t *w, size_t at){
+    const chip8_key_event_t event = w->events[at];
+    memmove(&w->events[at], &w->events[at + 1], (--w->event_count - at) * sizeof event);
+    return event;
+}
+
+static void mutate(worker_t *w){
+    const uint64_t cycles = w->fuzz->config->cycles;
+    const int64_t rate = w->fuzz->config->instr_rate;
+    const unsigned rounds = 1 + (unsigned)below(w, HAVOC_ROUNDS);
+    for(unsigned r = 0; r < rounds; r++){
+        switch(below(w, 6)){
+            case 0: {
+                // hold a key for up to half a second
+                const uint8_t key = (uint8_t)below(w, 16);
+                const uint64_t at = below(w, cycles), hold = 1 + below(w, rate / 2);
+                insert_event(w, (chip8_key_event_t){ at, key, true });
+                insert_event(w, (chip8_key_event_t){ at + hold, key, false });
+                break;
+            }
+            case 1:
+                if(w->event_count) remove_event(w, below(w, w->event_count));
+                break;
+            case 2:
+                // move an event by up to a tenth of a second either way
+                if(w->event_count){
+                    chip8_key_event_t event = remove_event(w, below(w, w->event_count));
+                    const int64_t delta = (int64_t)below(w, rate / 5 + 1) - rate / 10;
+                    event.cycle = delta < 0 && (uint64_t)-delta > event.cycle ? 0 : event.cycle + delta;
+                    insert_event(w, event);
+                }
+                break;
+            case 3:
+                if(w->event_count) w->events[below(w, w->event_count)].key = (uint8_t)below(w, 16);
+                break;
+            case 4: {
+                // our events up to a random cycle, another input's from there on
+                const input_t *other = &w->corpus[below(w, w->corpus_count)];
+                const uint64_t at = below(w, cycles);
+                while(w->event_count > 0 && w->events[w->event_count - 1].cycle >= at) w->event_count--;
+                for(size_t i = 0; i < other->count && w->event_count < MAX_EVENTS; i++){
+                    if(other->events[i].cycle >= at) w->events[w->event_count++] = other->events[i];
+                }
+                break;
+            }
+            default:
+                // now and then start over from no input at all
+                if(below(w, 8) == 0) w->event_count = 0;
+                break;
+        }
+    }
+}
+
+static void run_input(worker_t *w){
+    uint64_t before = 0;
+    const chip8_fault_t fault = execute(w, &before);
+    w->executions++;
+    if(new_coverage(w) || w->corpus_count == 0) keep_input(w);
+    if(fault != FAULT_NONE) report_fault(w, fault, before);
+}
+
+static void *worker_main(void *arg){
+    worker_t *w = arg;
+    chip8_restore(w->chip8, &w->fuzz->boot);
+    // whatever the ROM does with no key pressed comes first
+    w->event_count = 0;
+    run_input(w);
+    while(w->corpus_count > 0 && now_seconds() < w->fuzz->deadline){
+        const input_t *parent = &w->corpus[below(w, w->corpus_count)];
+        memcpy(w->events, parent->events, parent->count * sizeof parent->events[0]);
+        w->event_count = parent->count;
+        mutate(w);
+        run_input(w);
+    }
+    return NULL;
+}
+
+static void free_worker(worker_t *w){
+    for(size_t i = 0; i < w->corpus_count; i++) free(w->corpus[i].events);
+    free(w->corpus);
+    free(w->trace);
+    free(w->virgin);
+    chip8_destroy(w->chip8);
+}
+
+bool chip8_fuzz_run(const chip8_t *boot, const chip8_fuzz_config_t *config, chip8_fuzz_stats_t *stats){
+    unsigned threads = config->threads;
+    if(threads == 0){
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (unsigned)cores : 1;
+    }
+    *stats = (chip8_fuzz_stats_t){ .threads = threads };
+    fuzz_t *fuzz = calloc(1, sizeof *fuzz);
+    worker_t *workers = calloc(threads, sizeof *workers);
+    pthread_t *tids = calloc(threads, sizeof *tids);
+    bool ok = fuzz != NULL && workers != NULL && tids != NULL;
+    for(unsigned i = 0; ok && i < threads; i++){
+        worker_t *w = &workers[i];
+        w->fuzz = fuzz;
+        w->chip8 = chip8_create();
+        w->trace = malloc(chip8_ram_size(boot));
+        w->virgin = malloc(chip8_ram_size(boot));
+        w->corpus = malloc(MAX_CORPUS * sizeof *w->corpus);
+        ok = w->chip8 != NULL && w->trace != NULL && w->virgin != NULL && w->corpus != NULL;
+        if(ok){
+            chip8_set_variant(w->chip8, boot->variant);
+            chip8_set_quirks(w->chip8, boot->quirks);
+            chip8_seed(w->chip8, boot->seed);
+            memset(w->virgin, 0xFF, chip8_ram_size(boot));
+            w->rng = config->seed ^ (i + 1) * 0xD1B54A32D192ED03u;
+        }
+    }
+    if(!ok){
+        perror("Could not allocate the fuzzers");
+    } else {
+        fuzz->config = config;
+        chip8_snapshot(boot, &fuzz->boot);
+        fuzz->image = boot;
+        fuzz->map_size = chip8_ram_size(boot);
+        for(int count = 1; count < 256; count++){
+            fuzz->buckets[count] = count <= 2 ? count : count == 3 ? 4 : count < 8 ? 8 : count < 16 ? 16 :
+                                   count < 32 ? 32 : count < 128 ? 64 : 128;
+        }
+        fuzz->stats = stats;
+        pthread_mutex_init(&fuzz->lock, NULL);
+        const double start = now_seconds();
+        fuzz->deadline = start + config->seconds;
+        unsigned started = 0;
+        for(; started < threads; started++){
+            if(pthread_create(&tids[started], NULL, worker_main, &workers[started]) != 0) break;
+        }
+        for(unsigned i = 0; i < started; i++) pthread_join(tids[i], NULL);
+        stats->seconds = now_seconds() - start;
+        pthread_mutex_destroy(&fuzz->lock);
+        if(started < threads){
+            fprintf(stderr, "Could not start the fuzzer threads\n");
+            ok = false;
+        }
+        for(unsigned i = 0; i < threads; i++){
+            stats->executions += workers[i].executions;
+            stats->instructions += workers[i].instructions;
+            stats->corpus += workers[i].corpus_count;
+        }
+        for(size_t e = 0; e < fuzz->map_size; e++){
+            bool taken = false;
+            for(unsigned i = 0; i < threads && !taken; i++) taken = workers[i].virgin[e] != 0xFF;
+            stats->edges += taken;
+        }
+    }
+    for(unsigned i = 0; workers != NULL && i < threads; i++) free_worker(&workers[i]);
+    free(tids);
+    free(workers);
+    free(fuzz);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef CHIP8_FUZZ_H
+#define CHIP8_FUZZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Coverage guided fuzzing of a ROM's keypad input, in process: every execution restores the
+// machine from a snapshot taken right after the ROM was loaded, plays a schedule of key events
+// into it on the switch interpreter and records which PC to PC edges it took. Schedules that
+// take an edge (or an edge a new number of times) no earlier one did are kept and mutated
+// further. Runs that end in a fault (chip8_fault_t) are saved as input movies, so chip8
+// -replay takes the machine to the faulting instruction again. Besides the stack faults the
+// engines report, the fuzzer reports FAULT_MEMORY for instructions that would access memory past
+// the variant's RAM (or run off its end), which the engines silently wrap.
+
+#define CHIP8_FUZZ_MAX_FAULTS 64     // distinct faults kept, by kind and PC
+
+typedef struct {
+    uint32_t instr_rate;            // instructions per emulated second, for the timers and the movies
+    uint64_t cycles;                // instructions per execution
+    double seconds;                 // how long to fuzz
+    unsigned threads;               // independent fuzzers, one per thread (0 = one per core)
+    uint64_t seed;                  // of the mutations, the machine keeps the snapshot's CXNN seed
+    const char *fault_dir;          // directory the fault movies are written to, NULL: not written
+} chip8_fuzz_config_t;
+
+typedef struct {
+    chip8_fault_t kind;
+    uint16_t pc;
+    uint16_t instr;
+    uint64_t cycle;                 // instructions run before the faulting one
+    char movie_path[256];           // empty if it was not saved
+} chip8_fuzz_fault_t;
+
+typedef struct {
+    uint64_t executions;
+    uint64_t instructions;
+    double seconds;                 // wall time
+    unsigned threads;
+    size_t edges;                   // distinct edges taken by any thread
+    size_t corpus;                  // inputs kept, over all threads
+    size_t fault_count;
+    chip8_fuzz_fault_t faults[CHIP8_FUZZ_MAX_FAULTS];
+} chip8_fuzz_stats_t;
+
+// fuzz the ROM loaded into `boot` (freshly, by init_chip8 or chip8_load_rom) with its variant,
+// quirks and seed; false if the fuzzers could not be set up
+bool chip8_fuzz_run(const chip8_t *boot, const chip8_fuzz_config_t *config, chip8_fuzz_stats_t *stats);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef CHIP8_INTERNAL_H
+#define CHIP8_INTERNAL_H
+
+#include <time.h>
+
+#include "chip8_core.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// what a quirk profile changes, resolved per chip8_quirks_t by chip8_quirk_set. The interpreter is
+// instantiated once per profile with these as constants, the predecode engine picks handlers by them
+// and the JIT emits code for them, so no engine tests a quirk per instruction
+typedef enum {
+    INDEX_KEEP,                     // FX55/FX65 leave I alone
+    INDEX_ADD_X,                    // I += X (CHIP-48)
+    INDEX_ADD_X1,                   // I += X + 1 (COSMAC VIP, XO-CHIP)
+} chip8_index_quirk_t;
+
+typedef struct {
+    bool shift_vy;                  // 8XY6/8XYE shift VY into VX instead of VX in place
+    chip8_index_quirk_t index;
+    bool jump_vx;                   // BXNN jumps to XNN + VX instead of NNN + V0
+    bool vf_reset;                  // 8XY1/8XY2/8XY3 clear VF
+    bool wrap;                      // sprites wrap around the display edges instead of being clipped
+    bool display_wait;              // DXYN waits for the next 60Hz tick
+} chip8_quirk_set_t;
+
+const chip8_quirk_set_t *chip8_quirk_set(const chip8_t *chip8);
+
+// instruction bodies shared by the execution engines
+void chip8_draw_sprite(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N);
+void chip8_draw_sprite_wrap(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N);
+void chip8_wait_key(chip8_t *chip8, uint8_t X);
+void chip8_clear_display(chip8_t *chip8);
+
+// the instruction just fetched cannot be carried out: stay on it and stop the machine with
+// `fault`, or stop in the debugger if one is attached
+void chip8_fault(chip8_t *chip8, chip8_fault_t fault);
+
+// display wait quirk: true (staying on the DXYN) until a 60Hz tick came since the last draw
+static inline bool chip8_wait_vblank(chip8_t *chip8){
+    if(!chip8->vblank){
+        chip8->PC -= 2;
+        return true;
+    }
+    chip8->vblank = false;
+    return false;
+}
+
+// a taken skip; on XO-CHIP it steps over the whole 4 byte F000 NNNN
+static inline void chip8_skip_next(chip8_t *chip8){
+    const bool long_instr = chip8->variant == VARIANT_XOCHIP && chip8->RAM[chip8->PC] == 0xF0 && chip8->RAM[(chip8->PC + 1) & 0xFFFF] == 0x00;
+    chip8->PC += long_instr ? 4 : 2;
+}
+
+// SUPER-CHIP / XO-CHIP instructions that are no-ops (or plain skips) on CHIP-8; the predecode and
+// JIT engines leave them to emulate_instruction when the variant implements them
+static inline bool chip8_extended_opcode(uint16_t instr){
+    const uint8_t NN = instr & 0xFF;
+    switch(instr >> 12){
+        case 0x0: return (instr & 0xFFF0) == 0x00C0 || (instr & 0xFFF0) == 0x00D0 || (instr >= 0x00FB && instr <= 0x00FF);
+        case 0x5: return (instr & 0xF) == 2 || (instr & 0xF) == 3;
+        case 0xF: return instr == 0xF000 || instr == 0xF002 || NN == 0x01 || NN == 0x30 || NN == 0x3A || NN == 0x75 || NN == 0x85;
+        default: return false;
+    }
+}
+
+// next number of the per-instance random sequence (splitmix64), used by CXNN
+static inline uint64_t chip8_random(chip8_t *chip8){
+    uint64_t z = (chip8->rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// instruction profiler, chip8_profile.c
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_CLOCK_UNIT "TSC cycles"
+static inline uint64_t profile_clock(void){
+    return __rdtsc();
+}
+#else
+#define PROFILE_CLOCK_UNIT "ns"
+static inline uint64_t profile_clock(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+// charge an instruction, decoded as `variant` decodes it, to its opcode kind and PC
+void profile_count(struct chip8_profile *profile, chip8_variant_t variant, uint16_t pc, uint16_t instr, uint64_t ticks);
+
+// execution trace, chip8_trace.c: append the record of the instruction that just ran at `pc`,
+// `V` being the registers before it
+void trace_record(chip8_t *chip8, uint16_t pc, uint16_t instr, const uint8_t *V);
+
+// debugger, chip8_debug.c: whether chip8_run_cycles has to check every instruction, the checks
+// before and after one (true: stop), and the fault / invalid opcode stop, which pauses the machine
+bool debug_armed(const struct chip8_debug *debug);
+bool debug_before(chip8_t *chip8);
+bool debug_after(chip8_t *chip8);
+void debug_fault(chip8_t *chip8, const char *what, uint16_t addr);
+
+// predecoded dispatch engine, chip8_predecode.c
+bool predecode_init(chip8_t *chip8);
+void predecode_free(chip8_t *chip8);
+void predecode_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len);
+uint64_t predecode_run(chip8_t *chip8, uint64_t cycles);
+
+// x86-64 basic-block recompiler, chip8_jit.c
+bool jit_init(chip8_t *chip8);
+void jit_free(chip8_t *chip8);
+void jit_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len);
+uint64_t jit_run(chip8_t *chip8, uint64_t cycles);
+
+// ahead-of-time compiled blocks, chip8_aot.c
+bool aot_init(chip8_t *chip8);
+void aot_free(chip8_t *chip8);
+void aot_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len);
+uint64_t aot_run(chip8_t *chip8, uint64_t cycles);
+
+#endif
@@ -0,0 +1,587 @@
+#define _DEFAULT_SOURCE
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "chip8_core.h"
+#include "chip8_internal.h"
+
+// Basic-block recompiler: straight-line runs of instructions starting at PC are translated into
+// x86-64 code and cached by start address. Inside a block every V register it touches and I live
+// in host registers; they are loaded on entry and written back on every exit. A block ends at
+// 1NNN/2NNN/00EE/BNNN/skips, after an FX33/FX55 whose stores dropped the block itself, or just
+// before an instruction it cannot translate (00E0, DXYN, FX0A, ...), which is then run by
+// emulate_instruction. CXNN, FX33 and FX55 call small C helpers from the block.
+//
+// A block is called as `uint32_t block(chip8_t *chip8, uint32_t budget)` and returns the number of
+// instructions it executed. It counts the budget down in ecx before every instruction so
+// chip8_run_cycles stops on exactly the same instruction as the interpreters, and a block ending
+// in a jump back to its own start loops natively until the budget runs out. Quirks are resolved
+// at translation time, the code of a block is what the profile does and nothing else.
+// The code buffer is never writable and executable at once (W^X): it is one shared memory object
+// mapped twice, blocks are emitted through a read/write view and run from a read/execute one.
+
+#if defined(__x86_64__)
+
+#define RAM_SIZE (sizeof ((chip8_t*)0)->RAM)
+#define JIT_CODE_SIZE (1u << 20)
+#define JIT_MAX_BLOCK 64
+// worst case code size of one block: prologue, epilogue and per instruction body plus exit stub
+#define JIT_MAX_BLOCK_CODE (512 + JIT_MAX_BLOCK * 256)
+
+typedef uint32_t (*jit_block_fn)(chip8_t *chip8, uint32_t budget);
+
+struct chip8_jit {
+    uint8_t *code;                  // writable view of the buffer holding all translated blocks
+    uint8_t *exec;                  // executable view of the same buffer
+    size_t used;
+    jit_block_fn entry[RAM_SIZE];   // block starting at each address, NULL if not translated yet
+    uint32_t end[RAM_SIZE];         // one past the last byte read by that block
+    uint8_t covered[RAM_SIZE];      // number of translated blocks reading each byte
+};
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// host registers handed out to V registers and I; rdi holds chip8, esi the budget passed in,
+// ecx the remaining budget, rax/rdx are scratch
+static const uint8_t reg_pool[] = { RBX, RBP, R8, R9, R10, R11, R12, R13, R14, R15 };
+#define REG_I 16
+
+typedef enum {
+    OP_NORMAL,                      // translated, execution continues with the next instruction
+    OP_TERMINATOR,                  // translated, sets PC and ends the block
+    OP_FALLBACK,                    // left to emulate_instruction
+} op_kind_t;
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *p;
+} emitter_t;
+
+static void emit8(emitter_t *e, uint8_t b) { *e->p++ = b; }
+static void emit16(emitter_t *e, uint16_t v) { memcpy(e->p, &v, 2); e->p += 2; }
+static void emit32(emitter_t *e, uint32_t v) { memcpy(e->p, &v, 4); e->p += 4; }
+
+static void rex(emitter_t *e, uint8_t r, uint8_t b) { emit8(e, 0x40 | ((r >> 3) << 2) | (b >> 3)); }
+static void modrm_rr(emitter_t *e, uint8_t r, uint8_t b) { emit8(e, 0xC0 | (r & 7) << 3 | (b & 7)); }
+// [rdi + disp32]
+static void modrm_mem(emitter_t *e, uint8_t r, uint32_t disp) { emit8(e, 0x80 | (r & 7) << 3 | RDI); emit32(e, disp); }
+
+// <op> dst8, src8 (opcode is the r/m8, r8 form: add 00, or 08, and 20, sub 28, xor 30, cmp 38, mov 88)
+static void op_rr8(emitter_t *e, uint8_t opc, uint8_t dst, uint8_t src) {
+    rex(e, src, dst); emit8(e, opc); modrm_rr(e, src, dst);
+}
+// <op> dst8, imm8 (group 1 digit: add 0, or 1, and 4, sub 5, xor 6, cmp 7)
+static void op_ri8(emitter_t *e, uint8_t digit, uint8_t dst, uint8_t imm) {
+    rex(e, 0, dst); emit8(e, 0x80); modrm_rr(e, digit, dst); emit8(e, imm);
+}
+// <op> dst32, src32 (add 01, mov 89)
+static void op_rr32(emitter_t *e, uint8_t opc, uint8_t dst, uint8_t src) {
+    rex(e, src, dst); emit8(e, opc); modrm_rr(e, src, dst);
+}
+static void mov_ri8(emitter_t *e, uint8_t dst, uint8_t imm) { rex(e, 0, dst); emit8(e, 0xB0 | (dst & 7)); emit8(e, imm); }
+static void mov_ri32(emitter_t *e, uint8_t dst, uint32_t imm) { rex(e, 0, dst); emit8(e, 0xB8 | (dst & 7)); emit32(e, imm); }
+static void load8(emitter_t *e, uint8_t reg, uint32_t disp) { rex(e, reg, RDI); emit8(e, 0x8A); modrm_mem(e, reg, disp); }
+static void store8(emitter_t *e, uint8_t reg, uint32_t disp) { rex(e, reg, RDI); emit8(e, 0x88); modrm_mem(e, reg, disp); }
+static void load16zx(emitter_t *e, uint8_t reg, uint32_t disp) { rex(e, reg, RDI); emit8(e, 0x0F); emit8(e, 0xB7); modrm_mem(e, reg, disp); }
+static void store16(emitter_t *e, uint8_t reg, uint32_t disp) { emit8(e, 0x66); rex(e, reg, RDI); emit8(e, 0x89); modrm_mem(e, reg, disp); }
+static void store16_imm(emitter_t *e, uint32_t disp, uint16_t imm) { emit8(e, 0x66); emit8(e, 0xC7); modrm_mem(e, 0, disp); emit16(e, imm); }
+// movzx eax, src8
+static void movzx_eax8(emitter_t *e, uint8_t src) { rex(e, RAX, src); emit8(e, 0x0F); emit8(e, 0xB6); modrm_rr(e, RAX, src); }
+// movzx eax, src16
+static void movzx_eax16(emitter_t *e, uint8_t src) { rex(e, RAX, src); emit8(e, 0x0F); emit8(e, 0xB7); modrm_rr(e, RAX, src); }
+// setcc dl
+static void setcc_dl(emitter_t *e, uint8_t cc) { emit8(e, 0x0F); emit8(e, 0x90 | cc); modrm_rr(e, 0, RDX); }
+static void push(emitter_t *e, uint8_t reg) { if(reg >= 8) emit8(e, 0x41); emit8(e, 0x50 | (reg & 7)); }
+static void pop(emitter_t *e, uint8_t reg) { if(reg >= 8) emit8(e, 0x41); emit8(e, 0x58 | (reg & 7)); }
+// jcc/jmp rel32 with the target patched later, returns the location of the displacement
+static uint8_t *jcc_fwd(emitter_t *e, uint8_t cc) { emit8(e, 0x0F); emit8(e, 0x80 | cc); emit32(e, 0); return e->p - 4; }
+static uint8_t *jmp_fwd(emitter_t *e) { emit8(e, 0xE9); emit32(e, 0); return e->p - 4; }
+static void patch(uint8_t *disp, uint8_t *target) { uint32_t rel = (uint32_t)(target - (disp + 4)); memcpy(disp, &rel, 4); }
+
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+#define OFF(field) ((uint32_t)offsetof(chip8_t, field))
+
+// decide how `instr` is handled and which registers it needs (bits 0-15 for V, REG_I for I)
+static op_kind_t classify(chip8_variant_t variant, const chip8_quirk_set_t *q, uint16_t instr, uint32_t *regs){
+    *regs = 0;
+    if(variant != VARIANT_CHIP8 && chip8_extended_opcode(instr)) return OP_FALLBACK;
+    // XO-CHIP skips step over F000 NNNN as a whole, emit_skip does not know about it
+    if(variant == VARIANT_XOCHIP && ((instr >> 12) == 0x3 || (instr >> 12) == 0x4 || (instr >> 12) == 0x5 ||
+                                     (instr >> 12) == 0x9 || (instr & 0xF0FF) == 0xE09E || (instr & 0xF0FF) == 0xE0A1)) {
+        return OP_FALLBACK;
+    }
+    const uint8_t X = (instr & 0x0F00) >> 8;
+    const uint8_t Y = (instr & 0x00F0) >> 4;
+    const uint8_t NN = instr & 0x00FF;
+    const uint32_t vx = 1u << X, vy = 1u << Y, vf = 1u << 0xF, vi = 1u << REG_I;
+    switch(instr >> 12) {
+        case 0x0:
+            if(NN == 0xE0) return OP_FALLBACK;
+            return NN == 0xEE ? OP_TERMINATOR : OP_NORMAL;
+        case 0x1: case 0x2: return OP_TERMINATOR;
+        case 0x3: case 0x4: *regs = vx; return OP_TERMINATOR;
+        case 0x5: case 0x9: *regs = vx | vy; return OP_TERMINATOR;
+        case 0x6: case 0x7: *regs = vx; return OP_NORMAL;
+        case 0x8:
+            switch(instr & 0x000F) {
+                case 0x0: *regs = vx | vy; return OP_NORMAL;
+                case 0x1: case 0x2: case 0x3: *regs = vx | vy | (q->vf_reset ? vf : 0); return OP_NORMAL;
+                case 0x4: case 0x5: case 0x7: *regs = vx | vy | vf; return OP_NORMAL;
+                case 0x6: case 0xE: *regs = vx | vf | (q->shift_vy ? vy : 0); return OP_NORMAL;
+                default: return OP_FALLBACK;
+            }
+        case 0xA: *regs = vi; return OP_NORMAL;
+        case 0xB: *regs = q->jump_vx ? vx : 1u; return OP_TERMINATOR;
+        case 0xC: *regs = vx; return OP_NORMAL;
+        case 0xD: return OP_FALLBACK;
+        case 0xE:
+            if(NN == 0x9E || NN == 0xA1) { *regs = vx; return OP_TERMINATOR; }
+            return OP_NORMAL;
+        default:
+            switch(NN) {
+                case 0x07: case 0x15: case 0x18: *regs = vx; return OP_NORMAL;
+                case 0x1E: case 0x29: *regs = vx | vi; return OP_NORMAL;
+                case 0x65: *regs = ((2u << X) - 1) | vi; return OP_NORMAL;
+                case 0x33: *regs = vx | vi; return OP_NORMAL;
+                case 0x55: *regs = ((2u << X) - 1) | vi; return OP_NORMAL;
+                case 0x0A: return OP_FALLBACK;
+                default: return OP_NORMAL;
+            }
+    }
+}
+
+typedef struct {
+    const chip8_quirk_set_t *q;
+    uint8_t host[17];               // host register of each V register and I
+    uint32_t used;                  // mask of allocated registers
+    emitter_t e;
+    uint16_t start;                 // address of the first instruction
+    uint8_t *loop_top;              // code of the first instruction, after the register loads
+    int n_pushed;                   // callee-saved registers pushed by the prologue
+    uint8_t *epilogue_jumps[JIT_MAX_BLOCK * 3 + 1];
+    int n_epilogue_jumps;
+} block_ctx_t;
+
+// return the executed instruction count (budget - remaining) through the shared epilogue;
+// `undo` leaves the current instruction unexecuted, its budget was already taken
+static void emit_return(block_ctx_t *ctx, bool undo){
+    emitter_t *e = &ctx->e;
+    if(undo) { emit8(e, 0x83); emit8(e, 0xC1); emit8(e, 0x01); }                   // add ecx, 1
+    emit8(e, 0x89); emit8(e, 0xF0);                                                // mov eax, esi
+    emit8(e, 0x29); emit8(e, 0xC8);                                                // sub eax, ecx
+    ctx->epilogue_jumps[ctx->n_epilogue_jumps++] = jmp_fwd(e);
+}
+
+// set PC and leave the block
+static void emit_exit(block_ctx_t *ctx, uint16_t pc, bool undo){
+    store16_imm(&ctx->e, OFF(PC), pc);
+    emit_return(ctx, undo);
+}
+
+// PC = skip ? pc + 4 : pc + 2, flags already set by the caller
+static void emit_skip(block_ctx_t *ctx, uint16_t pc, uint8_t skip_cc){
+    emitter_t *e = &ctx->e;
+    mov_ri32(e, RAX, (uint16_t)(pc + 2));
+    mov_ri32(e, RDX, (uint16_t)(pc + 4));
+    emit8(e, 0x0F); emit8(e, 0x40 | skip_cc); modrm_rr(e, RAX, RDX);   // cmovcc eax, edx
+    store16(e, RAX, OFF(PC));
+}
+
+// helpers called from blocks, they see the machine's V and I as written back before the call.
+// The stores return true if they dropped the calling block starting at `start`
+static uint8_t jit_random(chip8_t *chip8, uint32_t NN, uint32_t unused) {
+    (void)unused;
+    return NN & (chip8_random(chip8) % 256 + 1);
+}
+static bool jit_bcd(chip8_t *chip8, uint32_t X, uint32_t start) {
+    chip8->RAM[chip8->I] = chip8->V[X] / 100;
+    chip8->RAM[(chip8->I + 1) & 0xFFFF] = (chip8->V[X] / 10) % 10;
+    chip8->RAM[(chip8->I + 2) & 0xFFFF] = chip8->V[X] % 10;
+    chip8_invalidate_code(chip8, chip8->I, 3);
+    return chip8->jit->entry[start] == NULL;
+}
+static bool jit_store(chip8_t *chip8, uint32_t X, uint32_t start) {
+    for(uint32_t i = 0; i <= X; i++) chip8->RAM[(chip8->I + i) & 0xFFFF] = chip8->V[i];
+    chip8_invalidate_code(chip8, chip8->I, X + 1);
+    return chip8->jit->entry[start] == NULL;
+}
+
+// call fn(chip8, arg, arg2); the block's caller-saved registers (chip8, budgets, r8-r11) survive
+// it, the result is left in eax
+static void emit_call(block_ctx_t *ctx, uintptr_t fn, uint32_t arg, uint32_t arg2){
+    emitter_t *e = &ctx->e;
+    uint8_t saved[3 + 4] = { RDI, RSI, RCX };
+    int n = 3;
+    for(int r = 0; r <= REG_I; r++) {
+        if((ctx->used & (1u << r)) && ctx->host[r] >= R8 && ctx->host[r] <= R11) saved[n++] = ctx->host[r];
+    }
+    for(int i = 0; i < n; i++) push(e, saved[i]);
+    // the stack is 16 byte aligned at the call: return address, prologue pushes and these
+    const bool pad = (1 + ctx->n_pushed + n) % 2 != 0;
+    if(pad) { emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x08); }    // sub rsp, 8
+    mov_ri32(e, RSI, arg);
+    mov_ri32(e, RDX, arg2);
+    const uint64_t target = fn;
+    emit8(e, 0x48); emit8(e, 0xB8); memcpy(e->p, &target, 8); e->p += 8;          // mov rax, fn
+    emit8(e, 0xFF); emit8(e, 0xD0);                                                // call rax
+    if(pad) { emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08); }    // add rsp, 8
+    for(int i = n - 1; i >= 0; i--) pop(e, saved[i]);
+}
+
+// emit one instruction at `pc`; for terminators this also stores PC and leaves the block
+static void emit_instruction(block_ctx_t *ctx, uint16_t pc, uint16_t instr){
+    emitter_t *e = &ctx->e;
+    const uint8_t X = (instr & 0x0F00) >> 8;
+    const uint8_t Y = (instr & 0x00F0) >> 4;
+    const uint8_t N = instr & 0x000F;
+    const uint8_t NN = instr & 0x00FF;
+    const uint16_t NNN = instr & 0x0FFF;
+    const uint8_t vx = ctx->host[X], vy = ctx->host[Y], vf = ctx->host[0xF], ri = ctx->host[REG_I];
+    const chip8_quirk_set_t *q = ctx->q;
+    const uint16_t next = pc + 2;
+
+    switch(instr >> 12) {
+        case 0x0:
+            if(NN == 0xEE) {
+                // SP == 0 would underflow the stack, let the interpreter handle it
+                emit8(e, 0x0F); emit8(e, 0xB6); modrm_mem(e, RAX, OFF(SP));        // movzx eax, byte [SP]
+                emit8(e, 0x85); emit8(e, 0xC0);                                    // test eax, eax
+                uint8_t *bail = jcc_fwd(e, CC_E);
+                emit8(e, 0xFF); emit8(e, 0xC8);                                    // dec eax
+                store8(e, RAX, OFF(SP));
+                emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x84); emit8(e, 0x47); emit32(e, OFF(stack)); // movzx eax, word [rdi+rax*2+stack]
+                store16(e, RAX, OFF(PC));
+                emit_return(ctx, false);
+                patch(bail, e->p);
+                emit_exit(ctx, pc, true);
+            }
+            return;
+        case 0x1:
+            if(NNN == ctx->start) {
+                emit8(e, 0xE9); emit32(e, (uint32_t)(ctx->loop_top - (e->p + 4)));   // jmp loop_top
+            } else {
+                emit_exit(ctx, NNN, false);
+            }
+            return;
+        case 0x2: {
+            // a full stack is reported by the interpreter
+            emit8(e, 0x0F); emit8(e, 0xB6); modrm_mem(e, RAX, OFF(SP));            // movzx eax, byte [SP]
+            emit8(e, 0x83); emit8(e, 0xF8); emit8(e, 12);                          // cmp eax, 12
+            uint8_t *bail = jcc_fwd(e, CC_AE);
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47); emit32(e, OFF(stack)); emit16(e, next); // mov word [rdi+rax*2+stack], next
+            emit8(e, 0xFE); modrm_mem(e, 0, OFF(SP));                              // inc byte [SP]
+            emit_exit(ctx, NNN, false);
+            patch(bail, e->p);
+            emit_exit(ctx, pc, true);
+            return;
+        }
+        case 0x3: op_ri8(e, 7, vx, NN); emit_skip(ctx, pc, CC_E); break;
+        case 0x4: op_ri8(e, 7, vx, NN); emit_skip(ctx, pc, CC_NE); break;
+        case 0x5: op_rr8(e, 0x38, vx, vy); emit_skip(ctx, pc, CC_E); break;
+        case 0x9: op_rr8(e, 0x38, vx, vy); emit_skip(ctx, pc, CC_NE); break;
+        case 0x6: mov_ri8(e, vx, NN); return;
+        case 0x7: op_ri8(e, 0, vx, NN); return;
+        case 0x8:
+            switch(N) {
+                case 0x0: op_rr8(e, 0x88, vx, vy); return;
+                case 0x1: op_rr8(e, 0x08, vx, vy); if(q->vf_reset) mov_ri8(e, vf, 0); return;
+                case 0x2: op_rr8(e, 0x20, vx, vy); if(q->vf_reset) mov_ri8(e, vf, 0); return;
+                case 0x3: op_rr8(e, 0x30, vx, vy); if(q->vf_reset) mov_ri8(e, vf, 0); return;
+                case 0x4:
+                    // VF is written before VX, exactly like the interpreter
+                    op_rr8(e, 0x88, RAX, vx); op_rr8(e, 0x00, RAX, vy); setcc_dl(e, CC_B);
+                    op_rr8(e, 0x88, vf, RDX); op_rr8(e, 0x00, vx, vy);
+                    return;
+                case 0x5:
+                    op_rr8(e, 0x38, vx, vy); setcc_dl(e, CC_AE);
+                    op_rr8(e, 0x88, vf, RDX); op_rr8(e, 0x28, vx, vy);
+                    return;
+                case 0x6: {
+                    // the source is read again after VF is written, like the interpreter does
+                    const uint8_t src = q->shift_vy ? vy : vx;
+                    op_rr8(e, 0x88, RDX, src); op_ri8(e, 4, RDX, 0x01); op_rr8(e, 0x88, vf, RDX);
+                    if(src != vx) op_rr8(e, 0x88, vx, src);
+                    rex(e, 0, vx); emit8(e, 0xD0); modrm_rr(e, 5, vx);               // shr vx, 1
+                    return;
+                }
+                case 0x7:
+                    op_rr8(e, 0x38, vy, vx); setcc_dl(e, CC_AE); op_rr8(e, 0x88, vf, RDX);
+                    op_rr8(e, 0x88, RAX, vy); op_rr8(e, 0x28, RAX, vx); op_rr8(e, 0x88, vx, RAX);
+                    return;
+                case 0xE: {
+                    const uint8_t src = q->shift_vy ? vy : vx;
+                    op_rr8(e, 0x88, RDX, src);
+                    rex(e, 0, RDX); emit8(e, 0xC0); modrm_rr(e, 5, RDX); emit8(e, 7);  // shr dl, 7
+                    op_rr8(e, 0x88, vf, RDX);
+                    if(src != vx) op_rr8(e, 0x88, vx, src);
+                    op_rr8(e, 0x00, vx, vx);
+                    return;
+                }
+            }
+            return;
+        case 0xA: mov_ri32(e, ri, NNN); return;
+        case 0xB:
+            movzx_eax8(e, q->jump_vx ? vx : ctx->host[0]);
+            emit8(e, 0x05); emit32(e, NNN);                                        // add eax, NNN
+            store16(e, RAX, OFF(PC));
+            break;
+        case 0xC:
+            emit_call(ctx, (uintptr_t)jit_random, NN, 0);
+            op_rr8(e, 0x88, vx, RAX);
+            return;
+        case 0xE:
+            if(NN != 0x9E && NN != 0xA1) return;
+            movzx_eax8(e, vx);
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F);                       // and eax, 0xF
+            emit8(e, 0x80); emit8(e, 0xBC); emit8(e, 0x07); emit32(e, OFF(keypad)); emit8(e, 0); // cmp byte [rdi+rax+keypad], 0
+            emit_skip(ctx, pc, NN == 0x9E ? CC_NE : CC_E);
+            break;
+        default:
+            switch(NN) {
+                case 0x07: load8(e, vx, OFF(delay_timer)); return;
+                case 0x15: store8(e, vx, OFF(delay_timer)); return;
+                case 0x18: store8(e, vx, OFF(sound_timer)); return;
+                case 0x1E: movzx_eax8(e, vx); op_rr32(e, 0x01, ri, RAX); return;
+                case 0x29:
+                    movzx_eax8(e, vx);
+                    emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80);                 // lea eax, [rax+rax*4]
+                    op_rr32(e, 0x89, ri, RAX);
+                    return;
+                case 0x33:
+                case 0x55: {
+                    for(uint8_t i = NN == 0x33 ? X : 0; i <= X; i++) store8(e, ctx->host[i], OFF(V) + i);
+                    store16(e, ri, OFF(I));
+                    emit_call(ctx, NN == 0x33 ? (uintptr_t)jit_bcd : (uintptr_t)jit_store, X, ctx->start);
+                    if(NN == 0x55 && q->index != INDEX_KEEP) {
+                        rex(e, 0, ri); emit8(e, 0x81); modrm_rr(e, 0, ri);               // add ri, X (+ 1)
+                        emit32(e, q->index == INDEX_ADD_X1 ? X + 1u : X);
+                    }
+                    // the stores dropped this very block: leave it, the rest is translated again
+                    emit8(e, 0x84); emit8(e, 0xC0);                                    // test al, al
+                    uint8_t *keep = jcc_fwd(e, CC_E);
+                    emit_exit(ctx, next, false);
+                    patch(keep, e->p);
+                    return;
+                }
+                case 0x65: {
+                    movzx_eax16(e, ri);
+                    // loads that would run past the end of RAM wrap around, the interpreter does that
+                    emit8(e, 0x3D); emit32(e, RAM_SIZE - (X + 1u));                  // cmp eax, RAM_SIZE - (X + 1)
+                    uint8_t *bail = jcc_fwd(e, CC_A);
+                    for(uint8_t i = 0; i <= X; i++) {
+                        const uint8_t reg = ctx->host[i];
+                        rex(e, reg, RDI); emit8(e, 0x8A); emit8(e, 0x84 | (reg & 7) << 3); emit8(e, 0x07); emit32(e, OFF(RAM) + i); // mov reg, [rdi+rax+RAM+i]
+                    }
+                    if(q->index != INDEX_KEEP) {
+                        rex(e, 0, ri); emit8(e, 0x81); modrm_rr(e, 0, ri);               // add ri, X (+ 1)
+                        emit32(e, q->index == INDEX_ADD_X1 ? X + 1u : X);
+                    }
+                    uint8_t *done = jmp_fwd(e);
+                    patch(bail, e->p);
+                    emit_exit(ctx, pc, true);
+                    patch(done, e->p);
+                    return;
+                }
+            }
+            return;
+    }
+    // skips and BNNN have stored PC themselves
+    emit_return(ctx, false);
+}
+
+static uint32_t untranslatable(chip8_t *chip8, uint32_t budget) { (void)chip8; (void)budget; return 0; }
+
+static jit_block_fn translate(struct chip8_jit *jit, chip8_t *chip8, uint16_t start){
+    block_ctx_t ctx = { .q = chip8_quirk_set(chip8), .start = start };
+    uint16_t instrs[JIT_MAX_BLOCK];
+    int n = 0;
+    bool terminated = false;
+
+    // pass 1: find the extent of the block and allocate host registers
+    for(uint32_t pc = start; n < JIT_MAX_BLOCK && pc + 1u < RAM_SIZE; pc += 2) {
+        const uint16_t instr = (chip8->RAM[pc] << 8) | chip8->RAM[pc + 1];
+        uint32_t regs;
+        const op_kind_t kind = classify(chip8->variant, ctx.q, instr, &regs);
+        if(kind == OP_FALLBACK) break;
+        if((uint32_t)__builtin_popcount(ctx.used | regs) > sizeof reg_pool) break;
+        ctx.used |= regs;
+        instrs[n++] = instr;
+        if(kind == OP_TERMINATOR) { terminated = true; break; }
+    }
+    if(jit->used + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE) {
+        // out of space, start over with an empty cache
+        memset(jit->entry, 0, sizeof jit->entry);
+        memset(jit->covered, 0, sizeof jit->covered);
+        jit->used = 0;
+    }
+    if(n == 0) {
+        jit->entry[start] = untranslatable;
+        jit->end[start] = start + 2u;
+        return untranslatable;
+    }
+
+    uint8_t pushed[sizeof reg_pool];
+    int n_pushed = 0;
+    int next_reg = 0;
+    for(int r = 0; r <= REG_I; r++) {
+        if(!(ctx.used & (1u << r))) continue;
+        ctx.host[r] = reg_pool[next_reg++];
+        const uint8_t h = ctx.host[r];
+        if(h == RBX || h == RBP || h >= R12) pushed[n_pushed++] = h;
+    }
+
+    // pass 2: emit code
+    ctx.e.start = ctx.e.p = jit->code + jit->used;
+    emitter_t *e = &ctx.e;
+    ctx.n_pushed = n_pushed;
+    for(int i = 0; i < n_pushed; i++) push(e, pushed[i]);
+    emit8(e, 0x89); emit8(e, 0xF1);                                                // mov ecx, esi
+    for(int r = 0; r < 16; r++) if(ctx.used & (1u << r)) load8(e, ctx.host[r], OFF(V) + r);
+    if(ctx.used & (1u << REG_I)) load16zx(e, ctx.host[REG_I], OFF(I));
+    ctx.loop_top = e->p;
+
+    uint8_t *budget_exits[JIT_MAX_BLOCK];
+    for(int i = 0; i < n; i++) {
+        emit8(e, 0x83); emit8(e, 0xE9); emit8(e, 0x01);                            // sub ecx, 1
+        budget_exits[i] = jcc_fwd(e, CC_B);
+        emit_instruction(&ctx, start + 2 * i, instrs[i]);
+    }
+    if(!terminated) emit_exit(&ctx, start + 2 * n, false);
+    for(int i = 0; i < n; i++) {
+        patch(budget_exits[i], e->p);
+        emit_exit(&ctx, start + 2 * i, true);
+    }
+
+    uint8_t *epilogue = e->p;
+    for(int r = 0; r < 16; r++) if(ctx.used & (1u << r)) store8(e, ctx.host[r], OFF(V) + r);
+    if(ctx.used & (1u << REG_I)) store16(e, ctx.host[REG_I], OFF(I));
+    for(int i = n_pushed - 1; i >= 0; i--) pop(e, pushed[i]);
+    emit8(e, 0xC3);                                                                 // ret
+    for(int i = 0; i < ctx.n_epilogue_jumps; i++) patch(ctx.epilogue_jumps[i], epilogue);
+
+    // code is position independent but for absolute calls, it runs as is from the executable view
+    const uint8_t *code = jit->exec + (e->start - jit->code);
+    jit->used += e->p - e->start;
+    jit_block_fn fn;
+    memcpy(&fn, &code, sizeof fn);
+    jit->entry[start] = fn;
+    jit->end[start] = start + 2u * n;
+    for(uint32_t a = start; a < start + 2u * n; a++) jit->covered[a]++;
+    return fn;
+}
+
+bool jit_init(chip8_t *chip8){
+    if(chip8->jit != NULL) {
+        jit_invalidate(chip8, 0, RAM_SIZE);
+        return true;
+    }
+    struct chip8_jit *jit = calloc(1, sizeof *jit);
+    if(jit == NULL) {
+        perror("Could not allocate the JIT block cache");
+        return false;
+    }
+    // an unnamed shared memory object, unlinked as soon as it exists, mapped writable and executable
+    // named uniquely even with batch threads setting up their engines at once
+    static atomic_uint serial;
+    char name[64];
+    snprintf(name, sizeof name, "/chip8-jit-%ld-%u", (long)getpid(), atomic_fetch_add(&serial, 1));
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) {
+        perror("Could not create the JIT code buffer");
+        free(jit);
+        return false;
+    }
+    shm_unlink(name);
+    jit->code = jit->exec = MAP_FAILED;
+    if(ftruncate(fd, JIT_CODE_SIZE) == 0) {
+        jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        jit->exec = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(jit->code == MAP_FAILED || jit->exec == MAP_FAILED) {
+        perror("Could not map the JIT code buffer");
+        if(jit->code != MAP_FAILED) munmap(jit->code, JIT_CODE_SIZE);
+        if(jit->exec != MAP_FAILED) munmap(jit->exec, JIT_CODE_SIZE);
+        free(jit);
+        return false;
+    }
+    chip8->jit = jit;
+    return true;
+}
+
+void jit_free(chip8_t *chip8){
+    if(chip8->jit == NULL) return;
+    munmap(chip8->jit->code, JIT_CODE_SIZE);
+    munmap(chip8->jit->exec, JIT_CODE_SIZE);
+    free(chip8->jit);
+    chip8->jit = NULL;
+}
+
+void jit_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len){
+    struct chip8_jit *jit = chip8->jit;
+    uint32_t start = addr > 0 ? addr - 1u : 0;
+    uint32_t end = (uint32_t)addr + len;
+    if(end > RAM_SIZE) end = RAM_SIZE;
+
+    // blocks that could not be translated only cover their own instruction
+    for(uint32_t a = start; a < end; a++) {
+        if(jit->entry[a] == untranslatable) jit->entry[a] = NULL;
+    }
+    bool hit = false;
+    for(uint32_t a = start; a < end && !hit; a++) hit = jit->covered[a] != 0;
+    if(!hit) return;
+
+    // drop the blocks overlapping the written range, which start at most one block length before it
+    const uint32_t first = start > 2u * JIT_MAX_BLOCK ? start - 2u * JIT_MAX_BLOCK : 0;
+    for(uint32_t a = first; a < end; a++) {
+        if(jit->entry[a] == NULL || jit->entry[a] == untranslatable || jit->end[a] <= start) continue;
+        for(uint32_t b = a; b < jit->end[a]; b++) jit->covered[b]--;
+        jit->entry[a] = NULL;
+    }
+}
+
+uint64_t jit_run(chip8_t *chip8, uint64_t cycles){
+    struct chip8_jit *jit = chip8->jit;
+    uint64_t done = 0;
+    while(done < cycles) {
+        const uint16_t pc = chip8->PC;
+        uint32_t executed = 0;
+        if(pc + 1u < RAM_SIZE) {
+            jit_block_fn fn = jit->entry[pc];
+            if(fn == NULL) fn = translate(jit, chip8, pc);
+            const uint64_t budget = cycles - done;
+            executed = fn(chip8, budget > UINT32_MAX ? UINT32_MAX : (uint32_t)budget);
+            chip8->cycles += executed;
+        }
+        if(executed == 0) {
+            // not translatable here (or a stack fault to report), interpret a single instruction
+            emulate_instruction(chip8);
+            executed = 1;
+        }
+        done += executed;
+        // blocks leave anything that can stop the machine to the interpreter
+        if(chip8->state != RUNNING) break;
+    }
+    return done;
+}
+
+#else
+
+bool jit_init(chip8_t *chip8){
+    (void)chip8;
+    fprintf(stderr, "The JIT engine is only available on x86-64\n");
+    return false;
+}
+
+void jit_free(chip8_t *chip8) { (void)chip8; }
+void jit_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len) { (void)chip8; (void)addr; (void)len; }
+uint64_t jit_run(chip8_t *chip8, uint64_t cycles) { (void)chip8; (void)cycles; return 0; }
+
+#endif
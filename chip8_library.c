@@ -0,0 +1,525 @@
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_library.h"
+
+// Library index file, every field little endian:
+//
+//   offset 0  "C8LB"
+//          4  u16 format version
+//          6  u16 reserved
+//          8  u32 entry count
+//         12  u32 size of the path block
+//         16  entries, sorted by SHA-1 then path, 40 bytes each:
+//               0 SHA-1, 20 u32 CRC-32, 24 u32 file size, 28 u32 path offset, 32 i64 mtime in ns
+//             then the path block, NUL terminated paths
+//
+// The index is written to a temporary file and renamed over the old one, so a reader never sees
+// half an index.
+
+#define INDEX_MAGIC "C8LB"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 16
+#define INDEX_ENTRY_SIZE 40
+#define SCAN_MAX_DEPTH 32
+
+static int map_file(const char *path, const uint8_t **data, size_t *size){
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0) return errno;
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        const int error = errno;
+        close(fd);
+        return error;
+    }
+    *size = (size_t)st.st_size;
+    *data = NULL;
+    // an empty file cannot be mapped, and has nothing to map
+    if(*size > 0){
+        void *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED){
+            const int error = errno;
+            close(fd);
+            return error;
+        }
+        *data = map;
+    }
+    close(fd);
+    return 0;
+}
+
+static void unmap_file(const uint8_t *data, size_t size){
+    if(data != NULL) munmap((void *)data, size);
+}
+
+bool chip8_rom_map(const char *path, chip8_rom_t *rom){
+    const int error = map_file(path, &rom->data, &rom->size);
+    if(error != 0){
+        errno = error;
+        perror("Failed to read the specified ROM file");
+        return false;
+    }
+    return true;
+}
+
+void chip8_rom_unmap(chip8_rom_t *rom){
+    unmap_file(rom->data, rom->size);
+    rom->data = NULL;
+    rom->size = 0;
+}
+
+static uint32_t rotl(uint32_t x, int n){
+    return x << n | x >> (32 - n);
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t *block){
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++){
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for(int i = 16; i < 80; i++) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for(int i = 0; i < 80; i++){
+        uint32_t f, k;
+        if(i < 20){
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if(i < 40){
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if(i < 60){
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        const uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void chip8_sha1(const void *data, size_t size, uint8_t digest[20]){
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    const uint8_t *p = data;
+    size_t left = size;
+    for(; left >= 64; left -= 64, p += 64) sha1_block(h, p);
+
+    // the rest, the 0x80 terminator and the length in bits fill one or two more blocks
+    uint8_t tail[128] = {0};
+    if(left > 0) memcpy(tail, p, left);
+    tail[left] = 0x80;
+    const size_t blocks = left < 56 ? 1 : 2;
+    const uint64_t bits = (uint64_t)size * 8;
+    for(int i = 0; i < 8; i++) tail[blocks * 64 - 1 - i] = (uint8_t)(bits >> (8 * i));
+    for(size_t b = 0; b < blocks; b++) sha1_block(h, tail + 64 * b);
+    for(int i = 0; i < 20; i++) digest[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+// reflected 0xEDB88320 a nibble at a time, the table is small enough to not need building
+uint32_t chip8_crc32(const void *data, size_t size){
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for(size_t i = 0; i < size; i++){
+        crc ^= p[i];
+        crc = (crc >> 4) ^ table[crc & 0xF];
+        crc = (crc >> 4) ^ table[crc & 0xF];
+    }
+    return ~crc;
+}
+
+void chip8_sha1_to_hex(const uint8_t digest[20], char hex[41]){
+    for(int i = 0; i < 20; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+}
+
+bool chip8_sha1_from_hex(const char *hex, uint8_t digest[20]){
+    if(strlen(hex) != 40) return false;
+    for(int i = 0; i < 40; i++){
+        if(!isxdigit((unsigned char)hex[i])) return false;
+    }
+    for(int i = 0; i < 20; i++){
+        const char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        digest[i] = (uint8_t)strtoul(pair, NULL, 16);
+    }
+    return true;
+}
+
+struct chip8_library {
+    const uint8_t *data;
+    size_t size;
+    size_t count;
+    const uint8_t *entries;
+    const char *paths;
+    size_t paths_size;
+};
+
+static void put(uint8_t *p, uint64_t value, int bytes){
+    for(int i = 0; i < bytes; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get(const uint8_t *p, int bytes){
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+chip8_library_t *chip8_library_open(const char *index_path){
+    chip8_library_t *library = calloc(1, sizeof *library);
+    if(library == NULL){
+        perror("Could not allocate the ROM library");
+        return NULL;
+    }
+    const int error = map_file(index_path, &library->data, &library->size);
+    if(error != 0){
+        errno = error;
+        perror("Could not open the ROM library index");
+        free(library);
+        return NULL;
+    }
+    const uint8_t *data = library->data;
+    bool ok = library->size >= INDEX_HEADER_SIZE && memcmp(data, INDEX_MAGIC, 4) == 0 && get(data + 4, 2) == INDEX_VERSION;
+    if(ok){
+        library->count = get(data + 8, 4);
+        library->paths_size = get(data + 12, 4);
+        library->entries = data + INDEX_HEADER_SIZE;
+        library->paths = (const char *)library->entries + library->count * INDEX_ENTRY_SIZE;
+        ok = INDEX_HEADER_SIZE + library->count * INDEX_ENTRY_SIZE + library->paths_size == library->size &&
+             (library->paths_size == 0 || library->paths[library->paths_size - 1] == '\0');
+    }
+    if(!ok){
+        fprintf(stderr, "%s is not a ROM library index\n", index_path);
+        chip8_library_close(library);
+        return NULL;
+    }
+    return library;
+}
+
+void chip8_library_close(chip8_library_t *library){
+    if(library == NULL) return;
+    unmap_file(library->data, library->size);
+    free(library);
+}
+
+size_t chip8_library_count(const chip8_library_t *library){
+    return library->count;
+}
+
+static bool library_entry(const chip8_library_t *library, size_t i, chip8_library_entry_t *entry){
+    const uint8_t *p = library->entries + i * INDEX_ENTRY_SIZE;
+    const size_t path = get(p + 28, 4);
+    if(path >= library->paths_size) return false;
+    memcpy(entry->sha1, p, 20);
+    entry->crc32 = (uint32_t)get(p + 20, 4);
+    entry->size = (uint32_t)get(p + 24, 4);
+    entry->path = library->paths + path;
+    entry->mtime = (int64_t)get(p + 32, 8);
+    return true;
+}
+
+bool chip8_library_find(const chip8_library_t *library, const uint8_t sha1[20], chip8_library_entry_t *entry){
+    // lower bound, so duplicates resolve to the first path in order
+    size_t low = 0, high = library->count;
+    while(low < high){
+        const size_t mid = low + (high - low) / 2;
+        if(memcmp(library->entries + mid * INDEX_ENTRY_SIZE, sha1, 20) < 0){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if(low == library->count || memcmp(library->entries + low * INDEX_ENTRY_SIZE, sha1, 20) != 0) return false;
+    return library_entry(library, low, entry);
+}
+
+typedef struct {
+    chip8_library_entry_t *old;     // previous index by path
+    size_t old_count;
+    chip8_library_entry_t *entries; // paths owned
+    size_t count;
+    size_t capacity;
+    chip8_library_scan_stats_t *stats;
+} scan_t;
+
+static int by_path(const void *a, const void *b){
+    return strcmp(((const chip8_library_entry_t *)a)->path, ((const chip8_library_entry_t *)b)->path);
+}
+
+static int by_sha1(const void *a, const void *b){
+    const int order = memcmp(((const chip8_library_entry_t *)a)->sha1, ((const chip8_library_entry_t *)b)->sha1, 20);
+    return order != 0 ? order : by_path(a, b);
+}
+
+static bool scan_file(scan_t *scan, const char *path, const struct stat *st){
+    if(st->st_size == 0 || st->st_size > CHIP8_RAM_SIZE - 0x200){
+        scan->stats->skipped++;
+        return true;
+    }
+    chip8_library_entry_t entry = {
+        .size = (uint32_t)st->st_size,
+        .mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec,
+    };
+    const chip8_library_entry_t key = { .path = path };
+    const chip8_library_entry_t *old = scan->old_count > 0 ? bsearch(&key, scan->old, scan->old_count, sizeof key, by_path) : NULL;
+    if(old != NULL && old->size == entry.size && old->mtime == entry.mtime){
+        memcpy(entry.sha1, old->sha1, 20);
+        entry.crc32 = old->crc32;
+        scan->stats->reused++;
+    } else {
+        chip8_rom_t rom;
+        if(!chip8_rom_map(path, &rom)){
+            fprintf(stderr, "Skipping %s\n", path);
+            return true;
+        }
+        chip8_sha1(rom.data, rom.size, entry.sha1);
+        entry.crc32 = chip8_crc32(rom.data, rom.size);
+        entry.size = (uint32_t)rom.size;
+        chip8_rom_unmap(&rom);
+        scan->stats->hashed++;
+    }
+
+    if(scan->count == scan->capacity){
+        const size_t capacity = scan->capacity ? scan->capacity * 2 : 256;
+        chip8_library_entry_t *entries = realloc(scan->entries, capacity * sizeof *entries);
+        if(entries == NULL){
+            perror("Could not allocate the ROM library");
+            return false;
+        }
+        scan->entries = entries;
+        scan->capacity = capacity;
+    }
+    entry.path = strdup(path);
+    if(entry.path == NULL){
+        perror("Could not allocate the ROM library");
+        return false;
+    }
+    scan->entries[scan->count++] = entry;
+    return true;
+}
+
+// `path` is a buffer of PATH_BUFFER bytes holding the directory, entries are appended to it in place
+#define PATH_BUFFER 4096
+
+static bool scan_dir(scan_t *scan, char *path, int depth){
+    DIR *dir = opendir(path);
+    if(dir == NULL){
+        fprintf(stderr, "Could not open the directory %s: %s\n", path, strerror(errno));
+        return depth > 0;
+    }
+    const size_t len = strlen(path);
+    bool ok = true;
+    struct dirent *entry;
+    while(ok && (entry = readdir(dir)) != NULL){
+        // hidden files, . and ..
+        if(entry->d_name[0] == '.') continue;
+        if(len + 1 + strlen(entry->d_name) + 1 > PATH_BUFFER){
+            fprintf(stderr, "Skipping %s/%s, the path is too long\n", path, entry->d_name);
+            continue;
+        }
+        snprintf(path + len, PATH_BUFFER - len, "/%s", entry->d_name);
+        // links to files are indexed, links to directories are not followed so a loop cannot recurse forever
+        struct stat st;
+        bool usable = lstat(path, &st) == 0;
+        if(usable && S_ISLNK(st.st_mode)) usable = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+        if(!usable){
+            path[len] = '\0';
+            continue;
+        }
+        if(S_ISDIR(st.st_mode) && depth < SCAN_MAX_DEPTH){
+            ok = scan_dir(scan, path, depth + 1);
+        } else if(S_ISREG(st.st_mode)){
+            ok = scan_file(scan, path, &st);
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return ok;
+}
+
+static bool write_index(const char *index_path, const chip8_library_entry_t *entries, size_t count){
+    size_t paths_size = 0;
+    for(size_t i = 0; i < count; i++) paths_size += strlen(entries[i].path) + 1;
+    if(count > UINT32_MAX / INDEX_ENTRY_SIZE || paths_size > UINT32_MAX){
+        fprintf(stderr, "Too many ROMs for one library index\n");
+        return false;
+    }
+    const size_t size = INDEX_HEADER_SIZE + count * INDEX_ENTRY_SIZE + paths_size;
+    uint8_t *data = calloc(1, size);
+    if(data == NULL){
+        perror("Could not allocate the ROM library index");
+        return false;
+    }
+    memcpy(data, INDEX_MAGIC, 4);
+    put(data + 4, INDEX_VERSION, 2);
+    put(data + 8, count, 4);
+    put(data + 12, paths_size, 4);
+    char *paths = (char *)data + INDEX_HEADER_SIZE + count * INDEX_ENTRY_SIZE;
+    size_t offset = 0;
+    for(size_t i = 0; i < count; i++){
+        uint8_t *p = data + INDEX_HEADER_SIZE + i * INDEX_ENTRY_SIZE;
+        memcpy(p, entries[i].sha1, 20);
+        put(p + 20, entries[i].crc32, 4);
+        put(p + 24, entries[i].size, 4);
+        put(p + 28, offset, 4);
+        put(p + 32, (uint64_t)entries[i].mtime, 8);
+        const size_t len = strlen(entries[i].path) + 1;
+        memcpy(paths + offset, entries[i].path, len);
+        offset += len;
+    }
+
+    char tmp_path[PATH_BUFFER];
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", index_path);
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = file != NULL;
+    if(!ok){
+        perror("Could not write the ROM library index");
+    } else {
+        ok = fwrite(data, size, 1, file) == 1;
+        ok = fclose(file) == 0 && ok;
+        if(ok && rename(tmp_path, index_path) != 0) ok = false;
+        if(!ok){
+            fprintf(stderr, "Could not write ROM library index %s\n", index_path);
+            remove(tmp_path);
+        }
+    }
+    free(data);
+    return ok;
+}
+
+bool chip8_library_scan(const char *dir, const char *index_path, chip8_library_scan_stats_t *stats){
+    *stats = (chip8_library_scan_stats_t){0};
+    scan_t scan = { .stats = stats };
+
+    // what the previous index knows, by path; a missing or unreadable index means hashing everything
+    chip8_library_t *previous = NULL;
+    if(access(index_path, F_OK) == 0) previous = chip8_library_open(index_path);
+    if(previous != NULL && previous->count > 0){
+        scan.old = malloc(previous->count * sizeof *scan.old);
+        if(scan.old == NULL){
+            perror("Could not allocate the ROM library");
+            chip8_library_close(previous);
+            return false;
+        }
+        for(size_t i = 0; i < previous->count; i++){
+            if(library_entry(previous, i, &scan.old[scan.old_count])) scan.old_count++;
+        }
+        qsort(scan.old, scan.old_count, sizeof *scan.old, by_path);
+    }
+
+    char path[PATH_BUFFER];
+    snprintf(path, sizeof path, "%s", dir);
+    // "roms/" and "roms" index the same paths
+    for(size_t len = strlen(path); len > 1 && path[len - 1] == '/'; len--) path[len - 1] = '\0';
+    bool ok = scan_dir(&scan, path, 0);
+    if(ok){
+        qsort(scan.entries, scan.count, sizeof *scan.entries, by_sha1);
+        stats->files = scan.count;
+        ok = write_index(index_path, scan.entries, scan.count);
+    }
+
+    for(size_t i = 0; i < scan.count; i++) free((char *)scan.entries[i].path);
+    free(scan.entries);
+    free(scan.old);
+    chip8_library_close(previous);
+    return ok;
+}
+
+static bool parse_color(const char *value, uint32_t *color){
+    const size_t len = strlen(value);
+    char *end;
+    const unsigned long rgba = strtoul(value, &end, 16);
+    if((len != 6 && len != 8) || *end != '\0' || !isxdigit((unsigned char)value[0])) return false;
+    *color = len == 6 ? (uint32_t)rgba << 8 | 0xFF : (uint32_t)rgba;
+    return true;
+}
+
+static bool parse_setting(chip8_rom_settings_t *settings, char *token){
+    static const char *const color_names[4] = { "bg", "fg", "plane2", "blend" };
+    char *value = strchr(token, '=');
+    if(value == NULL) return false;
+    *value++ = '\0';
+    if(strcmp(token, "variant") == 0){
+        return settings->variant_set = chip8_variant_from_name(value, &settings->variant);
+    }
+    if(strcmp(token, "quirks") == 0){
+        return settings->quirks_set = chip8_quirks_from_name(value, &settings->quirks);
+    }
+    if(strcmp(token, "ips") == 0){
+        char *end;
+        const unsigned long rate = strtoul(value, &end, 10);
+        if(*end != '\0' || rate == 0 || rate > UINT32_MAX) return false;
+        settings->instr_rate = (uint32_t)rate;
+        return true;
+    }
+    if(strcmp(token, "keys") == 0){
+        if(strlen(value) != 16) return false;
+        for(int i = 0; i < 16; i++) settings->keys[i] = (char)tolower((unsigned char)value[i]);
+        settings->keys[16] = '\0';
+        return true;
+    }
+    for(int c = 0; c < 4; c++){
+        if(strcmp(token, color_names[c]) == 0){
+            return settings->color_set[c] = parse_color(value, &settings->colors[c]);
+        }
+    }
+    return false;
+}
+
+bool chip8_settings_find(const char *path, const uint8_t sha1[20], chip8_rom_settings_t *settings){
+    *settings = (chip8_rom_settings_t){0};
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        perror("Could not open the ROM settings file");
+        return false;
+    }
+    char line[1024];
+    unsigned number = 0;
+    bool ok = true;
+    while(ok && !settings->found && fgets(line, sizeof line, file) != NULL){
+        number++;
+        char *save;
+        char *token = strtok_r(line, " \t\r\n", &save);
+        if(token == NULL || token[0] == '#') continue;
+        uint8_t digest[20];
+        if(!chip8_sha1_from_hex(token, digest)){
+            fprintf(stderr, "%s:%u: expected a SHA-1, got %s\n", path, number, token);
+            ok = false;
+            break;
+        }
+        // other ROMs' lines are only checked when those ROMs are loaded
+        if(memcmp(digest, sha1, 20) != 0) continue;
+        settings->found = true;
+        while(ok && (token = strtok_r(NULL, " \t\r\n", &save)) != NULL){
+            char setting[256];
+            snprintf(setting, sizeof setting, "%s", token);
+            if(!parse_setting(settings, token)){
+                fprintf(stderr, "%s:%u: bad setting %s\n", path, number, setting);
+                ok = false;
+            }
+        }
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,79 @@
+#ifndef CHIP8_LIBRARY_H
+#define CHIP8_LIBRARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// ROM files and ROM identity. A ROM file is mapped read-only rather than read through stdio, and
+// a ROM is known by the SHA-1 of its contents (CRC-32 alongside, as most ROM databases list both),
+// so a renamed or copied file is still the same ROM.
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} chip8_rom_t;
+
+// map `path` read-only; false (with a message) if it cannot be opened or mapped
+bool chip8_rom_map(const char *path, chip8_rom_t *rom);
+void chip8_rom_unmap(chip8_rom_t *rom);
+
+void chip8_sha1(const void *data, size_t size, uint8_t digest[20]);
+uint32_t chip8_crc32(const void *data, size_t size);
+// 40 lowercase hex digits and a NUL
+void chip8_sha1_to_hex(const uint8_t digest[20], char hex[41]);
+// false unless `hex` is exactly 40 hex digits
+bool chip8_sha1_from_hex(const char *hex, uint8_t digest[20]);
+
+// ROM library: every ROM file under a directory tree in one index file sorted by SHA-1, which is
+// mapped and binary searched as it is instead of being parsed. A rescan only reads the files whose
+// size or modification time changed since the index was written.
+typedef struct chip8_library chip8_library_t;
+
+typedef struct {
+    uint8_t sha1[20];
+    uint32_t crc32;
+    uint32_t size;
+    int64_t mtime;                  // nanoseconds since the epoch
+    const char *path;               // points into the index, valid until chip8_library_close
+} chip8_library_entry_t;
+
+typedef struct {
+    size_t files;                   // ROMs in the new index
+    size_t hashed;                  // files read and hashed
+    size_t reused;                  // files taken over from the previous index unread
+    size_t skipped;                 // empty files and files too big to be a ROM
+} chip8_library_scan_stats_t;
+
+// index every ROM under `dir` into `index_path`, reusing what the index there already knows
+bool chip8_library_scan(const char *dir, const char *index_path, chip8_library_scan_stats_t *stats);
+// NULL (with a message) if the file cannot be mapped or is not a ROM library index
+chip8_library_t *chip8_library_open(const char *index_path);
+void chip8_library_close(chip8_library_t *library);
+size_t chip8_library_count(const chip8_library_t *library);
+// the first file with these contents, false if there is none
+bool chip8_library_find(const chip8_library_t *library, const uint8_t sha1[20], chip8_library_entry_t *entry);
+
+// Per-ROM settings, one line per ROM in a text file:
+//     <sha1> [variant=name] [quirks=name] [ips=N] [fg=RRGGBB[AA]] [bg=..] [plane2=..] [blend=..] [keys=16 chars]
+// keys gives the host key for each of the CHIP-8 keys 0 to F in order, e.g. keys=x123qweasdzc4rfv.
+// Empty lines and lines starting with # are skipped.
+typedef enum { ROM_COLOR_BACKGROUND, ROM_COLOR_FOREGROUND, ROM_COLOR_PLANE2, ROM_COLOR_BLEND } chip8_rom_color_t;
+
+typedef struct {
+    bool found;                     // the file has a line for the ROM, nothing else is set otherwise
+    bool variant_set;
+    chip8_variant_t variant;
+    bool quirks_set;
+    chip8_quirks_t quirks;
+    uint32_t instr_rate;            // 0 = not set
+    bool color_set[4];              // by chip8_rom_color_t
+    uint32_t colors[4];             // RRGGBBAA
+    char keys[17];                  // empty = not set
+} chip8_rom_settings_t;
+
+// look up the settings of the ROM with this SHA-1; false (with a message) on a bad file or line
+bool chip8_settings_find(const char *path, const uint8_t sha1[20], chip8_rom_settings_t *settings);
+
+#endif
@@ -0,0 +1,457 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_lockstep.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Every step the first running lane leads: the lanes at the leader's PC that hold the same
+// instruction form the step's mask. If the instruction only touches registers (V, I, PC, timers)
+// the masked lanes run it in one SIMD kernel and everything else runs one lane at a time through
+// emulate_instruction on the lane's own chip8_t, with the registers copied in and out.
+// Each lane keeps a full chip8_t for its RAM, stack, display and keypad; lanes that never wrote
+// to RAM still match `image`, so only the others need their instruction fetched individually.
+
+#define LANE_BLOCK 32   // lanes per AVX2 byte vector, arrays are padded to a multiple of it
+
+struct chip8_lockstep {
+    size_t count;                   // lanes in use
+    size_t padded;                  // count rounded up to LANE_BLOCK, the padding lanes never run
+    uint8_t *V[16];                 // V[register][lane]
+    uint16_t *I;
+    uint16_t *PC;
+    uint8_t *delay_timer;
+    uint8_t *sound_timer;
+    uint8_t *active;                // 0xFF for RUNNING lanes
+    uint8_t *mask;                  // 0xFF for the lanes taking part in the current SIMD step
+    uint8_t *own_ram;               // 0xFF once the lane's RAM may differ from image
+    size_t own_ram_count;
+    size_t active_count;
+    size_t leader;                  // first active lane
+    bool stopped;                   // a lane faulted during this step, leader and active_count are stale
+    chip8_t *machines;              // per lane RAM, stack, display, keypad
+    uint8_t image[CHIP8_RAM_SIZE];  // RAM of every lane whose own_ram is clear
+    uint64_t cycles;                // steps taken
+    bool simd;
+    chip8_lockstep_stats_t stats;
+};
+
+// addressed like the interpreter's fetch, so a lane running past the ROM reads what it would
+static uint16_t fetch(const uint8_t *RAM, uint16_t pc){
+    return (RAM[pc] << 8) | RAM[(pc + 1) & 0xFFFF];
+}
+
+static uint16_t fetch_lane(const chip8_lockstep_t *ls, size_t lane){
+    return fetch(ls->own_ram[lane] ? ls->machines[lane].RAM : ls->image, ls->PC[lane]);
+}
+
+// instructions the SIMD kernels implement: they only read and write registers
+static bool vector_op(uint16_t instr){
+    const uint8_t NN = instr & 0x00FF;
+    switch(instr >> 12){
+        case 0x0: return NN != 0xE0 && NN != 0xEE;
+        case 0x1: case 0x3: case 0x4: case 0x6: case 0x7: case 0xA: return true;
+        case 0x5: case 0x9: return (instr & 0xF) == 0;
+        case 0x8: return (instr & 0xF) <= 0x7 || (instr & 0xF) == 0xE;
+        case 0xF: return NN == 0x07 || NN == 0x15 || NN == 0x18 || NN == 0x1E || NN == 0x29;
+        default: return false;
+    }
+}
+
+// run one instruction on one lane with the switch interpreter
+static void step_lane(chip8_lockstep_t *ls, size_t lane){
+    chip8_t *chip8 = &ls->machines[lane];
+    for(int r = 0; r < 16; r++) chip8->V[r] = ls->V[r][lane];
+    chip8->I = ls->I[lane];
+    chip8->PC = ls->PC[lane];
+    chip8->delay_timer = ls->delay_timer[lane];
+    chip8->sound_timer = ls->sound_timer[lane];
+    const uint16_t instr = fetch(chip8->RAM, chip8->PC);
+    emulate_instruction(chip8);
+    for(int r = 0; r < 16; r++) ls->V[r][lane] = chip8->V[r];
+    ls->I[lane] = chip8->I;
+    ls->PC[lane] = chip8->PC;
+    ls->delay_timer[lane] = chip8->delay_timer;
+    ls->sound_timer[lane] = chip8->sound_timer;
+    // a stack fault stops just this lane, it reads back with its state and fault set and the
+    // instructions it ran, the faulting one included like chip8_run_cycles counts it
+    if(chip8->state != RUNNING){
+        ls->active[lane] = 0;
+        ls->stopped = true;
+        chip8->cycles = ls->cycles + 1;
+    }
+    // FX33 and FX55 write to RAM, from now on fetch this lane's code from its own copy
+    if(((instr & 0xF0FF) == 0xF033 || (instr & 0xF0FF) == 0xF055) && !ls->own_ram[lane]){
+        ls->own_ram[lane] = 0xFF;
+        ls->own_ram_count++;
+    }
+}
+
+static void step_scalar(chip8_lockstep_t *ls){
+    ls->stats.scalar_lane_steps += ls->active_count;
+    for(size_t lane = ls->leader; lane < ls->count; lane++){
+        if(ls->active[lane]) step_lane(ls, lane);
+    }
+}
+
+#if defined(__x86_64__)
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i load8(const uint8_t *p) { return _mm256_load_si256((const __m256i *)p); }
+AVX2 static inline void store8(uint8_t *p, __m256i v) { _mm256_store_si256((__m256i *)p, v); }
+AVX2 static inline __m256i load16(const uint16_t *p) { return _mm256_load_si256((const __m256i *)p); }
+AVX2 static inline void store16(uint16_t *p, __m256i v) { _mm256_store_si256((__m256i *)p, v); }
+// 0xFF/0x00 byte masks to 0xFFFF/0x0000 word masks for the low and high 16 lanes
+AVX2 static inline __m256i widen_lo(__m256i v) { return _mm256_cvtepi8_epi16(_mm256_castsi256_si128(v)); }
+AVX2 static inline __m256i widen_hi(__m256i v) { return _mm256_cvtepi8_epi16(_mm256_extracti128_si256(v, 1)); }
+AVX2 static inline __m256i zext_lo(__m256i v) { return _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)); }
+AVX2 static inline __m256i zext_hi(__m256i v) { return _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)); }
+
+// mask = lanes running at pc, returns how many
+AVX2 static size_t build_mask_avx2(chip8_lockstep_t *ls, uint16_t pc){
+    const __m256i target = _mm256_set1_epi16((short)pc);
+    size_t count = 0;
+    for(size_t c = 0; c < ls->padded; c += LANE_BLOCK){
+        const __m256i lo = _mm256_cmpeq_epi16(load16(ls->PC + c), target);
+        const __m256i hi = _mm256_cmpeq_epi16(load16(ls->PC + c + 16), target);
+        // packs interleaves the 128 bit halves, put the lanes back in order
+        __m256i m = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+        m = _mm256_and_si256(m, load8(ls->active + c));
+        store8(ls->mask + c, m);
+        count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(m));
+    }
+    return count;
+}
+
+// drop the masked lanes whose instruction at pc is not `instr`; only lanes with their own RAM
+// can differ from the shared image
+AVX2 static size_t refine_mask_avx2(chip8_lockstep_t *ls, uint16_t instr, bool image_matches, size_t count){
+    for(size_t c = 0; c < ls->padded; c += LANE_BLOCK){
+        __m256i m = load8(ls->mask + c);
+        if(image_matches) m = _mm256_and_si256(m, load8(ls->own_ram + c));
+        for(uint32_t bits = (uint32_t)_mm256_movemask_epi8(m); bits; bits &= bits - 1){
+            const size_t lane = c + __builtin_ctz(bits);
+            if(fetch_lane(ls, lane) != instr){
+                ls->mask[lane] = 0;
+                count--;
+            }
+        }
+    }
+    return count;
+}
+
+// 8XYN on 32 lanes; VF is written before VX like the interpreter does, so X or Y == F behave the same
+AVX2 static void alu_avx2(uint8_t *vx, uint8_t *vy, uint8_t *vf, uint8_t N, __m256i m){
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i x = load8(vx);
+    const __m256i y = load8(vy);
+    __m256i flag;
+    switch(N){
+        case 0x0: store8(vx, _mm256_blendv_epi8(x, y, m)); return;
+        case 0x1: store8(vx, _mm256_blendv_epi8(x, _mm256_or_si256(x, y), m)); return;
+        case 0x2: store8(vx, _mm256_blendv_epi8(x, _mm256_and_si256(x, y), m)); return;
+        case 0x3: store8(vx, _mm256_blendv_epi8(x, _mm256_xor_si256(x, y), m)); return;
+        case 0x4: {
+            // carry out of x + y <=> the wrapped sum is below x
+            const __m256i sum = _mm256_add_epi8(x, y);
+            flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(sum, x), sum), one);
+            break;
+        }
+        case 0x5: flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), x), one); break;
+        case 0x6: flag = _mm256_and_si256(x, one); break;
+        case 0x7: flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(y, x), y), one); break;
+        default: flag = _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), x), one); break;  // 0xE
+    }
+    store8(vf, _mm256_blendv_epi8(load8(vf), flag, m));
+    const __m256i nx = load8(vx);
+    const __m256i ny = load8(vy);
+    __m256i result;
+    switch(N){
+        case 0x4: result = _mm256_add_epi8(nx, ny); break;
+        case 0x5: result = _mm256_sub_epi8(nx, ny); break;
+        case 0x6: result = _mm256_and_si256(_mm256_srli_epi16(nx, 1), _mm256_set1_epi8(0x7F)); break;
+        case 0x7: result = _mm256_sub_epi8(ny, nx); break;
+        default: result = _mm256_add_epi8(nx, nx); break;
+    }
+    store8(vx, _mm256_blendv_epi8(nx, result, m));
+}
+
+// run `instr` on every masked lane, 32 lanes per iteration
+AVX2 static void vector_step_avx2(chip8_lockstep_t *ls, uint16_t instr){
+    const uint16_t NNN = instr & 0x0FFF;
+    const uint8_t X = (instr & 0x0F00) >> 8;
+    const uint8_t Y = (instr & 0x00F0) >> 4;
+    const uint8_t NN = instr & 0x00FF;
+    const uint8_t N = instr & 0x000F;
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i ones = _mm256_set1_epi8(-1);
+    for(size_t c = 0; c < ls->padded; c += LANE_BLOCK){
+        const __m256i m = load8(ls->mask + c);
+        if(_mm256_testz_si256(m, m)) continue;
+        const __m256i m_lo = widen_lo(m);
+        const __m256i m_hi = widen_hi(m);
+        uint8_t *vx = ls->V[X] + c;
+        uint8_t *vy = ls->V[Y] + c;
+        uint16_t *I = ls->I + c;
+        __m256i pc_lo = _mm256_add_epi16(load16(ls->PC + c), _mm256_and_si256(m_lo, two));
+        __m256i pc_hi = _mm256_add_epi16(load16(ls->PC + c + 16), _mm256_and_si256(m_hi, two));
+        __m256i skip = _mm256_setzero_si256();
+        switch(instr >> 12){
+            case 0x1:
+                pc_lo = _mm256_blendv_epi8(pc_lo, _mm256_set1_epi16((short)NNN), m_lo);
+                pc_hi = _mm256_blendv_epi8(pc_hi, _mm256_set1_epi16((short)NNN), m_hi);
+                break;
+            case 0x3: skip = _mm256_cmpeq_epi8(load8(vx), _mm256_set1_epi8((char)NN)); break;
+            case 0x4: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(load8(vx), _mm256_set1_epi8((char)NN)), ones); break;
+            case 0x5: skip = _mm256_cmpeq_epi8(load8(vx), load8(vy)); break;
+            case 0x9: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(load8(vx), load8(vy)), ones); break;
+            case 0x6: store8(vx, _mm256_blendv_epi8(load8(vx), _mm256_set1_epi8((char)NN), m)); break;
+            case 0x7: store8(vx, _mm256_blendv_epi8(load8(vx), _mm256_add_epi8(load8(vx), _mm256_set1_epi8((char)NN)), m)); break;
+            case 0x8: alu_avx2(vx, vy, ls->V[0xF] + c, N, m); break;
+            case 0xA:
+                store16(I, _mm256_blendv_epi8(load16(I), _mm256_set1_epi16((short)NNN), m_lo));
+                store16(I + 16, _mm256_blendv_epi8(load16(I + 16), _mm256_set1_epi16((short)NNN), m_hi));
+                break;
+            case 0xF:
+                switch(NN){
+                    case 0x07: store8(vx, _mm256_blendv_epi8(load8(vx), load8(ls->delay_timer + c), m)); break;
+                    case 0x15: store8(ls->delay_timer + c, _mm256_blendv_epi8(load8(ls->delay_timer + c), load8(vx), m)); break;
+                    case 0x18: store8(ls->sound_timer + c, _mm256_blendv_epi8(load8(ls->sound_timer + c), load8(vx), m)); break;
+                    case 0x1E: {
+                        const __m256i x = load8(vx);
+                        store16(I, _mm256_add_epi16(load16(I), _mm256_and_si256(zext_lo(x), m_lo)));
+                        store16(I + 16, _mm256_add_epi16(load16(I + 16), _mm256_and_si256(zext_hi(x), m_hi)));
+                        break;
+                    }
+                    case 0x29: {
+                        const __m256i x = load8(vx);
+                        const __m256i five = _mm256_set1_epi16(5);
+                        store16(I, _mm256_blendv_epi8(load16(I), _mm256_mullo_epi16(zext_lo(x), five), m_lo));
+                        store16(I + 16, _mm256_blendv_epi8(load16(I + 16), _mm256_mullo_epi16(zext_hi(x), five), m_hi));
+                        break;
+                    }
+                }
+                break;
+            default: break;     // 0NNN
+        }
+        skip = _mm256_and_si256(skip, m);
+        pc_lo = _mm256_add_epi16(pc_lo, _mm256_and_si256(widen_lo(skip), two));
+        pc_hi = _mm256_add_epi16(pc_hi, _mm256_and_si256(widen_hi(skip), two));
+        store16(ls->PC + c, pc_lo);
+        store16(ls->PC + c + 16, pc_hi);
+    }
+}
+
+// the lanes left out of the SIMD step run one at a time
+AVX2 static void step_unmasked_avx2(chip8_lockstep_t *ls){
+    for(size_t c = 0; c < ls->padded; c += LANE_BLOCK){
+        const __m256i rest = _mm256_andnot_si256(load8(ls->mask + c), load8(ls->active + c));
+        for(uint32_t bits = (uint32_t)_mm256_movemask_epi8(rest); bits; bits &= bits - 1){
+            step_lane(ls, c + __builtin_ctz(bits));
+        }
+    }
+}
+
+static bool step_simd(chip8_lockstep_t *ls){
+    const uint16_t pc = ls->PC[ls->leader];
+    const uint16_t instr = fetch_lane(ls, ls->leader);
+    if(!vector_op(instr)) return false;
+    size_t count = build_mask_avx2(ls, pc);
+    const bool image_matches = fetch(ls->image, pc) == instr;
+    if(!image_matches || ls->own_ram_count){
+        count = refine_mask_avx2(ls, instr, image_matches, count);
+    }
+    vector_step_avx2(ls, instr);
+    if(count < ls->active_count) step_unmasked_avx2(ls);
+    ls->stats.vector_lane_steps += count;
+    ls->stats.scalar_lane_steps += ls->active_count - count;
+    return true;
+}
+
+static bool simd_available(void){
+    return __builtin_cpu_supports("avx2");
+}
+#else
+static bool step_simd(chip8_lockstep_t *ls) { (void)ls; return false; }
+static bool simd_available(void) { return false; }
+#endif
+
+static void *lane_array(size_t padded, size_t size){
+    // aligned_alloc wants a multiple of the alignment
+    const size_t align = LANE_BLOCK * sizeof(uint16_t);
+    const size_t bytes = (padded * size + align - 1) / align * align;
+    void *p = aligned_alloc(align, bytes);
+    if(p != NULL) memset(p, 0, bytes);
+    return p;
+}
+
+static void load_lane(chip8_lockstep_t *ls, size_t lane, const chip8_t *in);
+
+static void update_leader(chip8_lockstep_t *ls){
+    ls->leader = 0;
+    ls->active_count = 0;
+    for(size_t lane = ls->count; lane-- > 0;){
+        if(ls->active[lane]){
+            ls->leader = lane;
+            ls->active_count++;
+        }
+    }
+}
+
+chip8_lockstep_t *chip8_lockstep_create(const chip8_t *image, size_t count){
+    if(image->variant != VARIANT_CHIP8){
+        // the kernels and the shared image assume the 4 KB CHIP-8 machine
+        fprintf(stderr, "Lockstep lanes only run CHIP-8 ROMs\n");
+        return NULL;
+    }
+    if(chip8_quirks(image) != QUIRKS_MODERN){
+        // and the kernels implement the default quirks only
+        fprintf(stderr, "Lockstep lanes only run the modern quirk profile\n");
+        return NULL;
+    }
+    chip8_lockstep_t *ls = calloc(1, sizeof(chip8_lockstep_t));
+    if(ls == NULL || count == 0){
+        free(ls);
+        return NULL;
+    }
+    ls->count = count;
+    ls->padded = (count + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK;
+    bool ok = true;
+    for(int r = 0; r < 16; r++){
+        ok &= (ls->V[r] = lane_array(ls->padded, 1)) != NULL;
+    }
+    ok &= (ls->I = lane_array(ls->padded, sizeof(uint16_t))) != NULL;
+    ok &= (ls->PC = lane_array(ls->padded, sizeof(uint16_t))) != NULL;
+    ok &= (ls->delay_timer = lane_array(ls->padded, 1)) != NULL;
+    ok &= (ls->sound_timer = lane_array(ls->padded, 1)) != NULL;
+    ok &= (ls->active = lane_array(ls->padded, 1)) != NULL;
+    ok &= (ls->mask = lane_array(ls->padded, 1)) != NULL;
+    ok &= (ls->own_ram = lane_array(ls->padded, 1)) != NULL;
+    ok &= (ls->machines = calloc(ls->padded, sizeof(chip8_t))) != NULL;
+    if(!ok){
+        perror("Could not allocate the lockstep lanes");
+        chip8_lockstep_destroy(ls);
+        return NULL;
+    }
+    memcpy(ls->image, image->RAM, sizeof ls->image);
+    for(size_t lane = 0; lane < count; lane++){
+        load_lane(ls, lane, image);
+    }
+    update_leader(ls);
+    ls->simd = simd_available();
+    return ls;
+}
+
+void chip8_lockstep_destroy(chip8_lockstep_t *ls){
+    if(ls == NULL) return;
+    for(int r = 0; r < 16; r++) free(ls->V[r]);
+    free(ls->I);
+    free(ls->PC);
+    free(ls->delay_timer);
+    free(ls->sound_timer);
+    free(ls->active);
+    free(ls->mask);
+    free(ls->own_ram);
+    free(ls->machines);
+    free(ls);
+}
+
+size_t chip8_lockstep_count(const chip8_lockstep_t *ls){
+    return ls->count;
+}
+
+void chip8_lockstep_get(const chip8_lockstep_t *ls, size_t lane, chip8_t *out){
+    memcpy(out, &ls->machines[lane], CHIP8_MACHINE_SIZE);
+    for(int r = 0; r < 16; r++) out->V[r] = ls->V[r][lane];
+    out->I = ls->I[lane];
+    out->PC = ls->PC[lane];
+    out->delay_timer = ls->delay_timer[lane];
+    out->sound_timer = ls->sound_timer[lane];
+    if(ls->active[lane]) out->cycles = ls->cycles;
+}
+
+static void load_lane(chip8_lockstep_t *ls, size_t lane, const chip8_t *in){
+    chip8_t *chip8 = &ls->machines[lane];
+    memcpy(chip8, in, CHIP8_MACHINE_SIZE);
+    for(int r = 0; r < 16; r++) ls->V[r][lane] = in->V[r];
+    ls->I[lane] = in->I;
+    ls->PC[lane] = in->PC;
+    ls->delay_timer[lane] = in->delay_timer;
+    ls->sound_timer[lane] = in->sound_timer;
+    ls->active[lane] = in->state == RUNNING ? 0xFF : 0;
+    const uint8_t own_ram = memcmp(in->RAM, ls->image, sizeof ls->image) ? 0xFF : 0;
+    ls->own_ram_count += (own_ram != 0) - (ls->own_ram[lane] != 0);
+    ls->own_ram[lane] = own_ram;
+}
+
+void chip8_lockstep_set(chip8_lockstep_t *ls, size_t lane, const chip8_t *in){
+    load_lane(ls, lane, in);
+    update_leader(ls);
+}
+
+void chip8_lockstep_set_key(chip8_lockstep_t *ls, size_t lane, uint8_t key, bool pressed){
+    ls->machines[lane].keypad[key & 0xF] = pressed;
+}
+
+void chip8_lockstep_set_simd(chip8_lockstep_t *ls, bool enable){
+    ls->simd = enable && simd_available();
+}
+
+void chip8_lockstep_step(chip8_lockstep_t *ls){
+    if(ls->active_count == 0) return;
+    if(!ls->simd || !step_simd(ls)){
+        step_scalar(ls);
+    }
+    if(ls->stopped){
+        ls->stopped = false;
+        update_leader(ls);
+    }
+    ls->cycles++;
+}
+
+uint64_t chip8_lockstep_run(chip8_lockstep_t *ls, uint64_t cycles){
+    for(uint64_t i = 0; i < cycles; i++){
+        chip8_lockstep_step(ls);
+    }
+    return cycles;
+}
+
+bool chip8_lockstep_update_timers(chip8_lockstep_t *ls){
+    uint8_t sound = 0;
+    for(size_t lane = 0; lane < ls->padded; lane++){
+        // paused lanes and padding keep their timers
+        const uint8_t running = ls->active[lane] & 1;
+        sound |= ls->sound_timer[lane] & ls->active[lane];
+        ls->delay_timer[lane] -= running & (ls->delay_timer[lane] > 0);
+        ls->sound_timer[lane] -= running & (ls->sound_timer[lane] > 0);
+    }
+    // kept like update_timers does, so a lane reads back as the same machine
+    for(size_t lane = 0; lane < ls->count; lane++){
+        if(ls->active[lane]) ls->machines[lane].vblank = true;
+    }
+    return sound != 0;
+}
+
+bool chip8_lockstep_run_schedule(chip8_lockstep_t *ls, chip8_schedule_t *schedule, uint64_t cycles){
+    while(cycles > 0){
+        const uint64_t next_tick = (schedule->timer_ticks + 1) * schedule->instr_rate / 60;
+        const uint64_t until_tick = next_tick - schedule->cycles;
+        const uint64_t run = until_tick < cycles ? until_tick : cycles;
+        chip8_lockstep_run(ls, run);
+        schedule->cycles += run;
+        cycles -= run;
+        if(schedule->cycles == next_tick){
+            schedule->sound = chip8_lockstep_update_timers(ls);
+            schedule->timer_ticks++;
+        }
+    }
+    return schedule->sound;
+}
+
+chip8_lockstep_stats_t chip8_lockstep_stats(const chip8_lockstep_t *ls){
+    return ls->stats;
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_LOCKSTEP_H
+#define CHIP8_LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Lockstep engine: many instances (lanes) of the same program stepped together, one instruction
+// per lane per step. The register files live in structure-of-arrays form so lanes sharing a PC
+// execute register/ALU/branch instructions with AVX2 kernels, 32 lanes at a time; lanes that
+// diverged, and instructions touching memory, the stack, the display or the keypad, fall back to
+// the switch interpreter one lane at a time.
+typedef struct chip8_lockstep chip8_lockstep_t;
+
+typedef struct {
+    uint64_t vector_lane_steps;     // lane-instructions executed by the SIMD kernels
+    uint64_t scalar_lane_steps;     // lane-instructions executed one lane at a time
+} chip8_lockstep_stats_t;
+
+// `count` lanes, all starting as a copy of `image` (a CHIP-8 machine with a ROM loaded, modern quirks), NULL on failure
+chip8_lockstep_t *chip8_lockstep_create(const chip8_t *image, size_t count);
+void chip8_lockstep_destroy(chip8_lockstep_t *ls);
+size_t chip8_lockstep_count(const chip8_lockstep_t *ls);
+
+// copy a lane out to / in from a regular instance; `get` leaves out's host-side state untouched
+void chip8_lockstep_get(const chip8_lockstep_t *ls, size_t lane, chip8_t *out);
+void chip8_lockstep_set(chip8_lockstep_t *ls, size_t lane, const chip8_t *in);
+void chip8_lockstep_set_key(chip8_lockstep_t *ls, size_t lane, uint8_t key, bool pressed);
+// force the scalar path everywhere, for comparisons; SIMD is used by default where the CPU has AVX2
+void chip8_lockstep_set_simd(chip8_lockstep_t *ls, bool enable);
+
+// same shape as emulate_instruction / chip8_run_cycles / update_timers / chip8_run_schedule,
+// counts are per lane
+void chip8_lockstep_step(chip8_lockstep_t *ls);
+uint64_t chip8_lockstep_run(chip8_lockstep_t *ls, uint64_t cycles);
+bool chip8_lockstep_update_timers(chip8_lockstep_t *ls);
+bool chip8_lockstep_run_schedule(chip8_lockstep_t *ls, chip8_schedule_t *schedule, uint64_t cycles);
+chip8_lockstep_stats_t chip8_lockstep_stats(const chip8_lockstep_t *ls);
+
+#endif
@@ -0,0 +1,123 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_movie.h"
+
+// File format:
+//     CHIP8-MOVIE 1
+//     seed <decimal>
+//     rate <instructions per second>
+//     <cycle> <key, hex> <+ pressed | - released>
+//     ...
+//     end <cycles> <framebuffer hash, hex> <RAM hash, hex>
+
+#define MOVIE_MAGIC "CHIP8-MOVIE"
+#define MOVIE_VERSION 1
+
+void chip8_movie_start(chip8_movie_t *movie, const chip8_t *chip8, uint32_t instr_rate){
+    *movie = (chip8_movie_t){
+        .seed = chip8->seed,
+        .instr_rate = instr_rate,
+    };
+    memcpy(movie->keypad, chip8->keypad, sizeof movie->keypad);
+}
+
+static bool add_event(chip8_movie_t *movie, chip8_key_event_t event){
+    if(movie->event_count == movie->event_capacity){
+        const size_t capacity = movie->event_capacity ? movie->event_capacity * 2 : 256;
+        chip8_key_event_t *grown = realloc(movie->events, capacity * sizeof(chip8_key_event_t));
+        if(grown == NULL){
+            perror("Could not allocate the movie");
+            return false;
+        }
+        movie->events = grown;
+        movie->event_capacity = capacity;
+    }
+    movie->events[movie->event_count++] = event;
+    return true;
+}
+
+bool chip8_movie_record_keypad(chip8_movie_t *movie, const chip8_t *chip8){
+    for(uint8_t key = 0; key < 16; key++){
+        if(chip8->keypad[key] == movie->keypad[key]) continue;
+        const chip8_key_event_t event = { .cycle = chip8->cycles, .key = key, .pressed = chip8->keypad[key] };
+        if(!add_event(movie, event)) return false;
+        movie->keypad[key] = chip8->keypad[key];
+    }
+    return true;
+}
+
+void chip8_movie_finish(chip8_movie_t *movie, const chip8_t *chip8){
+    movie->cycles = chip8->cycles;
+    movie->framebuffer_hash = chip8_framebuffer_hash(chip8);
+    movie->ram_hash = chip8_ram_hash(chip8);
+}
+
+void chip8_movie_free(chip8_movie_t *movie){
+    free(movie->events);
+    movie->events = NULL;
+    movie->event_count = movie->event_capacity = 0;
+}
+
+bool chip8_movie_save(const chip8_movie_t *movie, const char *path){
+    FILE *file = fopen(path, "w");
+    if(file == NULL){
+        perror("Could not open the movie file for writing");
+        return false;
+    }
+    fprintf(file, MOVIE_MAGIC " %d\nseed %" PRIu64 "\nrate %" PRIu32 "\n", MOVIE_VERSION, movie->seed, movie->instr_rate);
+    for(size_t i = 0; i < movie->event_count; i++){
+        const chip8_key_event_t *event = &movie->events[i];
+        fprintf(file, "%" PRIu64 " %X %c\n", event->cycle, event->key, event->pressed ? '+' : '-');
+    }
+    fprintf(file, "end %" PRIu64 " %016" PRIx64 " %016" PRIx64 "\n", movie->cycles, movie->framebuffer_hash, movie->ram_hash);
+    if(fclose(file) != 0){
+        fprintf(stderr, "Could not write movie file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool chip8_movie_load(chip8_movie_t *movie, const char *path){
+    *movie = (chip8_movie_t){0};
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        perror("Could not open the movie file");
+        return false;
+    }
+    int version = 0;
+    bool ok = fscanf(file, MOVIE_MAGIC " %d seed %" SCNu64 " rate %" SCNu32, &version, &movie->seed, &movie->instr_rate) == 3
+              && version == MOVIE_VERSION && movie->instr_rate > 0;
+    bool ended = false;
+    char line[128];
+    while(ok && !ended && fgets(line, sizeof line, file) != NULL){
+        uint64_t cycle;
+        unsigned key;
+        char action;
+        if(sscanf(line, "end %" SCNu64 " %" SCNx64 " %" SCNx64, &movie->cycles, &movie->framebuffer_hash, &movie->ram_hash) == 3){
+            ended = true;
+        } else if(sscanf(line, "%" SCNu64 " %x %c", &cycle, &key, &action) == 3 && key <= 0xF && (action == '+' || action == '-')){
+            ok = add_event(movie, (chip8_key_event_t){ .cycle = cycle, .key = key, .pressed = action == '+' });
+        } else if(strspn(line, " \t\r\n") != strlen(line)){
+            ok = false;
+        }
+    }
+    fclose(file);
+    if(!ok || !ended){
+        fprintf(stderr, "%s is not a valid CHIP-8 movie\n", path);
+        chip8_movie_free(movie);
+        return false;
+    }
+    return true;
+}
+
+bool chip8_movie_replay(const chip8_movie_t *movie, chip8_t *chip8){
+    chip8_seed(chip8, movie->seed);
+    chip8_schedule_t schedule = { .instr_rate = movie->instr_rate };
+    chip8_run_script(chip8, &schedule, movie->events, movie->event_count, movie->cycles);
+    return chip8->cycles == movie->cycles
+        && chip8_framebuffer_hash(chip8) == movie->framebuffer_hash
+        && chip8_ram_hash(chip8) == movie->ram_hash;
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Input movie: the PRNG seed, the instruction rate the timers were ticked at and every keypad
+// transition with the instruction count it happened at. Since the machine is deterministic
+// given those, replaying a movie reproduces the recorded session exactly, and the hashes of the
+// final framebuffer and RAM verify it.
+typedef struct {
+    uint64_t seed;
+    uint32_t instr_rate;
+    chip8_key_event_t *events;      // sorted by cycle
+    size_t event_count;
+    size_t event_capacity;
+    bool keypad[16];                // keypad as of the last recorded event
+    // filled in by chip8_movie_finish
+    uint64_t cycles;
+    uint64_t framebuffer_hash;
+    uint64_t ram_hash;
+} chip8_movie_t;
+
+// start recording a session from the current (freshly loaded) machine
+void chip8_movie_start(chip8_movie_t *movie, const chip8_t *chip8, uint32_t instr_rate);
+// log every keypad change since the last call at the current cycle, false on allocation failure
+bool chip8_movie_record_keypad(chip8_movie_t *movie, const chip8_t *chip8);
+void chip8_movie_finish(chip8_movie_t *movie, const chip8_t *chip8);
+void chip8_movie_free(chip8_movie_t *movie);
+
+// text format, one keypad event per line
+bool chip8_movie_save(const chip8_movie_t *movie, const char *path);
+bool chip8_movie_load(chip8_movie_t *movie, const char *path);
+
+// replay on a machine with the movie's ROM freshly loaded, as fast as possible;
+// true if the final framebuffer and RAM match the recording
+bool chip8_movie_replay(const chip8_movie_t *movie, chip8_t *chip8);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_core.h"
+#include "chip8_internal.h"
+
+// Predecoded dispatch engine: every RAM address gets an entry holding the handler for the
+// instruction starting there plus its already extracted operands, so executing an instruction
+// is a table lookup and an indirect call instead of a fetch, decode and nested switch.
+// Entries are decoded lazily: loading a ROM, or anything writing over entries through
+// chip8_invalidate_code (FX33/FX55 included), only points them at a stub that decodes the entry
+// the first time it runs, so stores to data never pay for decoding. Quirks are resolved while
+// decoding: each quirk has its own handler, or an operand (how far FX55/FX65 move I), so handlers
+// never test the profile.
+
+typedef struct chip8_decoded chip8_decoded_t;
+typedef void (*chip8_handler_t)(chip8_t *chip8, const chip8_decoded_t *op);
+
+struct chip8_decoded {
+    chip8_handler_t handler;
+    uint16_t NNN;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t NN;
+    uint8_t N;
+    uint8_t advance;                // FX55/FX65: added to I afterwards, 0 unless the profile moves I
+};
+
+#define RAM_MASK (sizeof ((chip8_t*)0)->RAM - 1)
+
+static void op_nop(chip8_t *chip8, const chip8_decoded_t *op) { (void)chip8; (void)op; }
+
+// 00E0
+static void op_cls(chip8_t *chip8, const chip8_decoded_t *op) {
+    (void)op;
+    chip8_clear_display(chip8);
+}
+// 00EE
+static void op_ret(chip8_t *chip8, const chip8_decoded_t *op) {
+    (void)op;
+    if(chip8->SP == 0) {
+        chip8_fault(chip8, FAULT_STACK_UNDERFLOW);
+        return;
+    }
+    chip8->SP--;
+    chip8->PC = chip8->stack[chip8->SP];
+}
+// 1NNN
+static void op_jp(chip8_t *chip8, const chip8_decoded_t *op) { chip8->PC = op->NNN; }
+// 2NNN
+static void op_call(chip8_t *chip8, const chip8_decoded_t *op) {
+    // only allow a maximum recurive detpth of 12
+    if(chip8->SP < 12){
+        chip8->stack[chip8->SP] = chip8->PC;
+        chip8->SP ++;
+        chip8->PC = op->NNN;
+    } else {
+        chip8_fault(chip8, FAULT_STACK_OVERFLOW);
+    }
+}
+// 3XNN, 4XNN, 5XY0, 9XY0
+static void op_se_imm(chip8_t *chip8, const chip8_decoded_t *op) { if(chip8->V[op->X] == op->NN) chip8_skip_next(chip8); }
+static void op_sne_imm(chip8_t *chip8, const chip8_decoded_t *op) { if(chip8->V[op->X] != op->NN) chip8_skip_next(chip8); }
+static void op_se_reg(chip8_t *chip8, const chip8_decoded_t *op) { if(chip8->V[op->X] == chip8->V[op->Y]) chip8_skip_next(chip8); }
+static void op_sne_reg(chip8_t *chip8, const chip8_decoded_t *op) { if(chip8->V[op->X] != chip8->V[op->Y]) chip8_skip_next(chip8); }
+// 6XNN, 7XNN
+static void op_ld_imm(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] = op->NN; }
+static void op_add_imm(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] += op->NN; }
+// 8XY0 - 8XYE
+static void op_ld_reg(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] = chip8->V[op->Y]; }
+static void op_or(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] |= chip8->V[op->Y]; }
+static void op_and(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] &= chip8->V[op->Y]; }
+static void op_xor(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] ^= chip8->V[op->Y]; }
+// 8XY1 - 8XY3 with the VF reset quirk
+static void op_or_reset(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] |= chip8->V[op->Y]; chip8->V[0x0F] = 0; }
+static void op_and_reset(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] &= chip8->V[op->Y]; chip8->V[0x0F] = 0; }
+static void op_xor_reset(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] ^= chip8->V[op->Y]; chip8->V[0x0F] = 0; }
+static void op_add_reg(chip8_t *chip8, const chip8_decoded_t *op) {
+    const uint16_t sum = chip8->V[op->X] + chip8->V[op->Y];
+    chip8->V[0x0F] = sum > 0xFF;
+    chip8->V[op->X] += chip8->V[op->Y];
+}
+static void op_sub(chip8_t *chip8, const chip8_decoded_t *op) {
+    const bool no_borrow = chip8->V[op->X] >= chip8->V[op->Y];
+    chip8->V[0x0F] = no_borrow;
+    chip8->V[op->X] -= chip8->V[op->Y];
+}
+static void op_shr(chip8_t *chip8, const chip8_decoded_t *op) {
+    chip8->V[0x0F] = chip8->V[op->X] & 0x01;
+    chip8->V[op->X] >>= 1;
+}
+static void op_subn(chip8_t *chip8, const chip8_decoded_t *op) {
+    const bool no_borrow = chip8->V[op->Y] >= chip8->V[op->X];
+    chip8->V[0x0F] = no_borrow;
+    chip8->V[op->X] = chip8->V[op->Y] - chip8->V[op->X];
+}
+static void op_shl(chip8_t *chip8, const chip8_decoded_t *op) {
+    chip8->V[0x0F] = (chip8->V[op->X] & 0x80) >> 7;
+    chip8->V[op->X] <<= 1;
+}
+// 8XY6 / 8XYE with the shift quirk, VY is shifted into VX
+static void op_shr_vy(chip8_t *chip8, const chip8_decoded_t *op) {
+    chip8->V[0x0F] = chip8->V[op->Y] & 0x01;
+    chip8->V[op->X] = chip8->V[op->Y] >> 1;
+}
+static void op_shl_vy(chip8_t *chip8, const chip8_decoded_t *op) {
+    chip8->V[0x0F] = (chip8->V[op->Y] & 0x80) >> 7;
+    chip8->V[op->X] = chip8->V[op->Y] << 1;
+}
+static void op_invalid_8(chip8_t *chip8, const chip8_decoded_t *op) {
+    if(chip8->debug != NULL) {
+        debug_fault(chip8, "invalid opcode", chip8->PC - 2);
+        return;
+    }
+    printf("Invalid opcode 0x8%d%d%d\n", op->X, op->Y, op->N);
+}
+// ANNN, BNNN, CXNN, DXYN
+static void op_ld_i(chip8_t *chip8, const chip8_decoded_t *op) { chip8->I = op->NNN; }
+static void op_jp_v0(chip8_t *chip8, const chip8_decoded_t *op) { chip8->PC = chip8->V[0] + op->NNN; }
+static void op_jp_vx(chip8_t *chip8, const chip8_decoded_t *op) { chip8->PC = chip8->V[op->X] + op->NNN; }
+static void op_rnd(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] = op->NN & (chip8_random(chip8) % 256 + 1); }
+static void op_drw(chip8_t *chip8, const chip8_decoded_t *op) { chip8_draw_sprite(chip8, op->X, op->Y, op->N); }
+static void op_drw_wrap(chip8_t *chip8, const chip8_decoded_t *op) { chip8_draw_sprite_wrap(chip8, op->X, op->Y, op->N); }
+static void op_drw_wait(chip8_t *chip8, const chip8_decoded_t *op) {
+    if(!chip8_wait_vblank(chip8)) chip8_draw_sprite(chip8, op->X, op->Y, op->N);
+}
+static void op_drw_wrap_wait(chip8_t *chip8, const chip8_decoded_t *op) {
+    if(!chip8_wait_vblank(chip8)) chip8_draw_sprite_wrap(chip8, op->X, op->Y, op->N);
+}
+// EX9E, EXA1
+static void op_skp(chip8_t *chip8, const chip8_decoded_t *op) { if(chip8->keypad[chip8->V[op->X] & 0xF]) chip8_skip_next(chip8); }
+static void op_sknp(chip8_t *chip8, const chip8_decoded_t *op) { if(!chip8->keypad[chip8->V[op->X] & 0xF]) chip8_skip_next(chip8); }
+// FX07 - FX65
+static void op_ld_vx_dt(chip8_t *chip8, const chip8_decoded_t *op) { chip8->V[op->X] = chip8->delay_timer; }
+static void op_ld_key(chip8_t *chip8, const chip8_decoded_t *op) { chip8_wait_key(chip8, op->X); }
+static void op_ld_dt(chip8_t *chip8, const chip8_decoded_t *op) { chip8->delay_timer = chip8->V[op->X]; }
+static void op_ld_st(chip8_t *chip8, const chip8_decoded_t *op) { chip8->sound_timer = chip8->V[op->X]; }
+static void op_add_i(chip8_t *chip8, const chip8_decoded_t *op) { chip8->I += chip8->V[op->X]; }
+static void op_ld_font(chip8_t *chip8, const chip8_decoded_t *op) { chip8->I = 5 * chip8->V[op->X]; }
+static void op_bcd(chip8_t *chip8, const chip8_decoded_t *op) {
+    chip8->RAM[chip8->I] = chip8->V[op->X] / 100;
+    chip8->RAM[(chip8->I + 1) & RAM_MASK] = (chip8->V[op->X] / 10) % 10;
+    chip8->RAM[(chip8->I + 2) & RAM_MASK] = chip8->V[op->X] % 10;
+    chip8_invalidate_code(chip8, chip8->I, 3);
+}
+static void op_store(chip8_t *chip8, const chip8_decoded_t *op) {
+    // the write can reset this very entry to the decoding stub
+    const uint8_t advance = op->advance;
+    for(uint8_t i =0; i<= op->X; i++) {
+        chip8->RAM[(chip8->I + i) & RAM_MASK] = chip8->V[i];
+    }
+    chip8_invalidate_code(chip8, chip8->I, op->X + 1);
+    chip8->I += advance;
+}
+static void op_load(chip8_t *chip8, const chip8_decoded_t *op) {
+    for(uint8_t i =0; i<= op->X; i++) {
+        chip8->V[i] = chip8->RAM[(chip8->I + i) & RAM_MASK];
+    }
+    chip8->I += op->advance;
+}
+
+// SUPER-CHIP / XO-CHIP instructions, run by the interpreter (which counts the cycle itself)
+static void op_extended(chip8_t *chip8, const chip8_decoded_t *op) {
+    (void)op;
+    chip8->PC -= 2;
+    chip8->cycles--;
+    emulate_instruction(chip8);
+}
+
+static chip8_handler_t decode_handler(chip8_variant_t variant, const chip8_quirk_set_t *q, uint16_t instr){
+    if(variant != VARIANT_CHIP8 && chip8_extended_opcode(instr)) return op_extended;
+    const uint8_t NN = instr & 0x00FF;
+    const uint8_t N = instr & 0x000F;
+    switch(instr >> 12) {
+        case 0x0:
+            if(NN == 0xE0) return op_cls;
+            if(NN == 0xEE) return op_ret;
+            return op_nop;
+        case 0x1: return op_jp;
+        case 0x2: return op_call;
+        case 0x3: return op_se_imm;
+        case 0x4: return op_sne_imm;
+        case 0x5: return op_se_reg;
+        case 0x6: return op_ld_imm;
+        case 0x7: return op_add_imm;
+        case 0x8:
+            switch(N) {
+                case 0x0: return op_ld_reg;
+                case 0x1: return q->vf_reset ? op_or_reset : op_or;
+                case 0x2: return q->vf_reset ? op_and_reset : op_and;
+                case 0x3: return q->vf_reset ? op_xor_reset : op_xor;
+                case 0x4: return op_add_reg;
+                case 0x5: return op_sub;
+                case 0x6: return q->shift_vy ? op_shr_vy : op_shr;
+                case 0x7: return op_subn;
+                case 0xE: return q->shift_vy ? op_shl_vy : op_shl;
+                default: return op_invalid_8;
+            }
+        case 0x9: return op_sne_reg;
+        case 0xA: return op_ld_i;
+        case 0xB: return q->jump_vx ? op_jp_vx : op_jp_v0;
+        case 0xC: return op_rnd;
+        case 0xD:
+            if(q->display_wait) return q->wrap ? op_drw_wrap_wait : op_drw_wait;
+            return q->wrap ? op_drw_wrap : op_drw;
+        case 0xE:
+            if(NN == 0x9E) return op_skp;
+            if(NN == 0xA1) return op_sknp;
+            return op_nop;
+        default:
+            switch(NN) {
+                case 0x07: return op_ld_vx_dt;
+                case 0x0A: return op_ld_key;
+                case 0x15: return op_ld_dt;
+                case 0x18: return op_ld_st;
+                case 0x1E: return op_add_i;
+                case 0x29: return op_ld_font;
+                case 0x33: return op_bcd;
+                case 0x55: return op_store;
+                case 0x65: return op_load;
+                default: return op_nop;
+            }
+    }
+}
+
+static void decode_at(chip8_t *chip8, const chip8_quirk_set_t *q, uint16_t addr){
+    const uint16_t instr = (chip8->RAM[addr] << 8) | chip8->RAM[(addr + 1) & RAM_MASK];
+    const uint8_t X = (instr & 0x0F00) >> 8;
+    chip8->decoded[addr] = (chip8_decoded_t){
+        .handler = decode_handler(chip8->variant, q, instr),
+        .NNN = instr & 0x0FFF,
+        .X = X,
+        .Y = (instr & 0x00F0) >> 4,
+        .NN = instr & 0x00FF,
+        .N = instr & 0x000F,
+        .advance = q->index == INDEX_ADD_X1 ? X + 1 : q->index == INDEX_ADD_X ? X : 0,
+    };
+}
+
+// entries written over since they were last decoded: decode on first execution, then run
+static void op_decode(chip8_t *chip8, const chip8_decoded_t *op) {
+    const uint16_t addr = op - chip8->decoded;
+    decode_at(chip8, chip8_quirk_set(chip8), addr);
+    chip8->decoded[addr].handler(chip8, &chip8->decoded[addr]);
+}
+
+bool predecode_init(chip8_t *chip8){
+    if(chip8->decoded == NULL){
+        chip8->decoded = malloc(sizeof chip8->RAM * sizeof(chip8_decoded_t));
+        if(chip8->decoded == NULL){
+            perror("Could not allocate the predecoded instruction table");
+            return false;
+        }
+    }
+    predecode_invalidate(chip8, 0, sizeof chip8->RAM);
+    return true;
+}
+
+void predecode_free(chip8_t *chip8){
+    free(chip8->decoded);
+    chip8->decoded = NULL;
+}
+
+void predecode_invalidate(chip8_t *chip8, uint16_t addr, uint32_t len){
+    // the instruction starting one byte before the written range also reads from it
+    uint32_t start = addr > 0 ? addr - 1u : 0;
+    uint32_t end = (uint32_t)addr + len;
+    if(end > sizeof chip8->RAM) end = sizeof chip8->RAM;
+    for(uint32_t a = start; a < end; a++){
+        chip8->decoded[a].handler = op_decode;
+    }
+    // the instruction at the last address reads its second byte from address 0
+    if(addr == 0 && len > 0) chip8->decoded[RAM_MASK].handler = op_decode;
+}
+
+uint64_t predecode_run(chip8_t *chip8, uint64_t cycles){
+    const chip8_decoded_t *table = chip8->decoded;
+    uint64_t i = 0;
+    while(i < cycles){
+        const chip8_decoded_t *op = &table[chip8->PC & RAM_MASK];
+        chip8->PC += 2;
+        op->handler(chip8, op);
+        i++;
+        // a fault or 00FD stops the machine on the instruction
+        if(chip8->state != RUNNING) break;
+    }
+    chip8->cycles += i;
+    return i;
+}
@@ -0,0 +1,177 @@
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "chip8_profile.h"
+#include "chip8_internal.h"
+
+// opcode kinds, one counter each
+static const char *const kind_names[] = {
+    "00E0", "00EE", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0",
+    "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+    // SUPER-CHIP, then XO-CHIP only
+    "00CN", "00FB", "00FC", "00FD", "00FE", "00FF", "FX30", "FX75", "FX85",
+    "00DN", "5XY2", "5XY3", "F000", "FN01", "F002", "FX3A", "????",
+};
+#define KIND_COUNT (sizeof kind_names / sizeof kind_names[0])
+#define KIND_INVALID (KIND_COUNT - 1)
+
+struct chip8_profile {
+    uint64_t kind_count[KIND_COUNT];
+    uint64_t kind_ticks[KIND_COUNT];
+    // per PC over the whole address space, XO-CHIP runs code past 4 KB
+    uint64_t pc_count[CHIP8_RAM_SIZE];
+    uint64_t pc_ticks[CHIP8_RAM_SIZE];
+    uint16_t pc_instr[CHIP8_RAM_SIZE];  // last instruction seen at each PC
+    uint64_t overhead;              // ticks of an empty profile_clock pair, subtracted from every sample
+};
+
+// decoded the way the interpreter does for `variant`
+static size_t kind_of(uint16_t instr, chip8_variant_t variant){
+    const uint8_t NN = instr & 0xFF;
+    switch(instr >> 12){
+        case 0x0:
+            if(instr == 0x00E0) return 0;
+            if(instr == 0x00EE) return 1;
+            if(variant != VARIANT_CHIP8){
+                if((instr & 0xFFF0) == 0x00C0) return 35;
+                if(instr >= 0x00FB && instr <= 0x00FF) return 36 + (instr - 0x00FB);
+                if((instr & 0xFFF0) == 0x00D0 && variant == VARIANT_XOCHIP) return 44;
+            }
+            return 2;
+        case 0x8:
+            switch(instr & 0xF){
+                case 0x0: case 0x1: case 0x2: case 0x3:
+                case 0x4: case 0x5: case 0x6: case 0x7: return 10 + (instr & 0xF);
+                case 0xE: return 18;
+                default: return KIND_INVALID;
+            }
+        case 0x5:
+            if(variant == VARIANT_XOCHIP && ((instr & 0xF) == 0x2 || (instr & 0xF) == 0x3)) return 45 + (instr & 0xF) - 2;
+            return (instr & 0xF) == 0 ? 7 : KIND_INVALID;
+        case 0x9: return (instr & 0xF) == 0 ? 19 : KIND_INVALID;
+        case 0xE: return NN == 0x9E ? 24 : NN == 0xA1 ? 25 : KIND_INVALID;
+        case 0xF:
+            if(variant == VARIANT_XOCHIP){
+                if(instr == 0xF000) return 47;
+                if(NN == 0x01) return 48;
+                if(instr == 0xF002) return 49;
+                if(NN == 0x3A) return 50;
+            }
+            if(variant != VARIANT_CHIP8){
+                if(NN == 0x30) return 41;
+                if(NN == 0x75) return 42;
+                if(NN == 0x85) return 43;
+            }
+            switch(NN){
+                case 0x07: return 26;
+                case 0x0A: return 27;
+                case 0x15: return 28;
+                case 0x18: return 29;
+                case 0x1E: return 30;
+                case 0x29: return 31;
+                case 0x33: return 32;
+                case 0x55: return 33;
+                case 0x65: return 34;
+                default: return KIND_INVALID;
+            }
+        case 0x1: return 3;
+        case 0x2: return 4;
+        case 0x3: return 5;
+        case 0x4: return 6;
+        case 0x6: return 8;
+        case 0x7: return 9;
+        case 0xA: return 20;
+        case 0xB: return 21;
+        case 0xC: return 22;
+        default: return 23;         // 0xD
+    }
+}
+
+bool chip8_profile_enable(chip8_t *chip8){
+    if(chip8->profile != NULL) return true;
+    struct chip8_profile *profile = calloc(1, sizeof(struct chip8_profile));
+    if(profile == NULL){
+        perror("Could not allocate the profile");
+        return false;
+    }
+    // the cheapest back to back reading is what a sample costs on top of the instruction
+    profile->overhead = UINT64_MAX;
+    for(int i = 0; i < 1000; i++){
+        const uint64_t start = profile_clock();
+        const uint64_t ticks = profile_clock() - start;
+        if(ticks < profile->overhead) profile->overhead = ticks;
+    }
+    chip8->profile = profile;
+    return true;
+}
+
+void chip8_profile_disable(chip8_t *chip8){
+    free(chip8->profile);
+    chip8->profile = NULL;
+}
+
+void profile_count(struct chip8_profile *profile, chip8_variant_t variant, uint16_t pc, uint16_t instr, uint64_t ticks){
+    ticks = ticks > profile->overhead ? ticks - profile->overhead : 0;
+    const size_t kind = kind_of(instr, variant);
+    profile->kind_count[kind]++;
+    profile->kind_ticks[kind] += ticks;
+    profile->pc_count[pc]++;
+    profile->pc_ticks[pc] += ticks;
+    profile->pc_instr[pc] = instr;
+}
+
+static const uint64_t *sort_ticks;
+
+static int by_ticks(const void *a, const void *b){
+    const uint64_t ta = sort_ticks[*(const uint16_t *)a], tb = sort_ticks[*(const uint16_t *)b];
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+void chip8_profile_report(const chip8_t *chip8, FILE *out, size_t top){
+    const struct chip8_profile *profile = chip8->profile;
+    if(profile == NULL) return;
+    uint64_t count = 0, ticks = 0;
+    for(size_t k = 0; k < KIND_COUNT; k++){
+        count += profile->kind_count[k];
+        ticks += profile->kind_ticks[k];
+    }
+    if(count == 0) return;
+    const double total = ticks > 0 ? (double)ticks : 1.0;
+
+    uint16_t *order = malloc(CHIP8_RAM_SIZE * sizeof(uint16_t));
+    if(order == NULL){
+        perror("Could not allocate the profile report");
+        return;
+    }
+    for(uint16_t k = 0; k < KIND_COUNT; k++) order[k] = k;
+    sort_ticks = profile->kind_ticks;
+    qsort(order, KIND_COUNT, sizeof order[0], by_ticks);
+    fprintf(out, "profile: %" PRIu64 " instructions, %" PRIu64 " ticks (%s)\n", count, ticks, PROFILE_CLOCK_UNIT);
+    fprintf(out, "%-6s %14s %7s %12s %7s\n", "opcode", "count", "count%", "ticks/instr", "time%");
+    for(size_t i = 0; i < KIND_COUNT; i++){
+        const size_t k = order[i];
+        if(profile->kind_count[k] == 0) continue;
+        fprintf(out, "%-6s %14" PRIu64 " %6.2f%% %12.1f %6.2f%%\n", kind_names[k], profile->kind_count[k],
+                100.0 * profile->kind_count[k] / count, (double)profile->kind_ticks[k] / profile->kind_count[k],
+                100.0 * profile->kind_ticks[k] / total);
+    }
+
+    for(size_t pc = 0; pc < CHIP8_RAM_SIZE; pc++) order[pc] = pc;
+    sort_ticks = profile->pc_ticks;
+    qsort(order, CHIP8_RAM_SIZE, sizeof order[0], by_ticks);
+    // 4 hex digits once the variant addresses more than 4 KB
+    const int digits = chip8_ram_size(chip8) > 4096 ? 4 : 3;
+    fprintf(out, "hot spots:\n%-*s %-6s %-6s %14s %7s %12s %7s\n", digits + 2, "PC", "instr", "opcode", "count", "count%",
+            "ticks/instr", "time%");
+    for(size_t i = 0; i < top && i < CHIP8_RAM_SIZE; i++){
+        const uint16_t pc = order[i];
+        if(profile->pc_count[pc] == 0) break;
+        fprintf(out, "0x%0*X %04X   %-6s %14" PRIu64 " %6.2f%% %12.1f %6.2f%%\n", digits, pc, profile->pc_instr[pc],
+                kind_names[kind_of(profile->pc_instr[pc], chip8->variant)], profile->pc_count[pc],
+                100.0 * profile->pc_count[pc] / count, (double)profile->pc_ticks[pc] / profile->pc_count[pc],
+                100.0 * profile->pc_ticks[pc] / total);
+    }
+    free(order);
+}
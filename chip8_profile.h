@@ -0,0 +1,22 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_core.h"
+
+// Opt-in instruction profiler. While a profile is attached, chip8_run_cycles runs everything
+// through emulate_instruction (whatever the engine), which counts each instruction and the host
+// clock ticks it took (TSC cycles on x86, nanoseconds elsewhere) per opcode kind and per PC.
+// Without one, emulate_instruction pays a single predictable branch.
+
+// attach a zeroed profile, false on allocation failure
+bool chip8_profile_enable(chip8_t *chip8);
+void chip8_profile_disable(chip8_t *chip8);
+// print the per-opcode table and the `top` hottest PCs, by time
+void chip8_profile_report(const chip8_t *chip8, FILE *out, size_t top);
+
+#endif
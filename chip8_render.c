@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "chip8_core.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Expands the 1 bit per pixel rows into 32 bit pixels for a streaming texture. A row is one word
+// in lores and two in hires; the second XO-CHIP plane is only looked at for the words where it
+// has pixels, so single plane games take the two color path.
+
+static void expand_word_scalar(uint64_t p0, uint64_t p1, const uint32_t palette[4], uint32_t *out){
+    for(int x = 0; x < 64; x++){
+        const int shift = 63 - x;
+        out[x] = palette[((p0 >> shift) & 1) | ((p1 >> shift) & 1) << 1];
+    }
+}
+
+#if defined(__SSE2__)
+// 4 pixels per step: broadcast the nibble, compare against one bit per lane and select fg/bg
+static void expand_word_sse2(uint64_t row, __m128i fg, __m128i bg, uint32_t *out){
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+    for(int x = 0; x < 64; x += 4){
+        const __m128i nibble = _mm_set1_epi32((int)((row >> (60 - x)) & 0xF));
+        const __m128i set = _mm_cmpeq_epi32(_mm_and_si128(nibble, bits), bits);
+        const __m128i pixels = _mm_or_si128(_mm_and_si128(set, fg), _mm_andnot_si128(set, bg));
+        _mm_storeu_si128((__m128i *)(out + x), pixels);
+    }
+}
+
+// both planes: the same per lane test on each, then pick one of four colors
+static void expand_word_planes_sse2(uint64_t p0, uint64_t p1, const __m128i colors[4], uint32_t *out){
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+    for(int x = 0; x < 64; x += 4){
+        const __m128i n0 = _mm_set1_epi32((int)((p0 >> (60 - x)) & 0xF));
+        const __m128i n1 = _mm_set1_epi32((int)((p1 >> (60 - x)) & 0xF));
+        const __m128i s0 = _mm_cmpeq_epi32(_mm_and_si128(n0, bits), bits);
+        const __m128i s1 = _mm_cmpeq_epi32(_mm_and_si128(n1, bits), bits);
+        const __m128i low = _mm_or_si128(_mm_and_si128(s0, colors[1]), _mm_andnot_si128(s0, colors[0]));
+        const __m128i high = _mm_or_si128(_mm_and_si128(s0, colors[3]), _mm_andnot_si128(s0, colors[2]));
+        const __m128i pixels = _mm_or_si128(_mm_and_si128(s1, high), _mm_andnot_si128(s1, low));
+        _mm_storeu_si128((__m128i *)(out + x), pixels);
+    }
+}
+#endif
+
+void chip8_framebuffer_to_rgba(const chip8_t *chip8, const uint32_t palette[4], void *pixels, int pitch){
+#if defined(__SSE2__)
+    const uint32_t height = chip8_display_height(chip8);
+    const int words = chip8->hires ? CHIP8_ROW_WORDS : 1;
+    __m128i colors[4];
+    for(int c = 0; c < 4; c++) colors[c] = _mm_set1_epi32((int)palette[c]);
+    uint8_t *line = pixels;
+    for(uint32_t y = 0; y < height; y++, line += pitch){
+        for(int w = 0; w < words; w++){
+            const uint64_t p0 = chip8->display[0][y][w], p1 = chip8->display[1][y][w];
+            uint32_t *out = (uint32_t *)line + 64 * w;
+            if(p1 == 0){
+                expand_word_sse2(p0, colors[1], colors[0], out);
+            } else {
+                expand_word_planes_sse2(p0, p1, colors, out);
+            }
+        }
+    }
+#else
+    chip8_framebuffer_to_rgba_scalar(chip8, palette, pixels, pitch);
+#endif
+}
+
+void chip8_framebuffer_to_rgba_scalar(const chip8_t *chip8, const uint32_t palette[4], void *pixels, int pitch){
+    const uint32_t height = chip8_display_height(chip8);
+    const int words = chip8->hires ? CHIP8_ROW_WORDS : 1;
+    uint8_t *line = pixels;
+    for(uint32_t y = 0; y < height; y++, line += pitch){
+        for(int w = 0; w < words; w++){
+            expand_word_scalar(chip8->display[0][y][w], chip8->display[1][y][w], palette, (uint32_t *)line + 64 * w);
+        }
+    }
+}
@@ -0,0 +1,265 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_rewind.h"
+
+// Frames live in a byte arena used as a ring: new frames are written after the newest one,
+// wrapping to the start of the arena when they do not fit at the end, and the oldest keyframe
+// group is evicted until there is room. Every frame is the XOR of its snapshot against the
+// snapshot of its group's keyframe (keyframes against zero) encoded as
+//     { varint equal_bytes, varint literal_bytes, literal_bytes x XORed byte } ...
+// Between two frames only the registers, a few RAM bytes and some display rows change, so the
+// XOR is almost all zeros and a frame shrinks to a few dozen bytes.
+
+typedef struct {
+    size_t offset;                  // in the arena
+    uint32_t length;
+    uint32_t key;                   // frame slot of the group's keyframe, its own slot for keyframes
+} frame_t;
+
+struct chip8_rewind {
+    frame_t *frames;                // ring of max_frames slots, oldest at `first`
+    size_t max_frames;
+    size_t first;
+    size_t count;
+    uint8_t *arena;
+    size_t arena_size;
+    size_t write;                   // where the next frame goes
+    bool wrapped;                   // the newest frames sit in front of the oldest ones
+    size_t used;                    // encoded bytes in the arena
+    uint32_t keyframe_interval;
+    uint32_t since_key;             // frames in the newest group
+    chip8_snapshot_t key;           // decoded keyframe of the newest group
+    uint8_t *scratch;               // one encoded frame, worst case
+    uint64_t pushes;
+    uint64_t push_ns;
+};
+
+#define SNAPSHOT_SIZE sizeof(chip8_snapshot_t)
+#define SCRATCH_SIZE (SNAPSHOT_SIZE * 2 + 32)
+
+static size_t put_varint(uint8_t *out, size_t value){
+    size_t n = 0;
+    while(value >= 0x80){
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t get_varint(const uint8_t *in, size_t *value){
+    size_t n = 0, shift = 0;
+    *value = 0;
+    do {
+        *value |= (size_t)(in[n] & 0x7F) << shift;
+        shift += 7;
+    } while(in[n++] & 0x80);
+    return n;
+}
+
+// length of the run of bytes where a and b agree, a word at a time
+static size_t equal_run(const uint8_t *a, const uint8_t *b, size_t n){
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if(x != y) break;
+    }
+    while(i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+// encode cur XOR base (base NULL = all zeros)
+static size_t encode(const uint8_t *cur, const uint8_t *base, uint8_t *out){
+    static const uint8_t zeros[SNAPSHOT_SIZE];
+    if(base == NULL) base = zeros;
+    size_t pos = 0, o = 0;
+    while(pos < SNAPSHOT_SIZE){
+        const size_t equal = equal_run(cur + pos, base + pos, SNAPSHOT_SIZE - pos);
+        pos += equal;
+        size_t literal = 0;
+        while(pos + literal < SNAPSHOT_SIZE && cur[pos + literal] != base[pos + literal]) literal++;
+        o += put_varint(out + o, equal);
+        o += put_varint(out + o, literal);
+        for(size_t i = 0; i < literal; i++) out[o++] = cur[pos + i] ^ base[pos + i];
+        pos += literal;
+    }
+    return o;
+}
+
+// out must hold the base (or zeros) already, the frame's differences are XORed in
+static void decode(const uint8_t *in, size_t length, uint8_t *out){
+    size_t pos = 0, i = 0;
+    while(i < length){
+        size_t equal, literal;
+        i += get_varint(in + i, &equal);
+        i += get_varint(in + i, &literal);
+        pos += equal;
+        for(size_t k = 0; k < literal; k++) out[pos++] ^= in[i++];
+    }
+}
+
+static size_t slot(const chip8_rewind_t *rw, size_t index){
+    return (rw->first + index) % rw->max_frames;
+}
+
+static void decode_keyframe(chip8_rewind_t *rw, size_t key_slot){
+    const frame_t *frame = &rw->frames[key_slot];
+    memset(rw->key.machine, 0, SNAPSHOT_SIZE);
+    decode(rw->arena + frame->offset, frame->length, rw->key.machine);
+}
+
+// drop the oldest keyframe group
+static void evict_group(chip8_rewind_t *rw){
+    const size_t start = rw->frames[rw->first].offset;
+    do {
+        rw->used -= rw->frames[rw->first].length;
+        rw->first = (rw->first + 1) % rw->max_frames;
+        rw->count--;
+    } while(rw->count > 0 && rw->frames[rw->first].key != rw->first);
+    if(rw->count == 0){
+        rw->write = 0;
+        rw->wrapped = false;
+        rw->since_key = 0;
+    } else if(rw->wrapped && rw->frames[rw->first].offset < start){
+        // the oldest frame is now in front of the arena as well
+        rw->wrapped = false;
+    }
+}
+
+// find room for length bytes, false if the oldest group has to go first
+static bool allocate(chip8_rewind_t *rw, size_t length, size_t *at){
+    if(rw->count == 0){
+        *at = 0;
+        return length <= rw->arena_size;
+    }
+    const size_t start = rw->frames[rw->first].offset;
+    if(!rw->wrapped){
+        if(length <= rw->arena_size - rw->write){
+            *at = rw->write;
+            return true;
+        }
+        if(length <= start){
+            rw->wrapped = true;
+            *at = 0;
+            return true;
+        }
+        return false;
+    }
+    if(rw->write + length <= start){
+        *at = rw->write;
+        return true;
+    }
+    return false;
+}
+
+chip8_rewind_t *chip8_rewind_create(size_t max_frames, size_t max_bytes, uint32_t keyframe_interval){
+    chip8_rewind_t *rw = calloc(1, sizeof(chip8_rewind_t));
+    if(rw == NULL) return NULL;
+    rw->max_frames = max_frames > 0 ? max_frames : 1;
+    rw->arena_size = max_bytes > SCRATCH_SIZE ? max_bytes : SCRATCH_SIZE;
+    rw->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    rw->frames = calloc(rw->max_frames, sizeof(frame_t));
+    rw->arena = malloc(rw->arena_size);
+    rw->scratch = malloc(SCRATCH_SIZE);
+    if(rw->frames == NULL || rw->arena == NULL || rw->scratch == NULL){
+        perror("Could not allocate the rewind buffer");
+        chip8_rewind_destroy(rw);
+        return NULL;
+    }
+    return rw;
+}
+
+void chip8_rewind_destroy(chip8_rewind_t *rw){
+    if(rw == NULL) return;
+    free(rw->frames);
+    free(rw->arena);
+    free(rw->scratch);
+    free(rw);
+}
+
+void chip8_rewind_push(chip8_rewind_t *rw, const chip8_t *chip8){
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    chip8_snapshot_t snapshot;
+    chip8_snapshot(chip8, &snapshot);
+    if(rw->count == rw->max_frames) evict_group(rw);
+
+    bool keyframe = rw->count == 0 || rw->since_key >= rw->keyframe_interval;
+    size_t length = encode(snapshot.machine, keyframe ? NULL : rw->key.machine, rw->scratch);
+    size_t at;
+    while(!allocate(rw, length, &at)){
+        evict_group(rw);
+        if(rw->count == 0 && !keyframe){
+            // the newest group itself was evicted, start a new one
+            keyframe = true;
+            length = encode(snapshot.machine, NULL, rw->scratch);
+        }
+    }
+    memcpy(rw->arena + at, rw->scratch, length);
+    const size_t s = slot(rw, rw->count);
+    rw->frames[s] = (frame_t){
+        .offset = at,
+        .length = (uint32_t)length,
+        .key = keyframe ? (uint32_t)s : rw->frames[slot(rw, rw->count - 1)].key,
+    };
+    rw->count++;
+    rw->write = at + length;
+    rw->used += length;
+    if(keyframe){
+        rw->key = snapshot;
+        rw->since_key = 0;
+    }
+    rw->since_key++;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    rw->pushes++;
+    rw->push_ns += (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+}
+
+bool chip8_rewind_pop(chip8_rewind_t *rw, chip8_t *chip8){
+    if(rw->count == 0) return false;
+    const size_t s = slot(rw, rw->count - 1);
+    const frame_t frame = rw->frames[s];
+    chip8_snapshot_t snapshot = rw->key;
+    if(frame.key != s){
+        decode(rw->arena + frame.offset, frame.length, snapshot.machine);
+    }
+    chip8_restore(chip8, &snapshot);
+
+    rw->count--;
+    rw->used -= frame.length;
+    rw->since_key--;
+    if(rw->count == 0){
+        rw->write = 0;
+        rw->wrapped = false;
+        return true;
+    }
+    rw->write = frame.offset;
+    if(rw->wrapped && rw->write >= rw->frames[rw->first].offset){
+        rw->wrapped = false;
+    }
+    if(frame.key == s){
+        // stepped back into the previous group
+        const size_t key_slot = rw->frames[slot(rw, rw->count - 1)].key;
+        decode_keyframe(rw, key_slot);
+        rw->since_key = (uint32_t)((key_slot <= slot(rw, rw->count - 1) ? slot(rw, rw->count - 1) - key_slot
+                                    : slot(rw, rw->count - 1) + rw->max_frames - key_slot) + 1);
+    }
+    return true;
+}
+
+chip8_rewind_stats_t chip8_rewind_stats(const chip8_rewind_t *rw){
+    return (chip8_rewind_stats_t){
+        .frames = rw->count,
+        .bytes = rw->used + rw->max_frames * sizeof(frame_t) + sizeof(chip8_rewind_t) + SCRATCH_SIZE,
+        .pushes = rw->pushes,
+        .push_ns = rw->push_ns,
+    };
+}
@@ -0,0 +1,31 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Rewind buffer: one machine state per recorded frame, stored as the XOR against the group's
+// keyframe and run-length encoded, so a frame usually costs a few dozen bytes instead of a full
+// snapshot. Memory is bounded: the oldest keyframe group is dropped when either limit is hit.
+typedef struct chip8_rewind chip8_rewind_t;
+
+typedef struct {
+    size_t frames;                  // frames that can currently be stepped back
+    size_t bytes;                   // encoded frames plus index and working buffers
+    uint64_t pushes;                // frames recorded so far
+    uint64_t push_ns;               // total time spent recording them
+} chip8_rewind_stats_t;
+
+// keep at most max_frames frames in at most max_bytes of encoded data, a keyframe every keyframe_interval frames
+chip8_rewind_t *chip8_rewind_create(size_t max_frames, size_t max_bytes, uint32_t keyframe_interval);
+void chip8_rewind_destroy(chip8_rewind_t *rw);
+// record the machine state as the newest frame
+void chip8_rewind_push(chip8_rewind_t *rw, const chip8_t *chip8);
+// restore the newest frame into chip8 and drop it, false once there is nothing left
+bool chip8_rewind_pop(chip8_rewind_t *rw, chip8_t *chip8);
+chip8_rewind_stats_t chip8_rewind_stats(const chip8_rewind_t *rw);
+
+#endif
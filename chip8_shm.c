@@ -0,0 +1,158 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_shm.h"
+
+struct chip8_shm {
+    chip8_shm_segment_t *segment;
+    char *name;
+};
+
+// pause between looks at an odd sequence number
+static inline void spin_pause(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+chip8_shm_t *chip8_shm_create(const char *name){
+    chip8_shm_t *shm = calloc(1, sizeof *shm);
+    char *copy = strdup(name);
+    if(shm == NULL || copy == NULL){
+        perror("Could not allocate the shared memory export");
+        free(shm);
+        free(copy);
+        return NULL;
+    }
+    // never take over a segment another run may still be exporting
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0){
+        if(errno == EEXIST){
+            fprintf(stderr, "Shared memory segment %s already exists: another chip8 exports it, or a crashed run "
+                    "left it behind (remove /dev/shm%s)\n", name, name);
+        } else {
+            perror("Could not create the shared memory segment");
+        }
+        free(shm);
+        free(copy);
+        return NULL;
+    }
+    void *map = MAP_FAILED;
+    if(ftruncate(fd, sizeof(chip8_shm_segment_t)) == 0){
+        map = mmap(NULL, sizeof(chip8_shm_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED){
+        perror("Could not map the shared memory segment");
+        shm_unlink(name);
+        free(shm);
+        free(copy);
+        return NULL;
+    }
+    chip8_shm_segment_t *segment = map;
+    memset(segment, 0, sizeof *segment);
+    memcpy(segment->magic, CHIP8_SHM_MAGIC, sizeof CHIP8_SHM_MAGIC);
+    segment->version = CHIP8_SHM_VERSION;
+    segment->size = sizeof *segment;
+    atomic_init(&segment->seq, 0);
+    atomic_init(&segment->keys, 0);
+    shm->segment = segment;
+    shm->name = copy;
+    return shm;
+}
+
+void chip8_shm_destroy(chip8_shm_t *shm){
+    if(shm == NULL) return;
+    munmap(shm->segment, sizeof *shm->segment);
+    shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
+
+void chip8_shm_publish(chip8_shm_t *shm, const chip8_t *chip8){
+    chip8_shm_segment_t *segment = shm->segment;
+    chip8_shm_frame_t *frame = &segment->frame;
+    const uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+    atomic_store_explicit(&segment->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    frame->frame++;
+    frame->time_ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    frame->cycles = chip8->cycles;
+    memcpy(frame->display, chip8->display, sizeof frame->display);
+    frame->width = chip8_display_width(chip8);
+    frame->height = chip8_display_height(chip8);
+    memcpy(frame->stack, chip8->stack, sizeof frame->stack);
+    frame->I = chip8->I;
+    frame->PC = chip8->PC;
+    memcpy(frame->V, chip8->V, sizeof frame->V);
+    frame->SP = chip8->SP;
+    frame->delay_timer = chip8->delay_timer;
+    frame->sound_timer = chip8->sound_timer;
+    frame->planes = chip8->planes;
+
+    atomic_store_explicit(&segment->seq, seq + 2, memory_order_release);
+}
+
+uint16_t chip8_shm_keys(const chip8_shm_t *shm){
+    return atomic_load_explicit(&shm->segment->keys, memory_order_relaxed);
+}
+
+chip8_shm_segment_t *chip8_shm_attach(const char *name){
+    const int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0){
+        perror("Could not open the shared memory segment");
+        return NULL;
+    }
+    // a smaller segment would fault on the first access past its end
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(chip8_shm_segment_t)){
+        fprintf(stderr, "%s is not a frame export of this version\n", name);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, sizeof(chip8_shm_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        perror("Could not map the shared memory segment");
+        return NULL;
+    }
+    chip8_shm_segment_t *segment = map;
+    if(memcmp(segment->magic, CHIP8_SHM_MAGIC, sizeof CHIP8_SHM_MAGIC) != 0 || segment->version != CHIP8_SHM_VERSION ||
+       segment->size != sizeof *segment){
+        fprintf(stderr, "%s is not a frame export of this version\n", name);
+        munmap(map, sizeof *segment);
+        return NULL;
+    }
+    return segment;
+}
+
+void chip8_shm_detach(chip8_shm_segment_t *segment){
+    if(segment != NULL) munmap(segment, sizeof *segment);
+}
+
+uint32_t chip8_shm_read_begin(const chip8_shm_segment_t *segment){
+    uint32_t seq;
+    while((seq = atomic_load_explicit(&segment->seq, memory_order_acquire)) & 1) spin_pause();
+    return seq;
+}
+
+bool chip8_shm_read_retry(const chip8_shm_segment_t *segment, uint32_t seq){
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&segment->seq, memory_order_relaxed) != seq;
+}
+
+void chip8_shm_set_keys(chip8_shm_segment_t *segment, uint16_t keys){
+    atomic_store_explicit(&segment->keys, keys, memory_order_relaxed);
+}
@@ -0,0 +1,73 @@
+#ifndef CHIP8_SHM_H
+#define CHIP8_SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_core.h"
+
+// Frame export over POSIX shared memory: the emulator publishes the framebuffer, registers and a
+// frame counter into a named segment once per frame, and ORs the keys other processes hold in the
+// segment into the keypad. Readers map the segment and read it in place under a seqlock: seq is odd
+// while the emulator writes `frame`, so a reader that saw the same even seq before and after
+// looking at the frame saw a consistent one.
+//
+//     const chip8_shm_segment_t *seg = chip8_shm_attach("/chip8");
+//     uint32_t seq;
+//     do {
+//         seq = chip8_shm_read_begin(seg);
+//         ... use seg->frame in place ...
+//     } while(chip8_shm_read_retry(seg, seq));
+
+#define CHIP8_SHM_MAGIC "CH8SHM"
+#define CHIP8_SHM_VERSION 1
+
+typedef struct {
+    uint64_t frame;                 // frames published, 0 before the first
+    uint64_t time_ns;               // CLOCK_MONOTONIC time it was published at
+    uint64_t cycles;                // chip8_t.cycles
+    uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][CHIP8_ROW_WORDS];    // as in chip8_t
+    uint16_t width, height;         // display mode
+    uint16_t stack[12];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t V[16];
+    uint8_t SP;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t planes;
+} chip8_shm_frame_t;
+
+typedef struct {
+    char magic[8];                  // CHIP8_SHM_MAGIC, NUL padded
+    uint32_t version;
+    uint32_t size;                  // sizeof(chip8_shm_segment_t)
+    _Atomic uint32_t seq;           // odd while `frame` is being written
+    _Atomic uint16_t keys;          // keys held by other processes, bit k for key k
+    chip8_shm_frame_t frame;
+} chip8_shm_segment_t;
+
+// emulator side
+typedef struct chip8_shm chip8_shm_t;
+
+// create the segment `name`, e.g. "/chip8"; NULL (with a message) on failure, also when the name is
+// already taken by another run or by one that crashed
+chip8_shm_t *chip8_shm_create(const char *name);
+// unmap and remove the segment, readers that still have it mapped keep their mapping
+void chip8_shm_destroy(chip8_shm_t *shm);
+void chip8_shm_publish(chip8_shm_t *shm, const chip8_t *chip8);
+// keys the readers hold, bit k for key k
+uint16_t chip8_shm_keys(const chip8_shm_t *shm);
+
+// reader side
+// map an existing segment read-write (for the keys), NULL (with a message) if there is none
+chip8_shm_segment_t *chip8_shm_attach(const char *name);
+void chip8_shm_detach(chip8_shm_segment_t *segment);
+// wait until no frame is being written and return the sequence number to check against
+uint32_t chip8_shm_read_begin(const chip8_shm_segment_t *segment);
+// true if a frame was published since chip8_shm_read_begin returned `seq`, what was read is torn
+bool chip8_shm_read_retry(const chip8_shm_segment_t *segment, uint32_t seq);
+void chip8_shm_set_keys(chip8_shm_segment_t *segment, uint16_t keys);
+
+#endif
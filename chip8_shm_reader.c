@@ -0,0 +1,81 @@
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_shm.h"
+
+// Example consumer of chip8 -shm: follows the published frames for a while, reading each one in
+// place, and reports how long frames took from being published to being seen, and how many were
+// missed. Usage: chip8_shm_reader [-s seconds] [-k key] /name
+//   -s  how long to watch (default 10)
+//   -k  hold this CHIP-8 key (hex digit) down while watching
+
+#define POLL_NS 50000               // between looks at the sequence number
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv){
+    const char *name = NULL;
+    double seconds = 10.0;
+    int key = -1;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+        else if(strcmp(argv[i], "-k") == 0 && i + 1 < argc) key = (int)strtol(argv[++i], NULL, 16) & 0xF;
+        else name = argv[i];
+    }
+    if(name == NULL){
+        fprintf(stderr, "Usage: %s [-s seconds] [-k key] /name\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    chip8_shm_segment_t *segment = chip8_shm_attach(name);
+    if(segment == NULL) return EXIT_FAILURE;
+    if(key >= 0) chip8_shm_set_keys(segment, 1u << key);
+
+    uint64_t last = 0, seen = 0, missed = 0, torn = 0, sum = 0, max = 0, lit = 0;
+    const uint64_t end = now_ns() + (uint64_t)(seconds * 1e9);
+    const struct timespec poll = { 0, POLL_NS };
+    while(now_ns() < end){
+        uint32_t seq;
+        uint64_t frame, latency;
+        uint32_t pixels;
+        do {
+            seq = chip8_shm_read_begin(segment);
+            frame = segment->frame.frame;
+            latency = now_ns() - segment->frame.time_ns;
+            // the pixels lit in plane 0, straight from the mapping
+            pixels = 0;
+            for(int y = 0; y < segment->frame.height && y < CHIP8_HIRES_HEIGHT; y++){
+                for(int w = 0; w < CHIP8_ROW_WORDS; w++) pixels += __builtin_popcountll(segment->frame.display[0][y][w]);
+            }
+        } while(chip8_shm_read_retry(segment, seq) && ++torn);
+        if(frame != last){
+            if(last != 0 && frame > last + 1) missed += frame - last - 1;
+            if(last != 0 || frame == 1){
+                seen++;
+                sum += latency;
+                if(latency > max) max = latency;
+            }
+            last = frame;
+            lit = pixels;
+        }
+        nanosleep(&poll, NULL);
+    }
+    if(key >= 0) chip8_shm_set_keys(segment, 0);
+    chip8_shm_detach(segment);
+
+    printf("%" PRIu64 " frames seen, %" PRIu64 " missed, %" PRIu64 " torn reads retried, %" PRIu64 " pixels lit in the last\n",
+           seen, missed, torn, lit);
+    if(seen){
+        printf("publish-to-read latency: avg %.3f ms, max %.3f ms (polling every %.3f ms)\n",
+               sum / 1e6 / seen, max / 1e6, POLL_NS / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8_core.h"
+
+// Save states. In memory a snapshot is the machine part of chip8_t copied as is; on disk every
+// field is written explicitly in little endian after a small header, so state files do not
+// depend on the struct layout, padding or byte order of the build that wrote them.
+//
+//   offset 0  "C8ST"
+//          4  u16 format version
+//          6  u16 variant (version 3 on, reserved before), a state only loads into the same variant
+//          8  u32 payload size
+//         12  payload, see state_fields
+
+#define STATE_MAGIC "C8ST"
+#define STATE_VERSION 4            // 2: CXNN random state, 3: variant sized RAM, hires display and planes, XO-CHIP state,
+                                   // 4: vertical blank flag of the display wait quirk
+#define STATE_HEADER_SIZE 12
+
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot){
+    memcpy(snapshot->machine, chip8, CHIP8_MACHINE_SIZE);
+}
+
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot){
+    // only the part of RAM that differs can hold stale predecoded/translated code
+    const unsigned char *ram = snapshot->machine + offsetof(chip8_t, RAM);
+    size_t first = 0, last = 0;
+    const bool cached = chip8->decoded != NULL || chip8->jit != NULL || chip8->aot != NULL;
+    if(cached && memcmp(chip8->RAM, ram, sizeof chip8->RAM) != 0){
+        last = sizeof chip8->RAM;
+        while(chip8->RAM[first] == ram[first]) first++;
+        while(chip8->RAM[last - 1] == ram[last - 1]) last--;
+    }
+    const emulator_state_t state = chip8->state;
+    memcpy(chip8, snapshot->machine, CHIP8_MACHINE_SIZE);
+    chip8->state = state;
+    chip8->display_dirty = true;
+    if(first < last){
+        chip8_invalidate_code(chip8, first, last - first);
+    }
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t pos;
+} cursor_t;
+
+static void put(cursor_t *c, uint64_t value, int bytes){
+    for(int i = 0; i < bytes; i++) c->data[c->pos++] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t get(cursor_t *c, int bytes){
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++) value |= (uint64_t)c->data[c->pos++] << (8 * i);
+    return value;
+}
+
+// the one list of fields, in file order; `save` picks between writing and reading them
+static void state_fields(chip8_t *chip8, cursor_t *c, bool save, unsigned version){
+#define FIELD(lvalue, bytes) do { if(save) put(c, (lvalue), (bytes)); else (lvalue) = get(c, (bytes)); } while(0)
+    const size_t ram = version >= 3 ? chip8_ram_size(chip8) : 4096;
+    for(size_t i = 0; i < ram; i++) FIELD(chip8->RAM[i], 1);
+    if(version >= 3){
+        for(int p = 0; p < CHIP8_PLANES; p++)
+            for(int y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+                for(int w = 0; w < CHIP8_ROW_WORDS; w++) FIELD(chip8->display[p][y][w], 8);
+    } else {
+        for(int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) FIELD(chip8->display[0][y][0], 8);
+    }
+    for(int i = 0; i < 12; i++) FIELD(chip8->stack[i], 2);
+    FIELD(chip8->SP, 1);
+    for(int i = 0; i < 16; i++) FIELD(chip8->V[i], 1);
+    FIELD(chip8->I, 2);
+    FIELD(chip8->PC, 2);
+    FIELD(chip8->delay_timer, 1);
+    FIELD(chip8->sound_timer, 1);
+    for(int i = 0; i < 16; i++) FIELD(chip8->keypad[i], 1);
+    FIELD(chip8->wait_key, 1);
+    FIELD(chip8->cycles, 8);
+    if(version >= 2) FIELD(chip8->rng, 8);
+    if(version >= 3){
+        FIELD(chip8->hires, 1);
+        FIELD(chip8->planes, 1);
+        for(int i = 0; i < 16; i++) FIELD(chip8->rpl[i], 1);
+        for(int i = 0; i < 16; i++) FIELD(chip8->audio_pattern[i], 1);
+        FIELD(chip8->pitch, 1);
+    }
+    if(version >= 4) FIELD(chip8->vblank, 1);
+#undef FIELD
+}
+
+#define STATE_REGISTERS_SIZE (12 * 2 + 1 + 16 + 2 + 2 + 1 + 1 + 16 + 1 + 8)
+#define STATE_PAYLOAD_SIZE_V1 (4096 + CHIP8_DISPLAY_HEIGHT * 8 + STATE_REGISTERS_SIZE)
+#define STATE_PAYLOAD_SIZE_V2 (STATE_PAYLOAD_SIZE_V1 + 8)
+#define STATE_DISPLAY_SIZE (CHIP8_PLANES * CHIP8_HIRES_HEIGHT * CHIP8_ROW_WORDS * 8)
+#define STATE_PAYLOAD_SIZE_V3_MAX (CHIP8_RAM_SIZE + STATE_DISPLAY_SIZE + STATE_REGISTERS_SIZE + 8 + 1 + 1 + 16 + 16 + 1)
+#define STATE_PAYLOAD_SIZE_MAX (STATE_PAYLOAD_SIZE_V3_MAX + 1)
+
+static size_t payload_size(unsigned version, size_t ram){
+    switch(version){
+        case 1: return STATE_PAYLOAD_SIZE_V1;
+        case 2: return STATE_PAYLOAD_SIZE_V2;
+        case 3: return STATE_PAYLOAD_SIZE_V3_MAX - CHIP8_RAM_SIZE + ram;
+        default: return STATE_PAYLOAD_SIZE_MAX - CHIP8_RAM_SIZE + ram;
+    }
+}
+
+bool chip8_save_state(const chip8_t *chip8, const char *path){
+    unsigned char buffer[STATE_HEADER_SIZE + STATE_PAYLOAD_SIZE_MAX];
+    const size_t size = payload_size(STATE_VERSION, chip8_ram_size(chip8));
+    cursor_t c = { .data = buffer };
+    memcpy(buffer, STATE_MAGIC, 4);
+    c.pos = 4;
+    put(&c, STATE_VERSION, 2);
+    put(&c, chip8->variant, 2);
+    put(&c, size, 4);
+    state_fields((chip8_t *)chip8, &c, true, STATE_VERSION);
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        perror("Could not open the state file for writing");
+        return false;
+    }
+    const bool ok = fwrite(buffer, STATE_HEADER_SIZE + size, 1, file) == 1;
+    if(fclose(file) != 0 || !ok){
+        fprintf(stderr, "Could not write state file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool chip8_load_state(chip8_t *chip8, const char *path){
+    unsigned char buffer[STATE_HEADER_SIZE + STATE_PAYLOAD_SIZE_MAX];
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        perror("Could not open the state file");
+        return false;
+    }
+    const size_t read = fread(buffer, 1, sizeof buffer, file);
+    fclose(file);
+    cursor_t c = { .data = buffer, .pos = 4 };
+    if(read < STATE_HEADER_SIZE || memcmp(buffer, STATE_MAGIC, 4) != 0){
+        fprintf(stderr, "%s is not a CHIP-8 state file\n", path);
+        return false;
+    }
+    const uint64_t version = get(&c, 2);
+    const uint64_t variant = get(&c, 2);
+    const uint64_t size = get(&c, 4);
+    // version 1 files load with the random state at its reset value, versions before 3 were CHIP-8 only
+    if(version < 1 || version > STATE_VERSION || size != payload_size((unsigned)version, chip8_ram_size(chip8))){
+        fprintf(stderr, "State file %s has unsupported version %u\n", path, (unsigned)version);
+        return false;
+    }
+    if(version >= 3 && variant != chip8->variant){
+        fprintf(stderr, "State file %s was saved from a different CHIP-8 variant\n", path);
+        return false;
+    }
+    if(read != STATE_HEADER_SIZE + size){
+        fprintf(stderr, "State file %s is truncated\n", path);
+        return false;
+    }
+    // decode into a copy, chip8_restore compares the old RAM against the new one
+    chip8_t loaded = *chip8;
+    loaded.rng = chip8->seed;
+    if(version < 3){
+        // older files only hold the CHIP-8 machine
+        memset(loaded.display, 0, sizeof loaded.display);
+        loaded.hires = false;
+        loaded.planes = 1;
+        memset(loaded.rpl, 0, sizeof loaded.rpl);
+        memset(loaded.audio_pattern, 0, sizeof loaded.audio_pattern);
+        loaded.pitch = 64;
+    }
+    if(version < 4) loaded.vblank = false;
+    state_fields(&loaded, &c, false, (unsigned)version);
+    chip8_snapshot_t snapshot;
+    chip8_snapshot(&loaded, &snapshot);
+    chip8_restore(chip8, &snapshot);
+    return true;
+}
@@ -0,0 +1,231 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_trace.h"
+#include "chip8_internal.h"
+
+// The ring is single producer, single consumer like the audio queue: head counts every record the
+// emulation thread published, tail every record the writer thread wrote out, both only grow and
+// each is written by one side only. The producer only takes the mutex to wake the writer once per
+// TRACE_BLOCK records, or to wait for room when the writer falls a whole ring behind; records are
+// never dropped. The writer also wakes up every TRACE_FLUSH_MS so a slow run still reaches the file.
+
+#define TRACE_RING 65536            // records, a power of two (1 MB)
+#define TRACE_BLOCK 8192            // records written per fwrite at most, and the producer's wake-up step
+#define TRACE_FLUSH_MS 100
+
+_Static_assert(sizeof(chip8_trace_record_t) == 16, "trace records are 16 bytes");
+
+struct chip8_trace {
+    chip8_trace_record_t *ring;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;          // a block is ready, or stopping
+    pthread_cond_t drained;         // the writer freed room
+    bool stopping;                  // under lock
+    pthread_t writer;
+
+    // producer side
+    size_t next;                    // head, without the atomic load
+    size_t free_until;              // head may grow up to this without looking at tail again
+
+    // writer side
+    FILE *file;
+    bool failed;                    // a write failed, the rest is drained without writing
+};
+
+// write out everything published so far, in at most TRACE_BLOCK record pieces
+static void drain(struct chip8_trace *trace){
+    size_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    while(tail != head){
+        const size_t at = tail & (TRACE_RING - 1);
+        size_t count = head - tail;
+        if(count > TRACE_RING - at) count = TRACE_RING - at;
+        if(count > TRACE_BLOCK) count = TRACE_BLOCK;
+        if(!trace->failed && fwrite(&trace->ring[at], sizeof(chip8_trace_record_t), count, trace->file) != count){
+            perror("Could not write the trace");
+            trace->failed = true;
+        }
+        tail += count;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+        pthread_mutex_lock(&trace->lock);
+        pthread_cond_signal(&trace->drained);
+        pthread_mutex_unlock(&trace->lock);
+    }
+}
+
+static void *writer_main(void *arg){
+    struct chip8_trace *trace = arg;
+    pthread_mutex_lock(&trace->lock);
+    while(!trace->stopping){
+        const size_t pending = atomic_load_explicit(&trace->head, memory_order_acquire) - atomic_load_explicit(&trace->tail, memory_order_relaxed);
+        if(pending < TRACE_BLOCK){
+            struct timespec deadline;
+            timespec_get(&deadline, TIME_UTC);
+            deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+            if(deadline.tv_nsec >= 1000000000L){
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&trace->filled, &trace->lock, &deadline);
+        }
+        pthread_mutex_unlock(&trace->lock);
+        drain(trace);
+        pthread_mutex_lock(&trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+    drain(trace);
+    return NULL;
+}
+
+bool chip8_trace_start(chip8_t *chip8, const char *path){
+    if(chip8->trace != NULL && !chip8_trace_stop(chip8)) return false;
+    struct chip8_trace *trace = calloc(1, sizeof *trace);
+    chip8_trace_record_t *ring = calloc(TRACE_RING, sizeof *ring);
+    if(trace == NULL || ring == NULL){
+        perror("Could not allocate the trace buffer");
+        free(trace);
+        free(ring);
+        return false;
+    }
+    trace->ring = ring;
+    trace->file = fopen(path, "wb");
+    if(trace->file == NULL){
+        perror("Could not create the trace file");
+        free(ring);
+        free(trace);
+        return false;
+    }
+    chip8_trace_header_t header = {
+        .version = CHIP8_TRACE_VERSION,
+        .record_size = sizeof(chip8_trace_record_t),
+        .variant = chip8->variant,
+        .quirks = chip8_quirks(chip8),
+        .engine = chip8->engine,
+    };
+    memcpy(header.magic, CHIP8_TRACE_MAGIC, sizeof header.magic);
+    if(fwrite(&header, sizeof header, 1, trace->file) != 1){
+        perror("Could not write the trace");
+        fclose(trace->file);
+        free(ring);
+        free(trace);
+        return false;
+    }
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    trace->free_until = TRACE_RING;
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->filled, NULL);
+    pthread_cond_init(&trace->drained, NULL);
+    if(pthread_create(&trace->writer, NULL, writer_main, trace) != 0){
+        fprintf(stderr, "Could not start the trace writer thread\n");
+        pthread_cond_destroy(&trace->drained);
+        pthread_cond_destroy(&trace->filled);
+        pthread_mutex_destroy(&trace->lock);
+        fclose(trace->file);
+        free(ring);
+        free(trace);
+        return false;
+    }
+    chip8->trace = trace;
+    return true;
+}
+
+bool chip8_trace_stop(chip8_t *chip8){
+    struct chip8_trace *trace = chip8->trace;
+    if(trace == NULL) return true;
+    chip8->trace = NULL;
+    pthread_mutex_lock(&trace->lock);
+    trace->stopping = true;
+    pthread_cond_signal(&trace->filled);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->writer, NULL);
+    bool ok = !trace->failed;
+    if(fclose(trace->file) != 0 && ok){
+        perror("Could not write the trace");
+        ok = false;
+    }
+    pthread_cond_destroy(&trace->drained);
+    pthread_cond_destroy(&trace->filled);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace->ring);
+    free(trace);
+    return ok;
+}
+
+// the ring is full as far as the producer knew: look at tail again, and wait for the writer if
+// it really is
+static void __attribute__((noinline)) wait_for_room(struct chip8_trace *trace){
+    size_t tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+    if(trace->next - tail == TRACE_RING){
+        pthread_mutex_lock(&trace->lock);
+        pthread_cond_signal(&trace->filled);
+        while(trace->next - (tail = atomic_load_explicit(&trace->tail, memory_order_acquire)) == TRACE_RING){
+            pthread_cond_wait(&trace->drained, &trace->lock);
+        }
+        pthread_mutex_unlock(&trace->lock);
+    }
+    trace->free_until = tail + TRACE_RING;
+}
+
+static void __attribute__((noinline)) wake_writer(struct chip8_trace *trace){
+    pthread_mutex_lock(&trace->lock);
+    pthread_cond_signal(&trace->filled);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void trace_record(chip8_t *chip8, uint16_t pc, uint16_t instr, const uint8_t *V){
+    struct chip8_trace *trace = chip8->trace;
+    if(trace->next == trace->free_until) wait_for_room(trace);
+
+    // the first changed register: the lowest differing byte of the two register files
+    uint8_t reg = CHIP8_TRACE_NO_REG;
+    for(int half = 0; half < 16; half += 8){
+        uint64_t before, after;
+        memcpy(&before, V + half, 8);
+        memcpy(&after, chip8->V + half, 8);
+        const uint64_t changed = before ^ after;
+        if(changed != 0){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            reg = half + __builtin_ctzll(changed) / 8;
+#else
+            reg = half + __builtin_clzll(changed) / 8;
+#endif
+            break;
+        }
+    }
+
+    chip8_trace_record_t *record = &trace->ring[trace->next & (TRACE_RING - 1)];
+    record->cycle = chip8->cycles - 1;
+    record->pc = pc;
+    record->instr = instr;
+    record->I = chip8->I;
+    record->reg = reg;
+    record->value = reg != CHIP8_TRACE_NO_REG ? chip8->V[reg] : 0;
+    atomic_store_explicit(&trace->head, ++trace->next, memory_order_release);
+    if((trace->next & (TRACE_BLOCK - 1)) == 0) wake_writer(trace);
+}
+
+FILE *chip8_trace_open(const char *path, chip8_trace_header_t *header){
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        perror("Could not open the trace file");
+        return NULL;
+    }
+    if(fread(header, sizeof *header, 1, file) != 1 || memcmp(header->magic, CHIP8_TRACE_MAGIC, sizeof header->magic) != 0){
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if(header->version != CHIP8_TRACE_VERSION || header->record_size != sizeof(chip8_trace_record_t)){
+        fprintf(stderr, "%s is a trace of another version (%u)\n", path, header->version);
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
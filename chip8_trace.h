@@ -0,0 +1,49 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_core.h"
+
+// Opt-in execution trace: while a trace is attached, chip8_run_cycles runs the selected engine one
+// instruction at a time (no idle loop skipping) and appends a fixed-size record per instruction to
+// a ring buffer; a background thread writes the ring to the trace file in large blocks. Two traces
+// of the same ROM, e.g. on different engines or quirk profiles, are compared by chip8_tracediff.
+//
+// The file is a chip8_trace_header_t followed by chip8_trace_record_t records, in host byte order.
+
+#define CHIP8_TRACE_MAGIC "CH8TRACE"
+#define CHIP8_TRACE_VERSION 1
+#define CHIP8_TRACE_NO_REG 0xFF     // the instruction changed no V register
+
+typedef struct {
+    char magic[8];                  // CHIP8_TRACE_MAGIC, not NUL terminated
+    uint16_t version;
+    uint16_t record_size;           // sizeof(chip8_trace_record_t)
+    uint8_t variant;                // chip8_variant_t the trace was run with
+    uint8_t quirks;                 // chip8_quirks_t, resolved
+    uint8_t engine;                 // chip8_engine_t
+    uint8_t reserved;
+} chip8_trace_header_t;
+
+typedef struct {
+    uint64_t cycle;                 // instructions executed before this one
+    uint16_t pc;
+    uint16_t instr;
+    uint16_t I;                     // after the instruction
+    uint8_t reg;                    // lowest V register the instruction changed, or CHIP8_TRACE_NO_REG
+    uint8_t value;                  // its new value
+} chip8_trace_record_t;
+
+// start writing a trace of everything `chip8` runs from now on to `path`, false (with a message)
+// if the file or the writer thread could not be set up
+bool chip8_trace_start(chip8_t *chip8, const char *path);
+// write out what is left and close the file; false (with a message) if any write failed
+bool chip8_trace_stop(chip8_t *chip8);
+
+// open a trace file and read its header, NULL (with a message) if it is not a trace of this version
+FILE *chip8_trace_open(const char *path, chip8_trace_header_t *header);
+
+#endif
@@ -0,0 +1,112 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_core.h"
+#include "chip8_debug.h"
+#include "chip8_trace.h"
+
+// Compares two execution traces written with chip8 -trace record by record and reports the first
+// one that differs, with the instructions leading up to it. Usage: chip8_tracediff a.trace b.trace
+// Exits with 0 if the traces are identical, 1 if they diverge and 2 on errors.
+
+#define READ_RECORDS 8192           // records read from each file at a time
+#define CONTEXT 8                   // matching records shown before the divergence
+
+static const char *const engine_names[] = { "switch", "predecode", "jit", "aot" };
+static const char *const variant_names[] = { "chip8", "schip", "xochip" };
+static const char *const quirks_names[] = { "auto", "modern", "vip", "chip48", "schip", "xochip" };
+
+#define NAME(names, i) ((i) < sizeof names / sizeof names[0] ? names[i] : "?")
+
+typedef struct {
+    const char *path;
+    FILE *file;
+    chip8_trace_header_t header;
+    chip8_trace_record_t records[READ_RECORDS];
+    size_t count;                   // records in the buffer
+    size_t at;                      // next one
+} trace_file_t;
+
+// the next record, NULL at the end of the file
+static const chip8_trace_record_t *next_record(trace_file_t *trace){
+    if(trace->at == trace->count){
+        trace->count = fread(trace->records, sizeof trace->records[0], READ_RECORDS, trace->file);
+        trace->at = 0;
+        if(trace->count == 0) return NULL;
+    }
+    return &trace->records[trace->at++];
+}
+
+static void print_record(chip8_t *chip8, const char *label, const chip8_trace_record_t *record){
+    // the disassembler only sees the instruction word; an F000 NNNN shows no address
+    chip8->RAM[record->pc] = record->instr >> 8;
+    chip8->RAM[(record->pc + 1) & 0xFFFF] = record->instr & 0xFF;
+    char text[64];
+    chip8_disassemble(chip8, record->pc, text, sizeof text);
+    printf("%-2s %12" PRIu64 "  %04X  %04X  %-22s I=%04X", label, record->cycle, record->pc, record->instr, text, record->I);
+    if(record->reg != CHIP8_TRACE_NO_REG) printf("  V%X=%02X", record->reg, record->value);
+    printf("\n");
+}
+
+int main(int argc, char **argv){
+    if(argc != 3){
+        fprintf(stderr, "Usage: %s a.trace b.trace\n", argv[0]);
+        return 2;
+    }
+    static trace_file_t traces[2];
+    for(int i = 0; i < 2; i++){
+        traces[i].path = argv[i + 1];
+        traces[i].file = chip8_trace_open(argv[i + 1], &traces[i].header);
+        if(traces[i].file == NULL) return 2;
+        const chip8_trace_header_t *h = &traces[i].header;
+        printf("%c: %s, %s, quirks %s, engine %s\n", 'a' + i, traces[i].path, NAME(variant_names, h->variant),
+               NAME(quirks_names, h->quirks), NAME(engine_names, h->engine));
+    }
+    chip8_t *chip8 = chip8_create();
+    if(chip8 == NULL){
+        perror("Could not allocate the disassembler's machine");
+        return 2;
+    }
+    chip8_set_variant(chip8, traces[0].header.variant);
+    chip8_set_quirks(chip8, traces[0].header.quirks);
+
+    // the last CONTEXT records both traces agree on
+    chip8_trace_record_t history[CONTEXT];
+    uint64_t index = 0;
+    int status = 0;
+    for(;; index++){
+        const chip8_trace_record_t *a = next_record(&traces[0]), *b = next_record(&traces[1]);
+        if(a == NULL && b == NULL){
+            printf("identical, %" PRIu64 " instructions\n", index);
+            break;
+        }
+        if(a == NULL || b == NULL || memcmp(a, b, sizeof *a) != 0){
+            if(a == NULL || b == NULL){
+                printf("%c ends after %" PRIu64 " instructions, %c goes on\n", a == NULL ? 'a' : 'b', index, a == NULL ? 'b' : 'a');
+            } else {
+                printf("first difference at instruction %" PRIu64 ":%s%s%s%s%s\n", index,
+                       a->cycle != b->cycle ? " cycle" : "", a->pc != b->pc ? " PC" : "",
+                       a->instr != b->instr ? " opcode" : "", a->I != b->I ? " I" : "",
+                       a->reg != b->reg || a->value != b->value ? " V" : "");
+            }
+            const uint64_t shown = index < CONTEXT ? index : CONTEXT;
+            for(uint64_t i = index - shown; i < index; i++) print_record(chip8, "", &history[i % CONTEXT]);
+            if(a != NULL) print_record(chip8, "a", a);
+            if(b != NULL) print_record(chip8, "b", b);
+            status = 1;
+            break;
+        }
+        history[index % CONTEXT] = *a;
+    }
+    for(int i = 0; i < 2; i++){
+        if(ferror(traces[i].file)){
+            fprintf(stderr, "Could not read %s\n", traces[i].path);
+            status = 2;
+        }
+        fclose(traces[i].file);
+    }
+    chip8_destroy(chip8);
+    return status;
+}